@@ -0,0 +1,514 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Microbenchmarks of the metadata paths of the reader. Every op is timed on
+ * its own, set up and torn down outside the clock. The reads and the
+ * allocations of the library are taken from its stats, which only count
+ * while an op runs. Cold runs drop the page cache of the image before each
+ * op, which only works on file systems that keep one (not tmpfs).
+ */
+
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "node.h"
+#include "dir.h"
+#include "dcache.h"
+#include "namei.h"
+
+#define BENCH_DEF_OPS		2000
+#define BENCH_MAX_PATHS		4096
+#define BENCH_PATH_LEN		256
+
+struct bench_path {
+	char path[BENCH_PATH_LEN];
+	nid_t ino;
+	int dir;
+	unsigned int entries;		/* for dirs */
+};
+
+struct bench_ctx {
+	const char *image;
+	int drop_fd;			/* only to drop the page cache of the image */
+	struct f2fs_super super;	/* mounted */
+	struct f2fs_super part;		/* filled up to the step under test */
+	struct bench_path *paths;
+	unsigned int nr_paths;
+	unsigned int big_dir;		/* the path with the most entries */
+	struct f2fs_inode inode;
+	struct f2fs_inode *dir;
+	struct dir_iter *iter;
+	int more;			/* the iterator had another entry */
+	char *buf;
+	unsigned int crc;
+};
+
+struct bench {
+	const char *name;
+	int cold;			/* also run with the page cache dropped */
+	int (*setup)(struct bench_ctx *ctx);
+	int (*run)(struct bench_ctx *ctx, unsigned long i);
+	void (*undo)(struct bench_ctx *ctx);
+	void (*cleanup)(struct bench_ctx *ctx);
+};
+
+struct bench_result {
+	unsigned long ops;
+	double ns;
+	unsigned long long reads, bytes, allocs;
+};
+
+static void usage()
+{
+	printf("f2fs_bench [-n ops] [-b bench] image...\n");
+}
+
+static int bench_fill_super(struct bench_ctx *ctx, unsigned long i)
+{
+	return f2fs_fill_super(&ctx->part, ctx->image, O_RDONLY);
+}
+
+static void undo_fill_super(struct bench_ctx *ctx)
+{
+	f2fs_umount(&ctx->part);
+}
+
+static int bench_mount(struct bench_ctx *ctx, unsigned long i)
+{
+	return f2fs_mount(&ctx->part, ctx->image, O_RDONLY);
+}
+
+static int bench_mount_lazy(struct bench_ctx *ctx, unsigned long i)
+{
+	return f2fs_mount_lazy(&ctx->part, ctx->image, O_RDONLY);
+}
+
+static int setup_get_cp(struct bench_ctx *ctx)
+{
+	return f2fs_fill_super(&ctx->part, ctx->image, O_RDONLY);
+}
+
+static int bench_get_cp(struct bench_ctx *ctx, unsigned long i)
+{
+	return f2fs_get_valid_checkpoint(&ctx->part, 0);
+}
+
+static void undo_get_cp(struct bench_ctx *ctx)
+{
+	f2fs_free(ctx->part.raw_cp);
+	ctx->part.raw_cp = NULL;
+}
+
+static void cleanup_part(struct bench_ctx *ctx)
+{
+	f2fs_umount(&ctx->part);
+}
+
+static int setup_nat_bitmap(struct bench_ctx *ctx)
+{
+	int ret = 0;
+
+	ret = f2fs_fill_super(&ctx->part, ctx->image, O_RDONLY);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = f2fs_get_valid_checkpoint(&ctx->part, 0);
+	if(ret < 0) {
+		f2fs_umount(&ctx->part);
+	}
+	return ret;
+}
+
+static int bench_nat_bitmap(struct bench_ctx *ctx, unsigned long i)
+{
+	return f2fs_build_nat_bitmap(&ctx->part);
+}
+
+static void undo_nat_bitmap(struct bench_ctx *ctx)
+{
+	f2fs_free(ctx->part.nat_bits);
+	ctx->part.nat_bits = NULL;
+}
+
+static int bench_read_inode(struct bench_ctx *ctx, unsigned long i)
+{
+	return f2fs_read_inode(&ctx->super, &ctx->inode,
+		ctx->paths[i % ctx->nr_paths].ino);
+}
+
+static void undo_read_inode(struct bench_ctx *ctx)
+{
+	f2fs_free_inode(&ctx->inode);
+}
+
+static int setup_dir_iter(struct bench_ctx *ctx)
+{
+	int ret = 0;
+
+	ctx->dir = f2fs_malloc(sizeof(struct f2fs_inode));
+	if(ctx->dir == NULL) {
+		return -ENOMEM;
+	}
+
+	ret = f2fs_read_inode(&ctx->super, ctx->dir, ctx->paths[ctx->big_dir].ino);
+	if(ret < 0) {
+		f2fs_free(ctx->dir);
+		return ret;
+	}
+
+	ctx->iter = dir_iter_start(&ctx->super, ctx->dir);
+	if(ctx->iter == NULL) {
+		f2fs_put_inode(ctx->dir);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int bench_dir_iter(struct bench_ctx *ctx, unsigned long i)
+{
+	ctx->more = dir_iter_next(ctx->iter) != NULL;
+	return 0;
+}
+
+/* start over at the end of the dir */
+static void undo_dir_iter(struct bench_ctx *ctx)
+{
+	if(!ctx->more) {
+		dir_iter_end(ctx->iter);
+		ctx->iter = dir_iter_start(&ctx->super, ctx->dir);
+	}
+}
+
+static void cleanup_dir_iter(struct bench_ctx *ctx)
+{
+	dir_iter_end(ctx->iter);
+	f2fs_put_inode(ctx->dir);
+}
+
+static int bench_lookup_path(struct bench_ctx *ctx, unsigned long i)
+{
+	nid_t ino = 0;
+
+	return f2fs_lookup_path(&ctx->super, ctx->paths[i % ctx->nr_paths].path, &ino);
+}
+
+/* without the dentry cache every lookup walks the dirs */
+static int setup_path_walk(struct bench_ctx *ctx)
+{
+	f2fs_destroy_dentry_cache(&ctx->super);
+	return 0;
+}
+
+static void cleanup_path_walk(struct bench_ctx *ctx)
+{
+	f2fs_build_dentry_cache(&ctx->super);
+}
+
+static int setup_crc(struct bench_ctx *ctx)
+{
+	unsigned int i = 0;
+
+	for(i=0; i<F2FS_BLKSIZE; i++) {
+		ctx->buf[i] = i * 31;
+	}
+	return 0;
+}
+
+static int bench_crc(struct bench_ctx *ctx, unsigned long i)
+{
+	ctx->crc = f2fs_cal_crc32(ctx->crc, ctx->buf, F2FS_BLKSIZE);
+	return 0;
+}
+
+static struct bench benches[] = {
+	{"fill_super", 1, NULL, bench_fill_super, undo_fill_super, NULL},
+	{"mount", 1, NULL, bench_mount, undo_fill_super, NULL},
+	{"mount_lazy", 1, NULL, bench_mount_lazy, undo_fill_super, NULL},
+	{"get_valid_checkpoint", 1, setup_get_cp, bench_get_cp, undo_get_cp, cleanup_part},
+	{"build_nat_bitmap", 1, setup_nat_bitmap, bench_nat_bitmap, undo_nat_bitmap,
+		cleanup_part},
+	{"read_inode", 1, NULL, bench_read_inode, undo_read_inode, NULL},
+	{"dir_iter_next", 1, setup_dir_iter, bench_dir_iter, undo_dir_iter,
+		cleanup_dir_iter},
+	{"lookup_path", 0, NULL, bench_lookup_path, NULL, NULL},
+	{"lookup_path_walk", 1, setup_path_walk, bench_lookup_path, NULL,
+		cleanup_path_walk},
+	{"crc32_update", 0, setup_crc, bench_crc, NULL, NULL},
+	{NULL, 0, NULL, NULL, NULL, NULL},
+};
+
+static double ns_between(struct timespec *a, struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+/* what a pair of clock reads costs, taken off every op */
+static double timer_overhead()
+{
+	struct timespec t0, t1;
+	double ns = 0;
+	int i = 0;
+
+	for(i=0; i<1000; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns += ns_between(&t0, &t1);
+	}
+	return ns / 1000;
+}
+
+static int collect_path(void *arg, const char *name, int len, nid_t ino,
+		unsigned char file_type)
+{
+	struct bench_ctx *ctx = arg;
+	struct bench_path *parent = &ctx->paths[ctx->big_dir];
+	struct bench_path *path = NULL;
+	int n = 0;
+
+	parent->entries++;
+	if(ctx->nr_paths >= BENCH_MAX_PATHS) {
+		return 0;
+	}
+
+	path = &ctx->paths[ctx->nr_paths];
+	n = snprintf(path->path, BENCH_PATH_LEN, "%s/%.*s",
+		strcmp(parent->path, "/") ? parent->path : "", len, name);
+	if(n >= BENCH_PATH_LEN) {
+		return 0;
+	}
+
+	path->ino = ino;
+	path->dir = file_type == F2FS_FT_DIR;
+	path->entries = 0;
+	ctx->nr_paths++;
+	return 0;
+}
+
+/* the first BENCH_MAX_PATHS paths breadth first, the ops cycle through them */
+static int collect_paths(struct bench_ctx *ctx)
+{
+	struct page *page = NULL;
+	unsigned int i = 0, big = 0;
+	int ret = 0;
+
+	page = alloc_page();
+	if(page == NULL) {
+		return -ENOMEM;
+	}
+
+	strcpy(ctx->paths[0].path, "/");
+	ctx->paths[0].ino = le32_to_cpu(ctx->super.raw_super->root_ino);
+	ctx->paths[0].dir = 1;
+	ctx->nr_paths = 1;
+
+	for(i=0; i<ctx->nr_paths; i++) {
+		if(!ctx->paths[i].dir) {
+			continue;
+		}
+
+		ret = f2fs_read_node_block(&ctx->super, ctx->paths[i].ino, page);
+		if(ret < 0) {
+			break;
+		}
+
+		/* collect_path finds the parent here */
+		ctx->big_dir = i;
+		ret = f2fs_readdir(&ctx->super, page, collect_path, ctx);
+		if(ret < 0) {
+			break;
+		}
+
+		if(ctx->paths[i].entries > ctx->paths[big].entries) {
+			big = i;
+		}
+	}
+
+	ctx->big_dir = big;
+	free_page(page);
+	return ret < 0 ? ret : 0;
+}
+
+static int measure(struct bench_ctx *ctx, struct bench *b, int cold,
+		unsigned long ops, double overhead, struct bench_result *res)
+{
+	struct f2fs_stats stats;
+	struct timespec t0, t1;
+	unsigned long i = 0;
+	int op = 0, pool = 0, ret = 0;
+
+	memset(res, 0, sizeof(struct bench_result));
+	f2fs_stats_reset();
+
+	for(i=0; i<ops; i++) {
+		if(cold) {
+			posix_fadvise(ctx->drop_fd, 0, 0, POSIX_FADV_DONTNEED);
+		}
+
+		f2fs_stats_enable(1);
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		ret = b->run(ctx, i);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		f2fs_stats_enable(0);
+
+		if(ret < 0) {
+			printf("%s: op %lu failed: %s\n", b->name, i, strerror(-ret));
+			return ret;
+		}
+		if(b->undo != NULL) {
+			b->undo(ctx);
+		}
+		res->ns += ns_between(&t0, &t1) - overhead;
+	}
+
+	f2fs_stats_read(&stats);
+	for(op=0; op<F2FS_NR_OPS; op++) {
+		res->reads += stats.op[op].reads;
+		res->bytes += stats.op[op].read_bytes;
+		for(pool=0; pool<F2FS_NR_POOLS; pool++) {
+			res->allocs += stats.op[op].allocs[pool];
+		}
+	}
+	res->ops = ops;
+	return 0;
+}
+
+static void report(struct bench *b, const char *state, struct bench_result *res)
+{
+	printf("%-22s %-5s %8lu %12.1f %10.2f %10.2f %10.2f\n", b->name, state,
+		res->ops, res->ns / res->ops, (double)res->reads / res->ops,
+		(double)res->bytes / F2FS_BLKSIZE / res->ops,
+		(double)res->allocs / res->ops);
+}
+
+/* warm runs go through the ops once untimed first */
+static int run_bench(struct bench_ctx *ctx, struct bench *b, unsigned long ops,
+		double overhead)
+{
+	struct bench_result res;
+	int ret = 0;
+
+	if(b->setup != NULL) {
+		ret = b->setup(ctx);
+		if(ret < 0) {
+			printf("%s: setup failed: %s\n", b->name, strerror(-ret));
+			return ret;
+		}
+	}
+
+	ret = measure(ctx, b, 0, ops, 0, &res);
+	if(ret == 0) {
+		ret = measure(ctx, b, 0, ops, overhead, &res);
+	}
+	if(ret == 0) {
+		report(b, "warm", &res);
+	}
+
+	if(ret == 0 && b->cold) {
+		ret = measure(ctx, b, 1, ops, overhead, &res);
+		if(ret == 0) {
+			report(b, "cold", &res);
+		}
+	}
+
+	if(b->cleanup != NULL) {
+		b->cleanup(ctx);
+	}
+	return ret;
+}
+
+static int bench_image(const char *image, const char *only, unsigned long ops,
+		double overhead)
+{
+	struct bench_ctx ctx;
+	struct bench *b = NULL;
+	int ret = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.image = image;
+	ctx.drop_fd = open(image, O_RDONLY);
+	if(ctx.drop_fd < 0) {
+		perror("open");
+		return -errno;
+	}
+
+	ret = f2fs_mount(&ctx.super, image, O_RDONLY);
+	if(ret < 0) {
+		goto close_fd;
+	}
+
+	ctx.paths = f2fs_malloc(BENCH_MAX_PATHS * sizeof(struct bench_path));
+	ctx.buf = f2fs_malloc(F2FS_BLKSIZE);
+	if(ctx.paths == NULL || ctx.buf == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = collect_paths(&ctx);
+	if(ret < 0) {
+		goto out;
+	}
+
+	printf("%s: %u paths, largest dir %s with %u entries\n", image, ctx.nr_paths,
+		ctx.paths[ctx.big_dir].path, ctx.paths[ctx.big_dir].entries);
+	printf("%-22s %-5s %8s %12s %10s %10s %10s\n", "bench", "cache", "ops",
+		"ns/op", "reads/op", "blocks/op", "allocs/op");
+
+	for(b=benches; b->name != NULL; b++) {
+		if(only != NULL && strcmp(only, b->name)) {
+			continue;
+		}
+
+		ret = run_bench(&ctx, b, ops, overhead);
+		if(ret < 0) {
+			break;
+		}
+	}
+
+out:
+	f2fs_free(ctx.buf);
+	f2fs_free(ctx.paths);
+	f2fs_umount(&ctx.super);
+close_fd:
+	close(ctx.drop_fd);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ops = BENCH_DEF_OPS;
+	const char *only = NULL;
+	double overhead = 0;
+	int ret = 0;
+
+	for(argc--, argv++; argc > 1 && argv[0][0] == '-'; argc-=2, argv+=2) {
+		if(!strcmp(argv[0], "-n")) {
+			ops = strtoul(argv[1], NULL, 0);
+		} else if(!strcmp(argv[0], "-b")) {
+			only = argv[1];
+		} else {
+			break;
+		}
+	}
+
+	if(argc == 0 || ops == 0) {
+		usage();
+		return -EINVAL;
+	}
+
+	overhead = timer_overhead();
+	for(; argc > 0 && ret == 0; argc--, argv++) {
+		ret = bench_image(argv[0], only, ops, overhead);
+	}
+
+	if(malloc_count != 0) {
+		BUG("BUG: The memory malloc count: %d\n", malloc_count);
+	}
+	return ret;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "super.h"
+#include "segment.h"
+#include "roaring.h"
+#include "trace.h"
+#include "capacity.h"
+
+struct capacity_ctx {
+	struct capacity_stat *stat;
+	struct roaring nids, sections;
+	unsigned int segs_per_sec;
+	int sec_free;			/* no segment of the section so far is used */
+	unsigned long long since;	/* sit mtime the window starts at */
+};
+
+static int add_free_nid(struct f2fs_super *super, struct node_info *ni, void *arg)
+{
+	struct capacity_ctx *ctx = arg;
+
+	return roaring_add(&ctx->nids, ni->nid);
+}
+
+static int add_segment(struct f2fs_super *super, unsigned int segno,
+		struct f2fs_sit_entry *raw_sit, void *arg)
+{
+	struct capacity_ctx *ctx = arg;
+	unsigned int secno = segno / ctx->segs_per_sec;
+	unsigned int vblocks = GET_SIT_VBLOCKS(raw_sit);
+	int type = 0;
+
+	if(segno % ctx->segs_per_sec == 0) {
+		ctx->sec_free = 1;
+	}
+
+	/* an mtime past the fs clock was not written by it */
+	if(vblocks > 0) {
+		ctx->sec_free = 0;
+		if(le64_to_cpu(raw_sit->mtime) >= ctx->since &&
+				le64_to_cpu(raw_sit->mtime) <= ctx->stat->age) {
+			ctx->stat->recent_blocks += vblocks;
+		}
+	}
+
+	if(segno % ctx->segs_per_sec != ctx->segs_per_sec - 1 || !ctx->sec_free) {
+		return 0;
+	}
+
+	/* the section of an open log is taken however empty it looks */
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(curseg_segno(super, type) / ctx->segs_per_sec == secno) {
+			return 0;
+		}
+	}
+	return roaring_add(&ctx->sections, secno);
+}
+
+/* the next modifying command frees the orphans, what they hold is not in use */
+static int sub_orphans(struct f2fs_super *super, struct capacity_stat *stat)
+{
+	unsigned long long blocks = 0;
+	struct page *page = NULL;
+	unsigned int i = 0;
+	int ret = 0;
+
+	ret = f2fs_load(super, F2FS_LAZY_ORPHANS);
+	if(ret < 0 || super->nr_orphans == 0) {
+		return ret;
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	/* i_blocks counts the inode and its other node blocks too */
+	for(i=0; i<super->nr_orphans; i++) {
+		ret = f2fs_read_node_block(super, super->orphans[i], page);
+		if(ret < 0) {
+			goto out;
+		}
+		blocks += le64_to_cpu(F2FS_NODE(page)->i.i_blocks);
+	}
+
+	stat->orphans = super->nr_orphans;
+	stat->valid_inodes -= stat->orphans < stat->valid_inodes ? stat->orphans :
+		stat->valid_inodes;
+	stat->valid_blocks -= blocks < stat->valid_blocks ? blocks : stat->valid_blocks;
+out:
+	free_page(page);
+	return ret;
+}
+
+static int add_run(unsigned int start, unsigned int len, void *arg)
+{
+	struct capacity_stat *stat = arg;
+	int bucket = 0;
+
+	for(bucket=0; bucket<CAPACITY_RUN_BUCKETS-1 && (len >> (bucket + 1)); bucket++);
+	stat->run_hist[bucket]++;
+	stat->runs++;
+	if(len > stat->longest_run) {
+		stat->longest_run = len;
+	}
+	return 0;
+}
+
+int f2fs_capacity(struct f2fs_super *super, unsigned long long window,
+		struct capacity_stat *stat)
+{
+	F2FS_TRACE_SCOPE("capacity", NULL, 0);
+	struct f2fs_checkpoint *cp = super->raw_cp;
+	struct nat_scan_stat nat_stat;
+	struct capacity_ctx ctx;
+	int ret = 0;
+
+	memset(stat, 0, sizeof(struct capacity_stat));
+	memset(&ctx, 0, sizeof(ctx));
+	roaring_init(&ctx.nids);
+	roaring_init(&ctx.sections);
+	ctx.stat = stat;
+	ctx.segs_per_sec = le32_to_cpu(super->raw_super->segs_per_sec);
+
+	stat->user_blocks = le64_to_cpu(cp->user_block_count);
+	stat->valid_blocks = le64_to_cpu(cp->valid_block_count);
+	stat->valid_inodes = le32_to_cpu(cp->valid_inode_count);
+	ret = sub_orphans(super, stat);
+	if(ret < 0) {
+		goto out;
+	}
+	if(stat->user_blocks > stat->valid_blocks) {
+		stat->free_blocks = stat->user_blocks - stat->valid_blocks;
+	}
+
+	/* a fs younger than the window is measured over its whole life */
+	stat->age = f2fs_get_mtime(super);
+	stat->window = window < stat->age ? window : stat->age;
+	ctx.since = stat->age - stat->window;
+
+	ret = f2fs_scan_nat(super, 0, NAT_SCAN_FREE, add_free_nid, &ctx, &nat_stat);
+	if(ret < 0) {
+		goto out;
+	}
+	stat->free_nids = roaring_card(&ctx.nids);
+	stat->nid_set_bytes = roaring_bytes(&ctx.nids);
+	stat->nat_read_blocks = nat_stat.read_blocks;
+	stat->inodes_left = stat->free_nids < stat->free_blocks ? stat->free_nids :
+		stat->free_blocks;
+
+	ret = f2fs_scan_sit(super, add_segment, &ctx);
+	if(ret < 0) {
+		goto out;
+	}
+	stat->sections = le32_to_cpu(super->raw_super->segment_count_main) /
+		ctx.segs_per_sec;
+	stat->free_sections = roaring_card(&ctx.sections);
+	stat->section_set_bytes = roaring_bytes(&ctx.sections);
+	roaring_runs(&ctx.sections, add_run, stat);
+
+	stat->days_left = -1;
+	if(stat->window > 0 && stat->recent_blocks > 0) {
+		stat->blocks_per_day = (double)stat->recent_blocks * 86400 / stat->window;
+		stat->days_left = stat->free_blocks / stat->blocks_per_day;
+	}
+
+out:
+	roaring_free(&ctx.nids);
+	roaring_free(&ctx.sections);
+	return ret;
+}
@@ -0,0 +1,50 @@
+#ifndef __CAPACITY_H__
+#define __CAPACITY_H__
+
+#include "f2fs.h"
+
+#define CAPACITY_DEF_WINDOW	(7 * 86400)	/* secs of writes the trend is taken from */
+#define CAPACITY_RUN_BUCKETS	32		/* runs of free sections by log2 length */
+
+struct capacity_stat {
+	/* nids, from nat_bits and the nat */
+	unsigned long long free_nids;
+	unsigned int valid_inodes;	/* orphans left out */
+	unsigned int orphans;
+	unsigned long long inodes_left;	/* each needs a nid and a node block */
+	size_t nid_set_bytes;
+	unsigned int nat_read_blocks;
+
+	/* sections, from the sit */
+	unsigned int sections;
+	unsigned int free_sections;
+	size_t section_set_bytes;
+	unsigned int runs;		/* of consecutive free sections */
+	unsigned int longest_run;
+	unsigned int run_hist[CAPACITY_RUN_BUCKETS];
+
+	/* blocks, from the checkpoint less the orphans' */
+	unsigned long long user_blocks;
+	unsigned long long valid_blocks;
+	unsigned long long free_blocks;
+
+	/* the trend, in the fs clock that the sit mtimes use */
+	unsigned long long age;		/* secs the fs was mounted */
+	unsigned long long window;	/* secs the trend covers */
+	unsigned long long recent_blocks;	/* valid blocks written within it */
+	double blocks_per_day;
+	double days_left;		/* < 0 when nothing was written */
+};
+
+/*
+ * A snapshot of what is left: the free nids and the free sections as
+ * compressed sets, how the free sections are cut into runs and, from the
+ * mtimes of the segments written in the last window secs, how fast the
+ * valid blocks grow and when the user blocks run out. Reads the nat
+ * blocks nat_bits does not cover, the sit and the orphan inodes, nothing
+ * else.
+ */
+int f2fs_capacity(struct f2fs_super *super, unsigned long long window,
+		struct capacity_stat *stat);
+
+#endif /*__CAPACITY_H__*/
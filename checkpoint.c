@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "super.h"
+#include "segment.h"
+#include "data.h"
+#include "checkpoint.h"
+#include "trace.h"
+
+static inline unsigned int cp_payload_blocks(struct f2fs_super *super)
+{
+	return le32_to_cpu(super->raw_super->cp_payload);
+}
+
+static inline unsigned int orphan_blocks(struct f2fs_super *super)
+{
+	if(!is_set_ckpt_flags(super->raw_cp, CP_ORPHAN_PRESENT_FLAG)) {
+		return 0;
+	}
+	return le32_to_cpu(super->raw_cp->cp_pack_start_sum) - 1 -
+		cp_payload_blocks(super);
+}
+
+/* orphans that were not reclaimed are carried over to the new pack */
+static int copy_orphan_blocks(struct f2fs_super *super, block_t new_addr)
+{
+	block_t old_addr = __start_cp_addr(super) + 1 + cp_payload_blocks(super);
+	unsigned int nr = orphan_blocks(super), i = 0;
+	struct page *page = NULL;
+	int ret = 0;
+
+	if(nr == 0) {
+		return 0;
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	for(i=0; i<nr; i++) {
+		ret = read_page(page, super->fd, old_addr + i);
+		if(ret < 0) {
+			perror("read page");
+			goto out;
+		}
+
+		ret = write_page(page, super->fd, new_addr + i);
+		if(ret < 0) {
+			perror("write page");
+			goto out;
+		}
+	}
+	ret = 0;
+
+out:
+	free_page(page);
+	return ret;
+}
+
+static int write_summaries(struct f2fs_super *super, block_t blkaddr)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	int ret = 0, type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		ret = write_page(address_to_page(sm->curseg[type].sum_blk),
+			super->fd, blkaddr + type);
+		if(ret < 0) {
+			perror("write page");
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static void update_raw_cp(struct f2fs_super *super, unsigned int start_sum)
+{
+	struct f2fs_checkpoint *raw_cp = super->raw_cp;
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct f2fs_nm_info *nm = NM_I(super);
+	unsigned int flags = le32_to_cpu(raw_cp->ckpt_flags);
+	size_t crc_offset = le32_to_cpu(raw_cp->checksum_offset);
+	unsigned int crc = 0;
+	int type = 0;
+
+	raw_cp->checkpoint_ver = cpu_to_le64(cur_cp_version(raw_cp) + 1);
+	raw_cp->valid_block_count = cpu_to_le64(f2fs_valid_user_blocks(super));
+	raw_cp->free_segment_count = cpu_to_le32(f2fs_free_segments(super));
+	raw_cp->elapsed_time = cpu_to_le64(f2fs_get_mtime(super));
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(type < CURSEG_HOT_NODE) {
+			raw_cp->cur_data_segno[type] = cpu_to_le32(sm->curseg[type].segno);
+			raw_cp->cur_data_blkoff[type] =
+				cpu_to_le16(sm->curseg[type].next_blkoff);
+		} else {
+			raw_cp->cur_node_segno[type - CURSEG_HOT_NODE] =
+				cpu_to_le32(sm->curseg[type].segno);
+			raw_cp->cur_node_blkoff[type - CURSEG_HOT_NODE] =
+				cpu_to_le16(sm->curseg[type].next_blkoff);
+		}
+		raw_cp->alloc_type[type] = sm->curseg[type].alloc_type;
+	}
+
+	raw_cp->valid_node_count = cpu_to_le32(nm->valid_node_count);
+	raw_cp->valid_inode_count = cpu_to_le32(nm->valid_inode_count);
+	raw_cp->next_free_nid = cpu_to_le32(f2fs_next_free_nid(super));
+
+	/* we always write normal summaries */
+	flags |= CP_UMOUNT_FLAG;
+	flags &= ~(CP_COMPACT_SUM_FLAG | CP_NAT_BITS_FLAG | CP_FASTBOOT_FLAG);
+	if(super->nat_bits != NULL) {
+		flags |= CP_NAT_BITS_FLAG;
+	}
+	raw_cp->ckpt_flags = cpu_to_le32(flags);
+
+	raw_cp->cp_pack_start_sum = cpu_to_le32(start_sum);
+	raw_cp->cp_pack_total_block_count = cpu_to_le32(start_sum +
+		NR_CURSEG_TYPE + 1);
+
+	crc = f2fs_cal_crc32(F2FS_SUPER_MAGIC, raw_cp, crc_offset);
+	*((__le32 *)((unsigned char *)raw_cp + crc_offset)) = cpu_to_le32(crc);
+}
+
+static void drop_nat_bits(struct f2fs_super *super)
+{
+	f2fs_free(super->nat_bits);
+	super->nat_bits = NULL;
+	super->full_nat_bits = NULL;
+	super->empty_nat_bits = NULL;
+}
+
+static int write_nat_bits(struct f2fs_super *super, block_t cp_addr)
+{
+	unsigned int nr = nat_bits_blocks(super);
+	struct iovec iov[nr];
+	unsigned int i = 0;
+
+	super->nat_bits->cp_checksum = cpu_to_le64(cur_cp_checksum(super->raw_cp));
+	for(i=0; i<nr; i++) {
+		iov[i].iov_base = (char *)super->nat_bits + i * F2FS_BLKSIZE;
+		iov[i].iov_len = F2FS_BLKSIZE;
+	}
+
+	if(write_pagesv(iov, nr, super->fd, cp_addr + blocks_per_seg(super) - nr) < 0) {
+		perror("write pages");
+		return -EIO;
+	}
+	return 0;
+}
+
+struct flush_work {
+	int (*fn)(struct f2fs_super *super);
+	struct f2fs_super *super;
+	pthread_t thread;
+	int started;
+	int ret;
+};
+
+static void *flush_worker(void *arg)
+{
+	struct flush_work *work = arg;
+
+	work->ret = work->fn(work->super);
+	return NULL;
+}
+
+/*
+ * Nat blocks, sit blocks and ssa pages neither overlap on disk nor share
+ * state in memory, so they are written side by side.
+ */
+static int flush_meta_areas(struct f2fs_super *super)
+{
+	struct flush_work works[] = {
+		{f2fs_flush_nat_entries, super},
+		{f2fs_flush_sit_entries, super},
+		{f2fs_write_ssa_pages, super},
+	};
+	int nr = sizeof(works) / sizeof(works[0]);
+	int i = 0, ret = 0;
+
+	for(i=0; i<nr; i++) {
+		works[i].started = !pthread_create(&works[i].thread, NULL,
+			flush_worker, &works[i]);
+		/* run it here instead */
+		if(!works[i].started) {
+			flush_worker(&works[i]);
+		}
+	}
+
+	for(i=0; i<nr; i++) {
+		if(works[i].started) {
+			pthread_join(works[i].thread, NULL);
+		}
+		if(works[i].ret < 0 && ret == 0) {
+			ret = works[i].ret;
+		}
+	}
+	return ret;
+}
+
+static int write_cp_block(struct f2fs_super *super, unsigned int i, block_t blkaddr)
+{
+	int ret = 0;
+
+	ret = write_page(address_to_page((char *)super->raw_cp + i * F2FS_BLKSIZE),
+		super->fd, blkaddr);
+	if(ret < 0) {
+		perror("write page");
+		return ret;
+	}
+	return 0;
+}
+
+static int barrier(struct f2fs_super *super)
+{
+	if(fsync(super->fd) < 0) {
+		perror("fsync");
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Flush everything the command dirtied and commit it in the pack that is not
+ * current. The pack only becomes valid with its tail cp block, which is
+ * written after a barrier, so a crash at any point leaves either the old or
+ * the new checkpoint intact:
+ *
+ *   data -> nodes -> nat | sit | ssa -> head, payload, orphans, summaries,
+ *   nat_bits -> fsync -> tail cp block -> fsync
+ */
+static int __f2fs_write_checkpoint(struct f2fs_super *super)
+{
+	unsigned int payload = cp_payload_blocks(super);
+	unsigned int start_sum = 0, total = 0, i = 0;
+	block_t cp_addr = 0;
+	int ret = 0;
+
+	/* every part goes into the new checkpoint */
+	ret = f2fs_load(super, F2FS_LAZY_ALL);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = f2fs_flush_data_pages(super);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = f2fs_flush_nodes(super);
+	if(ret < 0) {
+		return ret;
+	}
+
+	cp_addr = le32_to_cpu(super->raw_super->cp_blkaddr);
+	if(!super->cp_ver) {
+		cp_addr += blocks_per_seg(super);
+	}
+
+	/* nat_bits must fit behind the pack in the cp segment */
+	start_sum = 1 + payload + orphan_blocks(super);
+	total = start_sum + NR_CURSEG_TYPE + 1;
+	if(super->nat_bits != NULL &&
+			total + nat_bits_blocks(super) > blocks_per_seg(super)) {
+		drop_nat_bits(super);
+	}
+
+	ret = flush_meta_areas(super);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = copy_orphan_blocks(super, cp_addr + 1 + payload);
+	if(ret < 0) {
+		return ret;
+	}
+
+	update_raw_cp(super, start_sum);
+
+	for(i=0; i<=payload; i++) {
+		ret = write_cp_block(super, i, cp_addr + i);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	ret = write_summaries(super, cp_addr + start_sum);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(super->nat_bits != NULL) {
+		ret = write_nat_bits(super, cp_addr);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	ret = barrier(super);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = write_cp_block(super, 0, cp_addr + total - 1);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = barrier(super);
+	if(ret < 0) {
+		return ret;
+	}
+
+	f2fs_unpin_segments(super);
+	super->cp_ver = !super->cp_ver;
+	return 0;
+}
+
+int f2fs_write_checkpoint(struct f2fs_super *super)
+{
+	F2FS_TRACE_SCOPE("write_checkpoint", NULL, 0);
+	int op = f2fs_stat_enter(F2FS_OP_CHECKPOINT);
+	int ret = __f2fs_write_checkpoint(super);
+
+	f2fs_stat_leave(op);
+	return ret;
+}
@@ -0,0 +1,8 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "f2fs.h"
+
+int f2fs_write_checkpoint(struct f2fs_super *super);
+
+#endif /*__CHECKPOINT_H__*/
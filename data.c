@@ -0,0 +1,720 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "segment.h"
+#include "data.h"
+#include "trace.h"
+#include "dev.h"
+
+int f2fs_build_data_manager(struct f2fs_super *super)
+{
+	struct f2fs_dm_info *dm = NULL;
+
+	dm = f2fs_malloc(sizeof(struct f2fs_dm_info));
+	if(dm == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memset(dm, 0, sizeof(struct f2fs_dm_info));
+	super->dm_info = dm;
+	return 0;
+}
+
+void f2fs_destroy_data_manager(struct f2fs_super *super)
+{
+	struct f2fs_dm_info *dm = DM_I(super);
+	struct data_page *dp = NULL;
+
+	if(dm == NULL) {
+		return;
+	}
+
+	while(dm->data_list) {
+		dp = dm->data_list;
+		dm->data_list = dp->list;
+		free_page(dp->page);
+		f2fs_free(dp);
+	}
+
+	f2fs_free(dm);
+	super->dm_info = NULL;
+}
+
+static inline unsigned int data_hash(nid_t ino, unsigned long index)
+{
+	return (ino * 31 + index) % DM_HASH_SIZE;
+}
+
+static struct data_page *lookup_data_page(struct f2fs_dm_info *dm, nid_t ino,
+		unsigned long index)
+{
+	struct data_page *dp = dm->data_hash[data_hash(ino, index)];
+
+	while(dp != NULL && (dp->ino != ino || dp->index != index)) {
+		dp = dp->next;
+	}
+	return dp;
+}
+
+static struct data_page *add_data_page(struct f2fs_dm_info *dm, nid_t ino,
+		unsigned long index, struct page *page)
+{
+	struct data_page *dp = NULL;
+
+	dp = f2fs_malloc(sizeof(struct data_page));
+	if(dp == NULL) {
+		return NULL;
+	}
+
+	dp->ino = ino;
+	dp->index = index;
+	dp->dirty = 0;
+	dp->page = page;
+	dp->next = dm->data_hash[data_hash(ino, index)];
+	dm->data_hash[data_hash(ino, index)] = dp;
+	dp->list = dm->data_list;
+	dm->data_list = dp;
+	dm->data_cnt++;
+	return dp;
+}
+
+/* unlink *pp from the list and its hash chain and free it */
+static void remove_data_page(struct f2fs_dm_info *dm, struct data_page **pp)
+{
+	struct data_page *dp = *pp, **hp = NULL;
+
+	*pp = dp->list;
+
+	hp = &dm->data_hash[data_hash(dp->ino, dp->index)];
+	while(*hp != dp) {
+		hp = &(*hp)->next;
+	}
+	*hp = dp->next;
+
+	if(dp->dirty) {
+		dm->dirty_data_cnt--;
+	}
+	dm->data_cnt--;
+	free_page(dp->page);
+	f2fs_free(dp);
+}
+
+static void drop_data_pages(struct f2fs_dm_info *dm, nid_t ino)
+{
+	struct data_page **pp = &dm->data_list;
+
+	while(*pp != NULL) {
+		if((*pp)->ino != ino) {
+			pp = &(*pp)->list;
+			continue;
+		}
+		remove_data_page(dm, pp);
+	}
+}
+
+/* forget the cached blocks that were written, none may be in use */
+void f2fs_release_data_pages(struct f2fs_super *super)
+{
+	struct f2fs_dm_info *dm = DM_I(super);
+	struct data_page **pp = &dm->data_list;
+
+	while(*pp != NULL) {
+		if((*pp)->dirty) {
+			pp = &(*pp)->list;
+			continue;
+		}
+		remove_data_page(dm, pp);
+	}
+}
+
+/*
+ * Same walk as the kernel: offset[] is the slot to follow in each node of
+ * the path, noffset[] the logical node offset stored in its footer.
+ */
+static int get_node_path(struct f2fs_super *super, struct f2fs_raw_inode *ri,
+		unsigned long block, int offset[4], unsigned int noffset[4])
+{
+	const unsigned long direct_index = ADDRS_PER_INODE(super->raw_super, ri);
+	const unsigned long direct_blks = ADDRS_PER_BLOCK(ri);
+	const unsigned long dptrs_per_blk = NIDS_PER_BLOCK;
+	const unsigned long indirect_blks = direct_blks * NIDS_PER_BLOCK;
+	const unsigned long dindirect_blks = indirect_blks * NIDS_PER_BLOCK;
+	int n = 0;
+
+	noffset[0] = 0;
+	if(block < direct_index) {
+		offset[n] = block;
+		return 0;
+	}
+
+	block -= direct_index;
+	if(block < direct_blks) {
+		offset[n++] = NODE_DIR1_BLOCK;
+		noffset[n] = 1;
+		offset[n] = block;
+		return 1;
+	}
+
+	block -= direct_blks;
+	if(block < direct_blks) {
+		offset[n++] = NODE_DIR2_BLOCK;
+		noffset[n] = 2;
+		offset[n] = block;
+		return 1;
+	}
+
+	block -= direct_blks;
+	if(block < indirect_blks) {
+		offset[n++] = NODE_IND1_BLOCK;
+		noffset[n] = 3;
+		offset[n++] = block / direct_blks;
+		noffset[n] = 4 + offset[n - 1];
+		offset[n] = block % direct_blks;
+		return 2;
+	}
+
+	block -= indirect_blks;
+	if(block < indirect_blks) {
+		offset[n++] = NODE_IND2_BLOCK;
+		noffset[n] = 4 + dptrs_per_blk;
+		offset[n++] = block / direct_blks;
+		noffset[n] = 5 + dptrs_per_blk + offset[n - 1];
+		offset[n] = block % direct_blks;
+		return 2;
+	}
+
+	block -= indirect_blks;
+	if(block < dindirect_blks) {
+		offset[n++] = NODE_DIND_BLOCK;
+		noffset[n] = 5 + (dptrs_per_blk * 2);
+		offset[n++] = block / indirect_blks;
+		noffset[n] = 6 + (dptrs_per_blk * 2) +
+			offset[n - 1] * (dptrs_per_blk + 1);
+		offset[n++] = (block / direct_blks) % dptrs_per_blk;
+		noffset[n] = 7 + (dptrs_per_blk * 2) +
+			offset[n - 2] * (dptrs_per_blk + 1) + offset[n - 1];
+		offset[n] = block % direct_blks;
+		return 3;
+	}
+	return -E2BIG;
+}
+
+static void inc_inode_blocks(struct f2fs_super *super, struct page *inode_page)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(inode_page)->i;
+
+	ri->i_blocks = cpu_to_le64(le64_to_cpu(ri->i_blocks) + 1);
+	f2fs_mark_node_dirty(super, inode_page);
+}
+
+static void dec_inode_blocks(struct f2fs_super *super, struct page *inode_page)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(inode_page)->i;
+
+	ri->i_blocks = cpu_to_le64(le64_to_cpu(ri->i_blocks) - 1);
+	f2fs_mark_node_dirty(super, inode_page);
+}
+
+/* first data index covered by the dnode at a logical node offset */
+unsigned long f2fs_start_bidx_of_node(struct f2fs_super *super,
+		struct f2fs_raw_inode *ri, unsigned int node_ofs)
+{
+	unsigned int indirect_blks = 2 * NIDS_PER_BLOCK + 4;
+	unsigned long bidx = 0;
+	int dec = 0;
+
+	if(node_ofs == 0) {
+		return 0;
+	}
+
+	if(node_ofs <= 2) {
+		bidx = node_ofs - 1;
+	} else if(node_ofs <= indirect_blks) {
+		dec = (node_ofs - 4) / (NIDS_PER_BLOCK + 1);
+		bidx = node_ofs - 2 - dec;
+	} else {
+		dec = (node_ofs - indirect_blks - 3) / (NIDS_PER_BLOCK + 1);
+		bidx = node_ofs - 5 - dec;
+	}
+	return bidx * ADDRS_PER_BLOCK(ri) + ADDRS_PER_INODE(super->raw_super, ri);
+}
+
+/*
+ * Find the node holding the address of a data block. ALLOC_NODE builds the
+ * missing nodes on the way, which is only allowed for modifying commands.
+ */
+int f2fs_get_dnode_of_data(struct f2fs_super *super, struct dnode_of_data *dn,
+		unsigned long index, int mode)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(dn->inode_page)->i;
+	struct page *parent = dn->inode_page, *page = NULL;
+	unsigned int noffset[4];
+	int offset[4];
+	nid_t nids[4];
+	int level = 0, i = 0, ret = 0;
+
+	level = get_node_path(super, ri, index, offset, noffset);
+	if(level < 0) {
+		return level;
+	}
+
+	nids[0] = dn->ino;
+	for(i=1; i<=level; i++) {
+		nids[i] = get_nid(parent, offset[i - 1], i == 1);
+		if(nids[i] == 0 && mode == LOOKUP_NODE) {
+			ret = -ENOENT;
+			goto out;
+		}
+
+		if(nids[i] == 0) {
+			ret = f2fs_alloc_nid(super, &nids[i]);
+			if(ret < 0) {
+				goto out;
+			}
+
+			page = f2fs_new_node_page(super, nids[i], dn->ino, noffset[i],
+				!S_ISDIR(le16_to_cpu(ri->i_mode)));
+			if(page == NULL) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			set_nid(parent, offset[i - 1], nids[i], i == 1);
+			f2fs_mark_node_dirty(super, parent);
+			inc_inode_blocks(super, dn->inode_page);
+		} else {
+			page = f2fs_get_node_page(super, nids[i]);
+			if(page == NULL) {
+				ret = -EIO;
+				goto out;
+			}
+		}
+
+		if(parent != dn->inode_page) {
+			f2fs_put_node_page(super, parent);
+		}
+		parent = page;
+	}
+
+	dn->node_page = parent;
+	dn->nid = nids[level];
+	dn->ofs_in_node = offset[level];
+	dn->data_blkaddr = datablock_addr(parent, dn->ofs_in_node);
+	return 0;
+
+out:
+	if(parent != dn->inode_page) {
+		f2fs_put_node_page(super, parent);
+	}
+	return ret;
+}
+
+void f2fs_put_dnode(struct f2fs_super *super, struct dnode_of_data *dn)
+{
+	if(dn->node_page != NULL && dn->node_page != dn->inode_page) {
+		f2fs_put_node_page(super, dn->node_page);
+	}
+	dn->node_page = NULL;
+}
+
+/*
+ * Replay the block addresses of a dnode found by roll-forward recovery into
+ * the current block map of its inode. Blocks it points at were written
+ * after the checkpoint and become valid again, the ones they replace are
+ * released.
+ */
+int f2fs_recover_data_blocks(struct f2fs_super *super, struct page *inode_page,
+		struct page *page, unsigned int *nr_blocks)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(inode_page)->i;
+	nid_t ino = ino_of_node(inode_page);
+	struct dnode_of_data dn;
+	struct f2fs_summary sum;
+	struct node_info ni;
+	unsigned long bidx = 0;
+	unsigned int i = 0, count = 0;
+	block_t src = 0, dest = 0;
+	int ret = 0;
+
+	if(IS_INODE(page)) {
+		if(f2fs_has_inline(ri)) {
+			return 0;
+		}
+		count = ADDRS_PER_INODE(super->raw_super, ri);
+	} else {
+		count = ADDRS_PER_BLOCK(ri);
+	}
+	bidx = f2fs_start_bidx_of_node(super, ri, ofs_of_node(page));
+
+	for(i=0; i<count; i++, bidx++) {
+		src = datablock_addr(page, i);
+
+		set_new_dnode(&dn, ino, inode_page);
+		ret = f2fs_get_dnode_of_data(super, &dn, bidx,
+			src == NULL_ADDR ? LOOKUP_NODE : ALLOC_NODE);
+		if(ret == -ENOENT) {
+			continue;
+		}
+		if(ret < 0) {
+			return ret;
+		}
+
+		dest = dn.data_blkaddr;
+		if(src == dest) {
+			f2fs_put_dnode(super, &dn);
+			continue;
+		}
+
+		f2fs_invalidate_block(super, dest);
+		if(src == NULL_ADDR) {
+			dec_inode_blocks(super, inode_page);
+		} else if(dest == NULL_ADDR) {
+			inc_inode_blocks(super, inode_page);
+		}
+
+		if(src != NULL_ADDR && src != NEW_ADDR) {
+			ret = f2fs_get_node_info(super, dn.nid, &ni);
+			if(ret < 0) {
+				f2fs_put_dnode(super, &dn);
+				return ret;
+			}
+
+			set_summary(&sum, dn.nid, dn.ofs_in_node, ni.version);
+			ret = f2fs_validate_block(super, src, &sum);
+			if(ret < 0) {
+				f2fs_put_dnode(super, &dn);
+				return ret;
+			}
+		}
+
+		set_datablock_addr(dn.node_page, dn.ofs_in_node, src);
+		f2fs_mark_node_dirty(super, dn.node_page);
+		f2fs_put_dnode(super, &dn);
+		(*nr_blocks)++;
+	}
+	return 0;
+}
+
+/* copy the current content of a data block, holes are -ENOENT */
+static int __f2fs_read_data_block(struct f2fs_super *super,
+		struct page *inode_page, unsigned long index, struct page *page)
+{
+	struct dnode_of_data dn;
+	struct data_page *dp = NULL;
+	nid_t ino = ino_of_node(inode_page);
+	int ret = 0;
+
+	if(DM_I(super) != NULL) {
+		dp = lookup_data_page(DM_I(super), ino, index);
+		if(dp != NULL) {
+			memcpy(page_address(page), page_address(dp->page), F2FS_PAGE_SIZE);
+			return 0;
+		}
+	}
+
+	set_new_dnode(&dn, ino, inode_page);
+	ret = f2fs_get_dnode_of_data(super, &dn, index, LOOKUP_NODE);
+	if(ret < 0) {
+		return ret;
+	}
+	f2fs_put_dnode(super, &dn);
+
+	if(dn.data_blkaddr == NULL_ADDR) {
+		return -ENOENT;
+	}
+
+	if(dn.data_blkaddr == NEW_ADDR) {
+		memset(page_address(page), 0, F2FS_PAGE_SIZE);
+		return 0;
+	}
+
+	ret = f2fs_read_block(super, page, dn.data_blkaddr);
+	if(ret < 0) {
+		perror("read page");
+		return ret;
+	}
+	return 0;
+}
+
+int f2fs_read_data_block(struct f2fs_super *super, struct page *inode_page,
+		unsigned long index, struct page *page)
+{
+	F2FS_TRACE_SCOPE("read_block", "ino", ino_of_node(inode_page));
+	int op = f2fs_stat_enter(F2FS_OP_READ);
+	int ret = __f2fs_read_data_block(super, inode_page, index, page);
+
+	f2fs_stat_leave(op);
+	return ret;
+}
+
+/*
+ * Hand out the cached copy of a data block of a modifying command. With
+ * create a hole gets a zeroed block that is placed at checkpoint time.
+ */
+int f2fs_get_data_page(struct f2fs_super *super, struct page *inode_page,
+		unsigned long index, int create, struct page **page)
+{
+	struct f2fs_dm_info *dm = DM_I(super);
+	struct dnode_of_data dn;
+	struct data_page *dp = NULL;
+	struct page *new = NULL;
+	nid_t ino = ino_of_node(inode_page);
+	int ret = 0;
+
+	dp = lookup_data_page(dm, ino, index);
+	if(dp != NULL) {
+		*page = dp->page;
+		return 0;
+	}
+
+	set_new_dnode(&dn, ino, inode_page);
+	ret = f2fs_get_dnode_of_data(super, &dn, index, create ? ALLOC_NODE : LOOKUP_NODE);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(dn.data_blkaddr == NULL_ADDR && !create) {
+		f2fs_put_dnode(super, &dn);
+		return -ENOENT;
+	}
+
+	new = alloc_page();
+	if(new == NULL) {
+		perror("alloc page");
+		f2fs_put_dnode(super, &dn);
+		return -ENOMEM;
+	}
+
+	if(dn.data_blkaddr == NULL_ADDR) {
+		memset(page_address(new), 0, F2FS_PAGE_SIZE);
+		set_datablock_addr(dn.node_page, dn.ofs_in_node, NEW_ADDR);
+		f2fs_mark_node_dirty(super, dn.node_page);
+		inc_inode_blocks(super, inode_page);
+	} else if(dn.data_blkaddr == NEW_ADDR) {
+		memset(page_address(new), 0, F2FS_PAGE_SIZE);
+	} else {
+		ret = f2fs_read_block(super, new, dn.data_blkaddr);
+		if(ret < 0) {
+			perror("read page");
+			goto free_page;
+		}
+	}
+	f2fs_put_dnode(super, &dn);
+
+	if(add_data_page(dm, ino, index, new) == NULL) {
+		perror("f2fs_malloc");
+		free_page(new);
+		return -ENOMEM;
+	}
+	*page = new;
+	return 0;
+
+free_page:
+	f2fs_put_dnode(super, &dn);
+	free_page(new);
+	return ret;
+}
+
+void f2fs_mark_data_dirty(struct f2fs_super *super, nid_t ino, unsigned long index)
+{
+	struct f2fs_dm_info *dm = DM_I(super);
+	struct data_page *dp = lookup_data_page(dm, ino, index);
+
+	if(dp == NULL) {
+		BUG("BUG: data %u:%lu is not cached\n", ino, index);
+	}
+
+	if(!dp->dirty) {
+		dp->dirty = 1;
+		dm->dirty_data_cnt++;
+	}
+}
+
+static void truncate_data_blocks(struct f2fs_super *super, struct page *page,
+		int count)
+{
+	block_t blkaddr = 0;
+	int i = 0;
+
+	for(i=0; i<count; i++) {
+		blkaddr = datablock_addr(page, i);
+		if(blkaddr == NULL_ADDR) {
+			continue;
+		}
+		f2fs_invalidate_block(super, blkaddr);
+		set_datablock_addr(page, i, NULL_ADDR);
+	}
+}
+
+static int truncate_nodes(struct f2fs_super *super, nid_t nid, int depth)
+{
+	struct f2fs_node *rn = NULL;
+	struct page *page = NULL;
+	nid_t child = 0;
+	int i = 0, ret = 0;
+
+	page = f2fs_get_node_page(super, nid);
+	if(page == NULL) {
+		return -EIO;
+	}
+	rn = F2FS_NODE(page);
+
+	if(depth == 0) {
+		truncate_data_blocks(super, page, DEF_ADDRS_PER_BLOCK);
+	} else {
+		for(i=0; i<NIDS_PER_BLOCK; i++) {
+			child = le32_to_cpu(rn->in.nid[i]);
+			if(child == 0) {
+				continue;
+			}
+
+			ret = truncate_nodes(super, child, depth - 1);
+			if(ret < 0) {
+				return ret;
+			}
+		}
+	}
+	return f2fs_remove_node(super, nid);
+}
+
+/* free every data block and node below an inode, the inode itself stays */
+int f2fs_truncate_inode_blocks(struct f2fs_super *super, struct page *inode_page)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(inode_page)->i;
+	nid_t nid = 0;
+	int i = 0, depth = 0, ret = 0;
+
+	if(!f2fs_has_inline(ri)) {
+		truncate_data_blocks(super, inode_page, ADDRS_PER_INODE(super->raw_super, ri));
+	}
+
+	for(i=0; i<DEF_NIDS_PER_INODE; i++) {
+		nid = le32_to_cpu(ri->i_nid[i]);
+		if(nid == 0) {
+			continue;
+		}
+
+		/* two direct, two indirect, one double indirect */
+		depth = i < 2 ? 0 : (i < 4 ? 1 : 2);
+		ret = truncate_nodes(super, nid, depth);
+		if(ret < 0) {
+			return ret;
+		}
+		ri->i_nid[i] = cpu_to_le32(0);
+	}
+
+	drop_data_pages(DM_I(super), ino_of_node(inode_page));
+	ri->i_blocks = cpu_to_le64(1);
+	f2fs_mark_node_dirty(super, inode_page);
+	return 0;
+}
+
+static int data_page_cmp(const void *a, const void *b)
+{
+	const struct data_page *x = *(struct data_page **)a;
+	const struct data_page *y = *(struct data_page **)b;
+
+	if(x->ino != y->ino) {
+		return x->ino < y->ino ? -1 : 1;
+	}
+	if(x->index != y->index) {
+		return x->index < y->index ? -1 : 1;
+	}
+	return 0;
+}
+
+/* dentry blocks go to the hot log, file data to the warm one */
+static int flush_data_page(struct f2fs_super *super, struct data_page *dp)
+{
+	struct f2fs_summary sum;
+	struct dnode_of_data dn;
+	struct page *inode_page = NULL;
+	struct node_info ni;
+	block_t new_blkaddr = 0;
+	int ret = 0, type = 0;
+
+	inode_page = f2fs_get_node_page(super, dp->ino);
+	if(inode_page == NULL) {
+		return -EIO;
+	}
+
+	set_new_dnode(&dn, dp->ino, inode_page);
+	ret = f2fs_get_dnode_of_data(super, &dn, dp->index, LOOKUP_NODE);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = f2fs_get_node_info(super, dn.nid, &ni);
+	if(ret < 0) {
+		goto put_dnode;
+	}
+
+	type = CURSEG_WARM_DATA;
+	if(S_ISDIR(le16_to_cpu(F2FS_NODE(inode_page)->i.i_mode))) {
+		type = CURSEG_HOT_DATA;
+	}
+
+	set_summary(&sum, dn.nid, dn.ofs_in_node, ni.version);
+	ret = f2fs_allocate_block(super, type, &sum, &new_blkaddr);
+	if(ret < 0) {
+		goto put_dnode;
+	}
+
+	ret = f2fs_submit_page(super, type, dp->page, new_blkaddr);
+	if(ret < 0) {
+		goto put_dnode;
+	}
+
+	f2fs_invalidate_block(super, dn.data_blkaddr);
+	set_datablock_addr(dn.node_page, dn.ofs_in_node, new_blkaddr);
+	f2fs_mark_node_dirty(super, dn.node_page);
+
+put_dnode:
+	f2fs_put_dnode(super, &dn);
+	return ret;
+}
+
+/* the blocks of a file are placed in index order, so they end up as one run */
+int f2fs_flush_data_pages(struct f2fs_super *super)
+{
+	struct f2fs_dm_info *dm = DM_I(super);
+	struct data_page **order = NULL;
+	struct data_page *dp = NULL;
+	unsigned int nr = 0, i = 0;
+	int ret = 0;
+
+	if(dm->dirty_data_cnt == 0) {
+		return f2fs_flush_write_buffers(super);
+	}
+
+	order = f2fs_malloc(dm->dirty_data_cnt * sizeof(struct data_page *));
+	if(order == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	for(dp=dm->data_list; dp!=NULL; dp=dp->list) {
+		if(dp->dirty) {
+			order[nr++] = dp;
+		}
+	}
+	qsort(order, nr, sizeof(struct data_page *), data_page_cmp);
+
+	for(i=0; i<nr; i++) {
+		ret = flush_data_page(super, order[i]);
+		if(ret < 0) {
+			goto out;
+		}
+		order[i]->dirty = 0;
+		dm->dirty_data_cnt--;
+	}
+	ret = f2fs_flush_write_buffers(super);
+out:
+	f2fs_free(order);
+	return ret;
+}
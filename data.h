@@ -0,0 +1,101 @@
+#ifndef __DATA_H__
+#define __DATA_H__
+
+#include "f2fs.h"
+#include "node.h"
+
+/* f2fs_get_dnode_of_data modes */
+#define LOOKUP_NODE		0
+#define ALLOC_NODE		1
+
+#define DM_HASH_SIZE		1024
+
+struct dnode_of_data {
+	nid_t ino;
+	struct page *inode_page;	/* owned by the caller */
+	struct page *node_page;
+	nid_t nid;
+	unsigned int ofs_in_node;
+	block_t data_blkaddr;
+};
+
+/* data blocks read or built by a modifying command */
+struct data_page {
+	struct data_page *next;		/* hash chain */
+	struct data_page *list;		/* every cached data page */
+	nid_t ino;
+	unsigned long index;
+	int dirty;
+	struct page *page;
+};
+
+struct f2fs_dm_info {
+	struct data_page *data_hash[DM_HASH_SIZE];
+	struct data_page *data_list;
+	unsigned int data_cnt, dirty_data_cnt;
+};
+
+#define DM_I(super)		((super)->dm_info)
+
+static inline void set_new_dnode(struct dnode_of_data *dn, nid_t ino,
+		struct page *inode_page)
+{
+	memset(dn, 0, sizeof(struct dnode_of_data));
+	dn->ino = ino;
+	dn->inode_page = inode_page;
+}
+
+/* the inode keeps its addresses behind the extra attributes */
+static inline __le32 *blkaddr_in_node(struct page *page)
+{
+	struct f2fs_node *rn = F2FS_NODE(page);
+
+	if(IS_INODE(page)) {
+		return (__le32 *)page_address(page) +
+			offsetof(struct f2fs_raw_inode, i_addr) / sizeof(__le32) +
+			get_extra_isize(&rn->i);
+	}
+	return (__le32 *)page_address(page);
+}
+
+static inline block_t datablock_addr(struct page *page, unsigned int ofs)
+{
+	block_t blkaddr = le32_to_cpu(blkaddr_in_node(page)[ofs]);
+
+	/* on disk NEW_ADDR is only 32 bits wide */
+	if(blkaddr == (unsigned int)NEW_ADDR) {
+		return NEW_ADDR;
+	}
+	return blkaddr;
+}
+
+static inline void set_datablock_addr(struct page *page, unsigned int ofs,
+		block_t blkaddr)
+{
+	blkaddr_in_node(page)[ofs] = cpu_to_le32(blkaddr);
+}
+
+static inline int f2fs_has_inline(struct f2fs_raw_inode *raw_inode)
+{
+	return raw_inode->i_inline & (F2FS_INLINE_DATA | F2FS_INLINE_DENTRY);
+}
+
+int f2fs_build_data_manager(struct f2fs_super *super);
+void f2fs_destroy_data_manager(struct f2fs_super *super);
+int f2fs_get_dnode_of_data(struct f2fs_super *super, struct dnode_of_data *dn,
+		unsigned long index, int mode);
+void f2fs_put_dnode(struct f2fs_super *super, struct dnode_of_data *dn);
+int f2fs_recover_data_blocks(struct f2fs_super *super, struct page *inode_page,
+		struct page *page, unsigned int *nr_blocks);
+int f2fs_read_data_block(struct f2fs_super *super, struct page *inode_page,
+		unsigned long index, struct page *page);
+int f2fs_get_data_page(struct f2fs_super *super, struct page *inode_page,
+		unsigned long index, int create, struct page **page);
+void f2fs_mark_data_dirty(struct f2fs_super *super, nid_t ino, unsigned long index);
+int f2fs_truncate_inode_blocks(struct f2fs_super *super, struct page *inode_page);
+int f2fs_flush_data_pages(struct f2fs_super *super);
+void f2fs_release_data_pages(struct f2fs_super *super);
+unsigned long f2fs_start_bidx_of_node(struct f2fs_super *super,
+		struct f2fs_raw_inode *ri, unsigned int node_ofs);
+
+#endif /*__DATA_H__*/
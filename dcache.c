@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "dcache.h"
+
+static void init_table(struct dcache_table *table, unsigned int max_entries)
+{
+	struct dcache_stripe *stripe = NULL;
+	int i = 0;
+
+	for(i=0; i<DC_STRIPES; i++) {
+		stripe = &table->stripes[i];
+		pthread_mutex_init(&stripe->lock, NULL);
+		stripe->lru.prev_lru = &stripe->lru;
+		stripe->lru.next_lru = &stripe->lru;
+	}
+	table->max_entries = max_entries;
+}
+
+/* called with the stripe locked */
+static void clear_stripe(struct dcache_stripe *stripe)
+{
+	struct dcache_entry *e = NULL;
+
+	while(stripe->lru.next_lru != &stripe->lru) {
+		e = stripe->lru.next_lru;
+		stripe->lru.next_lru = e->next_lru;
+		f2fs_free(e);
+	}
+	stripe->lru.prev_lru = &stripe->lru;
+	memset(stripe->hash, 0, sizeof(stripe->hash));
+	stripe->nr_entries = 0;
+}
+
+static void destroy_table(struct dcache_table *table)
+{
+	int i = 0;
+
+	for(i=0; i<DC_STRIPES; i++) {
+		clear_stripe(&table->stripes[i]);
+		pthread_mutex_destroy(&table->stripes[i].lock);
+	}
+}
+
+int f2fs_build_dentry_cache(struct f2fs_super *super)
+{
+	struct f2fs_dentry_cache *dc = NULL;
+
+	dc = f2fs_malloc(sizeof(struct f2fs_dentry_cache));
+	if(dc == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memset(dc, 0, sizeof(struct f2fs_dentry_cache));
+
+	init_table(&dc->dentries, DC_STRIPE_DENTRIES);
+	init_table(&dc->paths, DC_STRIPE_PATHS);
+	super->dc_info = dc;
+	return 0;
+}
+
+void f2fs_destroy_dentry_cache(struct f2fs_super *super)
+{
+	struct f2fs_dentry_cache *dc = DC_I(super);
+
+	if(dc == NULL) {
+		return;
+	}
+
+	destroy_table(&dc->dentries);
+	destroy_table(&dc->paths);
+	f2fs_free(dc);
+	super->dc_info = NULL;
+}
+
+/* fnv-1a over the parent and the name, the on-disk hash costs far more */
+static unsigned int dc_hash(nid_t pino, const char *name, int len)
+{
+	unsigned int hash = 2166136261u;
+	int i = 0;
+
+	for(i=0; i<4; i++) {
+		hash = (hash ^ ((pino >> (i * 8)) & 0xff)) * 16777619u;
+	}
+	for(i=0; i<len; i++) {
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static inline struct dcache_stripe *dc_stripe(struct dcache_table *table,
+		unsigned int hash)
+{
+	return &table->stripes[hash % DC_STRIPES];
+}
+
+static inline unsigned int dc_bucket(unsigned int hash)
+{
+	return (hash / DC_STRIPES) % DC_HASH_SIZE;
+}
+
+static void dc_unlink_lru(struct dcache_entry *e)
+{
+	e->prev_lru->next_lru = e->next_lru;
+	e->next_lru->prev_lru = e->prev_lru;
+}
+
+static void dc_link_lru(struct dcache_stripe *stripe, struct dcache_entry *e)
+{
+	e->prev_lru = &stripe->lru;
+	e->next_lru = stripe->lru.next_lru;
+	stripe->lru.next_lru->prev_lru = e;
+	stripe->lru.next_lru = e;
+}
+
+/* called with the stripe locked */
+static struct dcache_entry *dc_lookup(struct dcache_stripe *stripe, nid_t pino,
+		unsigned int hash, const char *name, int len)
+{
+	struct dcache_entry *e = stripe->hash[dc_bucket(hash)];
+
+	while(e != NULL) {
+		if(e->hash == hash && e->pino == pino && e->len == len &&
+				!memcmp(e->name, name, len)) {
+			break;
+		}
+		e = e->next;
+	}
+
+	if(e != NULL) {
+		dc_unlink_lru(e);
+		dc_link_lru(stripe, e);
+	}
+	return e;
+}
+
+static void dc_remove(struct dcache_stripe *stripe, struct dcache_entry *e)
+{
+	struct dcache_entry **pp = NULL;
+
+	dc_unlink_lru(e);
+	for(pp=&stripe->hash[dc_bucket(e->hash)]; *pp!=e; pp=&(*pp)->next);
+	*pp = e->next;
+	stripe->nr_entries--;
+	f2fs_free(e);
+}
+
+/* called with the stripe locked, a failed allocation only means no caching */
+static void dc_insert(struct dcache_table *table, struct dcache_stripe *stripe,
+		nid_t pino, unsigned int hash, const char *name, int len, nid_t ino)
+{
+	struct dcache_entry *e = dc_lookup(stripe, pino, hash, name, len);
+
+	if(e != NULL) {
+		e->ino = ino;
+		return;
+	}
+
+	if(stripe->nr_entries >= table->max_entries) {
+		dc_remove(stripe, stripe->lru.prev_lru);
+	}
+
+	e = f2fs_malloc(sizeof(struct dcache_entry) + len);
+	if(e == NULL) {
+		return;
+	}
+	e->pino = pino;
+	e->hash = hash;
+	e->ino = ino;
+	e->len = len;
+	e->name = (char *)(e + 1);
+	memcpy(e->name, name, len);
+
+	e->next = stripe->hash[dc_bucket(hash)];
+	stripe->hash[dc_bucket(hash)] = e;
+	dc_link_lru(stripe, e);
+	stripe->nr_entries++;
+}
+
+static int table_lookup(struct dcache_table *table, int cache, nid_t pino,
+		const char *name, int len, nid_t *ino)
+{
+	unsigned int hash = dc_hash(pino, name, len);
+	struct dcache_stripe *stripe = dc_stripe(table, hash);
+	struct dcache_entry *e = NULL;
+
+	pthread_mutex_lock(&stripe->lock);
+	e = dc_lookup(stripe, pino, hash, name, len);
+	if(e != NULL) {
+		*ino = e->ino;
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	f2fs_stat_cache(cache, e != NULL);
+	return e != NULL;
+}
+
+static void table_add(struct dcache_table *table, nid_t pino,
+		const char *name, int len, nid_t ino)
+{
+	unsigned int hash = dc_hash(pino, name, len);
+	struct dcache_stripe *stripe = dc_stripe(table, hash);
+
+	pthread_mutex_lock(&stripe->lock);
+	dc_insert(table, stripe, pino, hash, name, len, ino);
+	pthread_mutex_unlock(&stripe->lock);
+}
+
+int f2fs_dcache_lookup(struct f2fs_super *super, nid_t pino, const char *name,
+		int len, nid_t *ino)
+{
+	if(DC_I(super) == NULL) {
+		return 0;
+	}
+	return table_lookup(&DC_I(super)->dentries, F2FS_CACHE_DENTRY, pino, name,
+		len, ino);
+}
+
+void f2fs_dcache_add(struct f2fs_super *super, nid_t pino, const char *name,
+		int len, nid_t ino)
+{
+	if(DC_I(super) != NULL) {
+		table_add(&DC_I(super)->dentries, pino, name, len, ino);
+	}
+}
+
+int f2fs_dcache_lookup_path(struct f2fs_super *super, const char *path, int len,
+		nid_t *ino)
+{
+	if(DC_I(super) == NULL) {
+		return 0;
+	}
+	return table_lookup(&DC_I(super)->paths, F2FS_CACHE_PATH, 0, path, len,
+		ino);
+}
+
+void f2fs_dcache_add_path(struct f2fs_super *super, const char *path, int len,
+		nid_t ino)
+{
+	if(DC_I(super) != NULL) {
+		table_add(&DC_I(super)->paths, 0, path, len, ino);
+	}
+}
+
+/*
+ * The dentry itself is updated in place. Any cached path may run through
+ * it, and changes are rare next to lookups, so all paths are dropped.
+ */
+void f2fs_dcache_update(struct f2fs_super *super, nid_t pino, const char *name,
+		int len, nid_t ino)
+{
+	struct f2fs_dentry_cache *dc = DC_I(super);
+	struct dcache_stripe *stripe = NULL;
+	int i = 0;
+
+	if(dc == NULL) {
+		return;
+	}
+
+	table_add(&dc->dentries, pino, name, len, ino);
+
+	for(i=0; i<DC_STRIPES; i++) {
+		stripe = &dc->paths.stripes[i];
+		pthread_mutex_lock(&stripe->lock);
+		clear_stripe(stripe);
+		pthread_mutex_unlock(&stripe->lock);
+	}
+}
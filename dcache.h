@@ -0,0 +1,64 @@
+#ifndef __DCACHE_H__
+#define __DCACHE_H__
+
+#include <pthread.h>
+#include "f2fs.h"
+
+/*
+ * Results of name lookups, keyed by parent ino and name. A miss is kept as
+ * a negative entry with ino 0. Whole paths resolved from the root live in
+ * a second table with parent 0, which no dentry uses. Both are striped like
+ * the node cache and forget the least recently used entry when full.
+ */
+#define DC_STRIPES		64
+#define DC_HASH_SIZE		256	/* buckets per stripe */
+#define DC_STRIPE_DENTRIES	512	/* dentries kept per stripe */
+#define DC_STRIPE_PATHS		128	/* paths kept per stripe */
+
+struct dcache_entry {
+	struct dcache_entry *next;	/* hash chain */
+	struct dcache_entry *prev_lru, *next_lru;
+	nid_t pino;
+	unsigned int hash;
+	nid_t ino;			/* 0 for a negative entry */
+	int len;
+	char *name;			/* right behind the entry */
+};
+
+struct dcache_stripe {
+	pthread_mutex_t lock;
+	struct dcache_entry *hash[DC_HASH_SIZE];
+	struct dcache_entry lru;	/* most recently used first */
+	unsigned int nr_entries;
+};
+
+struct dcache_table {
+	struct dcache_stripe stripes[DC_STRIPES];
+	unsigned int max_entries;	/* per stripe */
+};
+
+struct f2fs_dentry_cache {
+	struct dcache_table dentries;
+	struct dcache_table paths;
+};
+
+#define DC_I(super)		((super)->dc_info)
+
+int f2fs_build_dentry_cache(struct f2fs_super *super);
+void f2fs_destroy_dentry_cache(struct f2fs_super *super);
+
+/* 1 and the cached ino (0 when the name is known missing), or 0 */
+int f2fs_dcache_lookup(struct f2fs_super *super, nid_t pino, const char *name,
+		int len, nid_t *ino);
+void f2fs_dcache_add(struct f2fs_super *super, nid_t pino, const char *name,
+		int len, nid_t ino);
+int f2fs_dcache_lookup_path(struct f2fs_super *super, const char *path, int len,
+		nid_t *ino);
+void f2fs_dcache_add_path(struct f2fs_super *super, const char *path, int len,
+		nid_t ino);
+
+/* a dentry of pino was added or removed */
+void f2fs_dcache_update(struct f2fs_super *super, nid_t pino, const char *name,
+		int len, nid_t ino);
+
+#endif /*__DCACHE_H__*/
@@ -0,0 +1,594 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "super.h"
+#include "segment.h"
+#include "namei.h"
+#include "dedup.h"
+#include "dev.h"
+#include "segwalk.h"
+
+#define DEDUP_PRIME1		0x9e3779b185ebca87ULL
+#define DEDUP_PRIME2		0xc2b2ae3d27d4eb4fULL
+#define DEDUP_PRIME3		0x165667b19e3779f9ULL
+#define DEDUP_PRIME4		0x85ebca77c2b2ae63ULL
+
+#define DEDUP_TABLE_MIN		1024
+
+/* what the blocks of one inode, or of everything below one dir, add up to */
+struct dedup_file {
+	nid_t ino;
+	nid_t pino;			/* 0 until the inode was read */
+	unsigned long long blocks;
+	unsigned long long dup_blocks;
+	double reclaim;
+};
+
+/* open addressing on ino, 0 marks a free slot */
+struct dedup_table {
+	struct dedup_file *files;
+	unsigned int nr, max;
+};
+
+struct dedup_ctx {
+	struct seg_walk walk;		/* both passes go over the data segments */
+	struct f2fs_super *super;
+	int pass;
+	uint32_t *sketch;
+	uint64_t width;			/* counters per row, a power of two */
+	uint64_t *hashes;		/* hashes of pass one in sit order, or NULL */
+	unsigned long long *seg_first;	/* index of the first hash of each segment */
+	unsigned int reads;
+};
+
+struct dedup_worker {
+	struct seg_walker walker;	/* first, for f2fs_seg_walk_run() */
+	struct dedup_ctx *ctx;
+	char *buf;
+	struct page *sum_page;
+	struct dedup_table table;
+	unsigned long long blocks, dup_blocks;
+	double reclaim;
+};
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+	return rotl64(acc + input * DEDUP_PRIME2, 31) * DEDUP_PRIME1;
+}
+
+/*
+ * xxh64 style: four independent lanes walk the block, so the loop keeps
+ * four multiplies in flight and vectorizes where the target allows it.
+ */
+static uint64_t hash_block(const char *block)
+{
+	const uint64_t *p = (const uint64_t *)block;
+	uint64_t v[4] = {DEDUP_PRIME1 + DEDUP_PRIME2, DEDUP_PRIME2, 0, -DEDUP_PRIME1};
+	uint64_t h = 0;
+	int i = 0, l = 0;
+
+	for(i=0; i<F2FS_BLKSIZE/8; i+=4) {
+		for(l=0; l<4; l++) {
+			v[l] = hash_round(v[l], p[i + l]);
+		}
+	}
+
+	h = rotl64(v[0], 1) + rotl64(v[1], 7) + rotl64(v[2], 12) + rotl64(v[3], 18);
+	for(l=0; l<4; l++) {
+		h = (h ^ hash_round(0, v[l])) * DEDUP_PRIME1 + DEDUP_PRIME4;
+	}
+
+	h ^= h >> 33;
+	h *= DEDUP_PRIME2;
+	h ^= h >> 29;
+	h *= DEDUP_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64_t sketch_index(struct dedup_ctx *ctx, uint64_t h, int row)
+{
+	return row * ctx->width + (((h & 0xffffffff) + row * (h >> 32)) & (ctx->width - 1));
+}
+
+static void sketch_add(struct dedup_ctx *ctx, uint64_t h)
+{
+	int row = 0;
+
+	for(row=0; row<DEDUP_SKETCH_ROWS; row++) {
+		__sync_fetch_and_add(&ctx->sketch[sketch_index(ctx, h, row)], 1);
+	}
+}
+
+/* never below the real count, above it only on collisions in every row */
+static uint32_t sketch_count(struct dedup_ctx *ctx, uint64_t h)
+{
+	uint32_t count = UINT32_MAX, c = 0;
+	int row = 0;
+
+	for(row=0; row<DEDUP_SKETCH_ROWS; row++) {
+		c = ctx->sketch[sketch_index(ctx, h, row)];
+		if(c < count) {
+			count = c;
+		}
+	}
+	return count;
+}
+
+static unsigned int table_slot(struct dedup_table *table, nid_t ino)
+{
+	unsigned int i = (ino * 0x9e3779b1U) & (table->max - 1);
+
+	while(table->files[i].ino != 0 && table->files[i].ino != ino) {
+		i = (i + 1) & (table->max - 1);
+	}
+	return i;
+}
+
+static struct dedup_file *table_get(struct dedup_table *table, nid_t ino)
+{
+	struct dedup_file *old = table->files;
+	unsigned int max = table->max, i = 0;
+
+	if((table->nr + 1) * 2 > table->max) {
+		table->max = max ? max * 2 : DEDUP_TABLE_MIN;
+		table->files = f2fs_malloc(table->max * sizeof(struct dedup_file));
+		if(table->files == NULL) {
+			perror("f2fs_malloc");
+			table->files = old;
+			table->max = max;
+			return NULL;
+		}
+		memset(table->files, 0, table->max * sizeof(struct dedup_file));
+
+		for(i=0; i<max; i++) {
+			if(old[i].ino != 0) {
+				table->files[table_slot(table, old[i].ino)] = old[i];
+			}
+		}
+		if(old != NULL) {
+			f2fs_free(old);
+		}
+	}
+
+	i = table_slot(table, ino);
+	if(table->files[i].ino == 0) {
+		table->files[i].ino = ino;
+		table->nr++;
+	}
+	return &table->files[i];
+}
+
+static void table_free(struct dedup_table *table)
+{
+	if(table->files != NULL) {
+		f2fs_free(table->files);
+	}
+	memset(table, 0, sizeof(struct dedup_table));
+}
+
+/* counted from the map, the hashes of a segment are laid out by it */
+static unsigned int valid_in_map(struct seg_entry *se)
+{
+	unsigned int i = 0, count = 0;
+
+	for(i=0; i<SIT_VBLOCK_MAP_SIZE; i++) {
+		count += __builtin_popcount(se->cur_valid_map[i]);
+	}
+	return count;
+}
+
+static int is_data_segment(struct f2fs_super *super, unsigned int segno)
+{
+	struct seg_entry *se = get_seg_entry(super, segno);
+
+	return se->valid_blocks > 0 && se->type < CURSEG_HOT_NODE;
+}
+
+/* the summaries of an open data log are only current in the checkpoint */
+static struct f2fs_summary_block *read_summary(struct dedup_worker *w,
+		unsigned int segno)
+{
+	struct f2fs_super *super = w->ctx->super;
+	int type = 0;
+
+	for(type=CURSEG_HOT_DATA; type<CURSEG_HOT_NODE; type++) {
+		if(curseg_segno(super, type) == segno) {
+			return super->sum_blk[type];
+		}
+	}
+
+	if(read_page(w->sum_page, super->fd,
+			le32_to_cpu(super->raw_super->ssa_blkaddr) + segno) < 0) {
+		perror("read page");
+		return NULL;
+	}
+	__sync_fetch_and_add(&w->ctx->reads, 1);
+	return page_address(w->sum_page);
+}
+
+static int account_block(struct dedup_worker *w, struct f2fs_summary *sum,
+		uint32_t count)
+{
+	struct dedup_file *file = NULL;
+	double reclaim = count > 1 ? 1.0 - 1.0 / count : 0;
+	nid_t ino = f2fs_seg_walk_owner(&w->walker, le32_to_cpu(sum->nid));
+
+	w->blocks++;
+	w->dup_blocks += count > 1;
+	w->reclaim += reclaim;
+
+	/* blocks of orphans and unknown owners only show in the totals */
+	if(ino == 0) {
+		return 0;
+	}
+
+	file = table_get(&w->table, ino);
+	if(file == NULL) {
+		return -ENOMEM;
+	}
+	file->blocks++;
+	file->dup_blocks += count > 1;
+	file->reclaim += reclaim;
+	return 0;
+}
+
+/*
+ * Pass one hashes the valid blocks into the sketch, pass two hands every
+ * block with its count to its owner. Only the span between the first and
+ * the last valid block is read, and pass two reads nothing but the summary
+ * when pass one kept the hashes.
+ */
+static int scan_segment(struct seg_walker *walker, unsigned int segno)
+{
+	struct dedup_worker *w = (struct dedup_worker *)walker;
+	struct dedup_ctx *ctx = w->ctx;
+	struct f2fs_super *super = ctx->super;
+	struct seg_entry *se = get_seg_entry(super, segno);
+	struct f2fs_summary_block *sum_blk = NULL;
+	uint64_t *hashes = NULL, h = 0;
+	unsigned int first = blocks_per_seg(super), last = 0, off = 0, i = 0;
+	struct timespec start;
+	struct f2fs_dev *dev = NULL;
+	block_t devblk = 0;
+	ssize_t len = 0, n = 0;
+	char *map = (char *)se->cur_valid_map;
+	int ret = 0;
+
+	for(off=0; off<blocks_per_seg(super); off++) {
+		if(f2fs_test_bit(off, map)) {
+			first = off < first ? off : first;
+			last = off;
+		}
+	}
+
+	if(ctx->hashes != NULL) {
+		hashes = ctx->hashes + ctx->seg_first[segno];
+	}
+
+	if(ctx->pass == 1 || hashes == NULL) {
+		len = (ssize_t)(last - first + 1) * F2FS_BLKSIZE;
+		dev = f2fs_dev_map(super, START_BLOCK(super, segno) + first, &devblk);
+		f2fs_stat_read_start(&start);
+		n = pread(dev->fd, w->buf, len, (off_t)devblk * F2FS_BLKSIZE);
+		f2fs_stat_read_end(&start, n);
+		if(n != len) {
+			perror("pread");
+			return -EIO;
+		}
+		__sync_fetch_and_add(&ctx->reads, 1);
+	}
+
+	if(ctx->pass == 2) {
+		sum_blk = read_summary(w, segno);
+		if(sum_blk == NULL) {
+			return -EIO;
+		}
+	}
+
+	for(off=first; off<=last; off++) {
+		if(!f2fs_test_bit(off, map)) {
+			continue;
+		}
+
+		if(ctx->pass == 1 || hashes == NULL) {
+			h = hash_block(w->buf + (size_t)(off - first) * F2FS_BLKSIZE);
+		} else {
+			h = hashes[i];
+		}
+
+		if(ctx->pass == 1) {
+			sketch_add(ctx, h);
+			if(hashes != NULL) {
+				hashes[i] = h;
+			}
+		} else {
+			ret = account_block(w, &sum_blk->entries[off], sketch_count(ctx, h));
+			if(ret < 0) {
+				return ret;
+			}
+		}
+		i++;
+	}
+	return 0;
+}
+
+/* blocks of a file count for its dir and every dir above it */
+static int add_to_dirs(struct f2fs_super *super, struct dedup_table *dirs,
+		struct dedup_file *file, struct page *page)
+{
+	nid_t root = le32_to_cpu(super->raw_super->root_ino);
+	struct dedup_file *dir = NULL;
+	nid_t ino = file->pino;
+	int depth = 0;
+
+	for(depth=0; ino!=0 && depth<NAMEI_MAX_DEPTH; depth++) {
+		dir = table_get(dirs, ino);
+		if(dir == NULL) {
+			return -ENOMEM;
+		}
+		dir->blocks += file->blocks;
+		dir->dup_blocks += file->dup_blocks;
+		dir->reclaim += file->reclaim;
+		if(ino == root) {
+			break;
+		}
+
+		if(dir->pino == 0) {
+			dir->pino = root;
+			if(f2fs_read_node_block(super, ino, page) == 0 && IS_INODE(page)) {
+				dir->pino = le32_to_cpu(F2FS_NODE(page)->i.i_pino);
+			}
+		}
+		ino = dir->pino;
+	}
+	return 0;
+}
+
+static int cmp_reclaim(const void *a, const void *b)
+{
+	const struct dedup_file *fa = *(struct dedup_file * const *)a;
+	const struct dedup_file *fb = *(struct dedup_file * const *)b;
+
+	if(fa->reclaim != fb->reclaim) {
+		return fa->reclaim < fb->reclaim ? 1 : -1;
+	}
+	return fa->ino < fb->ino ? -1 : fa->ino > fb->ino;
+}
+
+static int print_top(struct f2fs_super *super, const char *title,
+		struct dedup_table *table, int top, struct page *page)
+{
+	struct dedup_file **order = NULL;
+	char path[PATH_MAX];
+	unsigned int i = 0, nr = 0;
+
+	order = f2fs_malloc((table->nr + 1) * sizeof(struct dedup_file *));
+	if(order == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	for(i=0; i<table->max; i++) {
+		if(table->files[i].ino != 0 && table->files[i].dup_blocks > 0) {
+			order[nr++] = &table->files[i];
+		}
+	}
+	qsort(order, nr, sizeof(struct dedup_file *), cmp_reclaim);
+
+	printf("%s by reclaimable blocks:\n", title);
+	for(i=0; i<nr && i<(unsigned int)top; i++) {
+		f2fs_ino_path(super, order[i]->ino, page, path, sizeof(path));
+		printf("%10.0f %10llu %10llu %s\n", order[i]->reclaim,
+			order[i]->dup_blocks, order[i]->blocks, path);
+	}
+	f2fs_free(order);
+	return 0;
+}
+
+static int report(struct f2fs_super *super, struct dedup_table *files, int top)
+{
+	struct dedup_table dirs;
+	struct page *page = NULL;
+	unsigned int i = 0;
+	int ret = 0;
+
+	memset(&dirs, 0, sizeof(dirs));
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	for(i=0; i<files->max; i++) {
+		if(files->files[i].ino == 0 || files->files[i].dup_blocks == 0) {
+			continue;
+		}
+
+		if(f2fs_read_node_block(super, files->files[i].ino, page) == 0 &&
+				IS_INODE(page)) {
+			files->files[i].pino = le32_to_cpu(F2FS_NODE(page)->i.i_pino);
+		}
+		ret = add_to_dirs(super, &dirs, &files->files[i], page);
+		if(ret < 0) {
+			goto out;
+		}
+	}
+
+	printf("%10s %10s %10s\n", "reclaim", "dup", "blocks");
+	ret = print_top(super, "files", files, top, page);
+	if(ret == 0 && dirs.nr > 0) {
+		ret = print_top(super, "dirs (dup blocks of the files below)", &dirs,
+			top, page);
+	}
+
+out:
+	table_free(&dirs);
+	free_page(page);
+	return ret;
+}
+
+/* keep the hashes of pass one when they fit half of the memory given */
+static int plan_memory(struct dedup_ctx *ctx, size_t mem)
+{
+	struct f2fs_sm_info *sm = SM_I(ctx->super);
+	unsigned long long total = 0;
+	unsigned int segno = 0;
+	size_t sketch_mem = mem;
+
+	ctx->seg_first = f2fs_malloc(sm->main_segments * sizeof(unsigned long long));
+	if(ctx->seg_first == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	for(segno=0; segno<sm->main_segments; segno++) {
+		ctx->seg_first[segno] = total;
+		if(is_data_segment(ctx->super, segno)) {
+			total += valid_in_map(get_seg_entry(ctx->super, segno));
+		}
+	}
+
+	if(total > 0 && total * sizeof(uint64_t) <= mem / 2) {
+		ctx->hashes = f2fs_malloc(total * sizeof(uint64_t));
+		if(ctx->hashes != NULL) {
+			sketch_mem = mem - total * sizeof(uint64_t);
+		}
+	}
+
+	ctx->width = 1024;
+	while(ctx->width * 2 * DEDUP_SKETCH_ROWS * sizeof(uint32_t) <= sketch_mem) {
+		ctx->width *= 2;
+	}
+
+	ctx->sketch = f2fs_malloc(ctx->width * DEDUP_SKETCH_ROWS * sizeof(uint32_t));
+	if(ctx->sketch == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memset(ctx->sketch, 0, ctx->width * DEDUP_SKETCH_ROWS * sizeof(uint32_t));
+	return 0;
+}
+
+int f2fs_analyze_dedup(struct f2fs_super *super, int threads, size_t mem,
+		int top, struct dedup_stat *stat)
+{
+	struct dedup_worker *workers = NULL;
+	struct dedup_file *file = NULL, *from = NULL;
+	struct dedup_table *files = NULL;
+	struct dedup_ctx ctx;
+	unsigned int j = 0;
+	int i = 0, ret = 0;
+
+	memset(stat, 0, sizeof(struct dedup_stat));
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.super = super;
+	f2fs_seg_walk_init(&ctx.walk, super, is_data_segment, scan_segment);
+
+	ret = plan_memory(&ctx, mem);
+	if(ret < 0) {
+		goto out;
+	}
+
+	workers = f2fs_malloc(threads * sizeof(struct dedup_worker));
+	if(workers == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+	memset(workers, 0, threads * sizeof(struct dedup_worker));
+
+	for(i=0; i<threads; i++) {
+		f2fs_seg_walker_init(&ctx.walk, &workers[i].walker);
+		workers[i].ctx = &ctx;
+		workers[i].buf = f2fs_malloc((size_t)blocks_per_seg(super) * F2FS_BLKSIZE);
+		workers[i].sum_page = alloc_page();
+		if(workers[i].buf == NULL || workers[i].sum_page == NULL) {
+			perror("f2fs_malloc");
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ctx.pass = 1;
+	ret = f2fs_seg_walk_run(&ctx.walk, workers, sizeof(struct dedup_worker),
+		threads);
+	if(ret == 0) {
+		ctx.pass = 2;
+		ret = f2fs_seg_walk_run(&ctx.walk, workers, sizeof(struct dedup_worker),
+			threads);
+	}
+	if(ret < 0) {
+		goto out;
+	}
+
+	/* fold the tables of the workers into the first one */
+	files = &workers[0].table;
+	for(i=0; i<threads; i++) {
+		stat->blocks += workers[i].blocks;
+		stat->dup_blocks += workers[i].dup_blocks;
+		stat->reclaimable += workers[i].reclaim;
+
+		for(j=0; i>0 && j<workers[i].table.max; j++) {
+			from = &workers[i].table.files[j];
+			if(from->ino == 0) {
+				continue;
+			}
+
+			file = table_get(files, from->ino);
+			if(file == NULL) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			file->blocks += from->blocks;
+			file->dup_blocks += from->dup_blocks;
+			file->reclaim += from->reclaim;
+		}
+	}
+	stat->files = files->nr;
+	stat->reads = ctx.reads;
+	stat->kept_hashes = ctx.hashes != NULL;
+
+	printf("data blocks:%llu duplicate:%llu reclaimable:%.0f (%.1f%%) files:%u\n",
+		stat->blocks, stat->dup_blocks, stat->reclaimable,
+		stat->blocks ? 100.0 * stat->reclaimable / stat->blocks : 0.0, stat->files);
+	ret = report(super, files, top);
+
+out:
+	for(i=0; workers!=NULL && i<threads; i++) {
+		if(workers[i].buf != NULL) {
+			f2fs_free(workers[i].buf);
+		}
+		if(workers[i].sum_page != NULL) {
+			free_page(workers[i].sum_page);
+		}
+		table_free(&workers[i].table);
+	}
+	if(workers != NULL) {
+		f2fs_free(workers);
+	}
+	if(ctx.sketch != NULL) {
+		f2fs_free(ctx.sketch);
+	}
+	if(ctx.hashes != NULL) {
+		f2fs_free(ctx.hashes);
+	}
+	if(ctx.seg_first != NULL) {
+		f2fs_free(ctx.seg_first);
+	}
+	f2fs_seg_walk_exit(&ctx.walk);
+	return ret;
+}
@@ -0,0 +1,28 @@
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include "f2fs.h"
+
+/* rows of the count-min sketch, each indexed by another mix of the hash */
+#define DEDUP_SKETCH_ROWS	4
+#define DEDUP_DEF_MEM		(64 << 20)
+#define DEDUP_DEF_TOP		10
+
+struct dedup_stat {
+	unsigned long long blocks;	/* valid data blocks hashed */
+	unsigned long long dup_blocks;	/* blocks whose content occurs more than once */
+	double reclaimable;		/* blocks saved if each content were kept once */
+	unsigned int files;		/* inodes owning the blocks */
+	unsigned int reads;		/* segment and summary reads */
+	int kept_hashes;		/* the second pass did not read data again */
+};
+
+/*
+ * Hash every valid data block with threads workers, count the contents in
+ * a count-min sketch of about mem bytes and print the totals and the top
+ * files and dirs by the blocks dedup would save. Needs the segment manager.
+ */
+int f2fs_analyze_dedup(struct f2fs_super *super, int threads, size_t mem,
+		int top, struct dedup_stat *stat);
+
+#endif /*__DEDUP_H__*/
@@ -0,0 +1,730 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "node.h"
+#include "segment.h"
+#include "data.h"
+#include "trace.h"
+#include "defrag.h"
+
+/* node levels below an inode: double indirect, indirect, direct */
+#define DEFRAG_NODE_LEVELS	3
+
+/* the extent map of one file, in index order */
+struct extent_walk {
+	block_t last;
+	unsigned int blocks;
+	unsigned int extents;
+	unsigned int nodes;		/* inode and direct nodes, the ones a move dirties */
+	struct page *pages[DEFRAG_NODE_LEVELS];
+};
+
+struct plan_ctx {
+	struct defrag_opts *opts;
+	struct defrag_plan *plan;
+	struct page *inode_page;
+	struct page *sum_page;
+	struct extent_walk walk;
+	block_t blocks_per_sec;
+};
+
+struct defrag_ctx {
+	struct f2fs_super *super;
+	struct defrag_plan *plan;
+	struct defrag_stat *stat;
+	struct page *sum_page;
+};
+
+static void account_addr(struct extent_walk *w, block_t blkaddr)
+{
+	if(blkaddr == NULL_ADDR || blkaddr == NEW_ADDR) {
+		return;
+	}
+	if(w->blocks == 0 || blkaddr != w->last + 1) {
+		w->extents++;
+	}
+	w->blocks++;
+	w->last = blkaddr;
+}
+
+static int walk_node(struct f2fs_super *super, struct extent_walk *w, nid_t nid,
+		int level)
+{
+	struct page *page = w->pages[level];
+	unsigned int i = 0;
+	nid_t child = 0;
+	int ret = 0;
+
+	ret = f2fs_read_node_block(super, nid, page);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(level == 0) {
+		for(i=0; i<DEF_ADDRS_PER_BLOCK; i++) {
+			account_addr(w, datablock_addr(page, i));
+		}
+		w->nodes++;
+		return 0;
+	}
+
+	for(i=0; i<NIDS_PER_BLOCK; i++) {
+		child = le32_to_cpu(F2FS_NODE(page)->in.nid[i]);
+		if(child == 0) {
+			continue;
+		}
+		ret = walk_node(super, w, child, level - 1);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* count the runs of physically consecutive blocks of the file */
+static int file_extents(struct f2fs_super *super, struct page *inode_page,
+		struct extent_walk *w)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(inode_page)->i;
+	int levels[DEF_NIDS_PER_INODE] = {0, 0, 1, 1, 2};
+	unsigned int i = 0;
+	nid_t nid = 0;
+	int ret = 0;
+
+	w->last = NULL_ADDR;
+	w->blocks = 0;
+	w->extents = 0;
+	w->nodes = 1;
+
+	for(i=0; i<ADDRS_PER_INODE(super->raw_super, ri); i++) {
+		account_addr(w, datablock_addr(inode_page, i));
+	}
+
+	for(i=0; i<DEF_NIDS_PER_INODE; i++) {
+		nid = le32_to_cpu(ri->i_nid[i]);
+		if(nid == 0) {
+			continue;
+		}
+		ret = walk_node(super, w, nid, levels[i]);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* the blocks of pinned files are where swap and the like expect them */
+static int is_pinned(struct f2fs_raw_inode *ri)
+{
+	return (ri->i_inline & F2FS_PIN_FILE) ||
+		(le32_to_cpu(ri->i_flags) & F2FS_COMPR_FL);
+}
+
+static int add_item(struct defrag_plan *plan, struct defrag_item *item)
+{
+	struct defrag_item *items = NULL;
+	unsigned int max = 0;
+
+	if(plan->nr_items == plan->max_items) {
+		max = plan->max_items ? plan->max_items * 2 : 256;
+		items = f2fs_malloc(max * sizeof(struct defrag_item));
+		if(items == NULL) {
+			perror("f2fs_malloc");
+			return -ENOMEM;
+		}
+		if(plan->nr_items > 0) {
+			memcpy(items, plan->items, plan->nr_items * sizeof(struct defrag_item));
+		}
+		f2fs_free(plan->items);
+		plan->items = items;
+		plan->max_items = max;
+	}
+	plan->items[plan->nr_items++] = *item;
+	return 0;
+}
+
+static int add_file(struct f2fs_super *super, struct node_info *ni, void *arg)
+{
+	struct plan_ctx *ctx = arg;
+	struct defrag_plan *plan = ctx->plan;
+	struct extent_walk *w = &ctx->walk;
+	struct f2fs_raw_inode *ri = &F2FS_NODE(ctx->inode_page)->i;
+	struct defrag_item item;
+
+	/* the node and meta inodes have nat entries but no blocks of their own */
+	if(ni->nid != ni->ino || f2fs_is_orphan(super, ni->ino) ||
+			ni->ino == le32_to_cpu(super->raw_super->node_ino) ||
+			ni->ino == le32_to_cpu(super->raw_super->meta_ino)) {
+		return 0;
+	}
+
+	/* a node gone since the nat was read is not an error */
+	if(f2fs_read_node_block(super, ni->ino, ctx->inode_page) < 0 ||
+			!IS_INODE(ctx->inode_page)) {
+		return 0;
+	}
+	if(!S_ISREG(le16_to_cpu(ri->i_mode)) || f2fs_has_inline(ri)) {
+		return 0;
+	}
+	if(is_pinned(ri)) {
+		plan->pinned++;
+		return 0;
+	}
+
+	if(file_extents(super, ctx->inode_page, w) < 0 || w->blocks == 0) {
+		return 0;
+	}
+	plan->files++;
+
+	memset(&item, 0, sizeof(item));
+	item.type = DEFRAG_FILE;
+	item.id = ni->ino;
+	item.blocks = w->blocks;
+	item.nodes = w->nodes;
+	item.extents = w->extents;
+	item.ideal = (w->blocks + ctx->blocks_per_sec - 1) / ctx->blocks_per_sec;
+	if(item.extents <= item.ideal ||
+			item.blocks / item.extents >= ctx->opts->min_extent) {
+		return 0;
+	}
+	plan->fragmented++;
+	return add_item(plan, &item);
+}
+
+static int is_curseg(struct f2fs_super *super, unsigned int segno)
+{
+	int type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(SM_I(super)->curseg[type].segno == segno) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * What moving a section costs, from its summaries: the valid data blocks
+ * and their dnodes, or the valid node blocks.
+ */
+static int section_cost(struct f2fs_super *super, struct plan_ctx *ctx,
+		unsigned int secno, struct defrag_item *item)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct f2fs_summary_block *sum_blk = page_address(ctx->sum_page);
+	struct seg_entry *se = NULL;
+	unsigned int segno = 0, off = 0;
+	nid_t last = 0, nid = 0;
+	int ret = 0;
+
+	for(segno=secno*sm->segs_per_sec; segno<(secno + 1)*sm->segs_per_sec; segno++) {
+		se = get_seg_entry(super, segno);
+		if(se->valid_blocks == 0) {
+			continue;
+		}
+
+		ret = f2fs_get_summary(super, segno, ctx->sum_page);
+		if(ret < 0) {
+			return ret;
+		}
+
+		for(off=0; off<blocks_per_seg(super); off++) {
+			if(!f2fs_test_bit(off, (char *)se->cur_valid_map)) {
+				continue;
+			}
+			if(se->type >= CURSEG_HOT_NODE) {
+				item->nodes++;
+				continue;
+			}
+
+			/* blocks of one dnode are mostly next to each other */
+			item->blocks++;
+			nid = le32_to_cpu(sum_blk->entries[off].nid);
+			if(nid != last) {
+				item->nodes++;
+				last = nid;
+			}
+		}
+	}
+	return 0;
+}
+
+/* sections under max_util, and how many are free for the writes */
+static int add_sections(struct f2fs_super *super, struct plan_ctx *ctx,
+		unsigned int *free_secs)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	unsigned int nsecs = sm->main_segments / sm->segs_per_sec;
+	unsigned int secno = 0, segno = 0, valid = 0, ckpt = 0, open = 0;
+	struct defrag_item item;
+	struct seg_entry *se = NULL;
+	int ret = 0;
+
+	*free_secs = 0;
+	for(secno=0; secno<nsecs; secno++) {
+		valid = ckpt = open = 0;
+		for(segno=secno*sm->segs_per_sec; segno<(secno + 1)*sm->segs_per_sec; segno++) {
+			se = get_seg_entry(super, segno);
+			valid += se->valid_blocks;
+			ckpt += se->ckpt_valid_blocks;
+			open |= is_curseg(super, segno);
+		}
+
+		if(open) {
+			continue;
+		}
+		/* what the last checkpoint uses is only free after the next one */
+		if(valid == 0 && ckpt == 0) {
+			(*free_secs)++;
+			continue;
+		}
+		if(valid == 0 || (block_t)valid * 100 >= ctx->opts->max_util * ctx->blocks_per_sec) {
+			continue;
+		}
+
+		memset(&item, 0, sizeof(item));
+		item.type = DEFRAG_SECTION;
+		item.id = secno;
+		ret = section_cost(super, ctx, secno, &item);
+		if(ret < 0) {
+			return ret;
+		}
+		ctx->plan->sections++;
+		ret = add_item(ctx->plan, &item);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* files by the seeks a rewrite saves, then sections emptiest first */
+static int item_cmp(const void *a, const void *b)
+{
+	const struct defrag_item *x = a, *y = b;
+
+	if(x->type != y->type) {
+		return x->type == DEFRAG_FILE ? -1 : 1;
+	}
+	if(x->type == DEFRAG_FILE && x->extents - x->ideal != y->extents - y->ideal) {
+		return x->extents - x->ideal > y->extents - y->ideal ? -1 : 1;
+	}
+	if(x->blocks + x->nodes != y->blocks + y->nodes) {
+		return x->blocks + x->nodes < y->blocks + y->nodes ? -1 : 1;
+	}
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/* keep what fits the budget, in order, and cut it into batches */
+static int select_items(struct defrag_plan *plan, struct defrag_opts *opts)
+{
+	struct defrag_batch *batch = NULL;
+	unsigned int i = 0, nr = 0, files = 0;
+	unsigned long long cost = 0;
+
+	/* an empty plan has neither items nor batches */
+	if(plan->nr_items == 0) {
+		return 0;
+	}
+	qsort(plan->items, plan->nr_items, sizeof(struct defrag_item), item_cmp);
+
+	for(i=0; i<plan->nr_items; i++) {
+		cost = plan->items[i].blocks + plan->items[i].nodes;
+		if(plan->blocks + plan->nodes + cost > plan->budget ||
+				(plan->items[i].type == DEFRAG_FILE && opts->max_files != 0 &&
+				files == opts->max_files)) {
+			plan->left_out++;
+			continue;
+		}
+
+		files += plan->items[i].type == DEFRAG_FILE;
+		if(plan->items[i].type == DEFRAG_FILE) {
+			plan->extents += plan->items[i].extents;
+			plan->ideal += plan->items[i].ideal;
+		}
+		plan->blocks += plan->items[i].blocks;
+		plan->nodes += plan->items[i].nodes;
+		plan->items[nr++] = plan->items[i];
+	}
+	plan->nr_items = nr;
+
+	/* one batch per item at most */
+	plan->batches = f2fs_malloc((nr ? nr : 1) * sizeof(struct defrag_batch));
+	if(plan->batches == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	for(i=0; i<nr; i++) {
+		if(batch == NULL || (batch->blocks > 0 &&
+				batch->blocks + plan->items[i].blocks > opts->batch_blocks)) {
+			batch = &plan->batches[plan->nr_batches++];
+			batch->first = i;
+			batch->nr = 0;
+			batch->blocks = 0;
+		}
+		batch->nr++;
+		batch->blocks += plan->items[i].blocks;
+	}
+	return 0;
+}
+
+int f2fs_plan_defrag(struct f2fs_super *super, struct defrag_opts *opts,
+		struct defrag_plan *plan)
+{
+	F2FS_TRACE_SCOPE("plan_defrag", NULL, 0);
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct plan_ctx ctx;
+	unsigned int free_secs = 0, i = 0;
+	int ret = 0;
+
+	memset(plan, 0, sizeof(struct defrag_plan));
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.opts = opts;
+	ctx.plan = plan;
+	ctx.blocks_per_sec = blocks_per_seg(super) * sm->segs_per_sec;
+	plan->batch_blocks = opts->batch_blocks;
+
+	ctx.inode_page = alloc_page();
+	ctx.sum_page = alloc_page();
+	for(i=0; i<DEFRAG_NODE_LEVELS; i++) {
+		ctx.walk.pages[i] = alloc_page();
+		if(ctx.walk.pages[i] == NULL) {
+			ret = -ENOMEM;
+		}
+	}
+	if(ctx.inode_page == NULL || ctx.sum_page == NULL || ret < 0) {
+		perror("alloc page");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = f2fs_scan_nat(super, 0, NAT_SCAN_VALID, add_file, &ctx, NULL);
+	if(ret < 0) {
+		goto out;
+	}
+
+	ret = add_sections(super, &ctx, &free_secs);
+	if(ret < 0) {
+		goto out;
+	}
+
+	/* every log may open a section of its own on the way */
+	if(free_secs > NR_CURSEG_TYPE) {
+		plan->budget = (unsigned long long)(free_secs - NR_CURSEG_TYPE) *
+			ctx.blocks_per_sec;
+	}
+	ret = select_items(plan, opts);
+
+out:
+	if(ret < 0) {
+		f2fs_free_defrag_plan(plan);
+	}
+	for(i=0; i<DEFRAG_NODE_LEVELS; i++) {
+		if(ctx.walk.pages[i] != NULL) {
+			free_page(ctx.walk.pages[i]);
+		}
+	}
+	if(ctx.sum_page != NULL) {
+		free_page(ctx.sum_page);
+	}
+	if(ctx.inode_page != NULL) {
+		free_page(ctx.inode_page);
+	}
+	return ret;
+}
+
+void f2fs_free_defrag_plan(struct defrag_plan *plan)
+{
+	if(plan->items != NULL) {
+		f2fs_free(plan->items);
+	}
+	if(plan->batches != NULL) {
+		f2fs_free(plan->batches);
+	}
+	plan->items = NULL;
+	plan->batches = NULL;
+	plan->nr_items = plan->max_items = plan->nr_batches = 0;
+}
+
+/* write what was dirtied in one sorted pass and drop it from memory */
+static int flush_moves(struct defrag_ctx *ctx)
+{
+	int ret = f2fs_flush_data_pages(ctx->super);
+
+	if(ret < 0) {
+		return ret;
+	}
+	f2fs_release_data_pages(ctx->super);
+	return 0;
+}
+
+static int move_data(struct defrag_ctx *ctx, struct page *inode_page,
+		unsigned long index)
+{
+	struct page *page = NULL;
+	int ret = 0;
+
+	ret = f2fs_get_data_page(ctx->super, inode_page, index, 0, &page);
+	if(ret < 0) {
+		return ret;
+	}
+	f2fs_mark_data_dirty(ctx->super, ino_of_node(inode_page), index);
+	ctx->stat->data_blocks++;
+
+	/* a large file is written in pieces, the log keeps them in one run */
+	if(DM_I(ctx->super)->dirty_data_cnt >= ctx->plan->batch_blocks) {
+		return flush_moves(ctx);
+	}
+	return 0;
+}
+
+/* the slots of the node holding index that are at index or behind it */
+static unsigned long slots_from(struct f2fs_super *super, struct f2fs_raw_inode *ri,
+		unsigned long index)
+{
+	unsigned long api = ADDRS_PER_INODE(super->raw_super, ri);
+
+	if(index < api) {
+		return api - index;
+	}
+	return ADDRS_PER_BLOCK(ri) - (index - api) % ADDRS_PER_BLOCK(ri);
+}
+
+static int move_file(struct defrag_ctx *ctx, nid_t ino)
+{
+	struct f2fs_super *super = ctx->super;
+	struct page *inode_page = NULL;
+	struct f2fs_raw_inode *ri = NULL;
+	struct dnode_of_data dn;
+	unsigned long index = 0, end = 0, nblocks = 0, i = 0;
+	int ret = 0;
+
+	inode_page = f2fs_get_node_page(super, ino);
+	if(inode_page == NULL) {
+		return -EIO;
+	}
+	ri = &F2FS_NODE(inode_page)->i;
+	nblocks = (le64_to_cpu(ri->i_size) + F2FS_BLKSIZE - 1) >> F2FS_BLKSIZE_BITS;
+
+	for(index=0; index<nblocks; index=end) {
+		end = index + slots_from(ctx->super, ri, index);
+
+		set_new_dnode(&dn, ino, inode_page);
+		ret = f2fs_get_dnode_of_data(super, &dn, index, LOOKUP_NODE);
+		if(ret == -ENOENT) {
+			continue;
+		}
+		if(ret < 0) {
+			return ret;
+		}
+
+		for(i=index; i<end && i<nblocks && ret==0; i++) {
+			if(datablock_addr(dn.node_page, dn.ofs_in_node + (i - index)) != NULL_ADDR) {
+				ret = move_data(ctx, inode_page, i);
+			}
+		}
+		f2fs_put_dnode(super, &dn);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	ctx->stat->files++;
+	return 0;
+}
+
+/* a data block is live if its dnode still points at it */
+static int move_block(struct defrag_ctx *ctx, struct f2fs_summary *sum,
+		block_t blkaddr)
+{
+	struct f2fs_super *super = ctx->super;
+	struct page *dnode = NULL, *inode_page = NULL;
+	struct f2fs_raw_inode *ri = NULL;
+	unsigned int ofs = le16_to_cpu(sum->ofs_in_node);
+	nid_t nid = le32_to_cpu(sum->nid);
+	struct node_info ni;
+	unsigned long index = 0;
+
+	if(f2fs_get_node_info(super, nid, &ni) < 0 || ni.blk_addr == NULL_ADDR) {
+		goto skip;
+	}
+
+	dnode = f2fs_get_node_page(super, nid);
+	inode_page = dnode != NULL ? f2fs_get_node_page(super, ni.ino) : NULL;
+	if(inode_page == NULL || !IS_INODE(inode_page)) {
+		goto skip;
+	}
+
+	ri = &F2FS_NODE(inode_page)->i;
+	if(ofs >= ADDRS_PER_PAGE(super->raw_super, dnode, ri) || datablock_addr(dnode, ofs) != blkaddr ||
+			is_pinned(ri)) {
+		goto skip;
+	}
+
+	index = f2fs_start_bidx_of_node(ctx->super, ri, ofs_of_node(dnode)) + ofs;
+	return move_data(ctx, inode_page, index);
+
+skip:
+	ctx->stat->skipped++;
+	return 0;
+}
+
+/* a node block is live if the nat still points at it */
+static int move_node(struct defrag_ctx *ctx, nid_t nid, block_t blkaddr)
+{
+	struct page *page = NULL;
+	struct node_info ni;
+
+	if(f2fs_get_node_info(ctx->super, nid, &ni) < 0 || ni.blk_addr != blkaddr) {
+		ctx->stat->skipped++;
+		return 0;
+	}
+
+	page = f2fs_get_node_page(ctx->super, nid);
+	if(page == NULL) {
+		return -EIO;
+	}
+	f2fs_mark_node_dirty(ctx->super, page);
+	ctx->stat->node_blocks++;
+	return 0;
+}
+
+/* every valid block of the section, found through the summaries */
+static int move_section(struct defrag_ctx *ctx, unsigned int secno)
+{
+	struct f2fs_super *super = ctx->super;
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct f2fs_summary_block *sum_blk = page_address(ctx->sum_page);
+	unsigned long long skipped = ctx->stat->skipped;
+	unsigned int segno = 0, off = 0;
+	struct seg_entry *se = NULL;
+	block_t blkaddr = 0;
+	int ret = 0;
+
+	for(segno=secno*sm->segs_per_sec; segno<(secno + 1)*sm->segs_per_sec; segno++) {
+		se = get_seg_entry(super, segno);
+		if(se->valid_blocks == 0) {
+			continue;
+		}
+
+		ret = f2fs_get_summary(super, segno, ctx->sum_page);
+		if(ret < 0) {
+			return ret;
+		}
+
+		for(off=0; off<blocks_per_seg(super); off++) {
+			if(!f2fs_test_bit(off, (char *)se->cur_valid_map)) {
+				continue;
+			}
+
+			blkaddr = START_BLOCK(super, segno) + off;
+			if(se->type >= CURSEG_HOT_NODE) {
+				ret = move_node(ctx, le32_to_cpu(sum_blk->entries[off].nid), blkaddr);
+			} else {
+				ret = move_block(ctx, &sum_blk->entries[off], blkaddr);
+			}
+			if(ret < 0) {
+				return ret;
+			}
+		}
+	}
+
+	/* free after the checkpoint unless a block had to stay */
+	ctx->stat->sections++;
+	ctx->stat->freed += ctx->stat->skipped == skipped;
+	return 0;
+}
+
+static int run_batch(struct defrag_ctx *ctx, struct defrag_batch *batch)
+{
+	F2FS_TRACE_SCOPE("defrag_batch", "items", batch->nr);
+	struct defrag_item *item = NULL;
+	unsigned int i = 0;
+	int ret = 0;
+
+	for(i=batch->first; i<batch->first+batch->nr; i++) {
+		item = &ctx->plan->items[i];
+		if(item->type == DEFRAG_FILE) {
+			ret = move_file(ctx, item->id);
+		} else {
+			ret = move_section(ctx, item->id);
+		}
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	ctx->stat->batches++;
+	return flush_moves(ctx);
+}
+
+int f2fs_run_defrag(struct f2fs_super *super, struct defrag_plan *plan,
+		struct defrag_stat *stat)
+{
+	F2FS_TRACE_SCOPE("run_defrag", NULL, 0);
+	struct defrag_ctx ctx;
+	struct extent_walk w;
+	struct page *page = NULL;
+	unsigned int i = 0;
+	int ret = 0;
+
+	memset(stat, 0, sizeof(struct defrag_stat));
+	memset(&w, 0, sizeof(w));
+	ctx.super = super;
+	ctx.plan = plan;
+	ctx.stat = stat;
+	ctx.sum_page = alloc_page();
+	page = alloc_page();
+	for(i=0; i<DEFRAG_NODE_LEVELS; i++) {
+		w.pages[i] = alloc_page();
+		if(w.pages[i] == NULL) {
+			ret = -ENOMEM;
+		}
+	}
+	if(ctx.sum_page == NULL || page == NULL || ret < 0) {
+		perror("alloc page");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for(i=0; i<plan->nr_batches; i++) {
+		ret = run_batch(&ctx, &plan->batches[i]);
+		if(ret < 0) {
+			goto out;
+		}
+	}
+
+	/* the node manager has the new addresses already */
+	for(i=0; i<plan->nr_items; i++) {
+		if(plan->items[i].type != DEFRAG_FILE) {
+			continue;
+		}
+		ret = f2fs_read_node_block(super, plan->items[i].id, page);
+		if(ret == 0) {
+			ret = file_extents(super, page, &w);
+		}
+		if(ret < 0) {
+			goto out;
+		}
+		stat->extents += w.extents;
+	}
+
+out:
+	for(i=0; i<DEFRAG_NODE_LEVELS; i++) {
+		if(w.pages[i] != NULL) {
+			free_page(w.pages[i]);
+		}
+	}
+	if(page != NULL) {
+		free_page(page);
+	}
+	if(ctx.sum_page != NULL) {
+		free_page(ctx.sum_page);
+	}
+	return ret;
+}
@@ -0,0 +1,84 @@
+#ifndef __DEFRAG_H__
+#define __DEFRAG_H__
+
+#include "f2fs.h"
+
+#define DEFRAG_DEF_EXTENT	64		/* blocks a file's extents should average */
+#define DEFRAG_DEF_UTIL		10		/* percent valid under which a section is emptied */
+#define DEFRAG_DEF_BATCH	(16 << 20)	/* bytes moved between two flushes */
+
+enum {
+	DEFRAG_FILE,			/* rewrite a file into one run */
+	DEFRAG_SECTION,			/* move the valid blocks out of a section */
+};
+
+struct defrag_opts {
+	unsigned int min_extent;	/* files below this average extent are moved */
+	unsigned int max_util;		/* sections below this percent are emptied */
+	unsigned int batch_blocks;
+	unsigned int max_files;		/* 0 for no limit */
+};
+
+struct defrag_item {
+	int type;
+	unsigned int id;		/* ino of a file, secno of a section */
+	unsigned int blocks;		/* data blocks, or valid blocks of the section */
+	unsigned int nodes;		/* node blocks the move dirties */
+	unsigned int extents;		/* of a file, ideal is the fewest it could have */
+	unsigned int ideal;
+};
+
+struct defrag_batch {
+	unsigned int first, nr;		/* items */
+	unsigned long long blocks;
+};
+
+struct defrag_plan {
+	struct defrag_item *items;	/* files by seeks saved, then sections by utilization */
+	unsigned int nr_items, max_items;
+	struct defrag_batch *batches;
+	unsigned int nr_batches;
+	unsigned int batch_blocks;	/* dirty data blocks that force a flush */
+
+	unsigned int files;		/* regular files with blocks */
+	unsigned int fragmented;	/* of them over the threshold */
+	unsigned int pinned;		/* pinned or compressed, never moved */
+	unsigned int sections;		/* under max_util */
+	unsigned long long extents, ideal;	/* of the planned files */
+	unsigned long long blocks, nodes;	/* the plan writes */
+	unsigned long long budget;	/* blocks the writes may take */
+	unsigned int left_out;		/* items past the budget */
+};
+
+struct defrag_stat {
+	unsigned int batches;
+	unsigned int files;
+	unsigned int sections;
+	unsigned int freed;		/* sections nothing had to stay in */
+	unsigned long long data_blocks;
+	unsigned long long node_blocks;
+	unsigned long long skipped;	/* blocks of pinned files and dead summaries */
+	unsigned long long extents;	/* of the moved files afterwards */
+};
+
+/*
+ * Plan a defragmentation from the segment manager's view of the sit and
+ * the extent maps of all regular files: files whose extents average under
+ * min_extent blocks, most seeks saved first, then sections under max_util
+ * percent valid, emptiest first, as long as the writes fit the free
+ * sections. Items are cut into batches of about batch_blocks.
+ */
+int f2fs_plan_defrag(struct f2fs_super *super, struct defrag_opts *opts,
+		struct defrag_plan *plan);
+void f2fs_free_defrag_plan(struct defrag_plan *plan);
+
+/*
+ * Run a plan in a modifying command: the blocks of a batch are dirtied
+ * through the data and node managers and the data is written in one sorted
+ * flush before the next batch is read. Only the checkpoint at the end of
+ * the command makes the moves visible, the old blocks stay valid until it.
+ */
+int f2fs_run_defrag(struct f2fs_super *super, struct defrag_plan *plan,
+		struct defrag_stat *stat);
+
+#endif /*__DEFRAG_H__*/
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "trace.h"
+#include "dev.h"
+
+struct f2fs_dev_queue {
+	struct f2fs_super *super;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t more;		/* for the thread */
+	pthread_cond_t done;		/* for the waiters */
+	struct f2fs_dev_io *head, **tail;
+	int stop;
+};
+
+/* entry i of the devpath list, NULL when it has fewer */
+static char *list_path(const char *list, int i)
+{
+	const char *end = NULL;
+	char *path = NULL;
+	size_t len = 0;
+
+	for(; i > 0 && list != NULL; i--) {
+		list = strchr(list, ',');
+		if(list != NULL) {
+			list++;
+		}
+	}
+	if(list == NULL) {
+		return NULL;
+	}
+
+	end = strchr(list, ',');
+	len = end != NULL ? (size_t)(end - list) : strlen(list);
+	path = f2fs_malloc(len + 1);
+	if(path != NULL) {
+		memcpy(path, list, len);
+		path[len] = '\0';
+	}
+	return path;
+}
+
+/* the name in the super block is not terminated when it fills the field */
+static char *super_path(struct f2fs_super *super, int i)
+{
+	__u8 *name = super->raw_super->devs[i].path;
+	char *path = NULL;
+	size_t len = strnlen((char *)name, MAX_PATH_LEN);
+
+	path = f2fs_malloc(len + 1);
+	if(path != NULL) {
+		memcpy(path, name, len);
+		path[len] = '\0';
+	}
+	return path;
+}
+
+static int open_member(struct f2fs_super *super, int i, char *path, int flags)
+{
+	struct f2fs_dev *dev = &super->devs[i];
+
+	if(path == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	dev->path = path;
+	dev->fd = open(path, flags);
+	super->ndevs = i + 1;
+	if(dev->fd < 0) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	return 0;
+}
+
+/* the first member, the super block is read from it */
+int f2fs_open_device(struct f2fs_super *super, int flags)
+{
+	int ret = 0;
+
+	ret = open_member(super, 0, list_path(super->devpath, 0), flags);
+	super->fd = super->devs[0].fd;
+	super->devs[0].end_blk = ~(block_t)0;
+	return ret;
+}
+
+/* as f2fs_scan_devices() in the kernel lays them out */
+int f2fs_open_devices(struct f2fs_super *super, int flags)
+{
+	struct f2fs_super_block *raw_super = super->raw_super;
+	int log_blocks = le32_to_cpu(raw_super->log_blocks_per_seg);
+	struct f2fs_dev *dev = NULL;
+	block_t blocks = 0, main_end = 0;
+	char *path = NULL;
+	int i = 0, ret = 0;
+
+	/* one device leaves devs[] empty */
+	if(raw_super->devs[0].path[0] == '\0') {
+		return 0;
+	}
+
+	for(i=0; i<MAX_DEVICES; i++) {
+		if(i > 0 && raw_super->devs[i].path[0] == '\0') {
+			break;
+		}
+
+		if(i > 0) {
+			path = list_path(super->devpath, i);
+			if(path == NULL) {
+				path = super_path(super, i);
+			}
+			ret = open_member(super, i, path, flags);
+			if(ret < 0) {
+				return ret;
+			}
+		}
+
+		dev = &super->devs[i];
+		blocks = (block_t)le32_to_cpu(raw_super->devs[i].total_segments) << log_blocks;
+		if(i == 0) {
+			dev->start_blk = 0;
+			dev->end_blk = blocks - 1 + le32_to_cpu(raw_super->segment0_blkaddr);
+		} else {
+			dev->start_blk = super->devs[i - 1].end_blk + 1;
+			dev->end_blk = dev->start_blk + blocks - 1;
+		}
+	}
+
+	if(le32_to_cpu(raw_super->main_blkaddr) > super->devs[0].end_blk) {
+		printf("Error: the metadata does not fit on %s.\n", super->devs[0].path);
+		return -EINVAL;
+	}
+	main_end = le32_to_cpu(raw_super->main_blkaddr) +
+		((block_t)le32_to_cpu(raw_super->segment_count_main) << log_blocks);
+	if(super->devs[super->ndevs - 1].end_blk + 1 < main_end) {
+		printf("Error: the devices end at block %llu, the main area at %llu.\n",
+			(unsigned long long)super->devs[super->ndevs - 1].end_blk + 1,
+			(unsigned long long)main_end);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* devs[0].fd is super->fd, f2fs_umount() closes that one */
+void f2fs_close_devices(struct f2fs_super *super)
+{
+	int i = 0;
+
+	f2fs_dev_stop(super);
+	for(i=0; i<super->ndevs; i++) {
+		if(i > 0 && super->devs[i].fd >= 0) {
+			close(super->devs[i].fd);
+		}
+		f2fs_free(super->devs[i].path);
+	}
+	super->ndevs = 0;
+}
+
+void f2fs_dev_segments(struct f2fs_super *super, int dev, unsigned int *lo,
+		unsigned int *hi)
+{
+	struct f2fs_super_block *raw_super = super->raw_super;
+	int log_blocks = le32_to_cpu(raw_super->log_blocks_per_seg);
+	block_t main_blkaddr = le32_to_cpu(raw_super->main_blkaddr);
+	block_t start = super->devs[dev].start_blk, end = super->devs[dev].end_blk;
+	unsigned int segs = le32_to_cpu(raw_super->segment_count_main);
+
+	*lo = start <= main_blkaddr ? 0 : (start - main_blkaddr) >> log_blocks;
+	*hi = segs;
+	if(end - main_blkaddr < ((block_t)segs << log_blocks)) {
+		*hi = (end - main_blkaddr + 1) >> log_blocks;
+	}
+}
+
+/* runs crossing a member boundary take one read per member */
+int f2fs_read_blocks(struct f2fs_super *super, void *buf, block_t blkaddr, int nr)
+{
+	struct f2fs_dev *dev = NULL;
+	block_t devblk = 0;
+	unsigned int run = 0;
+	int done = 0;
+
+	for(done=0; done<nr; done+=run) {
+		dev = f2fs_dev_map(super, blkaddr + done, &devblk);
+		run = f2fs_dev_run(dev, blkaddr + done, nr - done);
+		if(read_pages((char *)buf + (size_t)done * F2FS_PAGE_SIZE, dev->fd,
+				devblk, run) < 0) {
+			return -1;
+		}
+	}
+	return nr;
+}
+
+int f2fs_write_blocksv(struct f2fs_super *super, struct iovec *iov, int nr,
+		block_t blkaddr)
+{
+	struct f2fs_dev *dev = NULL;
+	block_t devblk = 0;
+	unsigned int run = 0;
+	int done = 0;
+
+	for(done=0; done<nr; done+=run) {
+		dev = f2fs_dev_map(super, blkaddr + done, &devblk);
+		run = f2fs_dev_run(dev, blkaddr + done, nr - done);
+		if(write_pagesv(iov + done, run, dev->fd, devblk) < 0) {
+			return -1;
+		}
+	}
+	return nr;
+}
+
+static void do_io(struct f2fs_super *super, struct f2fs_dev_io *io)
+{
+	block_t devblk = 0;
+	struct f2fs_dev *dev = f2fs_dev_map(super, io->blkaddr, &devblk);
+	F2FS_TRACE_SCOPE("dev_read", "dev", dev - super->devs);
+
+	/* a short read leaves errno alone */
+	errno = 0;
+	io->ret = read_pages(io->buf, dev->fd, devblk, io->nr);
+	if(io->ret < 0) {
+		io->ret = errno != 0 ? -errno : -EIO;
+	}
+}
+
+static void *queue_main(void *arg)
+{
+	struct f2fs_dev_queue *q = arg;
+	struct f2fs_dev_io *io = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while(1) {
+		while(q->head == NULL && !q->stop) {
+			pthread_cond_wait(&q->more, &q->lock);
+		}
+		if(q->head == NULL) {
+			break;
+		}
+
+		io = q->head;
+		q->head = io->next;
+		if(q->head == NULL) {
+			q->tail = &q->head;
+		}
+		pthread_mutex_unlock(&q->lock);
+
+		do_io(q->super, io);
+
+		pthread_mutex_lock(&q->lock);
+		io->done = 1;
+		pthread_cond_broadcast(&q->done);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/* one queue and thread per member */
+int f2fs_dev_start(struct f2fs_super *super)
+{
+	struct f2fs_dev_queue *q = NULL;
+	int i = 0, ret = 0;
+
+	for(i=0; i<super->ndevs; i++) {
+		if(super->devs[i].queue != NULL) {
+			continue;
+		}
+
+		q = f2fs_malloc(sizeof(struct f2fs_dev_queue));
+		if(q == NULL) {
+			perror("f2fs_malloc");
+			ret = -ENOMEM;
+			goto stop;
+		}
+		memset(q, 0, sizeof(struct f2fs_dev_queue));
+		q->super = super;
+		q->tail = &q->head;
+		pthread_mutex_init(&q->lock, NULL);
+		pthread_cond_init(&q->more, NULL);
+		pthread_cond_init(&q->done, NULL);
+
+		ret = pthread_create(&q->thread, NULL, queue_main, q);
+		if(ret != 0) {
+			ret = -ret;
+			f2fs_free(q);
+			goto stop;
+		}
+		super->devs[i].queue = q;
+	}
+	return 0;
+
+stop:
+	f2fs_dev_stop(super);
+	return ret;
+}
+
+/* what was submitted is served first */
+void f2fs_dev_stop(struct f2fs_super *super)
+{
+	struct f2fs_dev_queue *q = NULL;
+	int i = 0;
+
+	for(i=0; i<super->ndevs; i++) {
+		q = super->devs[i].queue;
+		if(q == NULL) {
+			continue;
+		}
+
+		pthread_mutex_lock(&q->lock);
+		q->stop = 1;
+		pthread_cond_signal(&q->more);
+		pthread_mutex_unlock(&q->lock);
+		pthread_join(q->thread, NULL);
+
+		pthread_mutex_destroy(&q->lock);
+		pthread_cond_destroy(&q->more);
+		pthread_cond_destroy(&q->done);
+		f2fs_free(q);
+		super->devs[i].queue = NULL;
+	}
+}
+
+/* without a queue the read is done right away */
+void f2fs_dev_submit(struct f2fs_super *super, struct f2fs_dev_io *io)
+{
+	block_t devblk = 0;
+	struct f2fs_dev *dev = f2fs_dev_map(super, io->blkaddr, &devblk);
+	struct f2fs_dev_queue *q = dev->queue;
+
+	io->next = NULL;
+	io->done = 0;
+	io->queue = q;
+	if(q == NULL) {
+		do_io(super, io);
+		io->done = 1;
+		return;
+	}
+
+	pthread_mutex_lock(&q->lock);
+	*q->tail = io;
+	q->tail = &io->next;
+	pthread_cond_signal(&q->more);
+	pthread_mutex_unlock(&q->lock);
+}
+
+int f2fs_dev_wait(struct f2fs_dev_io *io)
+{
+	struct f2fs_dev_queue *q = io->queue;
+
+	if(q != NULL) {
+		pthread_mutex_lock(&q->lock);
+		while(!io->done) {
+			pthread_cond_wait(&q->done, &q->lock);
+		}
+		pthread_mutex_unlock(&q->lock);
+	}
+	return io->ret;
+}
@@ -0,0 +1,85 @@
+#ifndef __DEV_H__
+#define __DEV_H__
+
+#include "f2fs.h"
+
+/*
+ * The members of a multi device volume, as listed in the super block's
+ * devs[]. A block address of the volume goes to the member holding it,
+ * at its offset from the start of that member. A volume of one device is
+ * just devpath.
+ *
+ * devpath may be a comma separated list, its entries replace the member
+ * paths of the super block in order.
+ *
+ * For scans each member can get an I/O queue with a thread of its own:
+ * f2fs_dev_start() them, f2fs_dev_submit() reads to the member they fall
+ * on and f2fs_dev_wait() for each before using the buffer.
+ */
+struct f2fs_dev_io {
+	struct f2fs_dev_io *next;
+	block_t blkaddr;		/* of the volume */
+	unsigned int nr;		/* blocks, all on one member */
+	void *buf;
+	int ret;			/* nr, or -errno */
+	int done;
+	struct f2fs_dev_queue *queue;
+};
+
+int f2fs_open_device(struct f2fs_super *super, int flags);
+int f2fs_open_devices(struct f2fs_super *super, int flags);
+void f2fs_close_devices(struct f2fs_super *super);
+
+/* the main area segments lo..hi-1 are on member dev */
+void f2fs_dev_segments(struct f2fs_super *super, int dev, unsigned int *lo,
+		unsigned int *hi);
+
+int f2fs_read_blocks(struct f2fs_super *super, void *buf, block_t blkaddr, int nr);
+int f2fs_write_blocksv(struct f2fs_super *super, struct iovec *iov, int nr,
+		block_t blkaddr);
+
+int f2fs_dev_start(struct f2fs_super *super);
+void f2fs_dev_stop(struct f2fs_super *super);
+void f2fs_dev_submit(struct f2fs_super *super, struct f2fs_dev_io *io);
+int f2fs_dev_wait(struct f2fs_dev_io *io);
+
+/* the member blkaddr is on, *devblk is where on it */
+static inline struct f2fs_dev *f2fs_dev_map(struct f2fs_super *super,
+		block_t blkaddr, block_t *devblk)
+{
+	int i = 0;
+
+	for(i=0; i<super->ndevs-1 && blkaddr > super->devs[i].end_blk; i++);
+	*devblk = blkaddr - super->devs[i].start_blk;
+	return &super->devs[i];
+}
+
+/* how many of nr blocks from blkaddr are on dev, the member of blkaddr */
+static inline block_t f2fs_dev_run(struct f2fs_dev *dev, block_t blkaddr,
+		block_t nr)
+{
+	if(nr - 1 > dev->end_blk - blkaddr) {
+		return dev->end_blk - blkaddr + 1;
+	}
+	return nr;
+}
+
+static inline int f2fs_read_block(struct f2fs_super *super, struct page *page,
+		block_t blkaddr)
+{
+	block_t devblk = 0;
+	struct f2fs_dev *dev = f2fs_dev_map(super, blkaddr, &devblk);
+
+	return read_page(page, dev->fd, devblk);
+}
+
+static inline int f2fs_write_block(struct f2fs_super *super, struct page *page,
+		block_t blkaddr)
+{
+	block_t devblk = 0;
+	struct f2fs_dev *dev = f2fs_dev_map(super, blkaddr, &devblk);
+
+	return write_page(page, dev->fd, devblk);
+}
+
+#endif /*__DEV_H__*/
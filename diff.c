@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "segment.h"
+#include "dir.h"
+#include "diff.h"
+
+/*
+ * Everything that changes on disk is reached through the nat, and every
+ * block that is written or freed shows up in the sit. So comparing those
+ * two tables is enough to find the changed inodes, and through the changed
+ * dirs the changed names, without walking the tree.
+ */
+
+struct nat_change {
+	nid_t nid;
+	nid_t ino;
+	block_t old_blkaddr, new_blkaddr;
+};
+
+struct diff_dentry {
+	nid_t ino;
+	int len;
+	char name[F2FS_NAME_LEN];
+};
+
+struct dentry_set {
+	struct diff_dentry *entries;
+	unsigned int nr, max;
+};
+
+struct diff_ctx {
+	struct f2fs_super *old, *new;
+	int same_image;
+	struct nat_change *changes;
+	unsigned int nr_changes, max_changes;
+	struct diff_stat *stat;
+};
+
+/* grow an array of size bytes entries to hold at least nr + 1 */
+static int grow_array(void **array, unsigned int *max, unsigned int nr, size_t size)
+{
+	unsigned int new_max = *max ? *max * 2 : 64;
+	void *new = NULL;
+
+	if(nr < *max) {
+		return 0;
+	}
+
+	new = f2fs_malloc(new_max * size);
+	if(new == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	if(*array != NULL) {
+		memcpy(new, *array, nr * size);
+		f2fs_free(*array);
+	}
+	*array = new;
+	*max = new_max;
+	return 0;
+}
+
+static int add_nat_change(struct diff_ctx *ctx, nid_t nid, nid_t old_ino,
+		block_t old_blkaddr, nid_t new_ino, block_t new_blkaddr)
+{
+	struct nat_change *c = NULL;
+	int ret = 0;
+
+	if(old_ino == new_ino && old_blkaddr == new_blkaddr) {
+		return 0;
+	}
+
+	ret = grow_array((void **)&ctx->changes, &ctx->max_changes, ctx->nr_changes,
+		sizeof(struct nat_change));
+	if(ret < 0) {
+		return ret;
+	}
+
+	c = &ctx->changes[ctx->nr_changes++];
+	c->nid = nid;
+	c->ino = new_blkaddr != NULL_ADDR ? new_ino : old_ino;
+	c->old_blkaddr = old_blkaddr;
+	c->new_blkaddr = new_blkaddr;
+	ctx->stat->nids++;
+	return 0;
+}
+
+static int in_nat_journal(struct f2fs_super *super, nid_t nid)
+{
+	struct f2fs_journal *journal = NAT_JOURNAL(super);
+	int i = 0;
+
+	for(i=0; i<nats_in_cursum(journal); i++) {
+		if(le32_to_cpu(journal->nat_j.entries[i].nid) == nid) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int in_sit_journal(struct f2fs_super *super, unsigned int segno)
+{
+	struct f2fs_journal *journal = SIT_JOURNAL(super);
+	int i = 0;
+
+	for(i=0; i<sits_in_cursum(journal); i++) {
+		if(le32_to_cpu(journal->sit_j.entries[i].segno) == segno) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int diff_nat_blocks(struct diff_ctx *ctx, unsigned int index,
+		struct page *old_page, struct page *new_page)
+{
+	struct f2fs_nat_entry *old_ne = NULL, *new_ne = NULL;
+	nid_t nid = 0;
+	int i = 0, ret = 0;
+
+	for(i=0; i<NAT_ENTRY_PER_BLOCK; i++) {
+		nid = index * NAT_ENTRY_PER_BLOCK + i;
+		old_ne = &((struct f2fs_nat_block *)page_address(old_page))->entries[i];
+		new_ne = &((struct f2fs_nat_block *)page_address(new_page))->entries[i];
+
+		/* the journals overrule the blocks, they are compared below */
+		if(in_nat_journal(ctx->old, nid) || in_nat_journal(ctx->new, nid)) {
+			continue;
+		}
+
+		ret = add_nat_change(ctx, nid, le32_to_cpu(old_ne->ino),
+			le32_to_cpu(old_ne->block_addr), le32_to_cpu(new_ne->ino),
+			le32_to_cpu(new_ne->block_addr));
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int diff_nat_journal(struct diff_ctx *ctx, struct f2fs_super *super)
+{
+	struct f2fs_journal *journal = NAT_JOURNAL(super);
+	struct node_info old_ni, new_ni;
+	nid_t nid = 0;
+	int i = 0, ret = 0;
+
+	for(i=0; i<nats_in_cursum(journal); i++) {
+		nid = le32_to_cpu(journal->nat_j.entries[i].nid);
+		if(super == ctx->new && in_nat_journal(ctx->old, nid)) {
+			continue;
+		}
+
+		ret = f2fs_get_node_info(ctx->old, nid, &old_ni);
+		if(ret == 0) {
+			ret = f2fs_get_node_info(ctx->new, nid, &new_ni);
+		}
+		if(ret == 0) {
+			ret = add_nat_change(ctx, nid, old_ni.ino, old_ni.blk_addr,
+				new_ni.ino, new_ni.blk_addr);
+		}
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int diff_nat(struct diff_ctx *ctx)
+{
+	struct page *old_page = NULL, *new_page = NULL;
+	block_t old_addr = 0, new_addr = 0;
+	unsigned int index = 0;
+	int ret = 0;
+
+	old_page = alloc_page();
+	new_page = alloc_page();
+	if(old_page == NULL || new_page == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for(index=0; index<ctx->new->nat_blocks; index++) {
+		old_addr = current_nat_addr(ctx->old, index * NAT_ENTRY_PER_BLOCK);
+		new_addr = current_nat_addr(ctx->new, index * NAT_ENTRY_PER_BLOCK);
+		if(ctx->same_image && old_addr == new_addr) {
+			continue;
+		}
+
+		if(f2fs_nat_block_state(ctx->old, index) == NAT_BLOCK_EMPTY &&
+				f2fs_nat_block_state(ctx->new, index) == NAT_BLOCK_EMPTY) {
+			continue;
+		}
+		ctx->stat->nat_blocks++;
+
+		ret = read_page(old_page, ctx->old->fd, old_addr);
+		if(ret >= 0) {
+			ret = read_page(new_page, ctx->new->fd, new_addr);
+		}
+		if(ret < 0) {
+			perror("read page");
+			goto out;
+		}
+		ctx->stat->nat_reads += 2;
+
+		ret = diff_nat_blocks(ctx, index, old_page, new_page);
+		if(ret < 0) {
+			goto out;
+		}
+	}
+
+	ret = diff_nat_journal(ctx, ctx->old);
+	if(ret == 0) {
+		ret = diff_nat_journal(ctx, ctx->new);
+	}
+out:
+	if(old_page != NULL) {
+		free_page(old_page);
+	}
+	if(new_page != NULL) {
+		free_page(new_page);
+	}
+	return ret;
+}
+
+static int nat_change_cmp(const void *a, const void *b)
+{
+	const struct nat_change *x = a, *y = b;
+
+	if(x->ino != y->ino) {
+		return x->ino < y->ino ? -1 : 1;
+	}
+	if(x->nid != y->nid) {
+		return x->nid < y->nid ? -1 : 1;
+	}
+	return 0;
+}
+
+static int add_dentry(void *arg, const char *name, int len, nid_t ino,
+		unsigned char file_type)
+{
+	struct dentry_set *set = arg;
+	struct diff_dentry *de = NULL;
+
+	if(grow_array((void **)&set->entries, &set->max, set->nr,
+			sizeof(struct diff_dentry)) < 0) {
+		return 1;
+	}
+
+	de = &set->entries[set->nr++];
+	de->ino = ino;
+	de->len = len;
+	memcpy(de->name, name, len);
+	return 0;
+}
+
+static int dentry_cmp(const void *a, const void *b)
+{
+	const struct diff_dentry *x = a, *y = b;
+	int ret = memcmp(x->name, y->name, x->len < y->len ? x->len : y->len);
+
+	if(ret != 0) {
+		return ret;
+	}
+	return x->len - y->len;
+}
+
+/* the names of a dir in one state, sorted; a missing dir or a file has none */
+static int read_dentries(struct f2fs_super *super, struct page *dir_page,
+		struct dentry_set *set)
+{
+	int ret = 0;
+
+	if(dir_page == NULL || !S_ISDIR(le16_to_cpu(F2FS_NODE(dir_page)->i.i_mode))) {
+		return 0;
+	}
+
+	ret = f2fs_readdir(super, dir_page, add_dentry, set);
+	if(ret < 0 || set->nr == 0) {
+		return ret;
+	}
+	qsort(set->entries, set->nr, sizeof(struct diff_dentry), dentry_cmp);
+	return 0;
+}
+
+static void print_dentry(char op, nid_t dir, struct diff_dentry *de)
+{
+	printf("%c dentry %u/%.*s -> %u\n", op, dir, de->len, de->name, de->ino);
+}
+
+static int diff_dentries(struct diff_ctx *ctx, nid_t dir, struct page *old_page,
+		struct page *new_page)
+{
+	struct dentry_set old_set, new_set;
+	struct diff_dentry *o = NULL, *n = NULL;
+	unsigned int i = 0, j = 0;
+	int ret = 0, cmp = 0;
+
+	memset(&old_set, 0, sizeof(old_set));
+	memset(&new_set, 0, sizeof(new_set));
+
+	ret = read_dentries(ctx->old, old_page, &old_set);
+	if(ret == 0) {
+		ret = read_dentries(ctx->new, new_page, &new_set);
+	}
+	if(ret < 0) {
+		goto out;
+	}
+
+	while(i < old_set.nr || j < new_set.nr) {
+		o = i < old_set.nr ? &old_set.entries[i] : NULL;
+		n = j < new_set.nr ? &new_set.entries[j] : NULL;
+		cmp = o == NULL ? 1 : n == NULL ? -1 : dentry_cmp(o, n);
+
+		if(cmp == 0 && o->ino == n->ino) {
+			i++;
+			j++;
+			continue;
+		}
+
+		/* a name pointing elsewhere is a removal and an addition */
+		if(cmp <= 0) {
+			print_dentry('-', dir, o);
+			ctx->stat->dentries++;
+			i++;
+		}
+		if(cmp >= 0) {
+			print_dentry('+', dir, n);
+			ctx->stat->dentries++;
+			j++;
+		}
+	}
+out:
+	if(old_set.entries != NULL) {
+		f2fs_free(old_set.entries);
+	}
+	if(new_set.entries != NULL) {
+		f2fs_free(new_set.entries);
+	}
+	return ret;
+}
+
+/* a private copy of the inode block, NULL when the inode is not there */
+static struct page *read_inode_page(struct f2fs_super *super, nid_t ino)
+{
+	struct page *page = alloc_page();
+
+	if(page == NULL) {
+		return NULL;
+	}
+
+	if(f2fs_read_node_block(super, ino, page) < 0 || !IS_INODE(page)) {
+		free_page(page);
+		return NULL;
+	}
+	return page;
+}
+
+static int report_inode(struct diff_ctx *ctx, struct nat_change *first,
+		unsigned int nr)
+{
+	struct page *old_page = NULL, *new_page = NULL, *page = NULL;
+	struct f2fs_raw_inode *ri = NULL;
+	nid_t ino = first->ino;
+	char op = 'M';
+	unsigned int i = 0;
+	int ret = 0, len = 0;
+
+	for(i=0; i<nr; i++) {
+		if(first[i].nid != ino) {
+			continue;
+		}
+		if(first[i].old_blkaddr == NULL_ADDR) {
+			op = 'A';
+		} else if(first[i].new_blkaddr == NULL_ADDR) {
+			op = 'D';
+		}
+	}
+
+	if(op != 'A') {
+		old_page = read_inode_page(ctx->old, ino);
+	}
+	if(op != 'D') {
+		new_page = read_inode_page(ctx->new, ino);
+	}
+
+	ctx->stat->inodes++;
+	page = new_page != NULL ? new_page : old_page;
+	if(page == NULL) {
+		printf("%c ino %u nodes:%u\n", op, ino, nr);
+		return 0;
+	}
+
+	ri = &F2FS_NODE(page)->i;
+	len = le32_to_cpu(ri->i_namelen);
+	if(len > F2FS_NAME_LEN) {
+		len = F2FS_NAME_LEN;
+	}
+	printf("%c ino %u %.*s nodes:%u\n", op, ino, len, ri->i_name, nr);
+
+	/* the ino may have been a file on one side and a dir on the other */
+	if(S_ISDIR(le16_to_cpu(ri->i_mode)) || (old_page != NULL &&
+			S_ISDIR(le16_to_cpu(F2FS_NODE(old_page)->i.i_mode)))) {
+		ret = diff_dentries(ctx, ino, old_page, new_page);
+	}
+
+	if(old_page != NULL) {
+		free_page(old_page);
+	}
+	if(new_page != NULL) {
+		free_page(new_page);
+	}
+	return ret;
+}
+
+static int report_inodes(struct diff_ctx *ctx)
+{
+	unsigned int i = 0, j = 0;
+	int ret = 0;
+
+	if(ctx->nr_changes == 0) {
+		return 0;
+	}
+
+	qsort(ctx->changes, ctx->nr_changes, sizeof(struct nat_change), nat_change_cmp);
+	for(i=0; i<ctx->nr_changes; i=j) {
+		for(j=i; j<ctx->nr_changes && ctx->changes[j].ino == ctx->changes[i].ino; j++);
+
+		ret = report_inode(ctx, &ctx->changes[i], j - i);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static void print_range(struct diff_ctx *ctx, char op, block_t start, block_t end)
+{
+	printf("%c blocks %llu-%llu\n", op, (unsigned long long)start,
+		(unsigned long long)end);
+	ctx->stat->ranges++;
+}
+
+/* runs of blocks that became valid or were freed inside one segment */
+static void diff_segment(struct diff_ctx *ctx, unsigned int segno,
+		struct f2fs_sit_entry *old_se, struct f2fs_sit_entry *new_se)
+{
+	block_t start = le32_to_cpu(ctx->new->raw_super->main_blkaddr) +
+		((block_t)segno << le32_to_cpu(ctx->new->raw_super->log_blocks_per_seg));
+	unsigned int nr = blocks_per_seg(ctx->new), off = 0, run = 0;
+	int old_bit = 0, new_bit = 0, state = 0, cur = 0;
+
+	if(!memcmp(old_se->valid_map, new_se->valid_map, SIT_VBLOCK_MAP_SIZE)) {
+		return;
+	}
+	ctx->stat->segments++;
+
+	for(off=0; off<=nr; off++) {
+		cur = 0;
+		if(off < nr) {
+			old_bit = f2fs_test_bit(off, (char *)old_se->valid_map);
+			new_bit = f2fs_test_bit(off, (char *)new_se->valid_map);
+			if(!old_bit && new_bit) {
+				cur = '+';
+			} else if(old_bit && !new_bit) {
+				cur = '-';
+			}
+		}
+
+		if(cur == state) {
+			continue;
+		}
+
+		if(state != 0) {
+			print_range(ctx, state, start + run, start + off - 1);
+		}
+		state = cur;
+		run = off;
+	}
+}
+
+/* the sit entry of segno in one state, the journal first */
+static int get_sit_entry(struct f2fs_super *super, unsigned int segno,
+		struct f2fs_sit_entry *se, struct page *page)
+{
+	struct f2fs_journal *journal = SIT_JOURNAL(super);
+	int i = 0, ret = 0;
+
+	for(i=0; i<sits_in_cursum(journal); i++) {
+		if(le32_to_cpu(journal->sit_j.entries[i].segno) == segno) {
+			*se = journal->sit_j.entries[i].se;
+			return 0;
+		}
+	}
+
+	ret = read_page(page, super->fd, f2fs_current_sit_addr(super, segno));
+	if(ret < 0) {
+		perror("read page");
+		return ret;
+	}
+	*se = ((struct f2fs_sit_block *)page_address(page))->entries[segno % SIT_ENTRY_PER_BLOCK];
+	return 0;
+}
+
+static int diff_sit_journal(struct diff_ctx *ctx, struct f2fs_super *super,
+		struct page *page)
+{
+	struct f2fs_journal *journal = SIT_JOURNAL(super);
+	struct f2fs_sit_entry old_se, new_se;
+	unsigned int segno = 0;
+	int i = 0, ret = 0;
+
+	for(i=0; i<sits_in_cursum(journal); i++) {
+		segno = le32_to_cpu(journal->sit_j.entries[i].segno);
+		if(super == ctx->new && in_sit_journal(ctx->old, segno)) {
+			continue;
+		}
+
+		ret = get_sit_entry(ctx->old, segno, &old_se, page);
+		if(ret == 0) {
+			ret = get_sit_entry(ctx->new, segno, &new_se, page);
+		}
+		if(ret < 0) {
+			return ret;
+		}
+		diff_segment(ctx, segno, &old_se, &new_se);
+	}
+	return 0;
+}
+
+static int diff_sit(struct diff_ctx *ctx)
+{
+	unsigned int main_segments = le32_to_cpu(ctx->new->raw_super->segment_count_main);
+	unsigned int sit_blks = (main_segments + SIT_ENTRY_PER_BLOCK - 1) / SIT_ENTRY_PER_BLOCK;
+	struct page *old_page = NULL, *new_page = NULL;
+	struct f2fs_sit_block *old_blk = NULL, *new_blk = NULL;
+	block_t old_addr = 0, new_addr = 0;
+	unsigned int index = 0, segno = 0, i = 0;
+	int ret = 0;
+
+	old_page = alloc_page();
+	new_page = alloc_page();
+	if(old_page == NULL || new_page == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	old_blk = page_address(old_page);
+	new_blk = page_address(new_page);
+
+	for(index=0; index<sit_blks; index++) {
+		old_addr = f2fs_current_sit_addr(ctx->old, index * SIT_ENTRY_PER_BLOCK);
+		new_addr = f2fs_current_sit_addr(ctx->new, index * SIT_ENTRY_PER_BLOCK);
+		if(ctx->same_image && old_addr == new_addr) {
+			continue;
+		}
+		ctx->stat->sit_blocks++;
+
+		ret = read_page(old_page, ctx->old->fd, old_addr);
+		if(ret >= 0) {
+			ret = read_page(new_page, ctx->new->fd, new_addr);
+		}
+		if(ret < 0) {
+			perror("read page");
+			goto out;
+		}
+		ctx->stat->sit_reads += 2;
+
+		for(i=0; i<SIT_ENTRY_PER_BLOCK; i++) {
+			segno = index * SIT_ENTRY_PER_BLOCK + i;
+			if(segno >= main_segments) {
+				break;
+			}
+
+			if(in_sit_journal(ctx->old, segno) || in_sit_journal(ctx->new, segno)) {
+				continue;
+			}
+			diff_segment(ctx, segno, &old_blk->entries[i], &new_blk->entries[i]);
+		}
+	}
+
+	ret = diff_sit_journal(ctx, ctx->old, old_page);
+	if(ret == 0) {
+		ret = diff_sit_journal(ctx, ctx->new, old_page);
+	}
+out:
+	if(old_page != NULL) {
+		free_page(old_page);
+	}
+	if(new_page != NULL) {
+		free_page(new_page);
+	}
+	return ret;
+}
+
+/* two images only compare when they are copies of one filesystem */
+static int check_same_fs(struct f2fs_super *old, struct f2fs_super *new)
+{
+	struct f2fs_super_block *a = old->raw_super, *b = new->raw_super;
+
+	if(memcmp(a->uuid, b->uuid, sizeof(a->uuid)) ||
+			a->segment_count_main != b->segment_count_main ||
+			a->main_blkaddr != b->main_blkaddr ||
+			old->nat_blocks != new->nat_blocks) {
+		printf("Error: the images are not copies of one filesystem\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int f2fs_diff(struct f2fs_super *old, struct f2fs_super *new, int same_image,
+		struct diff_stat *stat)
+{
+	struct diff_ctx ctx;
+	int ret = 0;
+
+	memset(stat, 0, sizeof(struct diff_stat));
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.old = old;
+	ctx.new = new;
+	ctx.same_image = same_image;
+	ctx.stat = stat;
+
+	ret = check_same_fs(old, new);
+	if(ret < 0) {
+		return ret;
+	}
+
+	/* both journals of both sides */
+	ret = f2fs_load(old, F2FS_LAZY_ALL);
+	if(ret == 0) {
+		ret = f2fs_load(new, F2FS_LAZY_ALL);
+	}
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = diff_nat(&ctx);
+	if(ret == 0) {
+		ret = report_inodes(&ctx);
+	}
+	if(ret == 0) {
+		ret = diff_sit(&ctx);
+	}
+
+	if(ctx.changes != NULL) {
+		f2fs_free(ctx.changes);
+	}
+	return ret;
+}
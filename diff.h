@@ -0,0 +1,26 @@
+#ifndef __DIFF_H__
+#define __DIFF_H__
+
+#include "f2fs.h"
+
+struct diff_stat {
+	unsigned int nat_blocks;	/* nat blocks either side might differ in */
+	unsigned int nat_reads;		/* nat blocks read */
+	unsigned int sit_blocks;
+	unsigned int sit_reads;
+	unsigned int nids;		/* nat entries that changed */
+	unsigned int inodes;		/* inodes they belong to */
+	unsigned int dentries;		/* names added or removed */
+	unsigned int segments;		/* sit entries that changed */
+	unsigned int ranges;		/* block ranges validated or freed */
+};
+
+/*
+ * Print what changed from old to new. With same_image both are checkpoints
+ * of one image, so a nat or sit block whose version bit did not flip is
+ * known to be unchanged and is not read at all.
+ */
+int f2fs_diff(struct f2fs_super *old, struct f2fs_super *new, int same_image,
+		struct diff_stat *stat);
+
+#endif /*__DIFF_H__*/
@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "data.h"
+#include "dir.h"
+#include "dcache.h"
+#include "trace.h"
+
+#define TEA_DELTA		0x9E3779B9
+
+static void TEA_transform(unsigned int buf[4], unsigned int const in[])
+{
+	unsigned int sum = 0;
+	unsigned int b0 = buf[0], b1 = buf[1];
+	unsigned int a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += TEA_DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while(--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+static void str2hashbuf(const unsigned char *msg, int len, unsigned int *buf,
+		int num)
+{
+	unsigned int pad = 0, val = 0;
+	int i = 0;
+
+	pad = (unsigned int)len | ((unsigned int)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if(len > num * 4) {
+		len = num * 4;
+	}
+
+	for(i=0; i<len; i++) {
+		if((i % 4) == 0) {
+			val = pad;
+		}
+		val = msg[i] + (val << 8);
+		if((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+
+	if(--num >= 0) {
+		*buf++ = val;
+	}
+	while(--num >= 0) {
+		*buf++ = pad;
+	}
+}
+
+f2fs_hash_t f2fs_dentry_hash(const char *name, int len)
+{
+	const unsigned char *p = (const unsigned char *)name;
+	unsigned int in[8], buf[4];
+
+	if(is_dot_dotdot(name, len)) {
+		return F2FS_DOT_HASH;
+	}
+
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	while(1) {
+		str2hashbuf(p, len, in, 4);
+		TEA_transform(buf, in);
+		p += 16;
+		if(len <= 16) {
+			break;
+		}
+		len -= 16;
+	}
+	return cpu_to_le32(buf[0] & ~F2FS_HASH_COL_BIT);
+}
+
+/* the cached dentry block for modifying commands, a private copy otherwise */
+static int get_dentry_block(struct f2fs_super *super, struct page *dir_page,
+		unsigned long bidx, struct page **page)
+{
+	int ret = 0;
+
+	if(DM_I(super) != NULL) {
+		return f2fs_get_data_page(super, dir_page, bidx, 0, page);
+	}
+
+	*page = alloc_page();
+	if(*page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	ret = f2fs_read_data_block(super, dir_page, bidx, *page);
+	if(ret < 0) {
+		free_page(*page);
+		*page = NULL;
+	}
+	return ret;
+}
+
+static void put_dentry_block(struct f2fs_super *super, struct page *page)
+{
+	if(DM_I(super) == NULL && page != NULL) {
+		free_page(page);
+	}
+}
+
+static int find_target_dentry(struct f2fs_dentry_ptr *d, f2fs_hash_t hash,
+		const char *name, int len)
+{
+	struct f2fs_dir_entry *de = NULL;
+	int bit_pos = 0;
+
+	while(bit_pos < d->max) {
+		if(!test_bit_le(bit_pos, d->bitmap)) {
+			bit_pos++;
+			continue;
+		}
+
+		de = &d->dentry[bit_pos];
+		if(de->name_len == 0) {
+			bit_pos++;
+			continue;
+		}
+
+		if(le32_to_cpu(de->hash_code) == hash &&
+				le16_to_cpu(de->name_len) == len &&
+				!memcmp(d->filename[bit_pos], name, len)) {
+			return bit_pos;
+		}
+		bit_pos += GET_DENTRY_SLOTS(le16_to_cpu(de->name_len));
+	}
+	return -ENOENT;
+}
+
+/*
+ * Locate a name. For block dentries *page holds the dentry block, which the
+ * caller puts; for inline dentries it is NULL and d points into dir_page.
+ */
+static int lookup_dentry(struct f2fs_super *super, struct page *dir_page,
+		const char *name, int len, struct page **page, unsigned long *bidx,
+		struct f2fs_dentry_ptr *d)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(dir_page)->i;
+	f2fs_hash_t hash = f2fs_dentry_hash(name, len);
+	unsigned int level = 0, depth = le32_to_cpu(ri->i_current_depth);
+	unsigned long start = 0, block = 0;
+	int nbucket = 0, nblock = 0, bit_pos = 0, ret = 0;
+
+	*page = NULL;
+	if(f2fs_has_inline_dentry(ri)) {
+		make_dentry_ptr_inline(super->raw_super, d, ri);
+		return find_target_dentry(d, hash, name, len);
+	}
+
+	for(level=0; level<depth; level++) {
+		nbucket = dir_buckets(level, ri->i_dir_level);
+		nblock = bucket_blocks(level);
+		start = dir_block_index(level, ri->i_dir_level,
+			le32_to_cpu(hash) % nbucket);
+
+		for(block=start; block<start+nblock; block++) {
+			ret = get_dentry_block(super, dir_page, block, page);
+			if(ret == -ENOENT) {
+				continue;
+			}
+			if(ret < 0) {
+				return ret;
+			}
+
+			make_dentry_ptr_block(d, page_address(*page));
+			bit_pos = find_target_dentry(d, hash, name, len);
+			if(bit_pos >= 0) {
+				*bidx = block;
+				return bit_pos;
+			}
+			put_dentry_block(super, *page);
+			*page = NULL;
+		}
+	}
+	return -ENOENT;
+}
+
+int f2fs_find_entry(struct f2fs_super *super, struct page *dir_page,
+		const char *name, int len, struct f2fs_dir_entry *de)
+{
+	struct f2fs_dentry_ptr d;
+	struct page *page = NULL;
+	unsigned long bidx = 0;
+	int bit_pos = 0;
+
+	bit_pos = lookup_dentry(super, dir_page, name, len, &page, &bidx, &d);
+	if(bit_pos < 0) {
+		return bit_pos;
+	}
+
+	*de = d.dentry[bit_pos];
+	put_dentry_block(super, page);
+	return 0;
+}
+
+int f2fs_room_for_filename(const char *bitmap, int slots, int max)
+{
+	int zero_start = 0, zero_end = 0;
+
+	while(zero_start < max) {
+		if(test_bit_le(zero_start, bitmap)) {
+			zero_start++;
+			continue;
+		}
+
+		for(zero_end=zero_start; zero_end<max; zero_end++) {
+			if(test_bit_le(zero_end, bitmap)) {
+				break;
+			}
+		}
+
+		if(zero_end - zero_start >= slots) {
+			return zero_start;
+		}
+		zero_start = zero_end + 1;
+	}
+	return max;
+}
+
+void f2fs_update_dentry(struct f2fs_dentry_ptr *d, int bit_pos,
+		const char *name, int len, f2fs_hash_t hash, nid_t ino,
+		unsigned char file_type)
+{
+	struct f2fs_dir_entry *de = &d->dentry[bit_pos];
+	int slots = GET_DENTRY_SLOTS(len), i = 0;
+
+	de->hash_code = hash;
+	de->ino = cpu_to_le32(ino);
+	de->name_len = cpu_to_le16(len);
+	de->file_type = file_type;
+	memcpy(d->filename[bit_pos], name, len);
+
+	for(i=0; i<slots; i++) {
+		set_bit_le(bit_pos + i, d->bitmap);
+	}
+}
+
+/* inline dentries keep their slots when moved into block 0 */
+static int convert_inline_dir(struct f2fs_super *super, struct page *dir_page)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(dir_page)->i;
+	struct f2fs_dentry_ptr src, dst;
+	struct page *tmp = NULL, *page = NULL;
+	nid_t ino = ino_of_node(dir_page);
+	int ret = 0;
+
+	tmp = alloc_page();
+	if(tmp == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+	memset(page_address(tmp), 0, F2FS_PAGE_SIZE);
+
+	make_dentry_ptr_inline(super->raw_super, &src, ri);
+	make_dentry_ptr_block(&dst, page_address(tmp));
+	memcpy(dst.bitmap, src.bitmap, src.nr_bitmap);
+	memcpy(dst.dentry, src.dentry, SIZE_OF_DIR_ENTRY * src.max);
+	memcpy(dst.filename, src.filename, F2FS_SLOT_LEN * src.max);
+
+	memset(inline_data_addr(ri), 0, MAX_INLINE_DATA(super->raw_super, ri));
+	ri->i_inline &= ~F2FS_INLINE_DENTRY;
+
+	ret = f2fs_get_data_page(super, dir_page, 0, 1, &page);
+	if(ret < 0) {
+		goto out;
+	}
+	memcpy(page_address(page), page_address(tmp), F2FS_PAGE_SIZE);
+	f2fs_mark_data_dirty(super, ino, 0);
+
+	if(le64_to_cpu(ri->i_size) < F2FS_BLKSIZE) {
+		ri->i_size = cpu_to_le64(F2FS_BLKSIZE);
+	}
+	if(le32_to_cpu(ri->i_current_depth) == 0) {
+		ri->i_current_depth = cpu_to_le32(1);
+	}
+	f2fs_mark_node_dirty(super, dir_page);
+
+out:
+	free_page(tmp);
+	return ret;
+}
+
+int f2fs_add_link(struct f2fs_super *super, struct page *dir_page,
+		const char *name, int len, nid_t ino, unsigned char file_type)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(dir_page)->i;
+	f2fs_hash_t hash = f2fs_dentry_hash(name, len);
+	int slots = GET_DENTRY_SLOTS(len);
+	unsigned int level = 0, depth = 0;
+	unsigned long start = 0, block = 0;
+	int nbucket = 0, nblock = 0, bit_pos = 0, ret = 0;
+	struct f2fs_dentry_ptr d;
+	struct page *page = NULL;
+
+	if(f2fs_has_inline_dentry(ri)) {
+		make_dentry_ptr_inline(super->raw_super, &d, ri);
+		bit_pos = f2fs_room_for_filename(d.bitmap, slots, d.max);
+		if(bit_pos < d.max) {
+			f2fs_update_dentry(&d, bit_pos, name, len, hash, ino, file_type);
+			f2fs_mark_node_dirty(super, dir_page);
+			f2fs_dcache_update(super, ino_of_node(dir_page), name, len, ino);
+			return 0;
+		}
+
+		ret = convert_inline_dir(super, dir_page);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	depth = le32_to_cpu(ri->i_current_depth);
+	for(level=0; ; level++) {
+		if(depth == MAX_DIR_HASH_DEPTH) {
+			return -ENOSPC;
+		}
+
+		if(level == depth) {
+			depth++;
+		}
+
+		nbucket = dir_buckets(level, ri->i_dir_level);
+		nblock = bucket_blocks(level);
+		start = dir_block_index(level, ri->i_dir_level,
+			le32_to_cpu(hash) % nbucket);
+
+		for(block=start; block<start+nblock; block++) {
+			ret = f2fs_get_data_page(super, dir_page, block, 1, &page);
+			if(ret < 0) {
+				return ret;
+			}
+
+			make_dentry_ptr_block(&d, page_address(page));
+			bit_pos = f2fs_room_for_filename(d.bitmap, slots, NR_DENTRY_IN_BLOCK);
+			if(bit_pos < NR_DENTRY_IN_BLOCK) {
+				goto add_dentry;
+			}
+		}
+	}
+
+add_dentry:
+	f2fs_update_dentry(&d, bit_pos, name, len, hash, ino, file_type);
+	f2fs_mark_data_dirty(super, ino_of_node(dir_page), block);
+
+	if(le64_to_cpu(ri->i_size) < (block + 1) * F2FS_BLKSIZE) {
+		ri->i_size = cpu_to_le64((block + 1) * F2FS_BLKSIZE);
+	}
+	ri->i_current_depth = cpu_to_le32(depth);
+	f2fs_mark_node_dirty(super, dir_page);
+	f2fs_dcache_update(super, ino_of_node(dir_page), name, len, ino);
+	return 0;
+}
+
+int f2fs_delete_entry(struct f2fs_super *super, struct page *dir_page,
+		const char *name, int len)
+{
+	struct f2fs_dentry_ptr d;
+	struct page *page = NULL;
+	unsigned long bidx = 0;
+	int bit_pos = 0, slots = 0, i = 0;
+
+	bit_pos = lookup_dentry(super, dir_page, name, len, &page, &bidx, &d);
+	if(bit_pos < 0) {
+		return bit_pos;
+	}
+
+	slots = GET_DENTRY_SLOTS(le16_to_cpu(d.dentry[bit_pos].name_len));
+	for(i=0; i<slots; i++) {
+		clear_bit_le(bit_pos + i, d.bitmap);
+	}
+
+	if(page != NULL) {
+		f2fs_mark_data_dirty(super, ino_of_node(dir_page), bidx);
+	} else {
+		f2fs_mark_node_dirty(super, dir_page);
+	}
+	f2fs_dcache_update(super, ino_of_node(dir_page), name, len, 0);
+	return 0;
+}
+
+/* a new dir starts inline with only the dot entries */
+void f2fs_make_empty_dir(struct f2fs_super_block *raw_super, struct page *page,
+		nid_t ino, nid_t pino)
+{
+	struct f2fs_dentry_ptr d;
+
+	make_dentry_ptr_inline(raw_super, &d, &F2FS_NODE(page)->i);
+	f2fs_update_dentry(&d, 0, ".", 1, F2FS_DOT_HASH, ino, F2FS_FT_DIR);
+	f2fs_update_dentry(&d, 1, "..", 2, F2FS_DDOT_HASH, pino, F2FS_FT_DIR);
+}
+
+static int first_used_slot(struct f2fs_dentry_ptr *d, int start)
+{
+	int bit_pos = 0;
+
+	for(bit_pos=start; bit_pos<d->max; bit_pos++) {
+		if(test_bit_le(bit_pos, d->bitmap)) {
+			return bit_pos;
+		}
+	}
+	return d->max;
+}
+
+int f2fs_empty_dir(struct f2fs_super *super, struct page *dir_page)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(dir_page)->i;
+	unsigned long bidx = 0, nblocks = 0;
+	struct f2fs_dentry_ptr d;
+	struct page *page = NULL;
+	int ret = 0, empty = 1;
+
+	if(f2fs_has_inline_dentry(ri)) {
+		make_dentry_ptr_inline(super->raw_super, &d, ri);
+		return first_used_slot(&d, 2) == d.max;
+	}
+
+	nblocks = (le64_to_cpu(ri->i_size) + F2FS_BLKSIZE - 1) / F2FS_BLKSIZE;
+	for(bidx=0; bidx<nblocks && empty; bidx++) {
+		ret = get_dentry_block(super, dir_page, bidx, &page);
+		if(ret == -ENOENT) {
+			continue;
+		}
+		if(ret < 0) {
+			return ret;
+		}
+
+		/* the dot entries live in the first two slots of block 0 */
+		make_dentry_ptr_block(&d, page_address(page));
+		empty = first_used_slot(&d, bidx == 0 ? 2 : 0) == d.max;
+		put_dentry_block(super, page);
+	}
+	return empty;
+}
+
+static int emit_dentries(struct f2fs_dentry_ptr *d, filldir_t filldir, void *arg)
+{
+	struct f2fs_dir_entry *de = NULL;
+	int bit_pos = 0, len = 0, ret = 0;
+
+	while(bit_pos < d->max) {
+		if(!test_bit_le(bit_pos, d->bitmap)) {
+			bit_pos++;
+			continue;
+		}
+
+		de = &d->dentry[bit_pos];
+		len = le16_to_cpu(de->name_len);
+		if(len == 0) {
+			bit_pos++;
+			continue;
+		}
+
+		if(!is_dot_dotdot((char *)d->filename[bit_pos], len)) {
+			ret = filldir(arg, (char *)d->filename[bit_pos], len,
+				le32_to_cpu(de->ino), de->file_type);
+			if(ret != 0) {
+				return ret;
+			}
+		}
+		bit_pos += GET_DENTRY_SLOTS(len);
+	}
+	return 0;
+}
+
+/* hand every entry but . and .. to filldir, a nonzero return ends the walk */
+static int __f2fs_readdir(struct f2fs_super *super, struct page *dir_page,
+		filldir_t filldir, void *arg)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(dir_page)->i;
+	unsigned long bidx = 0, nblocks = 0;
+	struct f2fs_dentry_ptr d;
+	struct page *page = NULL;
+	int ret = 0;
+
+	if(f2fs_has_inline_dentry(ri)) {
+		make_dentry_ptr_inline(super->raw_super, &d, ri);
+		return emit_dentries(&d, filldir, arg);
+	}
+
+	nblocks = (le64_to_cpu(ri->i_size) + F2FS_BLKSIZE - 1) / F2FS_BLKSIZE;
+	for(bidx=0; bidx<nblocks; bidx++) {
+		ret = get_dentry_block(super, dir_page, bidx, &page);
+		if(ret == -ENOENT) {
+			continue;
+		}
+		if(ret < 0) {
+			return ret;
+		}
+
+		make_dentry_ptr_block(&d, page_address(page));
+		ret = emit_dentries(&d, filldir, arg);
+		put_dentry_block(super, page);
+		if(ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int f2fs_readdir(struct f2fs_super *super, struct page *dir_page,
+		filldir_t filldir, void *arg)
+{
+	F2FS_TRACE_SCOPE("readdir", "ino", ino_of_node(dir_page));
+	int op = f2fs_stat_enter(F2FS_OP_READDIR);
+	int ret = __f2fs_readdir(super, dir_page, filldir, arg);
+
+	f2fs_stat_leave(op);
+	return ret;
+}
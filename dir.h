@@ -0,0 +1,124 @@
+#ifndef __DIR_H__
+#define __DIR_H__
+
+#include <sys/stat.h>
+#include "f2fs.h"
+
+/* one view over inline and block dentries */
+struct f2fs_dentry_ptr {
+	int max;
+	int nr_bitmap;
+	char *bitmap;
+	struct f2fs_dir_entry *dentry;
+	__u8 (*filename)[F2FS_SLOT_LEN];
+};
+
+static inline void make_dentry_ptr_block(struct f2fs_dentry_ptr *d,
+		struct f2fs_dentry_block *blk)
+{
+	d->max = NR_DENTRY_IN_BLOCK;
+	d->nr_bitmap = SIZE_OF_DENTRY_BITMAP;
+	d->bitmap = (char *)blk->dentry_bitmap;
+	d->dentry = blk->dentry;
+	d->filename = blk->filename;
+}
+
+static inline void make_dentry_ptr_inline(struct f2fs_super_block *raw_super,
+		struct f2fs_dentry_ptr *d, struct f2fs_raw_inode *ri)
+{
+	char *addr = inline_data_addr(ri);
+	int entry_cnt = NR_INLINE_DENTRY(raw_super, ri);
+	int bitmap_size = INLINE_DENTRY_BITMAP_SIZE(raw_super, ri);
+	int reserved_size = INLINE_RESERVED_SIZE(raw_super, ri);
+
+	d->max = entry_cnt;
+	d->nr_bitmap = bitmap_size;
+	d->bitmap = addr;
+	d->dentry = (void *)(addr + bitmap_size + reserved_size);
+	d->filename = (void *)(addr + bitmap_size + reserved_size +
+		SIZE_OF_DIR_ENTRY * entry_cnt);
+}
+
+static inline int f2fs_has_inline_dentry(struct f2fs_raw_inode *ri)
+{
+	return ri->i_inline & F2FS_INLINE_DENTRY;
+}
+
+static inline unsigned char f2fs_file_type(unsigned int mode)
+{
+	switch(mode & S_IFMT) {
+	case S_IFREG:
+		return F2FS_FT_REG_FILE;
+	case S_IFDIR:
+		return F2FS_FT_DIR;
+	case S_IFCHR:
+		return F2FS_FT_CHRDEV;
+	case S_IFBLK:
+		return F2FS_FT_BLKDEV;
+	case S_IFIFO:
+		return F2FS_FT_FIFO;
+	case S_IFSOCK:
+		return F2FS_FT_SOCK;
+	case S_IFLNK:
+		return F2FS_FT_SYMLINK;
+	}
+	return F2FS_FT_UNKNOWN;
+}
+
+static inline int is_dot_dotdot(const char *name, int len)
+{
+	if(len == 1 && name[0] == '.') {
+		return 1;
+	}
+	return len == 2 && name[0] == '.' && name[1] == '.';
+}
+
+static inline unsigned int dir_buckets(unsigned int level, int dir_level)
+{
+	if(level + dir_level < MAX_DIR_HASH_DEPTH / 2) {
+		return 1 << (level + dir_level);
+	}
+	return MAX_DIR_BUCKETS;
+}
+
+static inline unsigned int bucket_blocks(unsigned int level)
+{
+	if(level < MAX_DIR_HASH_DEPTH / 2) {
+		return 2;
+	}
+	return 4;
+}
+
+static inline unsigned long dir_block_index(unsigned int level, int dir_level,
+		unsigned int idx)
+{
+	unsigned long bidx = 0;
+	unsigned int i = 0;
+
+	for(i=0; i<level; i++) {
+		bidx += dir_buckets(i, dir_level) * bucket_blocks(i);
+	}
+	return bidx + idx * bucket_blocks(level);
+}
+
+typedef int (*filldir_t)(void *arg, const char *name, int len, nid_t ino,
+		unsigned char file_type);
+
+f2fs_hash_t f2fs_dentry_hash(const char *name, int len);
+int f2fs_room_for_filename(const char *bitmap, int slots, int max);
+void f2fs_update_dentry(struct f2fs_dentry_ptr *d, int bit_pos,
+		const char *name, int len, f2fs_hash_t hash, nid_t ino,
+		unsigned char file_type);
+int f2fs_find_entry(struct f2fs_super *super, struct page *dir_page,
+		const char *name, int len, struct f2fs_dir_entry *de);
+int f2fs_add_link(struct f2fs_super *super, struct page *dir_page,
+		const char *name, int len, nid_t ino, unsigned char file_type);
+int f2fs_delete_entry(struct f2fs_super *super, struct page *dir_page,
+		const char *name, int len);
+void f2fs_make_empty_dir(struct f2fs_super_block *raw_super, struct page *page,
+		nid_t ino, nid_t pino);
+int f2fs_empty_dir(struct f2fs_super *super, struct page *dir_page);
+int f2fs_readdir(struct f2fs_super *super, struct page *dir_page,
+		filldir_t filldir, void *arg);
+
+#endif /*__DIR_H__*/
@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "segment.h"
+#include "export.h"
+#include "dev.h"
+
+struct export_extent {
+	block_t start;
+	block_t len;
+};
+
+struct export_map {
+	struct export_extent *extents;
+	unsigned int nr, max;
+};
+
+/* blocks are added in ascending order, touching ones join the last extent */
+static int add_extent(struct export_map *map, block_t start, block_t len)
+{
+	struct export_extent *new = NULL, *last = NULL;
+	unsigned int max = 0;
+
+	if(map->nr > 0) {
+		last = &map->extents[map->nr - 1];
+		if(last->start + last->len == start) {
+			last->len += len;
+			return 0;
+		}
+	}
+
+	if(map->nr == map->max) {
+		max = map->max ? map->max * 2 : 256;
+		new = f2fs_malloc(max * sizeof(struct export_extent));
+		if(new == NULL) {
+			perror("f2fs_malloc");
+			return -ENOMEM;
+		}
+		if(map->extents != NULL) {
+			memcpy(new, map->extents, map->nr * sizeof(struct export_extent));
+			f2fs_free(map->extents);
+		}
+		map->extents = new;
+		map->max = max;
+	}
+
+	map->extents[map->nr].start = start;
+	map->extents[map->nr].len = len;
+	map->nr++;
+	return 0;
+}
+
+/* first block of segno past the checkpoint when it is an open log, else -1 */
+static int open_segment_blkoff(struct f2fs_super *super, unsigned int segno)
+{
+	int type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(curseg_segno(super, type) == segno) {
+			return curseg_blkoff(super, type);
+		}
+	}
+	return -1;
+}
+
+static int build_export_map(struct f2fs_super *super, struct export_map *map)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct seg_entry *se = NULL;
+	unsigned int segno = 0, off = 0;
+	block_t base = 0;
+	int open_off = 0, ret = 0;
+
+	/* super blocks, checkpoints, sit, nat and ssa */
+	ret = add_extent(map, 0, sm->main_blkaddr);
+	if(ret < 0) {
+		return ret;
+	}
+
+	for(segno=0; segno<sm->main_segments; segno++) {
+		se = get_seg_entry(super, segno);
+		open_off = open_segment_blkoff(super, segno);
+		if(se->valid_blocks == 0 && open_off < 0) {
+			continue;
+		}
+
+		base = START_BLOCK(super, segno);
+		for(off=0; off<blocks_per_seg(super); off++) {
+			if(!f2fs_test_bit(off, (char *)se->cur_valid_map) &&
+					(open_off < 0 || off < (unsigned int)open_off)) {
+				continue;
+			}
+
+			ret = add_extent(map, base + off, 1);
+			if(ret < 0) {
+				return ret;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * copy_file_range lets the kernel or the file system move the data, and
+ * reflinks it where it can. Anything it refuses falls back to large reads
+ * and writes through buf.
+ */
+static int copy_extent(int in, int out, off_t in_off, off_t out_off, size_t len,
+		char *buf, int *use_copy_range)
+{
+	loff_t src = in_off, dst = out_off;
+	struct timespec start;
+	size_t chunk = 0;
+	ssize_t n = 0;
+
+	while(len > 0) {
+		if(*use_copy_range) {
+			n = copy_file_range(in, &src, out, &dst, len, 0);
+			if(n > 0) {
+				len -= n;
+				continue;
+			}
+			if(n == 0) {
+				return -EIO;
+			}
+			if(errno != EXDEV && errno != ENOSYS && errno != EINVAL &&
+					errno != EOPNOTSUPP) {
+				perror("copy_file_range");
+				return -errno;
+			}
+			*use_copy_range = 0;
+		}
+
+		chunk = len < EXPORT_IO_BLOCKS * F2FS_PAGE_SIZE ? len :
+			EXPORT_IO_BLOCKS * F2FS_PAGE_SIZE;
+		f2fs_stat_read_start(&start);
+		n = pread(in, buf, chunk, src);
+		f2fs_stat_read_end(&start, n);
+		if(n <= 0) {
+			perror("pread");
+			return -EIO;
+		}
+		if(pwrite(out, buf, n, dst) != n) {
+			perror("pwrite");
+			return -EIO;
+		}
+		src += n;
+		dst += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_blkmap_header(struct f2fs_super *super, int out,
+		struct export_map *map)
+{
+	struct f2fs_blkmap_header header;
+	struct f2fs_blkmap_extent *extents = NULL;
+	size_t size = map->nr * sizeof(struct f2fs_blkmap_extent);
+	unsigned int i = 0;
+	int ret = 0;
+
+	header.magic = cpu_to_le32(F2FS_BLKMAP_MAGIC);
+	header.version = cpu_to_le32(F2FS_BLKMAP_VERSION);
+	header.block_count = super->raw_super->block_count;
+	header.nr_extents = cpu_to_le64(map->nr);
+
+	extents = f2fs_malloc(size);
+	if(extents == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	for(i=0; i<map->nr; i++) {
+		extents[i].start = cpu_to_le64(map->extents[i].start);
+		extents[i].len = cpu_to_le64(map->extents[i].len);
+	}
+
+	if(pwrite(out, &header, sizeof(header), 0) != sizeof(header) ||
+			pwrite(out, extents, size, sizeof(header)) != (ssize_t)size) {
+		perror("pwrite");
+		ret = -EIO;
+	}
+	f2fs_free(extents);
+	return ret;
+}
+
+/* an extent of a multi device volume is copied from each member it spans */
+static int copy_volume_extent(struct f2fs_super *super, int out,
+		struct export_extent *e, off_t out_off, char *buf, int *use_copy_range)
+{
+	struct f2fs_dev *dev = NULL;
+	block_t devblk = 0, done = 0, run = 0;
+	int ret = 0;
+
+	for(done=0; done<e->len; done+=run) {
+		dev = f2fs_dev_map(super, e->start + done, &devblk);
+		run = f2fs_dev_run(dev, e->start + done, e->len - done);
+		ret = copy_extent(dev->fd, out, (off_t)devblk * F2FS_PAGE_SIZE,
+			out_off + (off_t)done * F2FS_PAGE_SIZE, (size_t)run * F2FS_PAGE_SIZE,
+			buf, use_copy_range);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int f2fs_export(struct f2fs_super *super, const char *path, int blkmap,
+		struct export_stat *stat)
+{
+	struct export_map map;
+	struct export_extent *e = NULL;
+	off_t out_off = 0;
+	char *buf = NULL;
+	unsigned int i = 0;
+	int out = -1, use_copy_range = 1, ret = 0;
+
+	memset(stat, 0, sizeof(struct export_stat));
+	memset(&map, 0, sizeof(map));
+
+	ret = build_export_map(super, &map);
+	if(ret < 0) {
+		goto out;
+	}
+
+	buf = f2fs_malloc(EXPORT_IO_BLOCKS * F2FS_PAGE_SIZE);
+	if(buf == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* a fresh file, so whatever is not copied below stays a hole */
+	out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(out < 0) {
+		perror("open");
+		ret = -errno;
+		goto out;
+	}
+
+	if(blkmap) {
+		ret = write_blkmap_header(super, out, &map);
+		out_off = sizeof(struct f2fs_blkmap_header) +
+			map.nr * sizeof(struct f2fs_blkmap_extent);
+	} else if(ftruncate(out, (off_t)le64_to_cpu(super->raw_super->block_count) *
+			F2FS_PAGE_SIZE) < 0) {
+		perror("ftruncate");
+		ret = -errno;
+	}
+	if(ret < 0) {
+		goto out;
+	}
+
+	for(i=0; i<map.nr; i++) {
+		e = &map.extents[i];
+		if(!blkmap) {
+			out_off = (off_t)e->start * F2FS_PAGE_SIZE;
+		}
+
+		ret = copy_volume_extent(super, out, e, out_off, buf, &use_copy_range);
+		if(ret < 0) {
+			goto out;
+		}
+
+		out_off += (off_t)e->len * F2FS_PAGE_SIZE;
+		stat->blocks += e->len;
+		stat->copy_range += use_copy_range;
+	}
+	stat->extents = map.nr;
+
+out:
+	if(out >= 0 && close(out) < 0 && ret == 0) {
+		perror("close");
+		ret = -EIO;
+	}
+	if(buf != NULL) {
+		f2fs_free(buf);
+	}
+	if(map.extents != NULL) {
+		f2fs_free(map.extents);
+	}
+	return ret;
+}
@@ -0,0 +1,43 @@
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include "f2fs.h"
+
+/* blocks moved by one read/write when copy_file_range can not be used */
+#define EXPORT_IO_BLOCKS	256
+
+/*
+ * Block map format, all little endian: the header, nr_extents extents and
+ * then the blocks of every extent in that order. Blocks outside of all
+ * extents read as zeros.
+ */
+#define F2FS_BLKMAP_MAGIC	0x4d423246	/* "F2BM" */
+#define F2FS_BLKMAP_VERSION	1
+
+struct f2fs_blkmap_header {
+	__le32 magic;
+	__le32 version;
+	__le64 block_count;		/* blocks of the whole image */
+	__le64 nr_extents;
+} __packed;
+
+struct f2fs_blkmap_extent {
+	__le64 start;
+	__le64 len;
+} __packed;
+
+struct export_stat {
+	block_t blocks;			/* blocks copied */
+	unsigned int extents;
+	unsigned int copy_range;	/* extents moved by copy_file_range */
+};
+
+/*
+ * Copy the metadata areas and every valid main area block, plus the open
+ * segments past the checkpoint so fsync'd data survives. The copy is a
+ * sparse image, or a block map with blkmap set. Needs the segment manager.
+ */
+int f2fs_export(struct f2fs_super *super, const char *path, int blkmap,
+		struct export_stat *stat);
+
+#endif /*__EXPORT_H__*/
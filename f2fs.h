@@ -1,35 +1,131 @@
 #ifndef __F2FS_H__
 #define __F2FS_H__
 #include <errno.h>
+#include <pthread.h>
 #include "f2fs_type.h"
 #include "f2fs_fs.h"
 #include "page.h"
+#include "crc32.h"
 
 #define F2FS_SUPER_MAGIC        0xF2F52010
 
+/*
+ * nat_bits lives in the last blocks of the cp segment: the checksum is
+ * followed by the full and the empty bitmaps, one bit per nat block.
+ */
 struct f2fs_nat_bitmap {
 	__le64 cp_checksum;
 	char bitmap[1];
-} __pack;
+} __packed;
 
 struct f2fs_inode {
 	inode_t ino;
 	int count;
-	struct f2fs_nat_block *nat_block;
 	struct f2fs_raw_inode *raw_inode;
 };
 
-struct f2fs_super {
+enum {
+	CURSEG_HOT_DATA = 0,
+	CURSEG_WARM_DATA,
+	CURSEG_COLD_DATA,
+	CURSEG_HOT_NODE,
+	CURSEG_WARM_NODE,
+	CURSEG_COLD_NODE,
+	NR_CURSEG_TYPE,
+};
+
+/* allocation type of a current segment */
+enum {
+	LFS = 0,
+	SSR,
+};
+
+#define NR_CURSEG_DATA_TYPE	3
+#define NR_CURSEG_NODE_TYPE	3
+
+struct f2fs_nm_info;
+struct f2fs_sm_info;
+struct f2fs_dm_info;
+struct f2fs_dev_queue;
+
+/*
+ * A member of the volume. Blocks start_blk..end_blk of the volume are
+ * blocks 0.. of the device, the metadata is all on the first one.
+ */
+struct f2fs_dev {
+	char *path;
 	int fd;
+	block_t start_blk, end_blk;
+	struct f2fs_dev_queue *queue;	/* while f2fs_dev_start() runs it */
+};
+
+struct f2fs_super {
+	const char *devpath;
+	int fd;				/* of devs[0] */
+	struct f2fs_dev devs[MAX_DEVICES];
+	int ndevs;
+
+	/* F2FS_LAZY_* parts not loaded yet, see f2fs_load() */
+	unsigned int lazy;
+	pthread_mutex_t lazy_lock;
+
 	int cp_ver;
 	block_t nat_blocks;
 	struct f2fs_super_block *raw_super;
 	struct f2fs_checkpoint *raw_cp;
+	/* fs clock: cp elapsed_time and the monotonic secs it was read at */
+	unsigned long long elapsed_time, mounted_time;
 	struct f2fs_nat_bitmap *nat_bits;
+	char *full_nat_bits, *empty_nat_bits;
 	char *nat_bitmap;
+	struct f2fs_summary_block *sum_blk[NR_CURSEG_TYPE];
 	struct f2fs_inode *root;
+
+	/* sorted orphan inode numbers of the checkpoint */
+	nid_t *orphans;
+	unsigned int nr_orphans;
+
+	/* only built for modifying commands */
+	struct f2fs_nm_info *nm_info;
+	struct f2fs_sm_info *sm_info;
+	struct f2fs_dm_info *dm_info;
+
+	/* only built for library handles */
+	struct f2fs_node_cache *nc_info;
+
+	/* name and path lookups, kept while mounted */
+	struct f2fs_dentry_cache *dc_info;
 };
 
+#define NAT_JOURNAL(super)	(&(super)->sum_blk[CURSEG_HOT_DATA]->journal)
+#define SIT_JOURNAL(super)	(&(super)->sum_blk[CURSEG_COLD_DATA]->journal)
+
+/*
+ * Parts of the checkpoint a lazy mount reads on first use: the summary of
+ * each current segment (which carry the nat and sit journals), nat_bits
+ * and the orphan list. A plain mount loads them all up front.
+ */
+#define F2FS_LAZY_SUM(type)	(1U << (type))
+#define F2FS_LAZY_SUMS		((1U << NR_CURSEG_TYPE) - 1)
+#define F2FS_LAZY_DATA_SUMS	((1U << NR_CURSEG_DATA_TYPE) - 1)
+#define F2FS_LAZY_NAT_BITS	(1U << NR_CURSEG_TYPE)
+#define F2FS_LAZY_ORPHANS	(1U << (NR_CURSEG_TYPE + 1))
+#define F2FS_LAZY_ALL		(F2FS_LAZY_SUMS | F2FS_LAZY_NAT_BITS | F2FS_LAZY_ORPHANS)
+
+/* the nat journal lives in the hot data summary */
+#define F2FS_LAZY_NAT		(F2FS_LAZY_SUM(CURSEG_HOT_DATA) | F2FS_LAZY_NAT_BITS)
+
+int __f2fs_load(struct f2fs_super *super, unsigned int parts);
+
+/* make sure parts are loaded, each is read once */
+static inline int f2fs_load(struct f2fs_super *super, unsigned int parts)
+{
+	if(!(__atomic_load_n(&super->lazy, __ATOMIC_ACQUIRE) & parts)) {
+		return 0;
+	}
+	return __f2fs_load(super, parts);
+}
+
 #define F2FS_FEATURE_ENCRYPT            0x0001
 #define F2FS_FEATURE_BLKZONED           0x0002
 #define F2FS_FEATURE_ATOMIC_WRITE       0x0004
@@ -51,36 +147,177 @@ static inline int is_set_ckpt_flags(struct f2fs_checkpoint *cp, unsigned long fl
 	return !!(le32_to_cpu(cp->ckpt_flags) & flags);
 }
 
+/* version bitmaps in the cp are big-endian within a byte */
+static inline int f2fs_test_bit(unsigned int nr, const char *addr)
+{
+	return !!(addr[nr >> 3] & (1 << (7 - (nr & 7))));
+}
+
+static inline void f2fs_set_bit(unsigned int nr, char *addr)
+{
+	addr[nr >> 3] |= 1 << (7 - (nr & 7));
+}
+
+static inline void f2fs_clear_bit(unsigned int nr, char *addr)
+{
+	addr[nr >> 3] &= ~(1 << (7 - (nr & 7)));
+}
+
+static inline void f2fs_change_bit(unsigned int nr, char *addr)
+{
+	addr[nr >> 3] ^= 1 << (7 - (nr & 7));
+}
+
+/* nat_bits and dentry bitmaps are little-endian within a byte */
+static inline int test_bit_le(unsigned int nr, const char *addr)
+{
+	return !!(addr[nr >> 3] & (1 << (nr & 7)));
+}
+
+/* on-disk checksums are a raw crc32 seeded with the magic, not inverted */
+static inline void set_bit_le(unsigned int nr, char *addr)
+{
+	addr[nr >> 3] |= 1 << (nr & 7);
+}
+
+static inline void clear_bit_le(unsigned int nr, char *addr)
+{
+	addr[nr >> 3] &= ~(1 << (nr & 7));
+}
+
+static inline unsigned int f2fs_cal_crc32(unsigned int crc, const void *buf, int len)
+{
+	return crc32_update(buf, len, crc);
+}
+
+static inline unsigned long long cur_cp_version(struct f2fs_checkpoint *cp)
+{
+	return le64_to_cpu(cp->checkpoint_ver);
+}
+
+static inline unsigned int cur_cp_crc(struct f2fs_checkpoint *cp)
+{
+	size_t crc_offset = le32_to_cpu(cp->checksum_offset);
+
+	return le32_to_cpu(*((__le32 *)((unsigned char *)cp + crc_offset)));
+}
+
+/* the value nat_bits carries to prove it belongs to this checkpoint */
+static inline unsigned long long cur_cp_checksum(struct f2fs_checkpoint *cp)
+{
+	return (unsigned long long)cur_cp_crc(cp) << 32 |
+		(unsigned int)cur_cp_version(cp);
+}
+
+static inline block_t blocks_per_seg(struct f2fs_super *super)
+{
+	return (block_t)1 << le32_to_cpu(super->raw_super->log_blocks_per_seg);
+}
+
 static inline block_t __start_cp_addr(struct f2fs_super *super)
 {
 	block_t blkaddr = le32_to_cpu(super->raw_super->cp_blkaddr);
 
 	if(super->cp_ver) {
-		blkaddr += le32_to_cpu(super->raw_super->log_blocks_per_seg);
+		blkaddr += blocks_per_seg(super);
 	}
 	return blkaddr;
 }
 
+/* nat_bits blocks at the end of the cp segment */
+static inline unsigned int nat_bits_blocks(struct f2fs_super *super)
+{
+	return F2FS_BLK_ALIGN((super->nat_blocks / BITS_PER_BYTE << 1) + 8);
+}
+
+static inline int cp_crc_valid(struct f2fs_checkpoint *cp)
+{
+	size_t crc_offset = le32_to_cpu(cp->checksum_offset);
+
+	if(crc_offset < CP_MIN_CHKSUM_OFFSET ||
+			crc_offset > F2FS_BLKSIZE - sizeof(__le32)) {
+		return 0;
+	}
+	return f2fs_cal_crc32(F2FS_SUPER_MAGIC, cp, crc_offset) == cur_cp_crc(cp);
+}
+
 static inline block_t start_sum_block(struct f2fs_super *super)
 {
 	return __start_cp_addr(super) +
 		le32_to_cpu(super->raw_cp->cp_pack_start_sum);
 }
 
+static inline block_t sum_blk_addr(struct f2fs_super *super, int base, int type)
+{
+	return __start_cp_addr(super) +
+		le32_to_cpu(super->raw_cp->cp_pack_total_block_count) -
+		(base + 1) + type;
+}
+
+static inline unsigned int curseg_segno(struct f2fs_super *super, int type)
+{
+	if(type < CURSEG_HOT_NODE) {
+		return le32_to_cpu(super->raw_cp->cur_data_segno[type]);
+	}
+	return le32_to_cpu(super->raw_cp->cur_node_segno[type - CURSEG_HOT_NODE]);
+}
+
+static inline unsigned short curseg_blkoff(struct f2fs_super *super, int type)
+{
+	if(type < CURSEG_HOT_NODE) {
+		return le16_to_cpu(super->raw_cp->cur_data_blkoff[type]);
+	}
+	return le16_to_cpu(super->raw_cp->cur_node_blkoff[type - CURSEG_HOT_NODE]);
+}
+
+static inline int nats_in_cursum(struct f2fs_journal *journal)
+{
+	return le16_to_cpu(journal->n_nats);
+}
+
+static inline int sits_in_cursum(struct f2fs_journal *journal)
+{
+	return le16_to_cpu(journal->n_sits);
+}
+
 static inline int get_extra_isize(struct f2fs_raw_inode *raw_inode)
 {
+	if(!(raw_inode->i_inline & F2FS_EXTRA_ATTR)) {
+		return 0;
+	}
 	return le16_to_cpu(raw_inode->i_extra_isize) / sizeof(__le32);
 }
 
-static inline int get_inline_xattr_addrs(struct f2fs_raw_inode *raw_inode)
+/*
+ * With flexible_inline_xattr every inode with extra attrs records the
+ * size it was created with, 0 included. Without the feature inline xattr
+ * and dentry inodes have the default.
+ */
+static inline int get_inline_xattr_addrs(struct f2fs_super_block *raw_super,
+		struct f2fs_raw_inode *raw_inode)
 {
-	if(raw_inode->i_inline && F2FS_INLINE_XATTR ||
-		raw_inode->i_inline && F2FS_INLINE_XATTR) {
+	if(F2FS_HAS_FEATURE(raw_super, F2FS_FEATURE_FLEXIBLE_INLINE_XATTR) &&
+			(raw_inode->i_inline & F2FS_EXTRA_ATTR)) {
+		return le16_to_cpu(raw_inode->i_inline_xattr_size);
+	}
+	if(raw_inode->i_inline & (F2FS_INLINE_XATTR | F2FS_INLINE_DENTRY)) {
 		return DEFAULT_INLINE_XATTR_ADDRS;
 	}
 	return 0;
 }
 
+static inline int addrs_per_inode(struct f2fs_super_block *raw_super,
+		struct f2fs_raw_inode *raw_inode)
+{
+	return CUR_ADDRS_PER_INODE(raw_inode) -
+		get_inline_xattr_addrs(raw_super, raw_inode);
+}
+
+static inline int addrs_per_block(struct f2fs_raw_inode *raw_inode)
+{
+	return DEF_ADDRS_PER_BLOCK;
+}
+
 #define DEF_INLINE_RESERVED_SIZE        1
 static inline void *inline_data_addr(struct f2fs_raw_inode *raw_inode)
 {
@@ -90,22 +327,22 @@ static inline void *inline_data_addr(struct f2fs_raw_inode *raw_inode)
 }
 
 /* for inline stuff */
-#define MAX_INLINE_DATA(inode)  (sizeof(__le32) *                       \
+#define MAX_INLINE_DATA(sb, inode)  (sizeof(__le32) *                   \
 				(CUR_ADDRS_PER_INODE(inode) -           \
-				get_inline_xattr_addrs(inode) - \
+				get_inline_xattr_addrs(sb, inode) - \
 				DEF_INLINE_RESERVED_SIZE))
 
 /* for inline dir */
-#define NR_INLINE_DENTRY(inode) (MAX_INLINE_DATA(inode) * BITS_PER_BYTE / \
+#define NR_INLINE_DENTRY(sb, inode) (MAX_INLINE_DATA(sb, inode) * BITS_PER_BYTE / \
 				((SIZE_OF_DIR_ENTRY + F2FS_SLOT_LEN) * \
 				BITS_PER_BYTE + 1))
 
-#define INLINE_DENTRY_BITMAP_SIZE(inode)        ((NR_INLINE_DENTRY(inode) + \
+#define INLINE_DENTRY_BITMAP_SIZE(sb, inode)    ((NR_INLINE_DENTRY(sb, inode) + \
 				BITS_PER_BYTE - 1) / BITS_PER_BYTE)
 
-#define INLINE_RESERVED_SIZE(inode)     (MAX_INLINE_DATA(inode) - \
+#define INLINE_RESERVED_SIZE(sb, inode) (MAX_INLINE_DATA(sb, inode) - \
 				((SIZE_OF_DIR_ENTRY + F2FS_SLOT_LEN) * \
-				NR_INLINE_DENTRY(inode) + \
-				INLINE_DENTRY_BITMAP_SIZE(inode)))
+				NR_INLINE_DENTRY(sb, inode) + \
+				INLINE_DENTRY_BITMAP_SIZE(sb, inode)))
 
 #endif /*__F2FS_H__*/
@@ -0,0 +1,44 @@
+#ifndef __F2FS_ENDIAN_H__
+#define __F2FS_ENDIAN_H__
+
+/*
+ * Byte order of the on-disk and wire formats. Kept apart from f2fs_type.h
+ * so that programs outside the library can use it without taking the
+ * counting malloc and free along.
+ */
+typedef unsigned short __le16;
+typedef unsigned int __le32;
+typedef unsigned long long __le64;
+
+/* LITTLE_ENDIAN */
+static inline unsigned short le16_to_cpu(__le16 le)
+{
+	return le;
+}
+
+static inline unsigned int le32_to_cpu(__le32 le)
+{
+	return le;
+}
+
+static inline unsigned long long le64_to_cpu(__le64 le)
+{
+	return le;
+}
+
+static inline __le16 cpu_to_le16(unsigned short val)
+{
+	return val;
+}
+
+static inline __le32 cpu_to_le32(unsigned int val)
+{
+	return val;
+}
+
+static inline __le64 cpu_to_le64(unsigned long long val)
+{
+	return val;
+}
+
+#endif /*__F2FS_ENDIAN_H__*/
@@ -200,13 +200,13 @@ struct f2fs_extent {
 #define CUR_ADDRS_PER_INODE(inode)	(DEF_ADDRS_PER_INODE - \
 					get_extra_isize(inode))
 #define DEF_NIDS_PER_INODE	5	/* Node IDs in an Inode */
-#define ADDRS_PER_INODE(inode)	addrs_per_inode(inode)
+#define ADDRS_PER_INODE(sb, inode)	addrs_per_inode(sb, inode)
 #define DEF_ADDRS_PER_BLOCK	1018	/* Address Pointers in a Direct Block */
 #define ADDRS_PER_BLOCK(inode)	addrs_per_block(inode)
 #define NIDS_PER_BLOCK		1018	/* Node IDs in an Indirect Block */
 
-#define ADDRS_PER_PAGE(page, inode)	\
-	(IS_INODE(page) ? ADDRS_PER_INODE(inode) : ADDRS_PER_BLOCK(inode))
+#define ADDRS_PER_PAGE(sb, page, inode)	\
+	(IS_INODE(page) ? ADDRS_PER_INODE(sb, inode) : ADDRS_PER_BLOCK(inode))
 
 #define	NODE_DIR1_BLOCK		(DEF_ADDRS_PER_INODE + 1)
 #define	NODE_DIR2_BLOCK		(DEF_ADDRS_PER_INODE + 2)
@@ -222,6 +222,11 @@ struct f2fs_extent {
 #define F2FS_EXTRA_ATTR		0x20	/* file having extra attribute */
 #define F2FS_PIN_FILE		0x40	/* file should not be gced */
 
+#define F2FS_COMPR_FL		0x00000004	/* i_flags: compressed file */
+
+#define FADVISE_COLD_BIT	0x01	/* i_advise: data goes to the cold log */
+#define FADVISE_HOT_BIT		0x20	/* i_advise: data goes to the hot log */
+
 struct f2fs_raw_inode {
 	__le16 i_mode;			/* file mode */
 	__u8 i_advise;			/* file hints */
@@ -305,6 +310,37 @@ struct f2fs_node {
 	struct node_footer footer;
 } __packed;
 
+/*
+ * For extended attributes, kept after the i_addr of the inode and in the
+ * node block of i_xattr_nid as one list: a header, then entries padded to
+ * 4 bytes, ended by a zero word.
+ */
+#define F2FS_XATTR_MAGIC		0xF2F52011
+#define VALID_XATTR_BLOCK_SIZE	(F2FS_BLKSIZE - sizeof(struct node_footer))
+
+#define F2FS_XATTR_INDEX_USER			1
+#define F2FS_XATTR_INDEX_POSIX_ACL_ACCESS	2
+#define F2FS_XATTR_INDEX_POSIX_ACL_DEFAULT	3
+#define F2FS_XATTR_INDEX_TRUSTED		4
+#define F2FS_XATTR_INDEX_LUSTRE			5
+#define F2FS_XATTR_INDEX_SECURITY		6
+#define F2FS_XATTR_INDEX_ADVISE			7
+#define F2FS_XATTR_INDEX_ENCRYPTION		9
+#define F2FS_XATTR_INDEX_VERITY			11
+
+struct f2fs_xattr_header {
+	__le32 h_magic;		/* magic number for identification */
+	__le32 h_refcount;	/* reference count */
+	__le32 h_reserved[4];	/* zero right now */
+} __packed;
+
+struct f2fs_xattr_entry {
+	__u8 e_name_index;
+	__u8 e_name_len;
+	__le16 e_value_size;	/* size of attribute value */
+	char e_name[0];		/* attribute name */
+} __packed;
+
 /*
  * For NAT entries
  */
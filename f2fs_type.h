@@ -1,13 +1,12 @@
 #ifndef __F2FS_TYPE_H__
 #define __F2FS_TYPE_H__
 #include <stdlib.h>
+#include "f2fs_endian.h"
 
 #define BITS_PER_BYTE 8
 typedef unsigned char __u8;
-typedef unsigned short __le16;
-typedef unsigned int __le32;
-typedef unsigned long long __le64;
 typedef unsigned long inode_t;
+typedef unsigned int nid_t;
 typedef unsigned long long block_t;
 
 #define __packed __attribute__((packed))
@@ -28,30 +27,31 @@ static inline void __BUG__()
 	__BUG__(); \
 } while(0);
 
+#ifndef offsetof
 #define offsetof(TYPE, MEMBER)  ((size_t)&((TYPE *)0)->MEMBER)
+#endif
 
-/* LITTLE_ENDIAN */
-static inline unsigned short le16_to_cpu(__le16 le)
-{
-	return le;
-}
+/*
+ * Allocations are counted against the library handle the calling thread
+ * works for, everything else goes to malloc_count.
+ */
+extern int malloc_count;
+extern __thread int *f2fs_malloc_counter;
 
-static inline unsigned int le32_to_cpu(__le32 le)
-{
-	return le;
-}
+/* the allocation hook of stats.c, kept out of line so this header needs none */
+void f2fs_stat_alloc(size_t size);
 
-static inline unsigned long long le64_to_cpu(__le64 le)
+static inline int *malloc_counter()
 {
-	return le;
+	return f2fs_malloc_counter != NULL ? f2fs_malloc_counter : &malloc_count;
 }
 
-extern int malloc_count;
 static inline void *f2fs_malloc(size_t size)
 {
 	void *ptr = malloc(size);
 	if(ptr != NULL) {
-		malloc_count++;
+		__sync_add_and_fetch(malloc_counter(), 1);
+		f2fs_stat_alloc(size);
 	}
 	return ptr;
 }
@@ -59,7 +59,7 @@ static inline void *f2fs_malloc(size_t size)
 static inline void f2fs_free(void *pt)
 {
 	if(pt != NULL) {
-		malloc_count--;
+		__sync_sub_and_fetch(malloc_counter(), 1);
 		free(pt);
 	}
 }
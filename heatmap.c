@@ -0,0 +1,636 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "super.h"
+#include "segment.h"
+#include "namei.h"
+#include "trace.h"
+#include "heatmap.h"
+#include "segwalk.h"
+
+#define HEAT_TABLE_MIN		1024
+/* an extension group whose files are of more than one class */
+#define HEAT_MIXED		-1
+/* the extension group of the dirs */
+#define HEAT_DIR_EXT		"<dir>"
+
+static const char *log_names[NR_CURSEG_TYPE] = {
+	"hot data", "warm data", "cold data", "hot node", "warm node", "cold node",
+};
+
+static const char *class_names[CURSEG_HOT_NODE] = {"hot", "warm", "cold"};
+
+static const unsigned long long age_bounds[HEATMAP_AGE_BUCKETS - 1] = {
+	86400, 7 * 86400, 30 * 86400, 90 * 86400,
+};
+
+/* the blocks of one inode, or of the files of one dir or extension */
+struct heat_file {
+	nid_t ino;
+	int used;
+	int class;			/* the CURSEG_*_DATA log its data belongs in */
+	char ext[HEATMAP_EXT_LEN];
+	unsigned int files;
+	unsigned long long blocks[NR_CURSEG_TYPE];
+	unsigned long long old;		/* data blocks in old segments */
+	unsigned long long misplaced;
+};
+
+/* open addressing on ino, or on ext for the extension groups */
+struct heat_table {
+	struct heat_file *files;
+	unsigned int nr, max;
+	int by_ext;
+};
+
+struct heat_ctx {
+	struct seg_walk walk;
+	struct f2fs_super *super;
+	unsigned long long now, age;
+	unsigned int segments;
+};
+
+struct heat_worker {
+	struct seg_walker walker;	/* first, for f2fs_seg_walk_run() */
+	struct heat_ctx *ctx;
+	struct page *sum_page;
+	struct heat_table table;
+	unsigned long long unowned;
+};
+
+static unsigned int table_slot(struct heat_table *table, nid_t ino, const char *ext)
+{
+	unsigned int i = ino * 0x9e3779b1U;
+	const char *c = NULL;
+
+	if(table->by_ext) {
+		for(i=2166136261U, c=ext; *c; c++) {
+			i = (i ^ (unsigned char)*c) * 16777619U;
+		}
+	}
+
+	for(i&=table->max-1; table->files[i].used; i=(i+1)&(table->max-1)) {
+		if(table->by_ext ? !strcmp(table->files[i].ext, ext) :
+				table->files[i].ino == ino) {
+			break;
+		}
+	}
+	return i;
+}
+
+static struct heat_file *table_get(struct heat_table *table, nid_t ino, const char *ext)
+{
+	struct heat_file *old = table->files;
+	unsigned int max = table->max, i = 0;
+
+	if((table->nr + 1) * 2 > table->max) {
+		table->max = max ? max * 2 : HEAT_TABLE_MIN;
+		table->files = f2fs_malloc(table->max * sizeof(struct heat_file));
+		if(table->files == NULL) {
+			perror("f2fs_malloc");
+			table->files = old;
+			table->max = max;
+			return NULL;
+		}
+		memset(table->files, 0, table->max * sizeof(struct heat_file));
+
+		for(i=0; i<max; i++) {
+			if(old[i].used) {
+				table->files[table_slot(table, old[i].ino, old[i].ext)] = old[i];
+			}
+		}
+		if(old != NULL) {
+			f2fs_free(old);
+		}
+	}
+
+	i = table_slot(table, ino, ext);
+	if(!table->files[i].used) {
+		table->files[i].used = 1;
+		table->files[i].ino = ino;
+		if(ext != NULL) {
+			snprintf(table->files[i].ext, HEATMAP_EXT_LEN, "%s", ext);
+		}
+		table->nr++;
+	}
+	return &table->files[i];
+}
+
+static void table_free(struct heat_table *table)
+{
+	if(table->files != NULL) {
+		f2fs_free(table->files);
+	}
+	memset(table, 0, sizeof(struct heat_table));
+}
+
+/* the kernel's test: the name ends in a dot and ext, any case */
+static int match_ext(const char *name, int len, const char *ext)
+{
+	int elen = strnlen(ext, F2FS_EXTENSION_LEN);
+
+	if(elen == 0 || len < elen + 2 || name[len - elen - 1] != '.') {
+		return 0;
+	}
+	return !strncasecmp(name + len - elen, ext, elen);
+}
+
+int f2fs_file_class(struct f2fs_super *super, struct f2fs_raw_inode *ri)
+{
+	struct f2fs_super_block *raw_super = super->raw_super;
+	int count = le32_to_cpu(raw_super->extension_count);
+	int hot = raw_super->hot_ext_count;
+	int len = le32_to_cpu(ri->i_namelen), i = 0;
+
+	if(S_ISDIR(le16_to_cpu(ri->i_mode))) {
+		return CURSEG_HOT_DATA;
+	}
+	/* the hints are set from the list at create, or by hand */
+	if(ri->i_advise & FADVISE_COLD_BIT) {
+		return CURSEG_COLD_DATA;
+	}
+	if(ri->i_advise & FADVISE_HOT_BIT) {
+		return CURSEG_HOT_DATA;
+	}
+
+	/* cold extensions come first, the last hot_ext_count are hot */
+	count = count < F2FS_MAX_EXTENSION ? count : F2FS_MAX_EXTENSION;
+	hot = hot < count ? hot : count;
+	if(len > F2FS_NAME_LEN) {
+		return CURSEG_WARM_DATA;
+	}
+	for(i=0; i<count; i++) {
+		if(match_ext((char *)ri->i_name, len, (char *)raw_super->extension_list[i])) {
+			return i < count - hot ? CURSEG_COLD_DATA : CURSEG_HOT_DATA;
+		}
+	}
+	return CURSEG_WARM_DATA;
+}
+
+/* an mtime past the fs clock was not written by it and counts as now */
+static int is_old(struct heat_ctx *ctx, struct seg_entry *se)
+{
+	unsigned long long mtime = se->mtime < ctx->now ? se->mtime : ctx->now;
+
+	return ctx->now - mtime >= ctx->age;
+}
+
+/* every valid block of the segment goes to its owner, by the segment's type */
+static int scan_segment(struct seg_walker *walker, unsigned int segno)
+{
+	struct heat_worker *w = (struct heat_worker *)walker;
+	struct heat_ctx *ctx = w->ctx;
+	struct f2fs_super *super = ctx->super;
+	struct seg_entry *se = get_seg_entry(super, segno);
+	struct f2fs_summary_block *sum_blk = page_address(w->sum_page);
+	struct heat_file *file = NULL;
+	unsigned int off = 0;
+	int old = is_old(ctx, se), ret = 0;
+	nid_t ino = 0;
+
+	ret = f2fs_get_summary(super, segno, w->sum_page);
+	if(ret < 0) {
+		return ret;
+	}
+	__sync_fetch_and_add(&ctx->segments, 1);
+
+	for(off=0; off<blocks_per_seg(super); off++) {
+		if(!f2fs_test_bit(off, (char *)se->cur_valid_map)) {
+			continue;
+		}
+
+		ino = f2fs_seg_walk_owner(walker, le32_to_cpu(sum_blk->entries[off].nid));
+		if(ino == 0) {
+			w->unowned++;
+			continue;
+		}
+
+		file = table_get(&w->table, ino, NULL);
+		if(file == NULL) {
+			return -ENOMEM;
+		}
+		file->blocks[se->type]++;
+		if(se->type < CURSEG_HOT_NODE && old) {
+			file->old++;
+		}
+	}
+	return 0;
+}
+
+static int is_used_segment(struct f2fs_super *super, unsigned int segno)
+{
+	struct seg_entry *se = get_seg_entry(super, segno);
+
+	return se->valid_blocks > 0 && se->type < NR_CURSEG_TYPE;
+}
+
+static unsigned long long data_blocks(const struct heat_file *file)
+{
+	return file->blocks[CURSEG_HOT_DATA] + file->blocks[CURSEG_WARM_DATA] +
+		file->blocks[CURSEG_COLD_DATA];
+}
+
+static int add_to_group(struct heat_table *table, nid_t ino, const char *ext,
+		struct heat_file *file)
+{
+	struct heat_file *group = table_get(table, ino, ext);
+	int type = 0;
+
+	if(group == NULL) {
+		return -ENOMEM;
+	}
+	if(group->files == 0) {
+		group->class = file->class;
+	} else if(group->class != file->class) {
+		group->class = HEAT_MIXED;
+	}
+	group->files++;
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		group->blocks[type] += file->blocks[type];
+	}
+	group->old += file->old;
+	group->misplaced += file->misplaced;
+	return 0;
+}
+
+/* what the extension groups go by: after the last dot, lower case */
+static void file_ext(struct f2fs_raw_inode *ri, char *ext)
+{
+	int len = le32_to_cpu(ri->i_namelen), i = 0;
+	const char *dot = NULL;
+
+	if(S_ISDIR(le16_to_cpu(ri->i_mode))) {
+		strcpy(ext, HEAT_DIR_EXT);
+		return;
+	}
+
+	len = len < F2FS_NAME_LEN ? len : F2FS_NAME_LEN;
+	for(i=len-1; i>0; i--) {
+		if(ri->i_name[i] == '.') {
+			dot = (char *)ri->i_name + i + 1;
+			break;
+		}
+	}
+	if(dot == NULL || dot == (char *)ri->i_name + len) {
+		strcpy(ext, "-");
+		return;
+	}
+
+	for(i=0; i<HEATMAP_EXT_LEN-1 && dot+i<(char *)ri->i_name+len; i++) {
+		ext[i] = (dot[i] >= 'A' && dot[i] <= 'Z') ? dot[i] - 'A' + 'a' : dot[i];
+	}
+	ext[i] = '\0';
+}
+
+static int cmp_misplaced(const void *a, const void *b)
+{
+	const struct heat_file *fa = *(struct heat_file * const *)a;
+	const struct heat_file *fb = *(struct heat_file * const *)b;
+
+	if(fa->misplaced != fb->misplaced) {
+		return fa->misplaced < fb->misplaced ? 1 : -1;
+	}
+	if(fa->old != fb->old) {
+		return fa->old < fb->old ? 1 : -1;
+	}
+	if(data_blocks(fa) != data_blocks(fb)) {
+		return data_blocks(fa) < data_blocks(fb) ? 1 : -1;
+	}
+	if(fa->ino != fb->ino) {
+		return fa->ino < fb->ino ? -1 : 1;
+	}
+	return strcmp(fa->ext, fb->ext);
+}
+
+static int cmp_ino(const void *a, const void *b)
+{
+	const struct heat_file *fa = *(struct heat_file * const *)a;
+	const struct heat_file *fb = *(struct heat_file * const *)b;
+
+	return fa->ino < fb->ino ? -1 : fa->ino > fb->ino;
+}
+
+/* the used slots of table in cmp order, NULL after an allocation failure */
+static struct heat_file **table_order(struct heat_table *table,
+		int (*cmp)(const void *, const void *), unsigned int *nr)
+{
+	struct heat_file **order = NULL;
+	unsigned int i = 0;
+
+	order = f2fs_malloc((table->nr + 1) * sizeof(struct heat_file *));
+	if(order == NULL) {
+		perror("f2fs_malloc");
+		return NULL;
+	}
+
+	for(i=0, *nr=0; i<table->max; i++) {
+		if(table->files[i].used) {
+			order[(*nr)++] = &table->files[i];
+		}
+	}
+	qsort(order, *nr, sizeof(struct heat_file *), cmp);
+	return order;
+}
+
+static const char *class_name(int class)
+{
+	return class == HEAT_MIXED ? "mixed" : class_names[class];
+}
+
+/* files of a class other than cold that mostly sit in old segments want to be */
+static const char *ext_hint(const struct heat_file *group)
+{
+	unsigned long long data = data_blocks(group);
+
+	/* dirs always go to the hot log */
+	if(data == 0 || !strcmp(group->ext, HEAT_DIR_EXT)) {
+		return "";
+	}
+	if(group->class != CURSEG_COLD_DATA && group->old * 10 >= data * 9) {
+		return " cold?";
+	}
+	if(group->class == CURSEG_HOT_DATA && group->old * 2 > data) {
+		return " not hot?";
+	}
+	return "";
+}
+
+static int print_top(struct f2fs_super *super, struct heat_table *table, int top,
+		struct page *page)
+{
+	struct heat_file **order = NULL, *group = NULL;
+	char path[PATH_MAX];
+	unsigned int i = 0, nr = 0;
+
+	order = table_order(table, cmp_misplaced, &nr);
+	if(order == NULL) {
+		return -ENOMEM;
+	}
+
+	if(table->by_ext) {
+		printf("extensions by misplaced blocks:\n%-16s %-5s %8s %10s %10s %10s "
+			"%10s %10s\n", "ext", "class", "files", "hot", "warm", "cold", "old",
+			"misplaced");
+	} else {
+		printf("dirs by misplaced blocks of the files in them:\n%-5s %8s %10s "
+			"%10s %10s %10s %10s\n", "class", "files", "hot", "warm", "cold",
+			"old", "misplaced");
+	}
+
+	for(i=0; i<nr && i<(unsigned int)top; i++) {
+		group = order[i];
+		if(table->by_ext) {
+			printf("%-16s %-5s %8u %10llu %10llu %10llu %10llu %10llu%s\n",
+				group->ext, class_name(group->class), group->files,
+				group->blocks[CURSEG_HOT_DATA], group->blocks[CURSEG_WARM_DATA],
+				group->blocks[CURSEG_COLD_DATA], group->old, group->misplaced,
+				ext_hint(group));
+			continue;
+		}
+		f2fs_ino_path(super, group->ino, page, path, sizeof(path));
+		printf("%-5s %8u %10llu %10llu %10llu %10llu %10llu %s\n",
+			class_name(group->class), group->files,
+			group->blocks[CURSEG_HOT_DATA], group->blocks[CURSEG_WARM_DATA],
+			group->blocks[CURSEG_COLD_DATA], group->old, group->misplaced, path);
+	}
+	f2fs_free(order);
+	return 0;
+}
+
+/*
+ * Class the owners in ino order, stream their rows when asked and fold
+ * them into the extension and dir groups.
+ */
+static int report(struct f2fs_super *super, struct heatmap_opts *opts,
+		struct heat_table *files, struct heatmap_stat *stat)
+{
+	struct heat_table exts, dirs;
+	struct heat_file **order = NULL, *file = NULL;
+	struct f2fs_raw_inode *ri = NULL;
+	struct page *page = NULL;
+	char path[PATH_MAX], ext[HEATMAP_EXT_LEN];
+	unsigned int i = 0, nr = 0;
+	nid_t pino = 0;
+	int type = 0, ret = 0;
+
+	memset(&exts, 0, sizeof(exts));
+	memset(&dirs, 0, sizeof(dirs));
+	exts.by_ext = 1;
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+	ri = &F2FS_NODE(page)->i;
+
+	order = table_order(files, cmp_ino, &nr);
+	if(order == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if(opts->files) {
+		printf("#ino\tclass\thot\twarm\tcold\thot_node\twarm_node\tcold_node\t"
+			"old\tmisplaced\tpath\n");
+	}
+
+	for(i=0; i<nr; i++) {
+		file = order[i];
+		if(f2fs_read_node_block(super, file->ino, page) < 0 || !IS_INODE(page)) {
+			for(type=0; type<NR_CURSEG_TYPE; type++) {
+				stat->unowned += file->blocks[type];
+			}
+			continue;
+		}
+
+		file->class = f2fs_file_class(super, ri);
+		file->misplaced = data_blocks(file) - file->blocks[file->class];
+		file_ext(ri, ext);
+		pino = le32_to_cpu(ri->i_pino);
+
+		stat->files++;
+		stat->old += file->old;
+		stat->misplaced += file->misplaced;
+		if(file->class == CURSEG_HOT_DATA) {
+			stat->old_hot += file->old;
+		}
+
+		ret = add_to_group(&exts, 0, ext, file);
+		if(ret == 0) {
+			ret = add_to_group(&dirs, pino, NULL, file);
+		}
+		if(ret < 0) {
+			goto out;
+		}
+
+		/* rows go out as they are classed, the groups wait for the end */
+		if(opts->files) {
+			f2fs_ino_path(super, file->ino, page, path, sizeof(path));
+			printf("%u\t%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%s\n",
+				file->ino, class_names[file->class], file->blocks[CURSEG_HOT_DATA],
+				file->blocks[CURSEG_WARM_DATA], file->blocks[CURSEG_COLD_DATA],
+				file->blocks[CURSEG_HOT_NODE], file->blocks[CURSEG_WARM_NODE],
+				file->blocks[CURSEG_COLD_NODE], file->old, file->misplaced, path);
+		}
+	}
+	stat->exts = exts.nr;
+	stat->dirs = dirs.nr;
+
+	ret = print_top(super, &exts, opts->top, page);
+	if(ret == 0) {
+		ret = print_top(super, &dirs, opts->top, page);
+	}
+
+out:
+	if(order != NULL) {
+		f2fs_free(order);
+	}
+	table_free(&exts);
+	table_free(&dirs);
+	free_page(page);
+	return ret;
+}
+
+/* the sit alone says how old the blocks of each log are */
+static void count_ages(struct heat_ctx *ctx, struct heatmap_stat *stat)
+{
+	struct f2fs_sm_info *sm = SM_I(ctx->super);
+	struct seg_entry *se = NULL;
+	unsigned long long age = 0;
+	unsigned int segno = 0;
+	int bucket = 0;
+
+	for(segno=0; segno<sm->main_segments; segno++) {
+		se = get_seg_entry(ctx->super, segno);
+		if(se->valid_blocks == 0 || se->type >= NR_CURSEG_TYPE) {
+			continue;
+		}
+
+		age = se->mtime < ctx->now ? ctx->now - se->mtime : 0;
+		for(bucket=0; bucket<HEATMAP_AGE_BUCKETS-1 && age>=age_bounds[bucket]; bucket++);
+		stat->age_blocks[se->type][bucket] += se->valid_blocks;
+		stat->blocks[se->type] += se->valid_blocks;
+	}
+}
+
+static void print_ages(struct heatmap_stat *stat)
+{
+	int type = 0, bucket = 0;
+
+	printf("%-10s %10s %10s %10s %10s %10s %10s\n", "log", "blocks", "<1d", "<7d",
+		"<30d", "<90d", "older");
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		printf("%-10s %10llu", log_names[type], stat->blocks[type]);
+		for(bucket=0; bucket<HEATMAP_AGE_BUCKETS; bucket++) {
+			printf(" %10llu", stat->age_blocks[type][bucket]);
+		}
+		printf("\n");
+	}
+}
+
+int f2fs_heatmap(struct f2fs_super *super, struct heatmap_opts *opts,
+		struct heatmap_stat *stat)
+{
+	F2FS_TRACE_SCOPE("heatmap", NULL, 0);
+	struct heat_worker *workers = NULL;
+	struct heat_file *file = NULL, *from = NULL;
+	struct heat_ctx ctx;
+	unsigned long long data = 0;
+	unsigned int j = 0;
+	int i = 0, type = 0, ret = 0;
+
+	memset(stat, 0, sizeof(struct heatmap_stat));
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.super = super;
+	f2fs_seg_walk_init(&ctx.walk, super, is_used_segment, scan_segment);
+	ctx.now = f2fs_get_mtime(super);
+	ctx.age = opts->age;
+
+	count_ages(&ctx, stat);
+
+	workers = f2fs_malloc(opts->threads * sizeof(struct heat_worker));
+	if(workers == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+	memset(workers, 0, opts->threads * sizeof(struct heat_worker));
+
+	for(i=0; i<opts->threads; i++) {
+		f2fs_seg_walker_init(&ctx.walk, &workers[i].walker);
+		workers[i].ctx = &ctx;
+		workers[i].sum_page = alloc_page();
+		if(workers[i].sum_page == NULL) {
+			perror("alloc page");
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ret = f2fs_seg_walk_run(&ctx.walk, workers, sizeof(struct heat_worker),
+		opts->threads);
+	if(ret < 0) {
+		goto out;
+	}
+
+	/* fold the tables of the workers into the first one */
+	for(i=0; i<opts->threads; i++) {
+		stat->unowned += workers[i].unowned;
+
+		for(j=0; i>0 && j<workers[i].table.max; j++) {
+			from = &workers[i].table.files[j];
+			if(!from->used) {
+				continue;
+			}
+
+			file = table_get(&workers[0].table, from->ino, NULL);
+			if(file == NULL) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			for(type=0; type<NR_CURSEG_TYPE; type++) {
+				file->blocks[type] += from->blocks[type];
+			}
+			file->old += from->old;
+		}
+	}
+	stat->segments = ctx.segments;
+
+	ret = report(super, opts, &workers[0].table, stat);
+	if(ret < 0) {
+		goto out;
+	}
+
+	print_ages(stat);
+	data = stat->blocks[CURSEG_HOT_DATA] + stat->blocks[CURSEG_WARM_DATA] +
+		stat->blocks[CURSEG_COLD_DATA];
+	printf("misplaced: %llu of %llu data blocks (%.1f%%) outside the log of "
+		"their class\n", stat->misplaced, data,
+		data ? 100.0 * stat->misplaced / data : 0.0);
+	printf("old: %llu data blocks in segments not written for %.1f days, %llu "
+		"of them of hot files\n", stat->old, opts->age / 86400.0, stat->old_hot);
+	printf("files: %u in %u extensions and %u dirs, %llu blocks without an "
+		"owner\n", stat->files, stat->exts, stat->dirs, stat->unowned);
+
+out:
+	for(i=0; workers!=NULL && i<opts->threads; i++) {
+		if(workers[i].sum_page != NULL) {
+			free_page(workers[i].sum_page);
+		}
+		table_free(&workers[i].table);
+	}
+	if(workers != NULL) {
+		f2fs_free(workers);
+	}
+	f2fs_seg_walk_exit(&ctx.walk);
+	return ret;
+}
@@ -0,0 +1,46 @@
+#ifndef __HEATMAP_H__
+#define __HEATMAP_H__
+
+#include "f2fs.h"
+
+#define HEATMAP_DEF_AGE		(30 * 86400)	/* secs a segment is not written to be old */
+#define HEATMAP_DEF_TOP		10
+/* segment ages blocks are counted by: a day, a week, a month, a quarter, older */
+#define HEATMAP_AGE_BUCKETS	5
+/* extensions are grouped by this many leading bytes */
+#define HEATMAP_EXT_LEN		16
+
+struct heatmap_opts {
+	int threads;
+	unsigned long long age;		/* secs of fs time after which a segment is old */
+	int top;			/* extensions and dirs listed */
+	int files;			/* stream a row for every file */
+};
+
+struct heatmap_stat {
+	unsigned long long blocks[NR_CURSEG_TYPE];	/* valid blocks by sit type */
+	unsigned long long age_blocks[NR_CURSEG_TYPE][HEATMAP_AGE_BUCKETS];
+	unsigned long long old;		/* data blocks in old segments */
+	unsigned long long old_hot;	/* of them owned by files classed hot */
+	unsigned long long misplaced;	/* data blocks outside the log of their class */
+	unsigned long long unowned;	/* blocks of orphans or of owners not read */
+	unsigned int files;		/* inodes owning blocks */
+	unsigned int exts, dirs;	/* groups they fall into */
+	unsigned int segments;		/* summaries read */
+};
+
+/* the data log the kernel writes a file to, from its mode, hints and name */
+int f2fs_file_class(struct f2fs_super *super, struct f2fs_raw_inode *ri);
+
+/*
+ * Map every valid block to its owner with threads workers reading the
+ * summaries, then class the owners like the kernel does by the super
+ * block's extension_list and fadvise hints. Prints blocks by log and
+ * segment age and the extensions and dirs with the most data outside the
+ * log of their class; with files set a row per file is streamed first.
+ * Needs the segment manager.
+ */
+int f2fs_heatmap(struct f2fs_super *super, struct heatmap_opts *opts,
+		struct heatmap_stat *stat);
+
+#endif /*__HEATMAP_H__*/
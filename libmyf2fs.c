@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "node.h"
+#include "data.h"
+#include "dir.h"
+#include "namei.h"
+#include "myf2fs.h"
+#include "trace.h"
+
+int malloc_count = 0;
+__thread int *f2fs_malloc_counter = NULL;
+
+struct myf2fs {
+	struct f2fs_super super;
+	int malloc_count;
+};
+
+/* count what the calling thread allocates against the handle */
+static int *handle_enter(myf2fs_t *fs)
+{
+	int *prev = f2fs_malloc_counter;
+
+	f2fs_malloc_counter = &fs->malloc_count;
+	return prev;
+}
+
+static void handle_leave(int *prev)
+{
+	f2fs_malloc_counter = prev;
+}
+
+int myf2fs_open(const char *dev, myf2fs_t **fs)
+{
+	F2FS_TRACE_SCOPE("open", NULL, 0);
+	myf2fs_t *new = NULL;
+	int *prev = NULL;
+	int ret = 0, op = 0;
+
+	new = f2fs_malloc(sizeof(struct myf2fs));
+	if(new == NULL) {
+		return -ENOMEM;
+	}
+	memset(new, 0, sizeof(struct myf2fs));
+
+	op = f2fs_stat_enter(F2FS_OP_MOUNT);
+	prev = handle_enter(new);
+	ret = f2fs_mount_lazy(&new->super, dev, O_RDONLY);
+	if(ret < 0) {
+		goto free;
+	}
+
+	ret = f2fs_build_node_cache(&new->super);
+	if(ret < 0) {
+		f2fs_umount(&new->super);
+		goto free;
+	}
+	handle_leave(prev);
+	f2fs_stat_leave(op);
+
+	*fs = new;
+	return 0;
+
+free:
+	handle_leave(prev);
+	f2fs_stat_leave(op);
+	f2fs_free(new);
+	return ret;
+}
+
+int myf2fs_close(myf2fs_t *fs)
+{
+	int *prev = NULL;
+	int leaked = 0;
+
+	prev = handle_enter(fs);
+	f2fs_destroy_node_cache(&fs->super);
+	f2fs_umount(&fs->super);
+	handle_leave(prev);
+
+	leaked = fs->malloc_count;
+	f2fs_free(fs);
+	return leaked;
+}
+
+int myf2fs_alloc_count(myf2fs_t *fs)
+{
+	return __sync_add_and_fetch(&fs->malloc_count, 0);
+}
+
+uint32_t myf2fs_root(myf2fs_t *fs)
+{
+	return le32_to_cpu(fs->super.raw_super->root_ino);
+}
+
+/* a private copy of an inode block, orphans and non-inodes are -ENOENT */
+static int get_inode_page(struct f2fs_super *super, nid_t ino, struct page **page)
+{
+	int ret = 0;
+
+	if(ino == 0 || f2fs_is_orphan(super, ino)) {
+		return -ENOENT;
+	}
+
+	*page = alloc_page();
+	if(*page == NULL) {
+		return -ENOMEM;
+	}
+
+	ret = f2fs_read_node_block(super, ino, *page);
+	if(ret == 0 && (!IS_INODE(*page) || ino_of_node(*page) != ino)) {
+		ret = -ENOENT;
+	}
+
+	if(ret < 0) {
+		free_page(*page);
+		*page = NULL;
+	}
+	return ret;
+}
+
+int myf2fs_lookup(myf2fs_t *fs, uint32_t dir, const char *name, int len,
+		uint32_t *ino)
+{
+	int *prev = handle_enter(fs);
+	int ret = 0;
+
+	ret = f2fs_lookup(&fs->super, dir, name, len, ino);
+	handle_leave(prev);
+	return ret;
+}
+
+int myf2fs_lookup_path(myf2fs_t *fs, const char *path, uint32_t *ino)
+{
+	int *prev = handle_enter(fs);
+	int ret = 0;
+
+	ret = f2fs_lookup_path(&fs->super, path, ino);
+	handle_leave(prev);
+	return ret;
+}
+
+int myf2fs_stat(myf2fs_t *fs, uint32_t ino, struct myf2fs_stat *st)
+{
+	F2FS_TRACE_SCOPE("stat", "ino", ino);
+	struct f2fs_raw_inode *ri = NULL;
+	struct page *page = NULL;
+	int op = f2fs_stat_enter(F2FS_OP_STAT);
+	int *prev = handle_enter(fs);
+	int ret = 0;
+
+	ret = get_inode_page(&fs->super, ino, &page);
+	if(ret < 0) {
+		goto out;
+	}
+	ri = &F2FS_NODE(page)->i;
+
+	st->ino = ino;
+	st->mode = le16_to_cpu(ri->i_mode);
+	st->uid = le32_to_cpu(ri->i_uid);
+	st->gid = le32_to_cpu(ri->i_gid);
+	st->links = le32_to_cpu(ri->i_links);
+	st->size = le64_to_cpu(ri->i_size);
+	st->blocks = le64_to_cpu(ri->i_blocks);
+	st->atime = le64_to_cpu(ri->i_atime);
+	st->mtime = le64_to_cpu(ri->i_mtime);
+	st->ctime = le64_to_cpu(ri->i_ctime);
+	free_page(page);
+out:
+	handle_leave(prev);
+	f2fs_stat_leave(op);
+	return ret;
+}
+
+struct readdir_ctx {
+	struct f2fs_super *super;
+	myf2fs_filldir_t filldir;
+	void *arg;
+};
+
+static int filldir_visible(void *arg, const char *name, int len, nid_t ino,
+		unsigned char file_type)
+{
+	struct readdir_ctx *ctx = arg;
+
+	if(f2fs_is_orphan(ctx->super, ino)) {
+		return 0;
+	}
+	return ctx->filldir(ctx->arg, name, len, ino, file_type);
+}
+
+int myf2fs_readdir(myf2fs_t *fs, uint32_t dir, myf2fs_filldir_t filldir,
+		void *arg)
+{
+	struct readdir_ctx ctx = {&fs->super, filldir, arg};
+	struct page *page = NULL;
+	int op = f2fs_stat_enter(F2FS_OP_READDIR);
+	int *prev = handle_enter(fs);
+	int ret = 0;
+
+	ret = get_inode_page(&fs->super, dir, &page);
+	if(ret < 0) {
+		goto out;
+	}
+
+	if(!S_ISDIR(le16_to_cpu(F2FS_NODE(page)->i.i_mode))) {
+		ret = -ENOTDIR;
+	} else {
+		ret = f2fs_readdir(&fs->super, page, filldir_visible, &ctx);
+	}
+	free_page(page);
+out:
+	handle_leave(prev);
+	f2fs_stat_leave(op);
+	return ret < 0 ? ret : 0;
+}
+
+/* holes read as zeros, the file ends at i_size */
+static ssize_t read_file(struct f2fs_super *super, struct page *inode_page,
+		char *buf, size_t count, uint64_t offset)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(inode_page)->i;
+	uint64_t size = le64_to_cpu(ri->i_size);
+	struct page *page = NULL;
+	size_t done = 0, ofs = 0, len = 0;
+	int ret = 0;
+
+	if(offset >= size) {
+		return 0;
+	}
+	if(count > size - offset) {
+		count = size - offset;
+	}
+
+	if(ri->i_inline & F2FS_INLINE_DATA) {
+		if(offset + count > MAX_INLINE_DATA(super->raw_super, ri)) {
+			return -EIO;
+		}
+		memcpy(buf, (char *)inline_data_addr(ri) + offset, count);
+		return count;
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		return -ENOMEM;
+	}
+
+	while(done < count) {
+		ofs = (offset + done) % F2FS_BLKSIZE;
+		len = F2FS_BLKSIZE - ofs;
+		if(len > count - done) {
+			len = count - done;
+		}
+
+		ret = f2fs_read_data_block(super, inode_page,
+			(offset + done) / F2FS_BLKSIZE, page);
+		if(ret == -ENOENT) {
+			memset(buf + done, 0, len);
+		} else if(ret < 0) {
+			break;
+		} else {
+			memcpy(buf + done, (char *)page_address(page) + ofs, len);
+		}
+		done += len;
+	}
+	free_page(page);
+
+	if(ret < 0 && ret != -ENOENT) {
+		return done > 0 ? (ssize_t)done : ret;
+	}
+	return done;
+}
+
+ssize_t myf2fs_read(myf2fs_t *fs, uint32_t ino, void *buf, size_t count,
+		uint64_t offset)
+{
+	F2FS_TRACE_SCOPE("read", "ino", ino);
+	struct page *page = NULL;
+	int op = f2fs_stat_enter(F2FS_OP_READ);
+	int *prev = handle_enter(fs);
+	ssize_t ret = 0;
+
+	ret = get_inode_page(&fs->super, ino, &page);
+	if(ret < 0) {
+		goto out;
+	}
+
+	if(S_ISDIR(le16_to_cpu(F2FS_NODE(page)->i.i_mode))) {
+		ret = -EISDIR;
+	} else {
+		ret = read_file(&fs->super, page, buf, count, offset);
+	}
+	free_page(page);
+out:
+	handle_leave(prev);
+	f2fs_stat_leave(op);
+	return ret;
+}
+
+void myf2fs_stats_enable(int on)
+{
+	f2fs_stats_enable(on);
+}
+
+void myf2fs_stats_reset(void)
+{
+	f2fs_stats_reset();
+}
+
+const char *myf2fs_stats_get(int op, struct myf2fs_op_stats *st)
+{
+	struct f2fs_stats stats;
+	struct f2fs_op_stats *s = NULL;
+	int i = 0;
+
+	if(op < 0 || op >= F2FS_NR_OPS) {
+		return NULL;
+	}
+
+	f2fs_stats_read(&stats);
+	s = &stats.op[op];
+	st->ops = s->ops;
+	st->reads = s->reads;
+	st->read_blocks = s->read_blocks;
+	st->read_bytes = s->read_bytes;
+	st->read_ns = s->read_ns;
+	st->writes = s->writes;
+	st->write_blocks = s->write_blocks;
+	for(i=0; i<F2FS_NR_CACHES; i++) {
+		st->hits[i] = s->hits[i];
+		st->misses[i] = s->misses[i];
+	}
+	for(i=0; i<F2FS_NR_POOLS; i++) {
+		st->allocs[i] = s->allocs[i];
+		st->alloc_bytes[i] = s->alloc_bytes[i];
+	}
+	for(i=0; i<F2FS_LAT_BUCKETS; i++) {
+		st->read_lat[i] = s->read_lat[i];
+	}
+	return f2fs_stat_op_name(op);
+}
+
+int myf2fs_trace_start(const char *path)
+{
+	return f2fs_trace_start(path);
+}
+
+int myf2fs_trace_stop(void)
+{
+	return f2fs_trace_stop();
+}
@@ -1,27 +1,66 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
 #include "f2fs_type.h"
 #include "f2fs.h"
 #include "super.h"
 #include "utils.h"
+#include "node.h"
+#include "segment.h"
+#include "data.h"
+#include "namei.h"
+#include "checkpoint.h"
+#include "recovery.h"
+#include "diff.h"
+#include "export.h"
+#include "tar.h"
+#include "dedup.h"
+#include "scrub.h"
+#include "capacity.h"
+#include "xattr.h"
+#include "defrag.h"
+#include "heatmap.h"
+#include "trace.h"
 
-int malloc_count = 0;
 void usage()
 {
 	printf("f2fs dev super\n");
 	printf("f2fs dev sit\n");
 	printf("f2fs dev ssa\n");
-	printf("f2fs dev nat\n");
+	printf("f2fs dev nat [free]\n");
 	printf("f2fs dev ls [dir]\n");
-	printf("f2fs dev mkdir [dir]\n");
-	printf("f2fs dev rm [file]\n");
-	printf("f2fs dev touch [file]\n");
+	printf("f2fs dev stat [-j] [-0] path... (- reads paths from stdin)\n");
+	printf("f2fs dev mkdir dir... (- reads paths from stdin)\n");
+	printf("f2fs dev rm file...\n");
+	printf("f2fs dev touch file...\n");
+	printf("f2fs dev recover\n");
+	printf("f2fs dev diff [image] (the last checkpoint against the one before or image)\n");
+	printf("f2fs dev export [-m] file (valid blocks only, -m writes a block map)\n");
+	printf("f2fs dev tar [path] > file.tar (the subtree at path as a POSIX tar)\n");
+	printf("f2fs dev analyze-dedup [-t threads] [-m MB] [-n top]\n");
+	printf("f2fs dev scrub [-d] [-b MB/s] [-i iops] [-c cursor] (-d reads data too)\n");
+	printf("f2fs dev capacity [-j] [-w days] (free nids and sections, days to full)\n");
+	printf("f2fs dev xattr [-n name] [-R] path (-R dumps the subtree)\n");
+	printf("f2fs dev defrag-plan [-e blocks] [-u percent] [-b MB] [-n files]\n");
+	printf("f2fs dev defrag [-e blocks] [-u percent] [-b MB] [-n files] (runs the plan)\n");
+	printf("f2fs dev heatmap [-t threads] [-a days] [-n top] [-f] (-f streams a row per file)\n");
+	printf("(modifying commands also free the orphan inodes of the checkpoint)\n");
+	printf("(and refuse to run over fsync'd data until it is replayed)\n");
+	printf("f2fs dev -r cmd... (replay fsync'd data first)\n");
+	printf("f2fs dev --stats cmd... (i/o and cache counters to stderr at the end)\n");
+	printf("f2fs dev --trace file cmd... (chrome trace of mount and walk)\n");
+	printf("(dev may list the members of a multi device volume: dev0,dev1,...)\n");
 }
 
 void print_super(struct f2fs_super *super)
 {
 	struct f2fs_super_block *raw_super = super->raw_super;
+	int i = 0;
 
 	printf("\nmagic: %X", le32_to_cpu(raw_super->magic));
 	printf("\nmajor_ver: %X", le16_to_cpu(raw_super->major_ver));
@@ -30,6 +69,11 @@ void print_super(struct f2fs_super *super)
 	printf("\nlog_blocks_per_seg:%d", raw_super->log_blocks_per_seg);
 	printf("\nchecksum_offset:%d", raw_super->checksum_offset);
 	printf("\nsegment_count_ssa:%d", raw_super->segment_count_ssa);
+	for(i=0; i<super->ndevs && super->ndevs > 1; i++) {
+		printf("\ndevice %d: %s blocks %llu-%llu", i, super->devs[i].path,
+			(unsigned long long)super->devs[i].start_blk,
+			(unsigned long long)super->devs[i].end_blk);
+	}
 	printf("\n");
 }
 
@@ -53,193 +97,1609 @@ void print_checkpoint(struct f2fs_super *super)
 	printf("\n");
 }
 
-static int f2fs_free_path(struct path *path)
+/* the inode a path names, put it when done */
+static struct f2fs_inode *path_lookup(struct f2fs_super *super, char *path)
+{
+	struct f2fs_inode *inode = NULL;
+	nid_t ino = 0;
+
+	if(f2fs_lookup_path(super, path, &ino) < 0) {
+		return NULL;
+	}
+
+	inode = (void *)f2fs_malloc(sizeof(struct f2fs_inode));
+	if(inode == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+
+	if(f2fs_read_inode(super, inode, ino) < 0) {
+		f2fs_free(inode);
+		return NULL;
+	}
+	return inode;
+}
+
+/* what the orphans of the checkpoint still pin down */
+static void print_orphans(struct f2fs_super *super)
 {
-	struct path *next = path, *tmp;
+	unsigned long long blocks = 0;
+	struct f2fs_raw_inode *ri = NULL;
+	struct page *page = NULL;
+	unsigned int i = 0;
+
+	if(f2fs_load(super, F2FS_LAZY_ORPHANS) < 0 || super->nr_orphans == 0) {
+		return;
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return;
+	}
+
+	for(i=0; i<super->nr_orphans; i++) {
+		if(f2fs_read_node_block(super, super->orphans[i], page) < 0) {
+			continue;
+		}
+		ri = &F2FS_NODE(page)->i;
+		blocks += le64_to_cpu(ri->i_blocks);
+	}
+	free_page(page);
 
-	do {
-		//printf("free:%s\n", next->inode->raw_inode->i_name);
-		f2fs_put_inode(next->inode);
-		tmp = next;
-		next = next->next;
-		f2fs_free(tmp);
-	} while(next != path);
+	printf("orphan inodes:%u blocks:%llu\n", super->nr_orphans, blocks);
+}
 
+static int cmd_super(struct f2fs_super *super, int argc, char **argv)
+{
+	print_super(super);
+	print_checkpoint(super);
+	print_orphans(super);
 	return 0;
 }
 
-static struct path *path_lookup(struct f2fs_super *super, char *dir)
+static int print_nat_entry(struct f2fs_super *super, struct node_info *ni, void *arg)
 {
-	struct f2fs_inode *iter_pos;
-	struct dir_iter *iter = NULL;
-	int next_ino = 0;
-	char name[256];
-	int i = 0, nameoff = 0, found = 0;
-	struct path *path, *tmp, *new;
+	unsigned int *count = arg;
 
-	if(dir[0] != '/') {
-		return NULL;
+	/* nodes of orphan inodes are as good as free */
+	if(ni->blk_addr == NULL_ADDR || f2fs_is_orphan(super, ni->ino)) {
+		count[1]++;
+		return 0;
 	}
 
-	path = (void *)f2fs_malloc(sizeof(struct path));
-	if(path == NULL) {
-		perror("malloc");
-		return NULL;
+	printf("nid:%u ino:%u blkaddr:%llu ver:%u\n", ni->nid, ni->ino,
+		ni->blk_addr, ni->version);
+	count[0]++;
+	return 0;
+}
+
+static int cmd_nat(struct f2fs_super *super, int argc, char **argv)
+{
+	struct nat_scan_stat stat;
+	unsigned int count[2] = {0, 0};
+	int ret = 0, flags = NAT_SCAN_VALID;
+
+	if(argc > 0 && !strcmp(argv[0], "free")) {
+		flags |= NAT_SCAN_FREE;
 	}
 
-	path->next = path;
-	path->prev = path;
-	f2fs_get_inode(super->root);
-	path->inode = super->root;
-	while(1) {
-		nameoff = 0;
-		name[0] = '\0';
+	ret = f2fs_scan_nat(super, 0, flags, print_nat_entry, count, &stat);
+	if(ret < 0) {
+		return ret;
+	}
+
+	printf("valid nids:%u", count[0]);
+	if(flags & NAT_SCAN_FREE) {
+		printf(" free nids:%u", count[1]);
+	}
+	printf("\nnat_bits:%s nat blocks:%llu empty:%u full:%u read:%u in %u reads\n",
+		super->nat_bits ? "on" : "off", super->nat_blocks,
+		stat.empty_blocks, stat.full_blocks, stat.read_blocks, stat.reads);
+	return 0;
+}
+
+static int cmd_ls(struct f2fs_super *super, int argc, char **argv)
+{
+	struct dir_iter *iter;
+	struct f2fs_inode *pos = NULL;
+	struct f2fs_inode *inode = NULL;
+	char *dir = "/";
+
+	if(argc > 0) {
+		dir = argv[0];
+	}
+
+	inode = path_lookup(super, dir);
+	if(inode == NULL) {
+		printf("No such file or directory:%s\n", dir);
+		return -ENOENT;
+	}
+
+	if(S_ISDIR(le32_to_cpu(inode->raw_inode->i_mode))) {
+		printf("DIR : .\nDIR : ..\n");
 
-		/* skip // */
-		for(; dir[i]!='\0'; i++) {
-			if(dir[i] != '/') {
-				break;
+		iter = dir_iter_start(super, inode);
+		while(pos = dir_iter_next(iter)) {
+			if(S_ISDIR(le32_to_cpu(pos->raw_inode->i_mode))) {
+				printf("DIR : %s\n", pos->raw_inode->i_name);
+			} else {
+				printf("FILE: %s\n", pos->raw_inode->i_name);
 			}
 		}
+		dir_iter_end(iter);
+	} else {
+		printf("FILE: %s\n", inode->raw_inode->i_name);
+	}
+
+	f2fs_put_inode(inode);
+	return 0;
+}
+
+/* split a path into its parent dir and the last name */
+static int lookup_parent(struct f2fs_super *super, char *path, nid_t *pino,
+		char **name)
+{
+	struct f2fs_inode *parent = NULL;
+	char *slash = NULL;
+	int len = strlen(path);
 
-		for(; dir[i]!='\0'; i++) {
-			if(dir[i] == '/' || dir[i] == '\0') {
-				break;
+	while(len > 1 && path[len - 1] == '/') {
+		path[--len] = '\0';
+	}
+
+	slash = strrchr(path, '/');
+	if(slash == NULL || slash[1] == '\0') {
+		return -EINVAL;
+	}
+
+	*slash = '\0';
+	parent = path_lookup(super, slash == path ? "/" : path);
+	*slash = '/';
+	if(parent == NULL) {
+		return -ENOENT;
+	}
+
+	if(!S_ISDIR(le16_to_cpu(parent->raw_inode->i_mode))) {
+		f2fs_put_inode(parent);
+		return -ENOTDIR;
+	}
+
+	*pino = parent->ino;
+	*name = slash + 1;
+	f2fs_put_inode(parent);
+	return 0;
+}
+
+typedef int (*path_fn)(struct f2fs_super *super, char *path);
+
+/* a run is one checkpoint, so a failed path drops the ones before it too */
+static int path_failed(const char *op, const char *path, int done, int err)
+{
+	printf("%s %s: %s\n", op, path, strerror(-err));
+	if(done > 0) {
+		printf("%s: nothing written, the %d path%s before it dropped too\n", op,
+			done, done == 1 ? "" : "s");
+	}
+	return err;
+}
+
+/* "-" reads one path per line from stdin so one run can carry many paths */
+static int for_each_path(struct f2fs_super *super, int argc, char **argv,
+		const char *op, path_fn fn)
+{
+	char line[PATH_MAX + 2];
+	int i = 0, len = 0, done = 0, ret = 0;
+
+	if(argc <= 0) {
+		usage();
+		return -EINVAL;
+	}
+
+	for(i=0; i<argc; i++) {
+		if(strcmp(argv[i], "-")) {
+			ret = fn(super, argv[i]);
+			if(ret < 0) {
+				return path_failed(op, argv[i], done, ret);
 			}
-			name[nameoff++] = dir[i];
+			done++;
+			continue;
 		}
 
-		if(nameoff == 0) {
-			break;
+		while(fgets(line, sizeof(line), stdin) != NULL) {
+			len = strlen(line);
+			while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+				line[--len] = '\0';
+			}
+			if(len == 0) {
+				continue;
+			}
+
+			ret = fn(super, line);
+			if(ret < 0) {
+				return path_failed(op, line, done, ret);
+			}
+			done++;
 		}
-		name[nameoff] = '\0';
+	}
+	return 0;
+}
 
-		/* . */
-		if(nameoff == 1 && name[0] == '.') {
-			continue;
+static int create_path(struct f2fs_super *super, char *path, unsigned int mode)
+{
+	nid_t pino = 0, ino = 0;
+	char *name = NULL;
+	int ret = 0;
+
+	ret = lookup_parent(super, path, &pino, &name);
+	if(ret < 0) {
+		return ret;
+	}
+	return f2fs_create(super, pino, name, strlen(name), mode, &ino);
+}
+
+static int mkdir_path(struct f2fs_super *super, char *path)
+{
+	return create_path(super, path, S_IFDIR | 0755);
+}
+
+static int touch_path(struct f2fs_super *super, char *path)
+{
+	int ret = create_path(super, path, S_IFREG | 0644);
+
+	return ret == -EEXIST ? 0 : ret;
+}
+
+static int rm_path(struct f2fs_super *super, char *path)
+{
+	nid_t pino = 0;
+	char *name = NULL;
+	int ret = 0;
+
+	ret = lookup_parent(super, path, &pino, &name);
+	if(ret < 0) {
+		return ret;
+	}
+	return f2fs_unlink(super, pino, name, strlen(name));
+}
+
+static int cmd_mkdir(struct f2fs_super *super, int argc, char **argv)
+{
+	return for_each_path(super, argc, argv, "mkdir", mkdir_path);
+}
+
+static int cmd_touch(struct f2fs_super *super, int argc, char **argv)
+{
+	return for_each_path(super, argc, argv, "touch", touch_path);
+}
+
+static int cmd_rm(struct f2fs_super *super, int argc, char **argv)
+{
+	return for_each_path(super, argc, argv, "rm", rm_path);
+}
+
+#define STAT_BATCH		65536	/* paths resolved and printed per round */
+
+enum {
+	STAT_TSV = 0,
+	STAT_JSON,
+};
+
+struct stat_input {
+	int argc;
+	char **argv;
+	int i;
+	int in_stdin;
+	int delim;
+	char *line;
+	size_t size;
+};
+
+struct stat_entry {
+	char *path;
+	int parent_len;		/* the parent dir is path[0, parent_len) */
+	const char *name;
+	int len;		/* 0 when the path names the parent itself */
+	nid_t ino;
+	block_t blkaddr;
+	int dir_only;		/* given with a trailing slash */
+	int err;
+	struct f2fs_raw_inode *ri;
+};
+
+/* one record of stdin up to the delimiter, -ENODATA once stdin is done */
+static ssize_t read_stat_record(struct stat_input *in)
+{
+	size_t len = 0, size = 0;
+	char *line = NULL;
+	int c = 0;
+
+	while((c = getc(stdin)) != EOF && c != in->delim) {
+		if(len + 1 >= in->size) {
+			size = in->size ? in->size * 2 : 256;
+			line = f2fs_malloc(size);
+			if(line == NULL) {
+				perror("f2fs_malloc");
+				return -ENOMEM;
+			}
+			if(in->line != NULL) {
+				memcpy(line, in->line, len);
+				f2fs_free(in->line);
+			}
+			in->line = line;
+			in->size = size;
 		}
+		in->line[len++] = c;
+	}
+
+	if(c == EOF && len == 0) {
+		return -ENODATA;
+	}
+
+	if(in->line != NULL) {
+		in->line[len] = '\0';
+	}
+	return len;
+}
+
+/* the next path of the arguments into path, NULL after the last; "-" reads them from stdin */
+static int next_stat_path(struct stat_input *in, char **path)
+{
+	ssize_t len = 0;
+	char *src = NULL;
+
+	*path = NULL;
+	while(1) {
+		if(in->in_stdin) {
+			len = read_stat_record(in);
+			if(len == -ENODATA) {
+				in->in_stdin = 0;
+				continue;
+			}
+			if(len < 0) {
+				return len;
+			}
+
+			while(len > 0 && in->delim == '\n' && in->line[len - 1] == '\r') {
+				in->line[--len] = '\0';
+			}
+			if(len == 0) {
+				continue;
+			}
+			src = in->line;
+		} else {
+			if(in->i >= in->argc) {
+				return 0;
+			}
 
-		/* .. */
-		if(nameoff == 2 && name[0] == '.' && name[1] == '.') {
-			if(path->prev->inode == super->root) {
-				goto out;
+			src = in->argv[in->i++];
+			if(!strcmp(src, "-")) {
+				in->in_stdin = 1;
+				continue;
 			}
+			len = strlen(src);
+		}
 
-			tmp = path->prev;
-			tmp->prev->next = path;
-			path->prev = tmp->prev;
-			f2fs_put_inode(tmp->inode);
-			f2fs_free(tmp);
-			continue;
+		*path = f2fs_malloc(len + 1);
+		if(*path == NULL) {
+			perror("f2fs_malloc");
+			return -ENOMEM;
 		}
+		memcpy(*path, src, len + 1);
+		return 0;
+	}
+}
+
+/* trailing slashes only match dirs, the path is printed as it was given */
+static void split_stat_path(struct stat_entry *e)
+{
+	int len = strlen(e->path), slash = 0;
+
+	while(len > 1 && e->path[len - 1] == '/') {
+		e->dir_only = 1;
+		len--;
+	}
+
+	if(e->path[0] != '/') {
+		e->err = -EINVAL;
+		return;
+	}
 
-		found = 0;
-		iter = dir_iter_start(super, path->prev->inode);
-		while(iter_pos = dir_iter_next(iter)) {
-			if(!strcmp(name, iter_pos->raw_inode->i_name)) {
-				new = (void *)f2fs_malloc(sizeof(struct path));
-				if(new == NULL) {
-					dir_iter_end(iter);
-					goto out;
-				}
-				f2fs_get_inode(iter_pos);
-				new->inode = iter_pos;
-				new->next = path->prev->next;
-				new->prev = path->prev;
+	for(slash=len-1; e->path[slash]!='/'; slash--);
+	e->parent_len = slash;
+	e->name = e->path + slash + 1;
+	e->len = len - slash - 1;
 
-				path->prev->next = new;
-				path->prev = new;
-				found = 1;
-				break;
+	/* "." and ".." are left to the path walk */
+	if(is_dot_dotdot(e->name, e->len)) {
+		e->parent_len = len;
+		e->len = 0;
+	}
+}
+
+static int stat_parent_cmp(const void *a, const void *b)
+{
+	const struct stat_entry *x = *(struct stat_entry **)a;
+	const struct stat_entry *y = *(struct stat_entry **)b;
+	int len = x->parent_len < y->parent_len ? x->parent_len : y->parent_len;
+	int ret = memcmp(x->path, y->path, len);
+
+	if(ret != 0) {
+		return ret;
+	}
+	return x->parent_len - y->parent_len;
+}
+
+static int stat_blkaddr_cmp(const void *a, const void *b)
+{
+	const struct stat_entry *x = *(struct stat_entry **)a;
+	const struct stat_entry *y = *(struct stat_entry **)b;
+
+	if(x->blkaddr != y->blkaddr) {
+		return x->blkaddr < y->blkaddr ? -1 : 1;
+	}
+	return 0;
+}
+
+/* every parent dir is walked once, its names are then single lookups */
+static void resolve_stat_entries(struct f2fs_super *super, struct stat_entry **order,
+		int nr)
+{
+	char parent[PATH_MAX + 1];
+	struct stat_entry *e = NULL;
+	nid_t pino = 0;
+	int i = 0, ret = 0;
+
+	qsort(order, nr, sizeof(struct stat_entry *), stat_parent_cmp);
+	for(i=0; i<nr; i++) {
+		e = order[i];
+		if(i == 0 || stat_parent_cmp(&order[i - 1], &order[i]) != 0) {
+			if(e->parent_len > PATH_MAX) {
+				ret = -ENAMETOOLONG;
+			} else if(e->parent_len == 0) {
+				ret = f2fs_lookup_path(super, "/", &pino);
+			} else {
+				memcpy(parent, e->path, e->parent_len);
+				parent[e->parent_len] = '\0';
+				ret = f2fs_lookup_path(super, parent, &pino);
 			}
 		}
-		dir_iter_end(iter);
 
-		if(found == 0) {
-			goto out;
+		if(ret < 0) {
+			e->err = ret;
+		} else if(e->len == 0) {
+			e->ino = pino;
+		} else {
+			e->err = f2fs_lookup(super, pino, e->name, e->len, &e->ino);
 		}
 	}
-	return path;
+}
 
-out:
-	f2fs_free_path(path);
-	return NULL;
+/* inode blocks are read in disk order, not in the order they were asked for */
+static void read_stat_inodes(struct f2fs_super *super, struct stat_entry **order,
+		int nr)
+{
+	struct stat_entry *e = NULL;
+	struct node_info ni;
+	struct page *page = NULL;
+	int i = 0;
+
+	for(i=0; i<nr; i++) {
+		e = order[i];
+		if(e->err == 0) {
+			e->err = f2fs_get_node_info(super, e->ino, &ni);
+			e->blkaddr = ni.blk_addr;
+		}
+	}
+	qsort(order, nr, sizeof(struct stat_entry *), stat_blkaddr_cmp);
+
+	for(i=0; i<nr; i++) {
+		e = order[i];
+		if(e->err < 0) {
+			continue;
+		}
+
+		page = alloc_page();
+		if(page == NULL) {
+			e->err = -ENOMEM;
+			continue;
+		}
+
+		e->err = f2fs_read_node_block(super, e->ino, page);
+		if(e->err == 0 && !IS_INODE(page)) {
+			e->err = -EINVAL;
+		}
+		if(e->err == 0 && e->dir_only &&
+				!S_ISDIR(le16_to_cpu(F2FS_NODE(page)->i.i_mode))) {
+			e->err = -ENOTDIR;
+		}
+
+		if(e->err < 0) {
+			free_page(page);
+			continue;
+		}
+		e->ri = &F2FS_NODE(page)->i;
+	}
 }
 
-int main(int argc, char **argv)
+static void print_stat_string(const char *s, int format)
 {
-	struct f2fs_super super;
-	struct dir_iter *iter;
-	int ret = 0;
-	struct f2fs_inode *pos = NULL;
-	struct path *path = NULL;
+	const unsigned char *p = (const unsigned char *)s;
 
-	if(argc <= 2) {
-		return -1;
+	for(; *p!='\0'; p++) {
+		if(*p == '\\' || (format == STAT_JSON && *p == '"')) {
+			printf("\\%c", *p);
+		} else if(*p == '\t') {
+			printf("\\t");
+		} else if(*p == '\n') {
+			printf("\\n");
+		} else if(*p < 0x20) {
+			printf(format == STAT_JSON ? "\\u%04x" : "\\x%02x", *p);
+		} else {
+			putchar(*p);
+		}
 	}
+}
 
-	ret = f2fs_fill_super(&super, argv[1]);
-	if(ret < 0) {
-		return ret;
+static void print_stat_entry(struct stat_entry *e, int format)
+{
+	struct f2fs_raw_inode *ri = e->ri;
+
+	if(format == STAT_JSON) {
+		printf("{\"path\":\"");
+		print_stat_string(e->path, format);
+		if(e->err < 0) {
+			printf("\",\"error\":\"%s\"}\n", strerror(-e->err));
+			return;
+		}
+		printf("\",\"ino\":%u,\"mode\":\"%o\",\"links\":%u,\"uid\":%u,"
+			"\"gid\":%u,\"size\":%llu,\"blocks\":%llu,\"mtime\":%llu}\n",
+			e->ino, le16_to_cpu(ri->i_mode), le32_to_cpu(ri->i_links),
+			le32_to_cpu(ri->i_uid), le32_to_cpu(ri->i_gid),
+			le64_to_cpu(ri->i_size), le64_to_cpu(ri->i_blocks),
+			le64_to_cpu(ri->i_mtime));
+		return;
 	}
 
-	ret = f2fs_get_valid_checkpoint(&super);
-	if(ret < 0) {
-		goto umount;
+	print_stat_string(e->path, format);
+	if(e->err < 0) {
+		printf("\terror\t%s\n", strerror(-e->err));
+		return;
 	}
+	printf("\t%u\t%o\t%u\t%u\t%u\t%llu\t%llu\t%llu\n", e->ino,
+		le16_to_cpu(ri->i_mode), le32_to_cpu(ri->i_links),
+		le32_to_cpu(ri->i_uid), le32_to_cpu(ri->i_gid),
+		le64_to_cpu(ri->i_size), le64_to_cpu(ri->i_blocks),
+		le64_to_cpu(ri->i_mtime));
+}
 
-	ret = f2fs_build_nat_bitmap(&super);
-	if(ret < 0) {
-		goto umount;
+/* one round: resolve, read and print up to STAT_BATCH paths, < 0 if any failed */
+static int stat_batch(struct f2fs_super *super, struct stat_entry *entries,
+		struct stat_entry **order, int nr, int format)
+{
+	int i = 0, ret = 0;
+
+	for(i=0; i<nr; i++) {
+		split_stat_path(&entries[i]);
+		order[i] = &entries[i];
 	}
 
-	ret = f2fs_read_ssa(&super);
-	if(ret < 0) {
-		goto umount;
+	resolve_stat_entries(super, order, nr);
+	read_stat_inodes(super, order, nr);
+
+	for(i=0; i<nr; i++) {
+		print_stat_entry(&entries[i], format);
+		if(entries[i].err < 0) {
+			ret = entries[i].err;
+		}
+
+		if(entries[i].ri != NULL) {
+			free_page(address_to_page(entries[i].ri));
+		}
+		f2fs_free(entries[i].path);
 	}
+	fflush(stdout);
+	return ret;
+}
+
+/*
+ * stat [-j] [-0] path... prints one line per path, in the order given, as
+ * tab separated values or with -j as json lines. "-" reads the paths from
+ * stdin, one per line or NUL separated with -0.
+ */
+static int cmd_stat(struct f2fs_super *super, int argc, char **argv)
+{
+	struct stat_input in;
+	struct stat_entry *entries = NULL, **order = NULL;
+	int format = STAT_TSV, own_cache = 0;
+	int nr = 0, ret = 0, err = 0;
+	char *path = NULL;
 
-//	print_super(&super);
-//	print_checkpoint(&super);
-	super.root = (void *)f2fs_malloc(sizeof(struct f2fs_inode));
-	if(super.root == NULL) {
-		ret = -1;
-		goto umount;
+	memset(&in, 0, sizeof(in));
+	in.delim = '\n';
+	for(; argc > 0 && argv[0][0] == '-' && argv[0][1] != '\0'; argc--, argv++) {
+		if(!strcmp(argv[0], "-j")) {
+			format = STAT_JSON;
+		} else if(!strcmp(argv[0], "-0")) {
+			in.delim = '\0';
+		} else {
+			usage();
+			return -EINVAL;
+		}
 	}
 
-	f2fs_read_inode(&super, super.root, le32_to_cpu(super.raw_super->root_ino));
-	if(!S_ISDIR(le32_to_cpu(super.root->raw_inode->i_mode))) {
-		printf("Error: the root was not a dir.\n");
-		goto free_root;
+	if(argc <= 0) {
+		usage();
+		return -EINVAL;
 	}
+	in.argc = argc;
+	in.argv = argv;
 
-	path = path_lookup(&super, argv[2]);
-	if(path == NULL) {
-		printf("No such file or directory:%s\n", argv[2]);
-		goto free_root;
+	entries = f2fs_malloc(STAT_BATCH * sizeof(struct stat_entry));
+	order = f2fs_malloc(STAT_BATCH * sizeof(struct stat_entry *));
+	if(entries == NULL || order == NULL) {
+		ret = -ENOMEM;
+		goto out;
 	}
 
-	if(S_ISDIR(le32_to_cpu(path->prev->inode->raw_inode->i_mode))) {
-		printf("DIR : .\nDIR : ..\n");
+	/* dir inodes and nat entries are read over and over */
+	if(NM_I(super) == NULL && NC_I(super) == NULL) {
+		ret = f2fs_build_node_cache(super);
+		if(ret < 0) {
+			goto out;
+		}
+		own_cache = 1;
+	}
 
-		iter = dir_iter_start(&super, path->prev->inode);
-		while(pos = dir_iter_next(iter)) {
-			if(S_ISDIR(le32_to_cpu(pos->raw_inode->i_mode))) {
-				printf("DIR : %s\n", pos->raw_inode->i_name);
-			} else {
-				printf("FILE: %s\n", pos->raw_inode->i_name);
+	if(format == STAT_TSV) {
+		printf("path\tino\tmode\tlinks\tuid\tgid\tsize\tblocks\tmtime\n");
+	}
+
+	while(1) {
+		err = next_stat_path(&in, &path);
+		if(err < 0) {
+			ret = err;
+		}
+		if(path != NULL) {
+			memset(&entries[nr], 0, sizeof(struct stat_entry));
+			entries[nr++].path = path;
+			if(nr < STAT_BATCH) {
+				continue;
 			}
 		}
-		dir_iter_end(iter);
-	} else {
-		printf("FILE: %s\n", path->prev->inode->raw_inode->i_name);
+
+		if(nr > 0) {
+			err = stat_batch(super, entries, order, nr, format);
+			if(err < 0) {
+				ret = err;
+			}
+			nr = 0;
+		}
+
+		if(path == NULL) {
+			break;
+		}
 	}
 
-	f2fs_free_path(path);
-free_root:
-	f2fs_put_inode(super.root);
-umount:
-	f2fs_umount(&super);
+	if(own_cache) {
+		f2fs_destroy_node_cache(super);
+	}
 out:
+	if(in.line != NULL) {
+		f2fs_free(in.line);
+	}
+	if(entries != NULL) {
+		f2fs_free(entries);
+	}
+	if(order != NULL) {
+		f2fs_free(order);
+	}
+	return ret;
+}
+
+static void print_recovery_stat(struct recovery_stat *stat)
+{
+	printf("recovered %u inodes, %u nodes, %u blocks, %u dentries "
+		"from %u chain blocks in %u reads\n", stat->inodes, stat->nodes,
+		stat->data_blocks, stat->dentries, stat->chain_blocks, stat->reads);
+}
+
+static int cmd_recover(struct f2fs_super *super, int argc, char **argv)
+{
+	struct recovery_stat stat;
+	int ret = 0;
+
+	ret = f2fs_recover_fsync_data(super, &stat);
+	if(ret < 0) {
+		return ret;
+	}
+	print_recovery_stat(&stat);
+	return 0;
+}
+
+/*
+ * Without an argument the checkpoint before the current one is the old
+ * side, otherwise dev is the old side and the image given the new one.
+ */
+static int cmd_diff(struct f2fs_super *super, int argc, char **argv)
+{
+	struct f2fs_super other;
+	struct diff_stat stat;
+	int ret = 0;
+
+	if(argc > 0) {
+		ret = f2fs_mount(&other, argv[0], O_RDONLY);
+	} else {
+		ret = f2fs_mount_older(&other, super->devpath);
+	}
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(argc > 0) {
+		ret = f2fs_diff(super, &other, 0, &stat);
+	} else {
+		ret = f2fs_diff(&other, super, 1, &stat);
+	}
+	f2fs_umount(&other);
+	if(ret < 0) {
+		return ret;
+	}
+
+	printf("nat: %u of %llu blocks compared in %u reads, %u nids of %u inodes changed, "
+		"%u dentries\n", stat.nat_blocks, super->nat_blocks, stat.nat_reads,
+		stat.nids, stat.inodes, stat.dentries);
+	printf("sit: %u blocks compared in %u reads, %u segments changed in %u ranges\n",
+		stat.sit_blocks, stat.sit_reads, stat.segments, stat.ranges);
+	return 0;
+}
+
+/*
+ * export [-m] file copies the image without its free blocks, as a sparse
+ * file or with -m as a block map that streams well.
+ */
+static int cmd_export(struct f2fs_super *super, int argc, char **argv)
+{
+	struct export_stat stat;
+	int blkmap = 0, own_sm = 0, ret = 0;
+
+	if(argc > 0 && !strcmp(argv[0], "-m")) {
+		blkmap = 1;
+		argc--;
+		argv++;
+	}
+
+	if(argc != 1) {
+		usage();
+		return -EINVAL;
+	}
+
+	if(SM_I(super) == NULL) {
+		ret = f2fs_build_segment_manager(super);
+		if(ret < 0) {
+			return ret;
+		}
+		own_sm = 1;
+	}
+
+	ret = f2fs_export(super, argv[0], blkmap, &stat);
+	if(own_sm) {
+		f2fs_destroy_segment_manager(super);
+	}
+	if(ret < 0) {
+		return ret;
+	}
+
+	printf("exported %llu of %llu blocks in %u extents (%u by copy_file_range)\n",
+		(unsigned long long)stat.blocks, le64_to_cpu(super->raw_super->block_count), stat.extents,
+		stat.copy_range);
+	return 0;
+}
+
+/*
+ * tar [path] streams the subtree at path, / by default, to stdout so files
+ * can be pulled out of an image without mounting it. Stdout carries the
+ * archive, everything else goes to stderr.
+ */
+static int cmd_tar(struct f2fs_super *super, int argc, char **argv)
+{
+	struct tar_stat stat;
+	char *path = "/";
+	int own_cache = 0, ret = 0;
+
+	if(argc > 1) {
+		usage();
+		return -EINVAL;
+	}
+	if(argc == 1) {
+		path = argv[0];
+	}
+
+	if(isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Refusing to write a tar to a terminal\n");
+		return -EINVAL;
+	}
+	fflush(stdout);
+
+	/* the walker and the reader share dir inodes and nat entries */
+	if(NM_I(super) == NULL && NC_I(super) == NULL) {
+		ret = f2fs_build_node_cache(super);
+		if(ret < 0) {
+			return ret;
+		}
+		own_cache = 1;
+	}
+
+	ret = f2fs_tar(super, path, STDOUT_FILENO, &stat);
+	if(own_cache) {
+		f2fs_destroy_node_cache(super);
+	}
+	if(ret < 0) {
+		fprintf(stderr, "tar %s: %s\n", path, strerror(-ret));
+		return ret;
+	}
+
+	fprintf(stderr, "tar: %u files, %u dirs, %u links, %u others, %u skipped, "
+		"%llu bytes (%llu spliced)\n", stat.files, stat.dirs, stat.links,
+		stat.others, stat.skipped, stat.bytes, stat.spliced);
+	return 0;
+}
+
+/*
+ * analyze-dedup [-t threads] [-m MB] [-n top] reports how many data blocks
+ * hold the same content and which files and dirs they belong to. -m bounds
+ * the memory of the counts, at the price of a second read of the data.
+ */
+static int cmd_analyze_dedup(struct f2fs_super *super, int argc, char **argv)
+{
+	struct dedup_stat stat;
+	size_t mem = DEDUP_DEF_MEM;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN), top = DEDUP_DEF_TOP;
+	int own_sm = 0, own_cache = 0, ret = 0;
+
+	for(; argc > 1 && argv[0][0] == '-'; argc-=2, argv+=2) {
+		if(!strcmp(argv[0], "-t")) {
+			threads = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-m")) {
+			mem = (size_t)atoi(argv[1]) << 20;
+		} else if(!strcmp(argv[0], "-n")) {
+			top = atoi(argv[1]);
+		} else {
+			break;
+		}
+	}
+
+	if(argc > 0 || threads <= 0 || mem == 0 || top < 0) {
+		usage();
+		return -EINVAL;
+	}
+
+	if(SM_I(super) == NULL) {
+		ret = f2fs_build_segment_manager(super);
+		if(ret < 0) {
+			return ret;
+		}
+		own_sm = 1;
+	}
+
+	/* the workers look up the owner of every block */
+	if(NM_I(super) == NULL && NC_I(super) == NULL) {
+		ret = f2fs_build_node_cache(super);
+		if(ret < 0) {
+			goto out;
+		}
+		own_cache = 1;
+	}
+
+	ret = f2fs_analyze_dedup(super, threads, mem, top, &stat);
+	if(ret == 0) {
+		printf("%u reads by %d threads, %s\n", stat.reads, threads,
+			stat.kept_hashes ? "hashes kept" : "data read twice");
+	}
+
+	if(own_cache) {
+		f2fs_destroy_node_cache(super);
+	}
+out:
+	if(own_sm) {
+		f2fs_destroy_segment_manager(super);
+	}
+	return ret;
+}
+
+static volatile sig_atomic_t scrub_stop;
+
+static void scrub_signal(int sig)
+{
+	scrub_stop = 1;
+}
+
+/*
+ * scrub [-d] [-b MB/s] [-i iops] [-c cursor] checks every checksum and node
+ * footer of the image at a bounded rate. With -c an interrupted run leaves
+ * its position in cursor and the next run goes on from there.
+ */
+static int cmd_scrub(struct f2fs_super *super, int argc, char **argv)
+{
+	struct scrub_opts opts;
+	struct scrub_stat stat;
+	struct sigaction act, old_int, old_term;
+	int own_sm = 0, own_cache = 0, ret = 0;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.stop = &scrub_stop;
+	for(; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+		if(!strcmp(argv[0], "-d")) {
+			opts.data = 1;
+			continue;
+		}
+		if(argc < 2) {
+			break;
+		}
+		if(!strcmp(argv[0], "-b")) {
+			opts.mbps = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-i")) {
+			opts.iops = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-c")) {
+			opts.cursor = argv[1];
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
+
+	if(argc > 0) {
+		usage();
+		return -EINVAL;
+	}
+
+	if(SM_I(super) == NULL) {
+		ret = f2fs_build_segment_manager(super);
+		if(ret < 0) {
+			return ret;
+		}
+		own_sm = 1;
+	}
+
+	if(NM_I(super) == NULL && NC_I(super) == NULL) {
+		ret = f2fs_build_node_cache(super);
+		if(ret < 0) {
+			goto out;
+		}
+		own_cache = 1;
+	}
+
+	/* no SA_RESTART, a pending throttle sleep ends at once */
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = scrub_signal;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, &old_int);
+	sigaction(SIGTERM, &act, &old_term);
+
+	ret = f2fs_scrub(super, &opts, &stat);
+
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+
+	if(ret == 0) {
+		printf("%llu blocks in %llu reads%s, %u nodes, %u inodes, %.1fs\n",
+			stat.blocks, stat.reads, stat.direct ? " (direct)" : "",
+			stat.nodes, stat.inodes, stat.secs);
+		if(stat.done) {
+			printf("scrub done from blkaddr %llu, %u errors\n",
+				(unsigned long long)stat.start, stat.errors);
+		} else {
+			printf("scrub stopped at blkaddr %llu, %u errors\n",
+				(unsigned long long)stat.next, stat.errors);
+		}
+		ret = stat.errors ? -EIO : 0;
+	}
+
+	if(own_cache) {
+		f2fs_destroy_node_cache(super);
+	}
+out:
+	if(own_sm) {
+		f2fs_destroy_segment_manager(super);
+	}
+	return ret;
+}
+
+static void print_capacity_json(struct capacity_stat *st)
+{
+	int i = 0;
+
+	printf("{\"free_nids\":%llu,\"valid_inodes\":%u,\"orphans\":%u,"
+		"\"inodes_left\":%llu,\"sections\":%u,\"free_sections\":%u,\"free_runs\":%u,"
+		"\"longest_free_run\":%u,\"run_hist\":[", st->free_nids, st->valid_inodes,
+		st->orphans, st->inodes_left, st->sections, st->free_sections, st->runs, st->longest_run);
+	for(i=0; i<CAPACITY_RUN_BUCKETS; i++) {
+		printf("%s%u", i ? "," : "", st->run_hist[i]);
+	}
+	printf("],\"user_blocks\":%llu,\"valid_blocks\":%llu,\"free_blocks\":%llu,"
+		"\"age\":%llu,\"window\":%llu,\"recent_blocks\":%llu,"
+		"\"blocks_per_day\":%.1f,\"days_left\":%.1f}\n", st->user_blocks,
+		st->valid_blocks, st->free_blocks, st->age, st->window, st->recent_blocks,
+		st->blocks_per_day, st->days_left);
+}
+
+/* capacity [-j] [-w days], -j prints one json line for scrapers */
+static int cmd_capacity(struct f2fs_super *super, int argc, char **argv)
+{
+	struct capacity_stat st;
+	unsigned long long window = CAPACITY_DEF_WINDOW;
+	int json = 0, ret = 0, i = 0;
+
+	for(; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+		if(!strcmp(argv[0], "-j")) {
+			json = 1;
+		} else if(!strcmp(argv[0], "-w") && argc > 1 && atof(argv[1]) > 0) {
+			window = atof(argv[1]) * 86400;
+			argc--;
+			argv++;
+		} else {
+			break;
+		}
+	}
+
+	if(argc > 0) {
+		usage();
+		return -EINVAL;
+	}
+
+	ret = f2fs_capacity(super, window, &st);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(json) {
+		print_capacity_json(&st);
+		return 0;
+	}
+
+	printf("inodes: %u valid, %llu free nids (a %zu byte set, %u nat blocks read), "
+		"room for %llu more\n", st.valid_inodes, st.free_nids, st.nid_set_bytes,
+		st.nat_read_blocks, st.inodes_left);
+	if(st.orphans > 0) {
+		printf("orphans: %u, their inodes and blocks are counted free\n", st.orphans);
+	}
+	printf("sections: %u, %u free (a %zu byte set) in %u runs, longest %u\n",
+		st.sections, st.free_sections, st.section_set_bytes, st.runs,
+		st.longest_run);
+	printf("free runs by length:");
+	for(i=0; i<CAPACITY_RUN_BUCKETS; i++) {
+		if(st.run_hist[i] != 0) {
+			printf(" %u+:%u", 1U << i, st.run_hist[i]);
+		}
+	}
+	printf("\nblocks: %llu of %llu valid, %llu free\n", st.valid_blocks,
+		st.user_blocks, st.free_blocks);
+	printf("trend: %llu blocks written in the last %.1f of %.1f days", st.recent_blocks,
+		st.window / 86400.0, st.age / 86400.0);
+	if(st.days_left < 0) {
+		printf(", no growth to project from\n");
+	} else {
+		printf(", %.0f blocks a day, full in %.1f days\n", st.blocks_per_day,
+			st.days_left);
+	}
+	return 0;
+}
+
+struct xattr_print {
+	const char *name;		/* -n, NULL prints all */
+	char last[PATH_MAX];		/* file the header was printed for */
+	int found;
+};
+
+/* getfattr's encoding: quoted text, or hex when a byte is not printable */
+static void print_xattr_value(const unsigned char *value, int size)
+{
+	int i = 0, len = size;
+
+	if(len > 0 && value[len - 1] == '\0') {
+		len--;
+	}
+	for(i=0; i<len && value[i]>=0x20 && value[i]<0x7f; i++);
+
+	if(i < len || size == 0) {
+		printf(size == 0 ? "\"\"" : "0x");
+		for(i=0; i<size; i++) {
+			printf("%02x", value[i]);
+		}
+		return;
+	}
+
+	putchar('"');
+	for(i=0; i<len; i++) {
+		if(value[i] == '"' || value[i] == '\\') {
+			putchar('\\');
+		}
+		putchar(value[i]);
+	}
+	putchar('"');
+}
+
+static int print_xattr(void *arg, const char *path, struct f2fs_xattr_entry *entry)
+{
+	struct xattr_print *p = arg;
+	const char *prefix = f2fs_xattr_prefix(entry->e_name_index);
+	char name[64 + 256];
+
+	if(prefix != NULL) {
+		snprintf(name, sizeof(name), "%s%.*s", prefix, entry->e_name_len,
+			entry->e_name);
+	} else {
+		snprintf(name, sizeof(name), "index%u.%.*s", entry->e_name_index,
+			entry->e_name_len, entry->e_name);
+	}
+	if(p->name != NULL && strcmp(p->name, name)) {
+		return 0;
+	}
+
+	if(strcmp(p->last, path)) {
+		printf("%s# file: %s\n", p->last[0] != '\0' ? "\n" : "", path);
+		snprintf(p->last, sizeof(p->last), "%s", path);
+	}
+	printf("%s=", name);
+	print_xattr_value((unsigned char *)xattr_value(entry),
+		le16_to_cpu(entry->e_value_size));
+	putchar('\n');
+	p->found = 1;
+	return 0;
+}
+
+/*
+ * xattr [-n name] [-R] path prints the xattrs of path like getfattr -d,
+ * -R those of every inode below it too with a summary to stderr.
+ */
+static int cmd_xattr(struct f2fs_super *super, int argc, char **argv)
+{
+	struct xattr_print *p = NULL;
+	struct xattr_stat stat;
+	int recursive = 0, ret = 0;
+	const char *name = NULL;
+
+	for(; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+		if(!strcmp(argv[0], "-R")) {
+			recursive = 1;
+		} else if(!strcmp(argv[0], "-n") && argc > 1) {
+			name = argv[1];
+			argc--;
+			argv++;
+		} else {
+			usage();
+			return -EINVAL;
+		}
+	}
+
+	if(argc != 1) {
+		usage();
+		return -EINVAL;
+	}
+
+	p = f2fs_malloc(sizeof(struct xattr_print));
+	if(p == NULL) {
+		return -ENOMEM;
+	}
+	memset(p, 0, sizeof(struct xattr_print));
+	p->name = name;
+
+	if(recursive) {
+		ret = f2fs_dump_xattrs(super, argv[0], print_xattr, p, &stat);
+	} else {
+		ret = f2fs_get_xattrs(super, argv[0], print_xattr, p);
+	}
+	if(ret < 0) {
+		fprintf(stderr, "xattr %s: %s\n", argv[0], strerror(-ret));
+		goto out;
+	}
+
+	if(recursive) {
+		fprintf(stderr, "xattr: %u inodes, %u with %llu xattrs (%u inline only), "
+			"%u xattr nodes in %u reads of %llu blocks, %u skipped\n", stat.files,
+			stat.xattr_files, stat.xattrs, stat.inline_only, stat.xattr_nodes,
+			stat.reads, stat.read_blocks, stat.skipped);
+	} else if(name != NULL && !p->found) {
+		fprintf(stderr, "xattr %s: %s: %s\n", argv[0], name, strerror(ENODATA));
+		ret = -ENODATA;
+	}
+out:
+	f2fs_free(p);
+	return ret;
+}
+
+/* -e blocks -u percent -b MB -n files, shared by defrag-plan and defrag */
+static int parse_defrag_opts(int argc, char **argv, struct defrag_opts *opts)
+{
+	opts->min_extent = DEFRAG_DEF_EXTENT;
+	opts->max_util = DEFRAG_DEF_UTIL;
+	opts->batch_blocks = DEFRAG_DEF_BATCH / F2FS_BLKSIZE;
+	opts->max_files = 0;
+
+	for(; argc > 1 && argv[0][0] == '-'; argc-=2, argv+=2) {
+		if(!strcmp(argv[0], "-e")) {
+			opts->min_extent = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-u")) {
+			opts->max_util = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-b")) {
+			opts->batch_blocks = (atoi(argv[1]) << 20) / F2FS_BLKSIZE;
+		} else if(!strcmp(argv[0], "-n")) {
+			opts->max_files = atoi(argv[1]);
+		} else {
+			break;
+		}
+	}
+
+	if(argc > 0 || opts->min_extent == 0 || opts->max_util > 100 ||
+			opts->batch_blocks == 0) {
+		usage();
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void print_defrag_plan(struct defrag_plan *plan)
+{
+	printf("files: %u with blocks, %u fragmented, %u pinned\n", plan->files,
+		plan->fragmented, plan->pinned);
+	printf("sections: %u under the utilization limit\n", plan->sections);
+	printf("plan: %u items in %u batches, %llu data and %llu node blocks to "
+		"write of %llu free, %llu extents to %llu, %u left out\n",
+		plan->nr_items, plan->nr_batches, plan->blocks, plan->nodes,
+		plan->budget, plan->extents, plan->ideal, plan->left_out);
+}
+
+/*
+ * defrag-plan [-e blocks] [-u percent] [-b MB] [-n files] lists the
+ * migration batches defrag with the same options would run.
+ */
+static int cmd_defrag_plan(struct f2fs_super *super, int argc, char **argv)
+{
+	struct defrag_opts opts;
+	struct defrag_plan plan;
+	struct defrag_batch *batch = NULL;
+	struct defrag_item *item = NULL;
+	int own_sm = 0, own_cache = 0, ret = 0;
+	unsigned int i = 0, j = 0;
+
+	ret = parse_defrag_opts(argc, argv, &opts);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(SM_I(super) == NULL) {
+		ret = f2fs_build_segment_manager(super);
+		if(ret < 0) {
+			return ret;
+		}
+		own_sm = 1;
+	}
+
+	/* every inode and its nodes are read */
+	if(NM_I(super) == NULL && NC_I(super) == NULL) {
+		ret = f2fs_build_node_cache(super);
+		if(ret < 0) {
+			goto out;
+		}
+		own_cache = 1;
+	}
+
+	ret = f2fs_plan_defrag(super, &opts, &plan);
+	if(ret < 0) {
+		goto destroy;
+	}
+
+	for(i=0; i<plan.nr_batches; i++) {
+		batch = &plan.batches[i];
+		printf("batch %u: %llu blocks\n", i, batch->blocks);
+		for(j=batch->first; j<batch->first+batch->nr; j++) {
+			item = &plan.items[j];
+			if(item->type == DEFRAG_FILE) {
+				printf("\tfile %u: %u blocks in %u extents, %u nodes\n",
+					item->id, item->blocks, item->extents, item->nodes);
+			} else {
+				printf("\tsection %u: %u data blocks, %u nodes\n",
+					item->id, item->blocks, item->nodes);
+			}
+		}
+	}
+	print_defrag_plan(&plan);
+	f2fs_free_defrag_plan(&plan);
+
+destroy:
+	if(own_cache) {
+		f2fs_destroy_node_cache(super);
+	}
+out:
+	if(own_sm) {
+		f2fs_destroy_segment_manager(super);
+	}
+	return ret;
+}
+
+/* defrag takes the options of defrag-plan and runs the plan */
+static int cmd_defrag(struct f2fs_super *super, int argc, char **argv)
+{
+	struct defrag_opts opts;
+	struct defrag_plan plan;
+	struct defrag_stat stat;
+	int ret = 0;
+
+	ret = parse_defrag_opts(argc, argv, &opts);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = f2fs_plan_defrag(super, &opts, &plan);
+	if(ret < 0) {
+		return ret;
+	}
+	print_defrag_plan(&plan);
+
+	ret = f2fs_run_defrag(super, &plan, &stat);
+	f2fs_free_defrag_plan(&plan);
+	if(ret < 0) {
+		return ret;
+	}
+
+	printf("defrag: %u batches, %u files now in %llu extents, %u sections "
+		"(%u freed), %llu data and %llu node blocks moved, %llu kept\n",
+		stat.batches, stat.files, stat.extents, stat.sections, stat.freed,
+		stat.data_blocks, stat.node_blocks, stat.skipped);
+	return 0;
+}
+
+/*
+ * heatmap [-t threads] [-a days] [-n top] [-f] maps every block to its
+ * owner and the sit type of its segment and lists the extensions and dirs
+ * whose data is furthest from the log extension_list and the fadvise
+ * hints class it in. -f streams a tsv row per file before the summary.
+ */
+static int cmd_heatmap(struct f2fs_super *super, int argc, char **argv)
+{
+	struct heatmap_opts opts;
+	struct heatmap_stat stat;
+	int own_sm = 0, own_cache = 0, ret = 0;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	opts.age = HEATMAP_DEF_AGE;
+	opts.top = HEATMAP_DEF_TOP;
+	for(; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+		if(!strcmp(argv[0], "-f")) {
+			opts.files = 1;
+			continue;
+		}
+		if(argc < 2) {
+			break;
+		}
+		if(!strcmp(argv[0], "-t")) {
+			opts.threads = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-a")) {
+			opts.age = atof(argv[1]) * 86400;
+		} else if(!strcmp(argv[0], "-n")) {
+			opts.top = atoi(argv[1]);
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
+
+	if(argc > 0 || opts.threads <= 0 || opts.top < 0) {
+		usage();
+		return -EINVAL;
+	}
+
+	if(SM_I(super) == NULL) {
+		ret = f2fs_build_segment_manager(super);
+		if(ret < 0) {
+			return ret;
+		}
+		own_sm = 1;
+	}
+
+	/* the workers look up the owner of every block */
+	if(NM_I(super) == NULL && NC_I(super) == NULL) {
+		ret = f2fs_build_node_cache(super);
+		if(ret < 0) {
+			goto out;
+		}
+		own_cache = 1;
+	}
+
+	ret = f2fs_heatmap(super, &opts, &stat);
+	if(ret == 0) {
+		printf("%u summaries read by %d threads\n", stat.segments, opts.threads);
+	}
+
+	if(own_cache) {
+		f2fs_destroy_node_cache(super);
+	}
+out:
+	if(own_sm) {
+		f2fs_destroy_segment_manager(super);
+	}
+	return ret;
+}
+
+/* modifying commands run against in-memory managers and end in one checkpoint */
+#define CMD_WRITE		0x1
+/* replay the fsync'd node chain into the managers before running */
+#define CMD_RECOVER		0x2
+/* the command replays the chain itself, others must not write over it */
+#define CMD_REPLAY		0x4
+
+struct command {
+	const char *name;
+	int (*fn)(struct f2fs_super *super, int argc, char **argv);
+	int flags;
+};
+
+static struct command commands[] = {
+	{"super", cmd_super, 0},
+	{"nat", cmd_nat, 0},
+	{"ls", cmd_ls, 0},
+	{"stat", cmd_stat, 0},
+	{"mkdir", cmd_mkdir, CMD_WRITE},
+	{"touch", cmd_touch, CMD_WRITE},
+	{"rm", cmd_rm, CMD_WRITE},
+	{"recover", cmd_recover, CMD_WRITE | CMD_REPLAY},
+	{"diff", cmd_diff, 0},
+	{"export", cmd_export, 0},
+	{"tar", cmd_tar, 0},
+	{"analyze-dedup", cmd_analyze_dedup, 0},
+	{"scrub", cmd_scrub, 0},
+	{"capacity", cmd_capacity, 0},
+	{"xattr", cmd_xattr, 0},
+	{"defrag-plan", cmd_defrag_plan, 0},
+	{"defrag", cmd_defrag, CMD_WRITE},
+	{"heatmap", cmd_heatmap, 0},
+	{NULL, NULL, 0},
+};
+
+static struct command ls_command = {"ls", cmd_ls, 0};
+
+static int run_command(struct f2fs_super *super, struct command *cmd,
+		int flags, int argc, char **argv)
+{
+	struct recovery_stat stat;
+	int ret = 0;
+
+	ret = f2fs_build_segment_manager(super);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = f2fs_build_node_manager(super);
+	if(ret < 0) {
+		goto destroy_sm;
+	}
+
+	ret = f2fs_build_data_manager(super);
+	if(ret < 0) {
+		goto destroy_nm;
+	}
+
+	/* new nodes go to the warm node log head the chain starts at */
+	if((flags & CMD_WRITE) && !(flags & (CMD_RECOVER | CMD_REPLAY))) {
+		ret = f2fs_has_fsync_data(super);
+		if(ret < 0) {
+			goto destroy_dm;
+		}
+		if(ret > 0) {
+			printf("fsync'd data past the checkpoint, run with -r or recover first\n");
+			ret = -EBUSY;
+			goto destroy_dm;
+		}
+	}
+
+	if(flags & CMD_WRITE) {
+		ret = f2fs_reclaim_orphans(super);
+		if(ret < 0) {
+			goto destroy_dm;
+		}
+	}
+
+	if(flags & CMD_RECOVER) {
+		ret = f2fs_recover_fsync_data(super, &stat);
+		if(ret < 0) {
+			goto destroy_dm;
+		}
+	}
+
+	/* a failed command leaves the image untouched */
+	ret = cmd->fn(super, argc, argv);
+	if(ret == 0 && (flags & CMD_WRITE)) {
+		ret = f2fs_write_checkpoint(super);
+	}
+
+destroy_dm:
+	f2fs_destroy_data_manager(super);
+destroy_nm:
+	f2fs_destroy_node_manager(super);
+destroy_sm:
+	f2fs_destroy_segment_manager(super);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct f2fs_super super;
+	struct f2fs_stats stats;
+	struct command *cmd = NULL;
+	int ret = 0, flags = 0, argn = 3, print_stats = 0, trace = 0;
+
+	/* options go between the image and the command */
+	while(argc > 2 && !strncmp(argv[2], "--", 2)) {
+		if(!strcmp(argv[2], "--stats")) {
+			print_stats = 1;
+			f2fs_stats_enable(1);
+			argv[2] = argv[1];
+			argc--;
+			argv++;
+		} else if(!strcmp(argv[2], "--trace") && argc > 3) {
+			ret = f2fs_trace_start(argv[3]);
+			if(ret < 0) {
+				return ret;
+			}
+			trace = 1;
+			argv[3] = argv[1];
+			argc -= 2;
+			argv += 2;
+		} else {
+			break;
+		}
+	}
+
+	if(argc <= 2) {
+		usage();
+		return -1;
+	}
+
+	ret = f2fs_mount_lazy(&super, argv[1], O_RDWR);
+	if(ret < 0) {
+		goto out;
+	}
+
+	/* -r shows the state of the last fsync instead of the last checkpoint */
+	if(!strcmp(argv[2], "-r")) {
+		flags |= CMD_RECOVER;
+		argc--;
+		argv++;
+	}
+
+	for(cmd=commands; argc > 2 && cmd->name != NULL; cmd++) {
+		if(!strcmp(cmd->name, argv[2])) {
+			break;
+		}
+	}
+
+	/* "f2fs dev /some/path" lists the path like ls */
+	if(argc <= 2 || cmd->name == NULL) {
+		cmd = &ls_command;
+		argn = 2;
+	}
+
+	flags |= cmd->flags;
+	if(flags & (CMD_WRITE | CMD_RECOVER)) {
+		ret = run_command(&super, cmd, flags, argc - argn, argv + argn);
+	} else {
+		ret = cmd->fn(&super, argc - argn, argv + argn);
+	}
+
+	f2fs_umount(&super);
+out:
+	if(trace && f2fs_trace_stop() < 0 && ret == 0) {
+		ret = -EIO;
+	}
+
+	if(print_stats) {
+		f2fs_stats_read(&stats);
+		f2fs_stats_print(&stats);
+	}
+
 	if(malloc_count != 0) {
 		BUG("BUG: The memory malloc count: %d\n", malloc_count);
 	}
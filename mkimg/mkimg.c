@@ -0,0 +1,1049 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "segment.h"
+#include "dir.h"
+
+/*
+ * mkimg writes a fresh, cleanly unmounted image with a synthetic tree:
+ * levels of dirs with fanout subdirs each and files in every dir. Blocks go
+ * through the six logs the way f2fs appends them, every log collects its
+ * open segment in memory and writes it in one piece, the metadata areas are
+ * written once at the end.
+ */
+
+#define MKIMG_LOG_BLOCKS_PER_SEG	9
+#define MKIMG_BLKS_PER_SEG	(1 << MKIMG_LOG_BLOCKS_PER_SEG)
+#define MKIMG_SEG0_BLKADDR	MKIMG_BLKS_PER_SEG
+#define MKIMG_RSVD_SEGS		2
+#define MKIMG_OVP_SEGS		4
+/* dentry blocks of that many levels fit the direct addresses of the inode */
+#define MKIMG_DIR_LEVELS	8
+#define MKIMG_ADDRS_PER_INODE	(DEF_ADDRS_PER_INODE - DEFAULT_INLINE_XATTR_ADDRS)
+#define MKIMG_MAX_BLOCKS	(MKIMG_ADDRS_PER_INODE + 2 * DEF_ADDRS_PER_BLOCK)
+#define MKIMG_INLINE_SIZE	64
+#define MKIMG_NAME_LEN		16
+#define MKIMG_CP_VER		1
+#define MKIMG_TIME		1600000000
+
+struct mkimg_opts {
+	unsigned long long size;	/* bytes */
+	unsigned int fanout;		/* subdirs of every dir above the last level */
+	unsigned int levels;		/* dir levels below the root */
+	unsigned int files;		/* files in every dir */
+	unsigned int blocks;		/* data blocks per file, 0 for inline data */
+	unsigned int frag;		/* percent of file data slots left as holes */
+	unsigned int nat_journal;	/* nat entries kept in the hot data summary */
+	unsigned int sit_journal;	/* sit entries kept in the cold data summary */
+	unsigned int seed;
+	unsigned long long elapsed;	/* secs of fs time, checkpoint and segments alike */
+	int block_dentries;		/* no inline dentries */
+	int nat_bits;			/* write nat_bits with the checkpoint */
+};
+
+struct mkimg_log {
+	unsigned int segno;
+	unsigned int blkoff;
+	char *buf;			/* the open segment, written once full */
+};
+
+struct mkimg_dentry {
+	char name[MKIMG_NAME_LEN];
+	nid_t ino;
+	unsigned char file_type;
+};
+
+struct image {
+	int fd;
+	struct mkimg_opts *opts;
+	struct f2fs_super_block *raw_super;
+	unsigned int sit_segs, nat_segs, main_segs, user_segs;
+	unsigned int next_segno;	/* segments are never reused */
+	struct mkimg_log logs[NR_CURSEG_TYPE];
+	char *sit;			/* whole blocks, the entries do not fill them */
+	char *nat;
+	struct f2fs_summary_block *ssa;	/* one per main segment */
+	struct page *ipage, *dpage;	/* scratch inode and direct node of a file */
+	nid_t max_nid, next_nid;
+	unsigned long long valid_blocks;
+	unsigned int valid_nodes, valid_inodes;
+	unsigned int dirs, files;
+	unsigned int rand;
+};
+
+static void usage()
+{
+	printf("mkimg [-s MB] [-d fanout] [-l levels] [-f files] [-b blocks] [-B]\n");
+	printf("      [-F frag%%] [-n nat journal] [-t sit journal] [-r seed]\n");
+	printf("      [-e elapsed secs] [-N] image\n");
+	printf("(-b 0 makes inline files, -B puts every dentry in dentry blocks)\n");
+	printf("(-N writes nat_bits, which leave no room for a nat journal)\n");
+}
+
+/* xorshift, the same seed gives the same image */
+static unsigned int next_rand(struct image *img)
+{
+	img->rand ^= img->rand << 13;
+	img->rand ^= img->rand >> 17;
+	img->rand ^= img->rand << 5;
+	return img->rand;
+}
+
+static int write_blocks(int fd, const void *buf, block_t blkaddr, size_t nr)
+{
+	const char *p = buf;
+	size_t len = nr * F2FS_BLKSIZE;
+	off_t off = (off_t)blkaddr * F2FS_BLKSIZE;
+	ssize_t n = 0;
+	int ret = 0;
+
+	while(len > 0) {
+		n = pwrite(fd, p, len, off);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			ret = -errno;
+			perror("pwrite");
+			return ret;
+		}
+		p += n;
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static block_t seg_blkaddr(struct image *img, unsigned int segno)
+{
+	return le32_to_cpu(img->raw_super->main_blkaddr) +
+		(block_t)segno * MKIMG_BLKS_PER_SEG;
+}
+
+static struct f2fs_sit_entry *sit_entry(struct image *img, unsigned int segno)
+{
+	struct f2fs_sit_block *blk = (struct f2fs_sit_block *)(img->sit +
+		(size_t)(segno / SIT_ENTRY_PER_BLOCK) * F2FS_BLKSIZE);
+
+	return &blk->entries[segno % SIT_ENTRY_PER_BLOCK];
+}
+
+static struct f2fs_nat_entry *nat_entry(struct image *img, nid_t nid)
+{
+	struct f2fs_nat_block *blk = (struct f2fs_nat_block *)(img->nat +
+		(size_t)(nid / NAT_ENTRY_PER_BLOCK) * F2FS_BLKSIZE);
+
+	return &blk->entries[nid % NAT_ENTRY_PER_BLOCK];
+}
+
+/* write out the open segment of log and move it to the next free one */
+static int next_segment(struct image *img, struct mkimg_log *log)
+{
+	int ret = 0;
+
+	ret = write_blocks(img->fd, log->buf, seg_blkaddr(img, log->segno), log->blkoff);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(img->next_segno >= img->user_segs) {
+		printf("mkimg: the image is full after %u segments\n", img->next_segno);
+		return -ENOSPC;
+	}
+
+	memset(log->buf, 0, (size_t)log->blkoff * F2FS_BLKSIZE);
+	log->segno = img->next_segno++;
+	log->blkoff = 0;
+	return 0;
+}
+
+/* the next block of the log, marked valid and summarized, to be filled in */
+static char *alloc_block(struct image *img, int type, nid_t nid,
+		unsigned int ofs_in_node, block_t *blkaddr)
+{
+	struct mkimg_log *log = &img->logs[type];
+	struct f2fs_sit_entry *se = NULL;
+	struct f2fs_summary *sum = NULL;
+	unsigned int vblocks = 0;
+	char *block = NULL;
+
+	if(log->blkoff >= MKIMG_BLKS_PER_SEG && next_segment(img, log) < 0) {
+		return NULL;
+	}
+
+	se = sit_entry(img, log->segno);
+	vblocks = (le16_to_cpu(se->vblocks) & SIT_VBLOCKS_MASK) + 1;
+	se->vblocks = cpu_to_le16(vblocks | type << SIT_VBLOCKS_SHIFT);
+	se->mtime = cpu_to_le64(img->opts->elapsed);
+	f2fs_set_bit(log->blkoff, (char *)se->valid_map);
+
+	sum = &img->ssa[log->segno].entries[log->blkoff];
+	sum->nid = cpu_to_le32(nid);
+	sum->ofs_in_node = cpu_to_le16(ofs_in_node);
+	img->ssa[log->segno].footer.entry_type =
+		type >= CURSEG_HOT_NODE ? SUM_TYPE_NODE : SUM_TYPE_DATA;
+
+	*blkaddr = seg_blkaddr(img, log->segno) + log->blkoff;
+	block = log->buf + (size_t)log->blkoff++ * F2FS_BLKSIZE;
+	img->valid_blocks++;
+
+	/* a hole after file blocks scatters files and segments alike */
+	if(type == CURSEG_WARM_DATA && log->blkoff < MKIMG_BLKS_PER_SEG &&
+			img->opts->frag > 0 && next_rand(img) % 100 < img->opts->frag) {
+		log->blkoff++;
+	}
+	return block;
+}
+
+static int alloc_nid(struct image *img, nid_t *nid)
+{
+	if(img->next_nid >= img->max_nid) {
+		printf("mkimg: out of nids at %u\n", img->next_nid);
+		return -ENOSPC;
+	}
+	*nid = img->next_nid++;
+	return 0;
+}
+
+static int write_node(struct image *img, int type, struct page *page)
+{
+	struct f2fs_node *rn = F2FS_NODE(page);
+	struct f2fs_nat_entry *ne = NULL;
+	block_t blkaddr = 0;
+	char *block = NULL;
+
+	block = alloc_block(img, type, nid_of_node(page), 0, &blkaddr);
+	if(block == NULL) {
+		return -ENOSPC;
+	}
+
+	rn->footer.cp_ver = cpu_to_le64(MKIMG_CP_VER);
+	rn->footer.next_blkaddr = cpu_to_le32(blkaddr + 1);
+	memcpy(block, rn, F2FS_BLKSIZE);
+
+	ne = nat_entry(img, nid_of_node(page));
+	ne->ino = rn->footer.ino;
+	ne->block_addr = cpu_to_le32(blkaddr);
+	ne->version = 0;
+
+	img->valid_nodes++;
+	img->valid_inodes += IS_INODE(page);
+	return 0;
+}
+
+static void init_inode(struct image *img, struct page *page, nid_t ino,
+		nid_t pino, const char *name, unsigned int mode)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(page)->i;
+	int len = strlen(name);
+
+	memset(page_address(page), 0, F2FS_PAGE_SIZE);
+	ri->i_mode = cpu_to_le16(mode);
+	ri->i_inline = F2FS_INLINE_XATTR;
+	ri->i_links = cpu_to_le32(S_ISDIR(mode) ? 2 : 1);
+	ri->i_blocks = cpu_to_le64(1);
+	ri->i_atime = cpu_to_le64(MKIMG_TIME);
+	ri->i_ctime = ri->i_atime;
+	ri->i_mtime = ri->i_atime;
+	ri->i_generation = cpu_to_le32(next_rand(img));
+	ri->i_pino = cpu_to_le32(pino);
+	ri->i_namelen = cpu_to_le32(len);
+	memcpy(ri->i_name, name, len);
+	fill_node_footer(page, ino, ino, 0, 0);
+}
+
+/* block idx of ino reads back as a header line and a fill byte */
+static void fill_data(char *buf, size_t len, nid_t ino, unsigned int idx)
+{
+	char line[64];
+	int n = 0;
+
+	memset(buf, 'a' + (ino + idx) % 26, len);
+	n = snprintf(line, sizeof(line), "ino %u block %u\n", ino, idx);
+	memcpy(buf, line, (size_t)n < len ? (size_t)n : len);
+}
+
+static int write_file(struct image *img, nid_t ino, nid_t pino, const char *name)
+{
+	struct page *ipage = img->ipage, *dpage = img->dpage;
+	struct f2fs_raw_inode *ri = &F2FS_NODE(ipage)->i;
+	unsigned int nr = img->opts->blocks, addrs = 0, ndn = 0, ofs = 0, i = 0;
+	block_t blkaddr = 0;
+	nid_t nid = ino;
+	char *block = NULL;
+	int ret = 0;
+
+	init_inode(img, ipage, ino, pino, name, S_IFREG | 0644);
+	img->files++;
+	if(nr == 0) {
+		ri->i_inline |= F2FS_INLINE_DATA | F2FS_DATA_EXIST;
+		ri->i_size = cpu_to_le64(MKIMG_INLINE_SIZE);
+		fill_data(inline_data_addr(ri), MKIMG_INLINE_SIZE, ino, 0);
+		return write_node(img, CURSEG_WARM_NODE, ipage);
+	}
+
+	addrs = addrs_per_inode(img->raw_super, ri);
+	for(i=0; i<nr; i++) {
+		ofs = i;
+		if(i >= addrs) {
+			ofs = (i - addrs) % DEF_ADDRS_PER_BLOCK;
+			if(ofs == 0) {
+				if(ndn > 0) {
+					ret = write_node(img, CURSEG_WARM_NODE, dpage);
+					if(ret < 0) {
+						return ret;
+					}
+				}
+
+				ret = alloc_nid(img, &nid);
+				if(ret < 0) {
+					return ret;
+				}
+				memset(page_address(dpage), 0, F2FS_PAGE_SIZE);
+				fill_node_footer(dpage, nid, ino, 1 + ndn, 0);
+				ri->i_nid[ndn++] = cpu_to_le32(nid);
+			}
+		}
+
+		block = alloc_block(img, CURSEG_WARM_DATA, nid, ofs, &blkaddr);
+		if(block == NULL) {
+			return -ENOSPC;
+		}
+		fill_data(block, F2FS_BLKSIZE, ino, i);
+
+		if(i < addrs) {
+			ri->i_addr[i] = cpu_to_le32(blkaddr);
+		} else {
+			F2FS_NODE(dpage)->dn.addr[ofs] = cpu_to_le32(blkaddr);
+		}
+	}
+
+	if(ndn > 0) {
+		ret = write_node(img, CURSEG_WARM_NODE, dpage);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	ri->i_blocks = cpu_to_le64(1 + nr + ndn);
+	ri->i_size = cpu_to_le64((unsigned long long)nr * F2FS_BLKSIZE);
+	return write_node(img, CURSEG_WARM_NODE, ipage);
+}
+
+static int add_dentry(struct f2fs_dentry_ptr *d, struct mkimg_dentry *de)
+{
+	int len = strlen(de->name), bit_pos = 0;
+
+	bit_pos = f2fs_room_for_filename(d->bitmap, GET_DENTRY_SLOTS(len), d->max);
+	if(bit_pos >= d->max) {
+		return -ENOSPC;
+	}
+
+	f2fs_update_dentry(d, bit_pos, de->name, len, f2fs_dentry_hash(de->name, len),
+		de->ino, de->file_type);
+	return 0;
+}
+
+/* the bucket f2fs_add_link would choose, growing the depth the same way */
+static long place_dentry(struct page **blocks, unsigned int *depth,
+		struct mkimg_dentry *de)
+{
+	f2fs_hash_t hash = f2fs_dentry_hash(de->name, strlen(de->name));
+	struct f2fs_dentry_ptr d;
+	unsigned long start = 0, bidx = 0;
+	unsigned int level = 0;
+
+	for(level=0; level<MKIMG_DIR_LEVELS; level++) {
+		if(level == *depth) {
+			(*depth)++;
+		}
+
+		start = dir_block_index(level, 0, le32_to_cpu(hash) % dir_buckets(level, 0));
+		for(bidx=start; bidx<start+bucket_blocks(level); bidx++) {
+			if(blocks[bidx] == NULL) {
+				blocks[bidx] = alloc_page();
+				if(blocks[bidx] == NULL) {
+					perror("alloc page");
+					return -ENOMEM;
+				}
+				memset(page_address(blocks[bidx]), 0, F2FS_PAGE_SIZE);
+			}
+
+			make_dentry_ptr_block(&d, page_address(blocks[bidx]));
+			if(add_dentry(&d, de) == 0) {
+				return bidx;
+			}
+		}
+	}
+	return -ENOSPC;
+}
+
+static int write_dentry_blocks(struct image *img, struct page *page,
+		struct mkimg_dentry *ents, unsigned int n)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(page)->i;
+	unsigned long nblocks = dir_block_index(MKIMG_DIR_LEVELS, 0, 0), last = 0, i = 0;
+	nid_t ino = nid_of_node(page);
+	struct page **blocks = NULL;
+	struct f2fs_dentry_ptr d;
+	unsigned int depth = 1, nr = 0;
+	block_t blkaddr = 0;
+	char *block = NULL;
+	long bidx = 0;
+	int ret = 0;
+
+	blocks = malloc(nblocks * sizeof(struct page *));
+	if(blocks == NULL) {
+		perror("malloc");
+		return -ENOMEM;
+	}
+	memset(blocks, 0, nblocks * sizeof(struct page *));
+
+	blocks[0] = alloc_page();
+	if(blocks[0] == NULL) {
+		perror("alloc page");
+		ret = -ENOMEM;
+		goto out;
+	}
+	memset(page_address(blocks[0]), 0, F2FS_PAGE_SIZE);
+	make_dentry_ptr_block(&d, page_address(blocks[0]));
+	f2fs_update_dentry(&d, 0, ".", 1, F2FS_DOT_HASH, ino, F2FS_FT_DIR);
+	f2fs_update_dentry(&d, 1, "..", 2, F2FS_DDOT_HASH, le32_to_cpu(ri->i_pino),
+		F2FS_FT_DIR);
+
+	for(i=0; i<n; i++) {
+		bidx = place_dentry(blocks, &depth, &ents[i]);
+		if(bidx < 0) {
+			printf("mkimg: dir %u can not hold %u entries\n", ino, n);
+			ret = bidx;
+			goto out;
+		}
+		last = (unsigned long)bidx > last ? (unsigned long)bidx : last;
+	}
+
+	for(i=0; i<=last; i++) {
+		if(blocks[i] == NULL) {
+			continue;
+		}
+
+		block = alloc_block(img, CURSEG_HOT_DATA, ino, i, &blkaddr);
+		if(block == NULL) {
+			ret = -ENOSPC;
+			goto out;
+		}
+		memcpy(block, page_address(blocks[i]), F2FS_PAGE_SIZE);
+		ri->i_addr[i] = cpu_to_le32(blkaddr);
+		nr++;
+	}
+
+	ri->i_blocks = cpu_to_le64(1 + nr);
+	ri->i_size = cpu_to_le64((unsigned long long)(last + 1) * F2FS_BLKSIZE);
+	ri->i_current_depth = cpu_to_le32(depth);
+
+out:
+	for(i=0; i<nblocks; i++) {
+		if(blocks[i] != NULL) {
+			free_page(blocks[i]);
+		}
+	}
+	free(blocks);
+	return ret;
+}
+
+/* inline while every entry fits, dentry blocks otherwise */
+static int add_dentries(struct image *img, struct page *page,
+		struct mkimg_dentry *ents, unsigned int n)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(page)->i;
+	struct f2fs_dentry_ptr d;
+	unsigned int i = 0;
+
+	if(!img->opts->block_dentries) {
+		ri->i_inline |= F2FS_INLINE_DENTRY;
+		f2fs_make_empty_dir(img->raw_super, page, nid_of_node(page), le32_to_cpu(ri->i_pino));
+		make_dentry_ptr_inline(img->raw_super, &d, ri);
+		for(i=0; i<n && add_dentry(&d, &ents[i]) == 0; i++) {
+		}
+
+		if(i == n) {
+			ri->i_size = cpu_to_le64(MAX_INLINE_DATA(img->raw_super, ri));
+			ri->i_current_depth = cpu_to_le32(1);
+			return 0;
+		}
+
+		memset(inline_data_addr(ri), 0, MAX_INLINE_DATA(img->raw_super, ri));
+		ri->i_inline &= ~F2FS_INLINE_DENTRY;
+	}
+	return write_dentry_blocks(img, page, ents, n);
+}
+
+/* children first, so the inode of a dir follows everything it names */
+static int write_dir(struct image *img, nid_t ino, nid_t pino, const char *name,
+		unsigned int level)
+{
+	struct mkimg_opts *opts = img->opts;
+	unsigned int nsub = level < opts->levels ? opts->fanout : 0;
+	unsigned int n = nsub + opts->files, i = 0;
+	struct mkimg_dentry *ents = NULL;
+	struct page *page = NULL;
+	int ret = 0;
+
+	ents = malloc((n + 1) * sizeof(struct mkimg_dentry));
+	page = alloc_page();
+	if(ents == NULL || page == NULL) {
+		perror("malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for(i=0; i<n; i++) {
+		ret = alloc_nid(img, &ents[i].ino);
+		if(ret < 0) {
+			goto out;
+		}
+
+		if(i < nsub) {
+			snprintf(ents[i].name, MKIMG_NAME_LEN, "dir%04u", i);
+			ents[i].file_type = F2FS_FT_DIR;
+			ret = write_dir(img, ents[i].ino, ino, ents[i].name, level + 1);
+		} else {
+			snprintf(ents[i].name, MKIMG_NAME_LEN, "file%06u", i - nsub);
+			ents[i].file_type = F2FS_FT_REG_FILE;
+			ret = write_file(img, ents[i].ino, ino, ents[i].name);
+		}
+		if(ret < 0) {
+			goto out;
+		}
+	}
+
+	init_inode(img, page, ino, pino, name, S_IFDIR | 0755);
+	F2FS_NODE(page)->i.i_links = cpu_to_le32(2 + nsub);
+	ret = add_dentries(img, page, ents, n);
+	if(ret == 0) {
+		ret = write_node(img, CURSEG_HOT_NODE, page);
+	}
+	img->dirs++;
+
+out:
+	if(page != NULL) {
+		free_page(page);
+	}
+	free(ents);
+	return ret;
+}
+
+static unsigned long long estimate_nids(struct mkimg_opts *opts)
+{
+	unsigned long long dirs = 1, level_dirs = 1, dnodes = 0;
+	unsigned int i = 0;
+
+	for(i=0; i<opts->levels && dirs < (1ULL << 32); i++) {
+		level_dirs *= opts->fanout;
+		dirs += level_dirs;
+	}
+
+	if(opts->blocks > MKIMG_ADDRS_PER_INODE) {
+		dnodes = (opts->blocks - MKIMG_ADDRS_PER_INODE + DEF_ADDRS_PER_BLOCK - 1) /
+			DEF_ADDRS_PER_BLOCK;
+	}
+	return F2FS_RESERVED_NODE_NUM + 1 + dirs + dirs * opts->files * (1 + dnodes);
+}
+
+static int layout(struct image *img)
+{
+	struct mkimg_opts *opts = img->opts;
+	struct f2fs_super_block *raw_super = img->raw_super;
+	unsigned long long total = opts->size / F2FS_BLKSIZE, nids = estimate_nids(opts);
+	unsigned int segs = 0, ssa_segs = 0, i = 0;
+	block_t blkaddr = 0;
+
+	if(total < MKIMG_SEG0_BLKADDR + 16 * MKIMG_BLKS_PER_SEG) {
+		printf("mkimg: %llu MB is too small\n", opts->size >> 20);
+		return -EINVAL;
+	}
+
+	segs = (total - MKIMG_SEG0_BLKADDR) / MKIMG_BLKS_PER_SEG;
+	img->sit_segs = ((segs + SIT_ENTRY_PER_BLOCK - 1) / SIT_ENTRY_PER_BLOCK +
+		MKIMG_BLKS_PER_SEG - 1) / MKIMG_BLKS_PER_SEG;
+	img->nat_segs = (nids + (unsigned long long)MKIMG_BLKS_PER_SEG * NAT_ENTRY_PER_BLOCK - 1) /
+		((unsigned long long)MKIMG_BLKS_PER_SEG * NAT_ENTRY_PER_BLOCK);
+	ssa_segs = (segs + MKIMG_BLKS_PER_SEG - 1) / MKIMG_BLKS_PER_SEG;
+
+	/* both version bitmaps have to fit the checkpoint block */
+	if((unsigned long long)(img->sit_segs + img->nat_segs) * MKIMG_BLKS_PER_SEG / BITS_PER_BYTE >
+			CP_CHKSUM_OFFSET - CP_MIN_CHKSUM_OFFSET ||
+			2 + 2 * img->sit_segs + 2 * img->nat_segs + ssa_segs +
+			MKIMG_OVP_SEGS + NR_CURSEG_TYPE >= segs) {
+		printf("mkimg: %llu nodes do not fit %llu MB\n", nids, opts->size >> 20);
+		return -EINVAL;
+	}
+
+	img->main_segs = segs - 2 - 2 * img->sit_segs - 2 * img->nat_segs - ssa_segs;
+	img->user_segs = img->main_segs - MKIMG_OVP_SEGS;
+	img->max_nid = img->nat_segs * MKIMG_BLKS_PER_SEG * NAT_ENTRY_PER_BLOCK;
+
+	raw_super->magic = cpu_to_le32(F2FS_SUPER_MAGIC);
+	raw_super->major_ver = cpu_to_le16(1);
+	raw_super->minor_ver = cpu_to_le16(16);
+	raw_super->log_sectorsize = cpu_to_le32(9);
+	raw_super->log_sectors_per_block = cpu_to_le32(F2FS_LOG_SECTORS_PER_BLOCK);
+	raw_super->log_blocksize = cpu_to_le32(F2FS_BLKSIZE_BITS);
+	raw_super->log_blocks_per_seg = cpu_to_le32(MKIMG_LOG_BLOCKS_PER_SEG);
+	raw_super->segs_per_sec = cpu_to_le32(1);
+	raw_super->secs_per_zone = cpu_to_le32(1);
+	raw_super->block_count = cpu_to_le64(total);
+	raw_super->segment_count = cpu_to_le32(segs);
+	raw_super->segment_count_ckpt = cpu_to_le32(2);
+	raw_super->segment_count_sit = cpu_to_le32(2 * img->sit_segs);
+	raw_super->segment_count_nat = cpu_to_le32(2 * img->nat_segs);
+	raw_super->segment_count_ssa = cpu_to_le32(ssa_segs);
+	raw_super->segment_count_main = cpu_to_le32(img->main_segs);
+	raw_super->section_count = cpu_to_le32(img->main_segs);
+
+	blkaddr = MKIMG_SEG0_BLKADDR;
+	raw_super->segment0_blkaddr = cpu_to_le32(blkaddr);
+	raw_super->cp_blkaddr = cpu_to_le32(blkaddr);
+	blkaddr += 2 * MKIMG_BLKS_PER_SEG;
+	raw_super->sit_blkaddr = cpu_to_le32(blkaddr);
+	blkaddr += 2 * img->sit_segs * MKIMG_BLKS_PER_SEG;
+	raw_super->nat_blkaddr = cpu_to_le32(blkaddr);
+	blkaddr += 2 * img->nat_segs * MKIMG_BLKS_PER_SEG;
+	raw_super->ssa_blkaddr = cpu_to_le32(blkaddr);
+	blkaddr += ssa_segs * MKIMG_BLKS_PER_SEG;
+	raw_super->main_blkaddr = cpu_to_le32(blkaddr);
+
+	raw_super->root_ino = cpu_to_le32(F2FS_RESERVED_NODE_NUM);
+	raw_super->node_ino = cpu_to_le32(1);
+	raw_super->meta_ino = cpu_to_le32(2);
+	for(i=0; i<sizeof(raw_super->uuid); i++) {
+		raw_super->uuid[i] = next_rand(img);
+	}
+	strcpy((char *)raw_super->version, "myf2fs mkimg");
+	strcpy((char *)raw_super->init_version, "myf2fs mkimg");
+	return 0;
+}
+
+static void *zalloc(size_t size)
+{
+	void *ptr = malloc(size);
+
+	if(ptr != NULL) {
+		memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+static int init_image(struct image *img)
+{
+	int ret = 0, type = 0;
+
+	img->rand = img->opts->seed ? img->opts->seed : 1;
+	img->raw_super = zalloc(sizeof(struct f2fs_super_block));
+	if(img->raw_super == NULL) {
+		perror("malloc");
+		return -ENOMEM;
+	}
+
+	ret = layout(img);
+	if(ret < 0) {
+		return ret;
+	}
+
+	img->sit = zalloc((size_t)img->sit_segs * MKIMG_BLKS_PER_SEG * F2FS_BLKSIZE);
+	img->nat = zalloc((size_t)img->nat_segs * MKIMG_BLKS_PER_SEG * F2FS_BLKSIZE);
+	img->ssa = zalloc((size_t)img->main_segs * F2FS_BLKSIZE);
+	img->ipage = alloc_page();
+	img->dpage = alloc_page();
+	if(img->sit == NULL || img->nat == NULL || img->ssa == NULL ||
+			img->ipage == NULL || img->dpage == NULL) {
+		perror("malloc");
+		return -ENOMEM;
+	}
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		img->logs[type].buf = zalloc((size_t)MKIMG_BLKS_PER_SEG * F2FS_BLKSIZE);
+		if(img->logs[type].buf == NULL) {
+			perror("malloc");
+			return -ENOMEM;
+		}
+		img->logs[type].segno = img->next_segno++;
+	}
+
+	/* the node and meta inodes have no node blocks */
+	nat_entry(img, 1)->ino = cpu_to_le32(1);
+	nat_entry(img, 1)->block_addr = cpu_to_le32(1);
+	nat_entry(img, 2)->ino = cpu_to_le32(2);
+	nat_entry(img, 2)->block_addr = cpu_to_le32(1);
+	img->next_nid = F2FS_RESERVED_NODE_NUM + 1;
+	return 0;
+}
+
+static void destroy_image(struct image *img)
+{
+	int type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		free(img->logs[type].buf);
+	}
+	if(img->ipage != NULL) {
+		free_page(img->ipage);
+	}
+	if(img->dpage != NULL) {
+		free_page(img->dpage);
+	}
+	free(img->ssa);
+	free(img->nat);
+	free(img->sit);
+	free(img->raw_super);
+}
+
+/* the newest nat entries and the open segments first go to the journals */
+static void fill_journals(struct image *img, struct f2fs_journal *nat_j,
+		struct f2fs_journal *sit_j)
+{
+	struct f2fs_nat_entry *ne = NULL;
+	struct f2fs_sit_entry *se = NULL;
+	unsigned int n = 0, segno = 0;
+	int type = 0;
+	nid_t nid = 0;
+
+	for(nid=img->next_nid-1; nid>F2FS_RESERVED_NODE_NUM &&
+			n<img->opts->nat_journal; nid--) {
+		ne = nat_entry(img, nid);
+		if(ne->block_addr == 0) {
+			continue;
+		}
+		nat_j->nat_j.entries[n].nid = cpu_to_le32(nid);
+		nat_j->nat_j.entries[n].ne = *ne;
+		memset(ne, 0, sizeof(struct f2fs_nat_entry));
+		n++;
+	}
+	nat_j->n_nats = cpu_to_le16(n);
+
+	n = 0;
+	for(type=0; type<NR_CURSEG_TYPE && n<img->opts->sit_journal; type++) {
+		segno = img->logs[type].segno;
+		sit_j->sit_j.entries[n].segno = cpu_to_le32(segno);
+		sit_j->sit_j.entries[n].se = *sit_entry(img, segno);
+		memset(sit_entry(img, segno), 0, sizeof(struct f2fs_sit_entry));
+		n++;
+	}
+
+	for(segno=img->next_segno; segno>0 && n<img->opts->sit_journal; segno--) {
+		se = sit_entry(img, segno - 1);
+		if(se->vblocks == 0) {
+			continue;
+		}
+		sit_j->sit_j.entries[n].segno = cpu_to_le32(segno - 1);
+		sit_j->sit_j.entries[n].se = *se;
+		memset(se, 0, sizeof(struct f2fs_sit_entry));
+		n++;
+	}
+	sit_j->n_sits = cpu_to_le16(n);
+}
+
+/* full and empty bits of every nat block, at the end of the cp segment */
+static int write_nat_bits(struct image *img, struct f2fs_checkpoint *cp,
+		unsigned int cp_blocks)
+{
+	unsigned int nat_blocks = img->nat_segs * MKIMG_BLKS_PER_SEG;
+	unsigned int bytes = nat_blocks / BITS_PER_BYTE;
+	unsigned int nr = F2FS_BLK_ALIGN(2 * bytes + sizeof(__le64));
+	struct f2fs_nat_bitmap *nat_bits = NULL;
+	struct f2fs_nat_block *blk = NULL;
+	unsigned int index = 0, valid = 0, i = 0;
+	int ret = 0;
+
+	if(cp_blocks + nr > MKIMG_BLKS_PER_SEG) {
+		printf("nat_bits of %u blocks do not fit the cp segment\n", nr);
+		return -ENOSPC;
+	}
+
+	nat_bits = zalloc((size_t)nr * F2FS_BLKSIZE);
+	if(nat_bits == NULL) {
+		perror("malloc");
+		return -ENOMEM;
+	}
+	nat_bits->cp_checksum = cpu_to_le64(cur_cp_checksum(cp));
+
+	for(index=0; index<nat_blocks; index++) {
+		blk = (struct f2fs_nat_block *)(img->nat + (size_t)index * F2FS_BLKSIZE);
+		valid = 0;
+		i = 0;
+		/* nid 0 is reserved and counts as used */
+		if(index == 0) {
+			valid = 1;
+			i = 1;
+		}
+		for(; i<NAT_ENTRY_PER_BLOCK; i++) {
+			if(blk->entries[i].block_addr != 0) {
+				valid++;
+			}
+		}
+		if(valid == 0) {
+			set_bit_le(index, nat_bits->bitmap + bytes);
+		} else if(valid == NAT_ENTRY_PER_BLOCK) {
+			set_bit_le(index, nat_bits->bitmap);
+		}
+	}
+
+	ret = write_blocks(img->fd, nat_bits, le32_to_cpu(img->raw_super->cp_blkaddr) +
+		MKIMG_BLKS_PER_SEG - nr, nr);
+	free(nat_bits);
+	return ret;
+}
+
+/* cp, three data and three node summaries, cp again: a clean unmount */
+static int write_checkpoint(struct image *img)
+{
+	struct f2fs_checkpoint *cp = NULL;
+	struct f2fs_summary_block *sum = NULL;
+	unsigned int nr = 2 + 2 * NR_CURSEG_DATA_TYPE, i = 0;
+	char *pack = NULL;
+	int ret = 0;
+
+	pack = zalloc((size_t)nr * F2FS_BLKSIZE);
+	if(pack == NULL) {
+		perror("malloc");
+		return -ENOMEM;
+	}
+
+	sum = (struct f2fs_summary_block *)(pack + F2FS_BLKSIZE);
+	for(i=0; i<NR_CURSEG_TYPE; i++) {
+		memcpy(&sum[i], &img->ssa[img->logs[i].segno], F2FS_BLKSIZE);
+		memset(&sum[i].journal, 0, sizeof(struct f2fs_journal));
+		sum[i].footer.entry_type = i < CURSEG_HOT_NODE ? SUM_TYPE_DATA : SUM_TYPE_NODE;
+	}
+	fill_journals(img, &sum[CURSEG_HOT_DATA].journal, &sum[CURSEG_COLD_DATA].journal);
+
+	cp = (struct f2fs_checkpoint *)pack;
+	cp->checkpoint_ver = cpu_to_le64(MKIMG_CP_VER);
+	cp->user_block_count = cpu_to_le64((unsigned long long)img->user_segs *
+		MKIMG_BLKS_PER_SEG);
+	cp->valid_block_count = cpu_to_le64(img->valid_blocks);
+	cp->rsvd_segment_count = cpu_to_le32(MKIMG_RSVD_SEGS);
+	cp->overprov_segment_count = cpu_to_le32(MKIMG_OVP_SEGS);
+	cp->free_segment_count = cpu_to_le32(img->main_segs - img->next_segno);
+	for(i=0; i<MAX_ACTIVE_NODE_LOGS; i++) {
+		cp->cur_node_segno[i] = cpu_to_le32(NULL_SEGNO);
+		cp->cur_data_segno[i] = cpu_to_le32(NULL_SEGNO);
+	}
+	for(i=0; i<NR_CURSEG_DATA_TYPE; i++) {
+		cp->cur_data_segno[i] = cpu_to_le32(img->logs[i].segno);
+		cp->cur_data_blkoff[i] = cpu_to_le16(img->logs[i].blkoff);
+		cp->cur_node_segno[i] = cpu_to_le32(img->logs[CURSEG_HOT_NODE + i].segno);
+		cp->cur_node_blkoff[i] = cpu_to_le16(img->logs[CURSEG_HOT_NODE + i].blkoff);
+	}
+	cp->ckpt_flags = cpu_to_le32(CP_UMOUNT_FLAG |
+		(img->opts->nat_bits ? CP_NAT_BITS_FLAG : 0));
+	cp->cp_pack_start_sum = cpu_to_le32(1);
+	cp->cp_pack_total_block_count = cpu_to_le32(nr);
+	cp->valid_node_count = cpu_to_le32(img->valid_nodes);
+	cp->valid_inode_count = cpu_to_le32(img->valid_inodes);
+	cp->next_free_nid = cpu_to_le32(img->next_nid);
+	cp->sit_ver_bitmap_bytesize = cpu_to_le32(img->sit_segs * MKIMG_BLKS_PER_SEG /
+		BITS_PER_BYTE);
+	cp->nat_ver_bitmap_bytesize = cpu_to_le32(img->nat_segs * MKIMG_BLKS_PER_SEG /
+		BITS_PER_BYTE);
+	cp->elapsed_time = cpu_to_le64(img->opts->elapsed);
+	cp->checksum_offset = cpu_to_le32(CP_CHKSUM_OFFSET);
+	*(__le32 *)(pack + CP_CHKSUM_OFFSET) = cpu_to_le32(
+		f2fs_cal_crc32(F2FS_SUPER_MAGIC, cp, CP_CHKSUM_OFFSET));
+	memcpy(pack + (size_t)(nr - 1) * F2FS_BLKSIZE, pack, F2FS_BLKSIZE);
+
+	ret = write_blocks(img->fd, pack, le32_to_cpu(img->raw_super->cp_blkaddr), nr);
+	if(ret == 0 && img->opts->nat_bits) {
+		ret = write_nat_bits(img, cp, nr);
+	}
+	free(pack);
+	return ret;
+}
+
+/* only the first copy of sit and nat is in use, everything past the last entry is a hole */
+static int write_meta(struct image *img)
+{
+	struct f2fs_super_block *raw_super = img->raw_super;
+	unsigned int nat_blocks = 0, i = 0, nr = 0;
+	char *sb = NULL;
+	int ret = 0;
+
+	ret = write_checkpoint(img);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = write_blocks(img->fd, img->sit, le32_to_cpu(raw_super->sit_blkaddr),
+		(img->next_segno + SIT_ENTRY_PER_BLOCK - 1) / SIT_ENTRY_PER_BLOCK);
+	if(ret < 0) {
+		return ret;
+	}
+
+	nat_blocks = img->next_nid / NAT_ENTRY_PER_BLOCK + 1;
+	for(i=0; i<img->nat_segs && i*MKIMG_BLKS_PER_SEG<nat_blocks; i++) {
+		nr = nat_blocks - i * MKIMG_BLKS_PER_SEG;
+		nr = nr < MKIMG_BLKS_PER_SEG ? nr : MKIMG_BLKS_PER_SEG;
+		ret = write_blocks(img->fd, img->nat + (size_t)i * MKIMG_BLKS_PER_SEG * F2FS_BLKSIZE,
+			le32_to_cpu(raw_super->nat_blkaddr) + 2 * i * MKIMG_BLKS_PER_SEG, nr);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	ret = write_blocks(img->fd, img->ssa, le32_to_cpu(raw_super->ssa_blkaddr),
+		img->next_segno);
+	if(ret < 0) {
+		return ret;
+	}
+
+	sb = zalloc(2 * F2FS_BLKSIZE);
+	if(sb == NULL) {
+		perror("malloc");
+		return -ENOMEM;
+	}
+	memcpy(sb + F2FS_SUPER_OFFSET, raw_super, sizeof(struct f2fs_super_block));
+	memcpy(sb + F2FS_BLKSIZE, sb, F2FS_BLKSIZE);
+	ret = write_blocks(img->fd, sb, 0, 2);
+	free(sb);
+	return ret;
+}
+
+static int make_image(const char *path, struct mkimg_opts *opts, struct image *img)
+{
+	int ret = 0, type = 0;
+
+	memset(img, 0, sizeof(struct image));
+	img->opts = opts;
+	img->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(img->fd < 0) {
+		perror("open");
+		return -errno;
+	}
+
+	ret = init_image(img);
+	if(ret < 0) {
+		goto out;
+	}
+
+	if(ftruncate(img->fd, opts->size) < 0) {
+		ret = -errno;
+		perror("ftruncate");
+		goto out;
+	}
+
+	ret = write_dir(img, F2FS_RESERVED_NODE_NUM, F2FS_RESERVED_NODE_NUM, "", 0);
+	if(ret < 0) {
+		goto out;
+	}
+
+	/* the open segments end at their blkoff, the rest stays a hole */
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		ret = write_blocks(img->fd, img->logs[type].buf,
+			seg_blkaddr(img, img->logs[type].segno), img->logs[type].blkoff);
+		if(ret < 0) {
+			goto out;
+		}
+	}
+
+	ret = write_meta(img);
+
+out:
+	destroy_image(img);
+	close(img->fd);
+	/* half an image would only mislead whoever picks it up */
+	if(ret < 0) {
+		unlink(path);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct mkimg_opts opts;
+	struct image img;
+	struct timespec begin, end;
+	double secs = 0;
+	int ret = 0;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.size = 256ULL << 20;
+	opts.fanout = 4;
+	opts.levels = 2;
+	opts.files = 32;
+	opts.blocks = 1;
+	opts.sit_journal = NR_CURSEG_TYPE;
+	opts.seed = 1;
+
+	for(argc--, argv++; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+		if(!strcmp(argv[0], "-B")) {
+			opts.block_dentries = 1;
+			continue;
+		}
+		if(!strcmp(argv[0], "-N")) {
+			opts.nat_bits = 1;
+			continue;
+		}
+		if(argc < 2) {
+			break;
+		}
+
+		if(!strcmp(argv[0], "-s")) {
+			opts.size = strtoull(argv[1], NULL, 0) << 20;
+		} else if(!strcmp(argv[0], "-d")) {
+			opts.fanout = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-l")) {
+			opts.levels = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-f")) {
+			opts.files = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-b")) {
+			opts.blocks = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-F")) {
+			opts.frag = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-n")) {
+			opts.nat_journal = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-t")) {
+			opts.sit_journal = atoi(argv[1]);
+		} else if(!strcmp(argv[0], "-r")) {
+			opts.seed = strtoul(argv[1], NULL, 0);
+		} else if(!strcmp(argv[0], "-e")) {
+			opts.elapsed = strtoull(argv[1], NULL, 0);
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
+
+	/* an option left over is unknown or lacks its value, never an image */
+	if(argc != 1 || argv[0][0] == '-' ||
+			opts.blocks > MKIMG_MAX_BLOCKS || opts.frag > 90 ||
+			opts.nat_journal > NAT_JOURNAL_ENTRIES ||
+			(opts.nat_bits && opts.nat_journal > 0) ||
+			opts.sit_journal > SIT_JOURNAL_ENTRIES) {
+		usage();
+		return -EINVAL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	ret = make_image(argv[0], &opts, &img);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+	if(ret == 0) {
+		printf("%s: %u dirs, %u files, %llu blocks in %u of %u segments, %.2fs\n",
+			argv[0], img.dirs, img.files, img.valid_blocks, img.next_segno,
+			img.main_segs, secs);
+	}
+
+	if(malloc_count != 0) {
+		BUG("BUG: The memory malloc count: %d\n", malloc_count);
+	}
+	return ret;
+}
@@ -0,0 +1,83 @@
+#ifndef __MYF2FS_H__
+#define __MYF2FS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Read-only access to an f2fs image for programs that embed the reader.
+ * One handle may be used from any number of threads at the same time.
+ * Calls return 0 or a negative errno.
+ */
+typedef struct myf2fs myf2fs_t;
+
+struct myf2fs_stat {
+	uint32_t ino;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t links;
+	uint64_t size;
+	uint64_t blocks;	/* 4k blocks, node blocks included */
+	uint64_t atime;
+	uint64_t mtime;
+	uint64_t ctime;
+};
+
+/* type is one of the F2FS_FT_* dentry types, nonzero return stops the walk */
+typedef int (*myf2fs_filldir_t)(void *arg, const char *name, int len,
+		uint32_t ino, unsigned char type);
+
+int myf2fs_open(const char *dev, myf2fs_t **fs);
+/* returns the allocations the handle still held, 0 when it was clean */
+int myf2fs_close(myf2fs_t *fs);
+
+uint32_t myf2fs_root(myf2fs_t *fs);
+int myf2fs_lookup(myf2fs_t *fs, uint32_t dir, const char *name, int len,
+		uint32_t *ino);
+int myf2fs_lookup_path(myf2fs_t *fs, const char *path, uint32_t *ino);
+int myf2fs_stat(myf2fs_t *fs, uint32_t ino, struct myf2fs_stat *st);
+int myf2fs_readdir(myf2fs_t *fs, uint32_t dir, myf2fs_filldir_t filldir,
+		void *arg);
+ssize_t myf2fs_read(myf2fs_t *fs, uint32_t ino, void *buf, size_t count,
+		uint64_t offset);
+
+/* allocations currently held on behalf of the handle */
+int myf2fs_alloc_count(myf2fs_t *fs);
+
+/*
+ * I/O, cache and allocation counters of the whole process, kept per thread
+ * and summed here, per operation: other, mount, lookup, readdir, stat, read
+ * and checkpoint. Counting is off until myf2fs_stats_enable(1).
+ */
+#define MYF2FS_LAT_BUCKETS	32
+
+struct myf2fs_op_stats {
+	uint64_t ops;
+	uint64_t reads;			/* syscalls */
+	uint64_t read_blocks;
+	uint64_t read_bytes;
+	uint64_t read_ns;
+	uint64_t writes;		/* syscalls */
+	uint64_t write_blocks;
+	uint64_t hits[4];		/* nat, node, dentry and path cache */
+	uint64_t misses[4];
+	uint64_t allocs[3];		/* below a page, a page, above a page */
+	uint64_t alloc_bytes[3];
+	uint64_t read_lat[MYF2FS_LAT_BUCKETS];	/* [2^i, 2^(i+1)) ns */
+};
+
+void myf2fs_stats_enable(int on);
+void myf2fs_stats_reset(void);
+/* the name of operation op counting from 0, NULL past the last one */
+const char *myf2fs_stats_get(int op, struct myf2fs_op_stats *st);
+
+/*
+ * Record mount phases, lookups, readdirs and reads of all threads and write
+ * them to path as Chrome trace JSON on myf2fs_trace_stop(), which must only
+ * be called once the traced calls have returned.
+ */
+int myf2fs_trace_start(const char *path);
+int myf2fs_trace_stop(void);
+
+#endif /*__MYF2FS_H__*/
@@ -0,0 +1,73 @@
+#ifndef __MYF2FS_PROTO_H__
+#define __MYF2FS_PROTO_H__
+
+#include <stdint.h>
+
+/*
+ * Wire format of myf2fsd, all fields little endian and packed.
+ *
+ * A client sends a frame holding a batch of requests and gets back one
+ * frame with a reply for each, in the same order:
+ *
+ *   frame:   struct myf2fs_frame, then len bytes of records
+ *   request: struct myf2fs_req, then name_len bytes of name
+ *   reply:   struct myf2fs_rep, then len bytes of payload
+ *
+ * Payloads by op:
+ *   LOOKUP   u32 ino. A zero ino in the request resolves name as a path
+ *            from the root, otherwise name is looked up in dir ino.
+ *   STAT     struct myf2fs_wire_stat
+ *   READDIR  entries from index offset on, at most count of them (0 means
+ *            as many as fit), each struct myf2fs_wire_dirent and its name.
+ *            status is the number of entries sent.
+ *   READ     up to count bytes of ino from offset, status is the length.
+ */
+
+#define MYF2FS_MAX_FRAME	(4 << 20)	/* largest frame either way */
+#define MYF2FS_MAX_BATCH	4096		/* records per frame */
+
+enum {
+	MYF2FS_OP_LOOKUP = 1,
+	MYF2FS_OP_STAT,
+	MYF2FS_OP_READDIR,
+	MYF2FS_OP_READ,
+};
+
+struct myf2fs_frame {
+	uint32_t len;		/* bytes of records behind the header */
+	uint32_t nr;		/* records in the batch */
+} __attribute__((packed));
+
+struct myf2fs_req {
+	uint16_t op;
+	uint16_t name_len;
+	uint32_t ino;
+	uint64_t offset;
+	uint32_t count;
+} __attribute__((packed));
+
+struct myf2fs_rep {
+	int32_t status;		/* negative errno on failure */
+	uint32_t len;		/* payload bytes */
+} __attribute__((packed));
+
+struct myf2fs_wire_stat {
+	uint32_t ino;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t links;
+	uint64_t size;
+	uint64_t blocks;
+	uint64_t atime;
+	uint64_t mtime;
+	uint64_t ctime;
+} __attribute__((packed));
+
+struct myf2fs_wire_dirent {
+	uint32_t ino;
+	uint8_t type;
+	uint8_t name_len;
+} __attribute__((packed));
+
+#endif /*__MYF2FS_PROTO_H__*/
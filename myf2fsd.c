@@ -0,0 +1,686 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "myf2fs.h"
+#include "myf2fs_proto.h"
+#include "f2fs_endian.h"
+
+/*
+ * Mount an image once and answer batched queries on a unix socket. Every
+ * worker waits on the same epoll set; connections are armed one shot, so a
+ * connection is only ever served by one worker at a time while the node
+ * cache of the handle stays warm for all of them.
+ */
+
+#define DEFAULT_WORKERS		4
+#define MAX_WORKERS		256
+#define PATH_BUF_SIZE		4096
+
+enum {
+	CONN_LISTEN = 0,
+	CONN_STOP,
+	CONN_CLIENT,
+};
+
+struct conn {
+	struct conn *prev, *next;	/* every open client */
+	int kind;
+	int fd;
+	char *in;
+	size_t in_len, in_size;
+	int eof;			/* the client shut down its side */
+	char *out;
+	size_t out_len, out_size;
+	size_t out_sent;		/* of out_len, the rest waits for EPOLLOUT */
+};
+
+struct server {
+	myf2fs_t *fs;
+	int epfd;
+	struct conn listener, stop;
+	pthread_mutex_t lock;		/* protects clients */
+	struct conn clients;
+	unsigned long frames, records;
+};
+
+static int stop_fd = -1;
+
+static void usage()
+{
+	printf("myf2fsd dev socket [workers]\n");
+}
+
+static void on_signal(int sig)
+{
+	unsigned long long one = 1;
+
+	if(write(stop_fd, &one, sizeof(one)) < 0) {
+		/* nothing to be done in a handler */
+	}
+}
+
+static int arm(struct server *srv, struct conn *c, int op, int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = c;
+	if(epoll_ctl(srv->epfd, op, c->fd, &ev) < 0) {
+		perror("epoll_ctl");
+		return -errno;
+	}
+	return 0;
+}
+
+static void close_conn(struct server *srv, struct conn *c)
+{
+	pthread_mutex_lock(&srv->lock);
+	c->prev->next = c->next;
+	c->next->prev = c->prev;
+	pthread_mutex_unlock(&srv->lock);
+
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->in);
+	free(c->out);
+	free(c);
+}
+
+static void accept_conns(struct server *srv)
+{
+	struct conn *c = NULL;
+	int fd = 0;
+
+	while((fd = accept4(srv->listener.fd, NULL, NULL,
+			SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		c = calloc(1, sizeof(struct conn));
+		if(c == NULL) {
+			close(fd);
+			continue;
+		}
+		c->kind = CONN_CLIENT;
+		c->fd = fd;
+
+		pthread_mutex_lock(&srv->lock);
+		c->next = srv->clients.next;
+		c->prev = &srv->clients;
+		srv->clients.next->prev = c;
+		srv->clients.next = c;
+		pthread_mutex_unlock(&srv->lock);
+
+		if(arm(srv, c, EPOLL_CTL_ADD, EPOLLIN) < 0) {
+			close_conn(srv, c);
+		}
+	}
+
+	if(errno != EAGAIN && errno != EWOULDBLOCK) {
+		perror("accept4");
+	}
+	arm(srv, &srv->listener, EPOLL_CTL_MOD, EPOLLIN);
+}
+
+static int grow(char **buf, size_t *size, size_t need)
+{
+	size_t new_size = *size ? *size : 4096;
+	char *new = NULL;
+
+	if(need <= *size) {
+		return 0;
+	}
+
+	while(new_size < need) {
+		new_size <<= 1;
+	}
+
+	new = realloc(*buf, new_size);
+	if(new == NULL) {
+		return -ENOMEM;
+	}
+	*buf = new;
+	*size = new_size;
+	return 0;
+}
+
+/* room for n more reply bytes, NULL when out of memory */
+static void *out_reserve(struct conn *c, size_t n)
+{
+	void *p = NULL;
+
+	if(grow(&c->out, &c->out_size, c->out_len + n) < 0) {
+		return NULL;
+	}
+	p = c->out + c->out_len;
+	c->out_len += n;
+	return p;
+}
+
+struct dirent_ctx {
+	struct conn *c;
+	uint64_t index, start;
+	uint32_t max, sent;
+	size_t budget;
+	int nomem;
+};
+
+static int fill_dirent(void *arg, const char *name, int len, uint32_t ino,
+		unsigned char type)
+{
+	struct dirent_ctx *ctx = arg;
+	struct myf2fs_wire_dirent *de = NULL;
+
+	if(ctx->index++ < ctx->start) {
+		return 0;
+	}
+
+	if(sizeof(*de) + len > ctx->budget) {
+		return 1;
+	}
+
+	de = out_reserve(ctx->c, sizeof(*de) + len);
+	if(de == NULL) {
+		ctx->nomem = 1;
+		return 1;
+	}
+	de->ino = cpu_to_le32(ino);
+	de->type = type;
+	de->name_len = len;
+	memcpy(de + 1, name, len);
+	ctx->budget -= sizeof(*de) + len;
+
+	ctx->sent++;
+	return ctx->max != 0 && ctx->sent >= ctx->max;
+}
+
+/*
+ * Append the reply to one request. Payloads are cut to what still fits
+ * into the reply frame, which is only ever an error for a stat.
+ */
+static int handle_req(struct server *srv, struct conn *c, struct myf2fs_req *req,
+		const char *name, size_t frame_start)
+{
+	size_t rep_off = c->out_len, budget = 0;
+	struct myf2fs_wire_stat *ws = NULL;
+	struct myf2fs_rep *rep = NULL;
+	struct myf2fs_stat st;
+	struct dirent_ctx ctx;
+	char path[PATH_BUF_SIZE];
+	uint32_t ino = 0, wire_ino = 0;
+	ssize_t n = 0;
+	int32_t status = 0;
+	uint32_t len = 0;
+
+	if(out_reserve(c, sizeof(struct myf2fs_rep)) == NULL) {
+		return -ENOMEM;
+	}
+
+	budget = MYF2FS_MAX_FRAME + sizeof(struct myf2fs_frame) - (c->out_len - frame_start);
+	if(c->out_len - frame_start > MYF2FS_MAX_FRAME + sizeof(struct myf2fs_frame)) {
+		budget = 0;
+	}
+
+	switch(req->op) {
+	case MYF2FS_OP_LOOKUP:
+		if(req->ino == 0) {
+			if(req->name_len >= sizeof(path)) {
+				status = -ENAMETOOLONG;
+				break;
+			}
+			memcpy(path, name, req->name_len);
+			path[req->name_len] = '\0';
+			status = myf2fs_lookup_path(srv->fs, path, &ino);
+		} else {
+			status = myf2fs_lookup(srv->fs, req->ino, name, req->name_len, &ino);
+		}
+
+		if(status == 0) {
+			if(budget < sizeof(ino) || out_reserve(c, sizeof(ino)) == NULL) {
+				status = -ENOBUFS;
+				break;
+			}
+			wire_ino = cpu_to_le32(ino);
+			memcpy(c->out + c->out_len - sizeof(ino), &wire_ino, sizeof(ino));
+			len = sizeof(ino);
+		}
+		break;
+	case MYF2FS_OP_STAT:
+		status = myf2fs_stat(srv->fs, req->ino, &st);
+		if(status < 0) {
+			break;
+		}
+
+		if(budget < sizeof(*ws)) {
+			status = -ENOBUFS;
+			break;
+		}
+
+		ws = out_reserve(c, sizeof(*ws));
+		if(ws == NULL) {
+			return -ENOMEM;
+		}
+		ws->ino = cpu_to_le32(st.ino);
+		ws->mode = cpu_to_le32(st.mode);
+		ws->uid = cpu_to_le32(st.uid);
+		ws->gid = cpu_to_le32(st.gid);
+		ws->links = cpu_to_le32(st.links);
+		ws->size = cpu_to_le64(st.size);
+		ws->blocks = cpu_to_le64(st.blocks);
+		ws->atime = cpu_to_le64(st.atime);
+		ws->mtime = cpu_to_le64(st.mtime);
+		ws->ctime = cpu_to_le64(st.ctime);
+		len = sizeof(*ws);
+		break;
+	case MYF2FS_OP_READDIR:
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.c = c;
+		ctx.start = req->offset;
+		ctx.max = req->count;
+		ctx.budget = budget;
+
+		status = myf2fs_readdir(srv->fs, req->ino, fill_dirent, &ctx);
+		if(ctx.nomem) {
+			return -ENOMEM;
+		}
+		if(status == 0) {
+			status = ctx.sent;
+		}
+		len = c->out_len - rep_off - sizeof(struct myf2fs_rep);
+		break;
+	case MYF2FS_OP_READ:
+		if(req->count < budget) {
+			budget = req->count;
+		}
+
+		if(out_reserve(c, budget) == NULL) {
+			return -ENOMEM;
+		}
+
+		n = myf2fs_read(srv->fs, req->ino, c->out + c->out_len - budget,
+			budget, req->offset);
+		c->out_len -= budget;
+		if(n > 0) {
+			c->out_len += n;
+			len = n;
+		}
+		status = n;
+		break;
+	default:
+		status = -EOPNOTSUPP;
+		break;
+	}
+
+	/* the buffer may have moved */
+	rep = (struct myf2fs_rep *)(c->out + rep_off);
+	rep->status = cpu_to_le32(status);
+	rep->len = cpu_to_le32(len);
+	return 0;
+}
+
+/* answer one complete frame sitting at the start of the input buffer */
+static int handle_frame(struct server *srv, struct conn *c)
+{
+	struct myf2fs_frame *frame = (struct myf2fs_frame *)c->in;
+	struct myf2fs_frame *rframe = NULL;
+	uint32_t nr = le32_to_cpu(frame->nr);
+	char *pos = c->in + sizeof(*frame), *end = pos + le32_to_cpu(frame->len);
+	size_t frame_start = c->out_len;
+	struct myf2fs_req req;
+	uint32_t i = 0;
+	int ret = 0;
+
+	if(out_reserve(c, sizeof(*rframe)) == NULL) {
+		return -ENOMEM;
+	}
+
+	for(i=0; i<nr; i++) {
+		if(end - pos < (ssize_t)sizeof(req)) {
+			return -EPROTO;
+		}
+		/* handle_req gets the fields in host order */
+		memcpy(&req, pos, sizeof(req));
+		req.op = le16_to_cpu(req.op);
+		req.name_len = le16_to_cpu(req.name_len);
+		req.ino = le32_to_cpu(req.ino);
+		req.offset = le64_to_cpu(req.offset);
+		req.count = le32_to_cpu(req.count);
+		pos += sizeof(req);
+
+		if(end - pos < req.name_len) {
+			return -EPROTO;
+		}
+
+		ret = handle_req(srv, c, &req, pos, frame_start);
+		if(ret < 0) {
+			return ret;
+		}
+		pos += req.name_len;
+	}
+
+	rframe = (struct myf2fs_frame *)(c->out + frame_start);
+	rframe->len = cpu_to_le32(c->out_len - frame_start - sizeof(*rframe));
+	rframe->nr = cpu_to_le32(nr);
+
+	__sync_add_and_fetch(&srv->frames, 1);
+	__sync_add_and_fetch(&srv->records, nr);
+	return 0;
+}
+
+/* send what the socket takes, 1 while some of the reply is left */
+static int flush_out(struct conn *c)
+{
+	ssize_t n = 0;
+
+	while(c->out_sent < c->out_len) {
+		n = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+		if(n > 0) {
+			c->out_sent += n;
+			continue;
+		}
+
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		/* a slow reader waits for EPOLLOUT without holding a worker */
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 1;
+		}
+		return n < 0 ? -errno : -EIO;
+	}
+	c->out_len = 0;
+	c->out_sent = 0;
+	return 0;
+}
+
+/* a frame header is checked as soon as it is in, not once the frame is */
+static int check_frame(struct conn *c)
+{
+	struct myf2fs_frame *frame = (struct myf2fs_frame *)c->in;
+
+	if(c->in_len < sizeof(*frame)) {
+		return 0;
+	}
+	if(le32_to_cpu(frame->len) > MYF2FS_MAX_FRAME ||
+			le32_to_cpu(frame->nr) > MYF2FS_MAX_BATCH) {
+		return -EPROTO;
+	}
+	return 0;
+}
+
+/*
+ * Read until the socket is drained, the client shut down its side or one
+ * whole frame is buffered; 1 when the socket is drained.
+ */
+static int read_in(struct conn *c)
+{
+	size_t limit = sizeof(struct myf2fs_frame) + MYF2FS_MAX_FRAME, want = 0;
+	ssize_t n = 0;
+
+	while(c->in_len < limit) {
+		want = c->in_len + 65536 < limit ? c->in_len + 65536 : limit;
+		if(grow(&c->in, &c->in_size, want) < 0) {
+			return -ENOMEM;
+		}
+
+		n = read(c->fd, c->in + c->in_len, want - c->in_len);
+		if(n > 0) {
+			c->in_len += n;
+			if(check_frame(c) < 0) {
+				return -EPROTO;
+			}
+			continue;
+		}
+		if(n == 0) {
+			c->eof = 1;
+			return 0;
+		}
+		if(errno == EINTR) {
+			continue;
+		}
+		if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 1;
+		}
+		return -errno;
+	}
+	return 0;
+}
+
+/* answer every complete frame at the start of the input buffer */
+static int handle_frames(struct server *srv, struct conn *c)
+{
+	struct myf2fs_frame *frame = NULL;
+	size_t need = 0;
+	int ret = 0;
+
+	while(c->in_len >= sizeof(*frame)) {
+		ret = check_frame(c);
+		if(ret < 0) {
+			return ret;
+		}
+
+		frame = (struct myf2fs_frame *)c->in;
+		need = sizeof(*frame) + le32_to_cpu(frame->len);
+		if(c->in_len < need) {
+			break;
+		}
+
+		ret = handle_frame(srv, c);
+		if(ret < 0) {
+			return ret;
+		}
+
+		memmove(c->in, c->in + need, c->in_len - need);
+		c->in_len -= need;
+	}
+	return 0;
+}
+
+/*
+ * Answer what the client sent. Nothing more is read while a reply is
+ * left over, so neither buffer grows past about one frame. 1 waits for
+ * the client to read, 0 for it to write, < 0 drops the client, which
+ * happens after the last reply once it shut down its side.
+ */
+static int serve_conn(struct server *srv, struct conn *c)
+{
+	int drained = 0, ret = 0;
+
+	while(1) {
+		ret = flush_out(c);
+		if(ret != 0) {
+			return ret;
+		}
+		if(c->eof) {
+			return -ECONNRESET;
+		}
+
+		drained = read_in(c);
+		if(drained < 0) {
+			return drained;
+		}
+
+		ret = handle_frames(srv, c);
+		if(ret < 0) {
+			return ret;
+		}
+
+		if(drained) {
+			return flush_out(c);
+		}
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct server *srv = arg;
+	struct epoll_event ev;
+	struct conn *c = NULL;
+	int n = 0, ret = 0;
+
+	while(1) {
+		n = epoll_wait(srv->epfd, &ev, 1, -1);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n < 0) {
+			perror("epoll_wait");
+			break;
+		}
+
+		c = ev.data.ptr;
+		if(c->kind == CONN_STOP) {
+			break;
+		}
+
+		if(c->kind == CONN_LISTEN) {
+			accept_conns(srv);
+			continue;
+		}
+
+		ret = serve_conn(srv, c);
+		if(ret < 0 || arm(srv, c, EPOLL_CTL_MOD, ret > 0 ? EPOLLOUT : EPOLLIN) < 0) {
+			close_conn(srv, c);
+		}
+	}
+	return NULL;
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd = 0;
+
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		printf("socket path too long: %s\n", path);
+		return -ENAMETOOLONG;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		perror("socket");
+		return -errno;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+		perror("bind");
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event ev;
+	pthread_t threads[MAX_WORKERS];
+	struct server srv;
+	struct conn *c = NULL;
+	int nr_workers = DEFAULT_WORKERS, started = 0, i = 0, ret = 0;
+
+	if(argc < 3) {
+		usage();
+		return -1;
+	}
+
+	if(argc > 3) {
+		nr_workers = atoi(argv[3]);
+		if(nr_workers <= 0 || nr_workers > MAX_WORKERS) {
+			usage();
+			return -1;
+		}
+	}
+
+	memset(&srv, 0, sizeof(srv));
+	pthread_mutex_init(&srv.lock, NULL);
+	srv.clients.next = &srv.clients;
+	srv.clients.prev = &srv.clients;
+	srv.listener.kind = CONN_LISTEN;
+	srv.stop.kind = CONN_STOP;
+
+	ret = myf2fs_open(argv[1], &srv.fs);
+	if(ret < 0) {
+		printf("can not open %s: %s\n", argv[1], strerror(-ret));
+		return ret;
+	}
+
+	srv.listener.fd = listen_on(argv[2]);
+	if(srv.listener.fd < 0) {
+		ret = srv.listener.fd;
+		goto close_fs;
+	}
+
+	stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	srv.stop.fd = stop_fd;
+	srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(stop_fd < 0 || srv.epfd < 0) {
+		perror("epoll_create1");
+		ret = -errno;
+		goto close_fds;
+	}
+
+	ret = arm(&srv, &srv.listener, EPOLL_CTL_ADD, EPOLLIN);
+	if(ret < 0) {
+		goto close_fds;
+	}
+
+	/* level triggered and never disarmed, so it wakes every worker */
+	ev.events = EPOLLIN;
+	ev.data.ptr = &srv.stop;
+	if(epoll_ctl(srv.epfd, EPOLL_CTL_ADD, stop_fd, &ev) < 0) {
+		perror("epoll_ctl");
+		ret = -errno;
+		goto close_fds;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	for(started=0; started<nr_workers; started++) {
+		if(pthread_create(&threads[started], NULL, worker, &srv) != 0) {
+			perror("pthread_create");
+			on_signal(0);
+			break;
+		}
+	}
+
+	for(i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	while(srv.clients.next != &srv.clients) {
+		c = srv.clients.next;
+		close_conn(&srv, c);
+	}
+	printf("served %lu requests in %lu frames\n", srv.records, srv.frames);
+
+close_fds:
+	if(srv.epfd > 0) {
+		close(srv.epfd);
+	}
+	if(stop_fd >= 0) {
+		close(stop_fd);
+	}
+	close(srv.listener.fd);
+	unlink(argv[2]);
+close_fs:
+	i = myf2fs_close(srv.fs);
+	if(i != 0) {
+		printf("BUG: %d allocations left behind\n", i);
+	}
+	pthread_mutex_destroy(&srv.lock);
+	return ret;
+}
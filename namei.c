@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "node.h"
+#include "data.h"
+#include "dir.h"
+#include "dcache.h"
+#include "namei.h"
+#include "trace.h"
+
+static void update_inode_time(struct f2fs_raw_inode *ri, int ctime_only)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	ri->i_ctime = cpu_to_le64(now.tv_sec);
+	ri->i_ctime_nsec = cpu_to_le32(now.tv_nsec);
+	if(ctime_only) {
+		return;
+	}
+	ri->i_mtime = ri->i_ctime;
+	ri->i_mtime_nsec = ri->i_ctime_nsec;
+}
+
+/*
+ * A new inode inherits the attribute layout of its parent, an inline
+ * xattr area of flexible size only if the parent has one.
+ */
+static void init_inode(struct f2fs_super *super, struct f2fs_raw_inode *ri,
+		struct f2fs_raw_inode *pri, nid_t pino, const char *name, int len,
+		unsigned int mode)
+{
+	ri->i_mode = cpu_to_le16(mode);
+	ri->i_inline = F2FS_INLINE_XATTR;
+	if(pri->i_inline & F2FS_EXTRA_ATTR) {
+		ri->i_inline |= F2FS_EXTRA_ATTR;
+		ri->i_extra_isize = pri->i_extra_isize;
+		ri->i_inline_xattr_size = pri->i_inline_xattr_size;
+		ri->i_projid = pri->i_projid;
+		if(get_inline_xattr_addrs(super->raw_super, ri) == 0) {
+			ri->i_inline &= ~F2FS_INLINE_XATTR;
+		}
+	}
+
+	ri->i_uid = cpu_to_le32(getuid());
+	ri->i_gid = cpu_to_le32(getgid());
+	ri->i_blocks = cpu_to_le64(1);
+	update_inode_time(ri, 0);
+	ri->i_atime = ri->i_ctime;
+	ri->i_atime_nsec = ri->i_ctime_nsec;
+	if(ri->i_inline & F2FS_EXTRA_ATTR) {
+		ri->i_crtime = ri->i_ctime;
+		ri->i_crtime_nsec = ri->i_ctime_nsec;
+	}
+	ri->i_generation = cpu_to_le32(rand());
+
+	if(S_ISDIR(mode)) {
+		ri->i_inline |= F2FS_INLINE_DENTRY;
+		ri->i_links = cpu_to_le32(2);
+		ri->i_size = cpu_to_le64(MAX_INLINE_DATA(super->raw_super, ri));
+		ri->i_current_depth = cpu_to_le32(1);
+		ri->i_dir_level = pri->i_dir_level;
+	} else {
+		ri->i_inline |= F2FS_INLINE_DATA;
+		ri->i_links = cpu_to_le32(1);
+	}
+
+	ri->i_pino = cpu_to_le32(pino);
+	ri->i_namelen = cpu_to_le32(len);
+	memcpy(ri->i_name, name, len);
+}
+
+int f2fs_create(struct f2fs_super *super, nid_t pino, const char *name, int len,
+		unsigned int mode, nid_t *ino)
+{
+	struct f2fs_raw_inode *pri = NULL, *ri = NULL;
+	struct page *dir_page = NULL, *page = NULL;
+	struct f2fs_dir_entry de;
+	int ret = 0;
+
+	if(len == 0 || len > F2FS_NAME_LEN) {
+		return -ENAMETOOLONG;
+	}
+
+	dir_page = f2fs_get_node_page(super, pino);
+	if(dir_page == NULL) {
+		return -EIO;
+	}
+	pri = &F2FS_NODE(dir_page)->i;
+
+	if(!S_ISDIR(le16_to_cpu(pri->i_mode))) {
+		return -ENOTDIR;
+	}
+
+	ret = f2fs_find_entry(super, dir_page, name, len, &de);
+	if(ret == 0) {
+		return -EEXIST;
+	}
+	if(ret != -ENOENT) {
+		return ret;
+	}
+
+	ret = f2fs_alloc_nid(super, ino);
+	if(ret < 0) {
+		return ret;
+	}
+
+	page = f2fs_new_node_page(super, *ino, *ino, 0, !S_ISDIR(mode));
+	if(page == NULL) {
+		return -ENOMEM;
+	}
+	ri = &F2FS_NODE(page)->i;
+	init_inode(super, ri, pri, pino, name, len, mode);
+
+	if(S_ISDIR(mode)) {
+		f2fs_make_empty_dir(super->raw_super, page, *ino, pino);
+	}
+
+	ret = f2fs_add_link(super, dir_page, name, len, *ino, f2fs_file_type(mode));
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(S_ISDIR(mode)) {
+		pri->i_links = cpu_to_le32(le32_to_cpu(pri->i_links) + 1);
+	}
+	update_inode_time(pri, 0);
+	f2fs_mark_node_dirty(super, dir_page);
+	return 0;
+}
+
+/* ino of name in dir pino, misses are remembered as well as hits */
+static int __f2fs_lookup(struct f2fs_super *super, nid_t pino, const char *name,
+		int len, nid_t *ino)
+{
+	struct f2fs_dir_entry de;
+	struct page *dir_page = NULL;
+	int ret = 0;
+
+	if(len <= 0 || len > F2FS_NAME_LEN) {
+		return -ENAMETOOLONG;
+	}
+
+	if(f2fs_is_orphan(super, pino)) {
+		return -ENOENT;
+	}
+
+	if(f2fs_dcache_lookup(super, pino, name, len, ino)) {
+		ret = *ino == 0 ? -ENOENT : 0;
+		goto out;
+	}
+
+	dir_page = f2fs_get_node_page(super, pino);
+	if(dir_page == NULL) {
+		return -ENOENT;
+	}
+
+	if(!IS_INODE(dir_page) || !S_ISDIR(le16_to_cpu(F2FS_NODE(dir_page)->i.i_mode))) {
+		f2fs_put_node_page(super, dir_page);
+		return -ENOTDIR;
+	}
+
+	ret = f2fs_find_entry(super, dir_page, name, len, &de);
+	f2fs_put_node_page(super, dir_page);
+	if(ret < 0 && ret != -ENOENT) {
+		return ret;
+	}
+
+	*ino = ret == 0 ? le32_to_cpu(de.ino) : 0;
+	f2fs_dcache_add(super, pino, name, len, *ino);
+out:
+	if(ret == 0 && f2fs_is_orphan(super, *ino)) {
+		ret = -ENOENT;
+	}
+	return ret;
+}
+
+int f2fs_lookup(struct f2fs_super *super, nid_t pino, const char *name, int len,
+		nid_t *ino)
+{
+	F2FS_TRACE_SCOPE("lookup", "dir", pino);
+	int op = f2fs_stat_enter(F2FS_OP_LOOKUP);
+	int ret = __f2fs_lookup(super, pino, name, len, ino);
+
+	f2fs_stat_leave(op);
+	return ret;
+}
+
+/* resolve a path from the root, a repeated path costs one cache lookup */
+static int __f2fs_lookup_path(struct f2fs_super *super, const char *path,
+		nid_t *ino)
+{
+	nid_t cur = le32_to_cpu(super->raw_super->root_ino);
+	const char *name = path;
+	int plen = strlen(path);
+	int len = 0, ret = 0;
+
+	if(path[0] != '/') {
+		return -EINVAL;
+	}
+
+	if(f2fs_dcache_lookup_path(super, path, plen, ino)) {
+		return *ino == 0 ? -ENOENT : 0;
+	}
+
+	while(*name != '\0') {
+		while(*name == '/') {
+			name++;
+		}
+
+		for(len=0; name[len]!='\0' && name[len]!='/'; len++);
+		if(len == 0 || (len == 1 && name[0] == '.')) {
+			name += len;
+			continue;
+		}
+
+		ret = f2fs_lookup(super, cur, name, len, &cur);
+		if(ret < 0) {
+			break;
+		}
+		name += len;
+	}
+
+	if(ret == 0 || ret == -ENOENT) {
+		f2fs_dcache_add_path(super, path, plen, ret == 0 ? cur : 0);
+	}
+
+	if(ret == 0) {
+		*ino = cur;
+	}
+	return ret;
+}
+
+int f2fs_lookup_path(struct f2fs_super *super, const char *path, nid_t *ino)
+{
+	F2FS_TRACE_SCOPE("lookup_path", NULL, 0);
+	int op = f2fs_stat_enter(F2FS_OP_LOOKUP);
+	int ret = __f2fs_lookup_path(super, path, ino);
+
+	f2fs_stat_leave(op);
+	return ret;
+}
+
+int f2fs_unlink(struct f2fs_super *super, nid_t pino, const char *name, int len)
+{
+	struct f2fs_raw_inode *pri = NULL, *ri = NULL;
+	struct page *dir_page = NULL, *page = NULL;
+	struct f2fs_dir_entry de;
+	unsigned int links = 0;
+	int ret = 0, is_dir = 0;
+
+	if(is_dot_dotdot(name, len)) {
+		return -EINVAL;
+	}
+
+	dir_page = f2fs_get_node_page(super, pino);
+	if(dir_page == NULL) {
+		return -EIO;
+	}
+	pri = &F2FS_NODE(dir_page)->i;
+
+	ret = f2fs_find_entry(super, dir_page, name, len, &de);
+	if(ret < 0) {
+		return ret;
+	}
+
+	page = f2fs_get_node_page(super, le32_to_cpu(de.ino));
+	if(page == NULL) {
+		return -EIO;
+	}
+	ri = &F2FS_NODE(page)->i;
+
+	is_dir = S_ISDIR(le16_to_cpu(ri->i_mode));
+	if(is_dir) {
+		ret = f2fs_empty_dir(super, page);
+		if(ret < 0) {
+			return ret;
+		}
+		if(ret == 0) {
+			return -ENOTEMPTY;
+		}
+	}
+
+	ret = f2fs_delete_entry(super, dir_page, name, len);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(is_dir) {
+		pri->i_links = cpu_to_le32(le32_to_cpu(pri->i_links) - 1);
+	}
+	update_inode_time(pri, 0);
+	f2fs_mark_node_dirty(super, dir_page);
+
+	links = le32_to_cpu(ri->i_links);
+	links = is_dir || links <= 1 ? 0 : links - 1;
+	if(links > 0) {
+		ri->i_links = cpu_to_le32(links);
+		update_inode_time(ri, 1);
+		f2fs_mark_node_dirty(super, page);
+		return 0;
+	}
+
+	return f2fs_evict_inode(super, page);
+}
+
+/* release an inode nobody links to, with its node tree and data */
+int f2fs_evict_inode(struct f2fs_super *super, struct page *page)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(page)->i;
+	nid_t ino = ino_of_node(page), xnid = 0;
+	int ret = 0;
+
+	ret = f2fs_truncate_inode_blocks(super, page);
+	if(ret < 0) {
+		return ret;
+	}
+
+	xnid = le32_to_cpu(ri->i_xattr_nid);
+	if(xnid != 0) {
+		ret = f2fs_remove_node(super, xnid);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return f2fs_remove_node(super, ino);
+}
+
+/*
+ * Orphans of the current checkpoint are freed in memory, so the checkpoint
+ * the command ends in drops all of them at once along with the orphan
+ * blocks.
+ */
+int f2fs_reclaim_orphans(struct f2fs_super *super)
+{
+	struct f2fs_checkpoint *raw_cp = super->raw_cp;
+	struct page *page = NULL;
+	struct node_info ni;
+	unsigned int i = 0;
+	int ret = 0;
+
+	ret = f2fs_load(super, F2FS_LAZY_ORPHANS);
+	if(ret < 0) {
+		return ret;
+	}
+
+	for(i=0; i<super->nr_orphans; i++) {
+		ret = f2fs_get_node_info(super, super->orphans[i], &ni);
+		if(ret < 0) {
+			return ret;
+		}
+
+		/* freed before the list was written */
+		if(ni.blk_addr == NULL_ADDR || ni.ino != super->orphans[i]) {
+			continue;
+		}
+
+		page = f2fs_get_node_page(super, super->orphans[i]);
+		if(page == NULL) {
+			return -EIO;
+		}
+
+		ret = f2fs_evict_inode(super, page);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	f2fs_free(super->orphans);
+	super->orphans = NULL;
+	super->nr_orphans = 0;
+	raw_cp->ckpt_flags = cpu_to_le32(le32_to_cpu(raw_cp->ckpt_flags) &
+		~CP_ORPHAN_PRESENT_FLAG);
+	return 0;
+}
+
+/* the path of ino from the names its inodes remember */
+void f2fs_ino_path(struct f2fs_super *super, nid_t ino, struct page *page,
+		char *path, int size)
+{
+	nid_t root = le32_to_cpu(super->raw_super->root_ino);
+	struct f2fs_raw_inode *ri = NULL;
+	int pos = size - 1, len = 0, depth = 0;
+
+	path[pos] = '\0';
+	for(depth=0; ino!=root && depth<NAMEI_MAX_DEPTH; depth++) {
+		if(f2fs_read_node_block(super, ino, page) < 0 || !IS_INODE(page)) {
+			break;
+		}
+		ri = &F2FS_NODE(page)->i;
+		len = le32_to_cpu(ri->i_namelen);
+		if(len > F2FS_NAME_LEN || pos - len - 1 < 0) {
+			break;
+		}
+
+		pos -= len;
+		memcpy(path + pos, ri->i_name, len);
+		path[--pos] = '/';
+		ino = le32_to_cpu(ri->i_pino);
+	}
+
+	if(ino != root) {
+		snprintf(path, size, "<ino %u>", ino);
+		return;
+	}
+	if(pos == size - 1) {
+		path[--pos] = '/';
+	}
+	memmove(path, path + pos, size - pos);
+}
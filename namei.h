@@ -0,0 +1,25 @@
+#ifndef __NAMEI_H__
+#define __NAMEI_H__
+
+#include "f2fs.h"
+
+/* dirs deeper than this are cut short when walking up */
+#define NAMEI_MAX_DEPTH		4096
+
+int f2fs_create(struct f2fs_super *super, nid_t pino, const char *name, int len,
+		unsigned int mode, nid_t *ino);
+int f2fs_lookup(struct f2fs_super *super, nid_t pino, const char *name, int len,
+		nid_t *ino);
+int f2fs_lookup_path(struct f2fs_super *super, const char *path, nid_t *ino);
+int f2fs_unlink(struct f2fs_super *super, nid_t pino, const char *name, int len);
+int f2fs_evict_inode(struct f2fs_super *super, struct page *page);
+int f2fs_reclaim_orphans(struct f2fs_super *super);
+
+/*
+ * The path of ino from the names and parents its inodes remember, or
+ * "<ino n>" when the chain does not reach the root. page is scratch.
+ */
+void f2fs_ino_path(struct f2fs_super *super, nid_t ino, struct page *page,
+		char *path, int size);
+
+#endif /*__NAMEI_H__*/
@@ -0,0 +1,1318 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "segment.h"
+#include "data.h"
+#include "trace.h"
+#include "dev.h"
+
+static struct nat_entry *lookup_nat_cache(struct f2fs_nm_info *nm, nid_t nid)
+{
+	struct nat_entry *e = nm->nat_hash[nid % NM_HASH_SIZE];
+
+	while(e != NULL && e->ni.nid != nid) {
+		e = e->next;
+	}
+	return e;
+}
+
+static struct nat_entry *grab_nat_entry(struct f2fs_nm_info *nm, nid_t nid)
+{
+	struct nat_entry *e = lookup_nat_cache(nm, nid);
+
+	if(e != NULL) {
+		return e;
+	}
+
+	e = f2fs_malloc(sizeof(struct nat_entry));
+	if(e == NULL) {
+		return NULL;
+	}
+	memset(e, 0, sizeof(struct nat_entry));
+	e->ni.nid = nid;
+	e->next = nm->nat_hash[nid % NM_HASH_SIZE];
+	nm->nat_hash[nid % NM_HASH_SIZE] = e;
+	nm->nat_cnt++;
+	return e;
+}
+
+static void set_nat_dirty(struct f2fs_nm_info *nm, struct nat_entry *e)
+{
+	if(!e->dirty) {
+		e->dirty = 1;
+		nm->dirty_nat_cnt++;
+	}
+}
+
+static int lookup_nat_in_journal(struct f2fs_super *super, nid_t nid,
+		struct f2fs_nat_entry *raw_ne)
+{
+	struct f2fs_journal *journal = NULL;
+	int i = 0;
+
+	if(super->sum_blk[CURSEG_HOT_DATA] == NULL) {
+		return -1;
+	}
+
+	journal = NAT_JOURNAL(super);
+	for(i=0; i<nats_in_cursum(journal); i++) {
+		if(le32_to_cpu(journal->nat_j.entries[i].nid) == nid) {
+			*raw_ne = journal->nat_j.entries[i].ne;
+			return i;
+		}
+	}
+	return -1;
+}
+
+int f2fs_build_node_cache(struct f2fs_super *super)
+{
+	F2FS_TRACE_SCOPE("node_cache", NULL, 0);
+	struct f2fs_node_cache *nc = NULL;
+	struct ncache_stripe *stripe = NULL;
+	int i = 0;
+
+	nc = f2fs_malloc(sizeof(struct f2fs_node_cache));
+	if(nc == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memset(nc, 0, sizeof(struct f2fs_node_cache));
+
+	for(i=0; i<NC_STRIPES; i++) {
+		stripe = &nc->stripes[i];
+		pthread_mutex_init(&stripe->lock, NULL);
+		stripe->lru.prev_lru = &stripe->lru;
+		stripe->lru.next_lru = &stripe->lru;
+	}
+	super->nc_info = nc;
+	return 0;
+}
+
+void f2fs_destroy_node_cache(struct f2fs_super *super)
+{
+	struct f2fs_node_cache *nc = NC_I(super);
+	struct ncache_stripe *stripe = NULL;
+	struct ncache_entry *e = NULL;
+	int i = 0;
+
+	if(nc == NULL) {
+		return;
+	}
+
+	for(i=0; i<NC_STRIPES; i++) {
+		stripe = &nc->stripes[i];
+		while(stripe->lru.next_lru != &stripe->lru) {
+			e = stripe->lru.next_lru;
+			stripe->lru.next_lru = e->next_lru;
+			if(e->page != NULL) {
+				free_page(e->page);
+			}
+			f2fs_free(e);
+		}
+		pthread_mutex_destroy(&stripe->lock);
+	}
+
+	f2fs_free(nc);
+	super->nc_info = NULL;
+}
+
+static inline struct ncache_stripe *nc_stripe(struct f2fs_node_cache *nc, nid_t nid)
+{
+	return &nc->stripes[nid % NC_STRIPES];
+}
+
+static inline unsigned int nc_hash(nid_t nid)
+{
+	return (nid / NC_STRIPES) % NC_HASH_SIZE;
+}
+
+static void nc_unlink_lru(struct ncache_entry *e)
+{
+	e->prev_lru->next_lru = e->next_lru;
+	e->next_lru->prev_lru = e->prev_lru;
+}
+
+static void nc_link_lru(struct ncache_stripe *stripe, struct ncache_entry *e)
+{
+	e->prev_lru = &stripe->lru;
+	e->next_lru = stripe->lru.next_lru;
+	stripe->lru.next_lru->prev_lru = e;
+	stripe->lru.next_lru = e;
+}
+
+/* called with the stripe locked */
+static struct ncache_entry *nc_lookup(struct ncache_stripe *stripe, nid_t nid)
+{
+	struct ncache_entry *e = stripe->hash[nc_hash(nid)];
+
+	while(e != NULL && e->ni.nid != nid) {
+		e = e->next;
+	}
+
+	if(e != NULL) {
+		nc_unlink_lru(e);
+		nc_link_lru(stripe, e);
+	}
+	return e;
+}
+
+static void nc_evict(struct ncache_stripe *stripe)
+{
+	struct ncache_entry *e = stripe->lru.prev_lru, **pp = NULL;
+
+	nc_unlink_lru(e);
+	for(pp=&stripe->hash[nc_hash(e->ni.nid)]; *pp!=e; pp=&(*pp)->next);
+	*pp = e->next;
+	stripe->nr_entries--;
+
+	if(e->page != NULL) {
+		free_page(e->page);
+	}
+	f2fs_free(e);
+}
+
+/* called with the stripe locked, NULL only means the entry is not kept */
+static struct ncache_entry *nc_insert(struct ncache_stripe *stripe,
+		struct node_info *ni)
+{
+	struct ncache_entry *e = nc_lookup(stripe, ni->nid);
+
+	if(e != NULL) {
+		return e;
+	}
+
+	if(stripe->nr_entries >= NC_STRIPE_ENTRIES) {
+		nc_evict(stripe);
+	}
+
+	e = f2fs_malloc(sizeof(struct ncache_entry));
+	if(e == NULL) {
+		return NULL;
+	}
+	e->ni = *ni;
+	e->page = NULL;
+	e->next = stripe->hash[nc_hash(ni->nid)];
+	stripe->hash[nc_hash(ni->nid)] = e;
+	nc_link_lru(stripe, e);
+	stripe->nr_entries++;
+	return e;
+}
+
+static int nc_get_node_info(struct f2fs_node_cache *nc, nid_t nid,
+		struct node_info *ni)
+{
+	struct ncache_stripe *stripe = nc_stripe(nc, nid);
+	struct ncache_entry *e = NULL;
+
+	pthread_mutex_lock(&stripe->lock);
+	e = nc_lookup(stripe, nid);
+	if(e != NULL) {
+		*ni = e->ni;
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	return e != NULL;
+}
+
+static void nc_add_node_info(struct f2fs_node_cache *nc, struct node_info *ni)
+{
+	struct ncache_stripe *stripe = nc_stripe(nc, ni->nid);
+
+	pthread_mutex_lock(&stripe->lock);
+	nc_insert(stripe, ni);
+	pthread_mutex_unlock(&stripe->lock);
+}
+
+static int nc_read_node_page(struct f2fs_node_cache *nc, nid_t nid,
+		struct page *page)
+{
+	struct ncache_stripe *stripe = nc_stripe(nc, nid);
+	struct ncache_entry *e = NULL;
+	int found = 0;
+
+	pthread_mutex_lock(&stripe->lock);
+	e = nc_lookup(stripe, nid);
+	if(e != NULL && e->page != NULL) {
+		memcpy(page_address(page), page_address(e->page), F2FS_PAGE_SIZE);
+		found = 1;
+	}
+	pthread_mutex_unlock(&stripe->lock);
+	return found;
+}
+
+static void nc_add_node_page(struct f2fs_node_cache *nc, struct node_info *ni,
+		struct page *page)
+{
+	struct ncache_stripe *stripe = nc_stripe(nc, ni->nid);
+	struct ncache_entry *e = NULL;
+
+	pthread_mutex_lock(&stripe->lock);
+	e = nc_insert(stripe, ni);
+	if(e != NULL && e->page == NULL) {
+		e->page = alloc_page();
+		if(e->page != NULL) {
+			memcpy(page_address(e->page), page_address(page), F2FS_PAGE_SIZE);
+		}
+	}
+	pthread_mutex_unlock(&stripe->lock);
+}
+
+int f2fs_get_node_info(struct f2fs_super *super, nid_t nid, struct node_info *ni)
+{
+	struct f2fs_nat_entry raw_ne;
+	struct f2fs_nat_block *nat_blk = NULL;
+	struct nat_entry *e = NULL;
+	struct page *page = NULL;
+	int ret = 0;
+
+	if(nid >= max_nid(super)) {
+		return -EINVAL;
+	}
+
+	ret = f2fs_load(super, F2FS_LAZY_SUM(CURSEG_HOT_DATA));
+	if(ret < 0) {
+		return ret;
+	}
+
+	ni->nid = nid;
+	if(NM_I(super) != NULL) {
+		e = lookup_nat_cache(NM_I(super), nid);
+		f2fs_stat_cache(F2FS_CACHE_NAT, e != NULL);
+		if(e != NULL) {
+			*ni = e->ni;
+			return 0;
+		}
+	} else if(NC_I(super) != NULL) {
+		if(nc_get_node_info(NC_I(super), nid, ni)) {
+			f2fs_stat_cache(F2FS_CACHE_NAT, 1);
+			return 0;
+		}
+		f2fs_stat_cache(F2FS_CACHE_NAT, 0);
+	}
+
+	if(lookup_nat_in_journal(super, nid, &raw_ne) >= 0) {
+		node_info_from_raw_nat(ni, &raw_ne);
+		goto out;
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	ret = read_page(page, super->fd, current_nat_addr(super, nid));
+	if(ret < 0) {
+		free_page(page);
+		perror("read page");
+		return ret;
+	}
+
+	nat_blk = page_address(page);
+	node_info_from_raw_nat(ni, &nat_blk->entries[nid % NAT_ENTRY_PER_BLOCK]);
+	free_page(page);
+out:
+	if(NM_I(super) == NULL && NC_I(super) != NULL) {
+		nc_add_node_info(NC_I(super), ni);
+	}
+	return 0;
+}
+
+int f2fs_build_node_manager(struct f2fs_super *super)
+{
+	F2FS_TRACE_SCOPE("nat", NULL, 0);
+	struct f2fs_nm_info *nm = NULL;
+	int ret = 0;
+
+	/* the checkpoint writes both back */
+	ret = f2fs_load(super, F2FS_LAZY_NAT | F2FS_LAZY_ORPHANS);
+	if(ret < 0) {
+		return ret;
+	}
+
+	nm = f2fs_malloc(sizeof(struct f2fs_nm_info));
+	if(nm == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memset(nm, 0, sizeof(struct f2fs_nm_info));
+
+	nm->free_nids = f2fs_malloc(FREE_NID_BATCH * sizeof(struct free_nid));
+	if(nm->free_nids == NULL) {
+		perror("f2fs_malloc");
+		f2fs_free(nm);
+		return -ENOMEM;
+	}
+
+	nm->next_scan_nid = le32_to_cpu(super->raw_cp->next_free_nid);
+	nm->valid_node_count = le32_to_cpu(super->raw_cp->valid_node_count);
+	nm->valid_inode_count = le32_to_cpu(super->raw_cp->valid_inode_count);
+	super->nm_info = nm;
+	return 0;
+}
+
+void f2fs_destroy_node_manager(struct f2fs_super *super)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct nat_entry *e = NULL;
+	struct node_page *np = NULL;
+	int i = 0;
+
+	if(nm == NULL) {
+		return;
+	}
+
+	for(i=0; i<NM_HASH_SIZE; i++) {
+		while(nm->nat_hash[i]) {
+			e = nm->nat_hash[i];
+			nm->nat_hash[i] = e->next;
+			f2fs_free(e);
+		}
+	}
+
+	while(nm->node_list) {
+		np = nm->node_list;
+		nm->node_list = np->list;
+		free_page(np->page);
+		f2fs_free(np);
+	}
+
+	f2fs_free(nm->free_nids);
+	f2fs_free(nm);
+	super->nm_info = NULL;
+}
+
+static struct node_page *lookup_node_page(struct f2fs_nm_info *nm, nid_t nid)
+{
+	struct node_page *np = nm->node_hash[nid % NM_HASH_SIZE];
+
+	while(np != NULL && np->nid != nid) {
+		np = np->next;
+	}
+	return np;
+}
+
+static struct node_page *add_node_page(struct f2fs_nm_info *nm, nid_t nid,
+		struct page *page)
+{
+	struct node_page *np = NULL;
+
+	np = f2fs_malloc(sizeof(struct node_page));
+	if(np == NULL) {
+		return NULL;
+	}
+
+	np->nid = nid;
+	np->dirty = 0;
+	np->page = page;
+	np->next = nm->node_hash[nid % NM_HASH_SIZE];
+	nm->node_hash[nid % NM_HASH_SIZE] = np;
+	np->list = nm->node_list;
+	nm->node_list = np;
+	nm->node_cnt++;
+	return np;
+}
+
+static void del_node_page(struct f2fs_nm_info *nm, nid_t nid)
+{
+	struct node_page **pp = &nm->node_hash[nid % NM_HASH_SIZE];
+	struct node_page *np = NULL;
+
+	while(*pp != NULL && (*pp)->nid != nid) {
+		pp = &(*pp)->next;
+	}
+
+	np = *pp;
+	if(np == NULL) {
+		return;
+	}
+	*pp = np->next;
+
+	pp = &nm->node_list;
+	while(*pp != np) {
+		pp = &(*pp)->list;
+	}
+	*pp = np->list;
+
+	if(np->dirty) {
+		nm->dirty_node_cnt--;
+	}
+	nm->node_cnt--;
+	free_page(np->page);
+	f2fs_free(np);
+}
+
+/* copy the current content of a node block, cached or on disk */
+/* the node manager has nid, maybe newer than its block on disk */
+int f2fs_node_cached(struct f2fs_super *super, nid_t nid)
+{
+	return NM_I(super) != NULL && lookup_node_page(NM_I(super), nid) != NULL;
+}
+
+int f2fs_read_node_block(struct f2fs_super *super, nid_t nid, struct page *page)
+{
+	struct node_page *np = NULL;
+	struct node_info ni;
+	int ret = 0;
+
+	if(NM_I(super) != NULL) {
+		np = lookup_node_page(NM_I(super), nid);
+		f2fs_stat_cache(F2FS_CACHE_NODE, np != NULL);
+		if(np != NULL) {
+			memcpy(page_address(page), page_address(np->page), F2FS_PAGE_SIZE);
+			return 0;
+		}
+	} else if(NC_I(super) != NULL) {
+		if(nc_read_node_page(NC_I(super), nid, page)) {
+			f2fs_stat_cache(F2FS_CACHE_NODE, 1);
+			return 0;
+		}
+		f2fs_stat_cache(F2FS_CACHE_NODE, 0);
+	}
+
+	ret = f2fs_get_node_info(super, nid, &ni);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(ni.blk_addr == NULL_ADDR || ni.blk_addr == NEW_ADDR) {
+		return -ENOENT;
+	}
+
+	ret = f2fs_read_block(super, page, ni.blk_addr);
+	if(ret < 0) {
+		perror("read page");
+		return ret;
+	}
+
+	if(nid_of_node(page) != nid) {
+		printf("BAD node footer nid:%u(%u) at %llu\n", nid_of_node(page),
+			nid, ni.blk_addr);
+		return -EINVAL;
+	}
+
+	if(NM_I(super) == NULL && NC_I(super) != NULL) {
+		nc_add_node_page(NC_I(super), &ni, page);
+	}
+	return 0;
+}
+
+/*
+ * Node pages of a modifying command stay cached until the checkpoint writes
+ * them out; read-only callers get a private copy they must put.
+ */
+struct page *f2fs_get_node_page(struct f2fs_super *super, nid_t nid)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct node_page *np = NULL;
+	struct page *page = NULL;
+
+	if(nm != NULL) {
+		np = lookup_node_page(nm, nid);
+		if(np != NULL) {
+			return np->page;
+		}
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return NULL;
+	}
+
+	if(f2fs_read_node_block(super, nid, page) < 0) {
+		free_page(page);
+		return NULL;
+	}
+
+	if(nm != NULL && add_node_page(nm, nid, page) == NULL) {
+		free_page(page);
+		return NULL;
+	}
+	return page;
+}
+
+void f2fs_put_node_page(struct f2fs_super *super, struct page *page)
+{
+	if(NM_I(super) == NULL && page != NULL) {
+		free_page(page);
+	}
+}
+
+void f2fs_mark_node_dirty(struct f2fs_super *super, struct page *page)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct node_page *np = lookup_node_page(nm, nid_of_node(page));
+
+	if(np == NULL || np->page != page) {
+		BUG("BUG: node %u is not cached\n", nid_of_node(page));
+	}
+
+	if(!np->dirty) {
+		np->dirty = 1;
+		nm->dirty_node_cnt++;
+	}
+}
+
+struct page *f2fs_new_node_page(struct f2fs_super *super, nid_t nid, nid_t ino,
+		unsigned int ofs, int cold)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct nat_entry *e = NULL;
+	struct page *page = NULL;
+
+	e = lookup_nat_cache(nm, nid);
+	if(e == NULL || e->ni.blk_addr != NULL_ADDR) {
+		BUG("BUG: nid %u was not allocated\n", nid);
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return NULL;
+	}
+	memset(page_address(page), 0, F2FS_PAGE_SIZE);
+	fill_node_footer(page, nid, ino, ofs, cold);
+
+	if(add_node_page(nm, nid, page) == NULL) {
+		free_page(page);
+		return NULL;
+	}
+	f2fs_mark_node_dirty(super, page);
+
+	e->ni.ino = ino;
+	e->ni.blk_addr = NEW_ADDR;
+	set_nat_dirty(nm, e);
+
+	nm->valid_node_count++;
+	if(nid == ino) {
+		nm->valid_inode_count++;
+	}
+	return page;
+}
+
+static int add_free_nid(struct f2fs_super *super, struct node_info *ni, void *arg)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+
+	if(ni->blk_addr != NULL_ADDR) {
+		return 0;
+	}
+
+	/* touched by this command, even when freed it stays taken */
+	if(lookup_nat_cache(nm, ni->nid) != NULL) {
+		return 0;
+	}
+
+	nm->free_nids[nm->nr_free_nids].nid = ni->nid;
+	nm->free_nids[nm->nr_free_nids].version = ni->version;
+	nm->nr_free_nids++;
+	nm->next_scan_nid = ni->nid + 1;
+	if(nm->nr_free_nids == FREE_NID_BATCH) {
+		return 1;
+	}
+	return 0;
+}
+
+static int build_free_nids(struct f2fs_super *super)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	int ret = 0;
+
+	nm->nr_free_nids = 0;
+	nm->free_nid_pos = 0;
+	ret = f2fs_scan_nat(super, nm->next_scan_nid, NAT_SCAN_FREE,
+		add_free_nid, NULL, NULL);
+	if(ret < 0) {
+		return ret;
+	}
+
+	/* wrap around once */
+	if(nm->nr_free_nids == 0 && nm->next_scan_nid != 0) {
+		nm->next_scan_nid = 0;
+		ret = f2fs_scan_nat(super, 0, NAT_SCAN_FREE, add_free_nid, NULL, NULL);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	if(nm->nr_free_nids == 0) {
+		printf("No free nid\n");
+		return -ENOSPC;
+	}
+	return 0;
+}
+
+/* where the next command starts its scan: the first free nid not handed out */
+nid_t f2fs_next_free_nid(struct f2fs_super *super)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	nid_t nid = nm->next_scan_nid;
+
+	if(nm->free_nid_pos < nm->nr_free_nids) {
+		nid = nm->free_nids[nm->free_nid_pos].nid;
+	}
+	return nid < max_nid(super) ? nid : 0;
+}
+
+int f2fs_alloc_nid(struct f2fs_super *super, nid_t *nid)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct nat_entry *e = NULL;
+	int ret = 0;
+
+	if(nm->free_nid_pos == nm->nr_free_nids) {
+		ret = build_free_nids(super);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	e = grab_nat_entry(nm, nm->free_nids[nm->free_nid_pos].nid);
+	if(e == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	e->ni.version = nm->free_nids[nm->free_nid_pos].version;
+	e->ni.blk_addr = NULL_ADDR;
+	*nid = e->ni.nid;
+	nm->free_nid_pos++;
+	return 0;
+}
+
+/*
+ * Bring an inode found by roll-forward recovery into the node cache. An
+ * inode the checkpoint knows keeps its block map and only takes over the
+ * attributes; one created after it starts with an empty block map, which
+ * the replay of its dnodes fills in again.
+ */
+struct page *f2fs_recover_inode_page(struct f2fs_super *super, struct page *src)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct f2fs_raw_inode *ri = NULL, *sri = &F2FS_NODE(src)->i;
+	nid_t ino = ino_of_node(src);
+	struct nat_entry *e = NULL;
+	struct page *page = NULL;
+	struct node_info ni;
+	int ret = 0;
+
+	ret = f2fs_get_node_info(super, ino, &ni);
+	if(ret < 0) {
+		return NULL;
+	}
+
+	if(ni.blk_addr != NULL_ADDR) {
+		page = f2fs_get_node_page(super, ino);
+		if(page == NULL) {
+			return NULL;
+		}
+		ri = &F2FS_NODE(page)->i;
+
+		ri->i_mode = sri->i_mode;
+		ri->i_advise = sri->i_advise;
+		ri->i_uid = sri->i_uid;
+		ri->i_gid = sri->i_gid;
+		ri->i_size = sri->i_size;
+		ri->i_atime = sri->i_atime;
+		ri->i_ctime = sri->i_ctime;
+		ri->i_mtime = sri->i_mtime;
+		ri->i_atime_nsec = sri->i_atime_nsec;
+		ri->i_ctime_nsec = sri->i_ctime_nsec;
+		ri->i_mtime_nsec = sri->i_mtime_nsec;
+		ri->i_flags = sri->i_flags;
+		if(f2fs_has_inline(sri) && f2fs_has_inline(ri)) {
+			memcpy(inline_data_addr(ri), inline_data_addr(sri),
+				MAX_INLINE_DATA(super->raw_super, sri));
+		}
+		f2fs_mark_node_dirty(super, page);
+		return page;
+	}
+
+	e = grab_nat_entry(nm, ino);
+	if(e == NULL) {
+		perror("f2fs_malloc");
+		return NULL;
+	}
+	e->ni = ni;
+
+	page = f2fs_new_node_page(super, ino, ino, 0, is_cold_node(src));
+	if(page == NULL) {
+		return NULL;
+	}
+	ri = &F2FS_NODE(page)->i;
+
+	memcpy(ri, sri, offsetof(struct f2fs_node, footer));
+	if(!f2fs_has_inline(ri)) {
+		memset(ri->i_addr, 0, sizeof(ri->i_addr));
+	}
+	memset(ri->i_nid, 0, sizeof(ri->i_nid));
+	ri->i_xattr_nid = cpu_to_le32(0);
+	ri->i_blocks = cpu_to_le64(1);
+	return page;
+}
+
+/* release a node block and its nid, the nid is reusable after checkpoint */
+int f2fs_remove_node(struct f2fs_super *super, nid_t nid)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct nat_entry *e = NULL;
+	struct node_info ni;
+	int ret = 0;
+
+	ret = f2fs_get_node_info(super, nid, &ni);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(ni.blk_addr == NULL_ADDR) {
+		return 0;
+	}
+
+	e = grab_nat_entry(nm, nid);
+	if(e == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	f2fs_invalidate_block(super, ni.blk_addr);
+	e->ni = ni;
+	e->ni.blk_addr = NULL_ADDR;
+	e->ni.version++;
+	set_nat_dirty(nm, e);
+	del_node_page(nm, nid);
+
+	nm->valid_node_count--;
+	if(nid == ni.ino) {
+		nm->valid_inode_count--;
+	}
+	return 0;
+}
+
+static int inode_has_chksum(struct f2fs_super *super, struct f2fs_raw_inode *ri)
+{
+	size_t end = offsetof(struct f2fs_raw_inode, i_inode_checksum) + sizeof(__le32);
+
+	if(!F2FS_HAS_FEATURE(super->raw_super, F2FS_FEATURE_INODE_CHKSUM)) {
+		return 0;
+	}
+
+	if(!(ri->i_inline & F2FS_EXTRA_ATTR)) {
+		return 0;
+	}
+	return end <= offsetof(struct f2fs_raw_inode, i_addr) +
+		le16_to_cpu(ri->i_extra_isize);
+}
+
+/* seeded with the uuid, then ino and generation, checksum field as zero */
+static unsigned int inode_chksum(struct f2fs_super *super, struct page *page)
+{
+	struct f2fs_node *rn = F2FS_NODE(page);
+	struct f2fs_raw_inode *ri = &rn->i;
+	size_t offset = offsetof(struct f2fs_raw_inode, i_inode_checksum);
+	__le32 ino = rn->footer.ino, gen = ri->i_generation, dummy = 0;
+	unsigned int crc = 0;
+
+	crc = f2fs_cal_crc32(~0, super->raw_super->uuid, sizeof(super->raw_super->uuid));
+	crc = f2fs_cal_crc32(crc, &ino, sizeof(ino));
+	crc = f2fs_cal_crc32(crc, &gen, sizeof(gen));
+	crc = f2fs_cal_crc32(crc, ri, offset);
+	crc = f2fs_cal_crc32(crc, &dummy, sizeof(dummy));
+	offset += sizeof(dummy);
+	return f2fs_cal_crc32(crc, (char *)ri + offset, F2FS_BLKSIZE - offset);
+}
+
+/* 1 when the inode in page carries no checksum or a matching one */
+int f2fs_inode_chksum_verify(struct f2fs_super *super, struct page *page)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(page)->i;
+
+	if(!inode_has_chksum(super, ri)) {
+		return 1;
+	}
+	return le32_to_cpu(ri->i_inode_checksum) == inode_chksum(super, page);
+}
+
+/* dentry-carrying dnodes of dirs go hot, files warm, indirect nodes cold */
+static int node_seg_type(struct page *page)
+{
+	if(!IS_DNODE(page)) {
+		return CURSEG_COLD_NODE;
+	}
+
+	if(is_cold_node(page)) {
+		return CURSEG_WARM_NODE;
+	}
+	return CURSEG_HOT_NODE;
+}
+
+int f2fs_flush_nodes(struct f2fs_super *super)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct f2fs_summary sum;
+	struct node_page *np = NULL;
+	struct nat_entry *e = NULL;
+	struct f2fs_node *rn = NULL;
+	struct node_info ni;
+	block_t new_blkaddr = 0;
+	int ret = 0, type = 0;
+
+	for(np=nm->node_list; np!=NULL; np=np->list) {
+		if(!np->dirty) {
+			continue;
+		}
+
+		ret = f2fs_get_node_info(super, np->nid, &ni);
+		if(ret < 0) {
+			return ret;
+		}
+
+		e = grab_nat_entry(nm, np->nid);
+		if(e == NULL) {
+			perror("f2fs_malloc");
+			return -ENOMEM;
+		}
+		e->ni = ni;
+
+		type = node_seg_type(np->page);
+		set_summary(&sum, np->nid, 0, e->ni.version);
+		ret = f2fs_allocate_block(super, type, &sum, &new_blkaddr);
+		if(ret < 0) {
+			return ret;
+		}
+
+		rn = F2FS_NODE(np->page);
+		rn->footer.cp_ver = cpu_to_le64(cpver_of_node(super->raw_cp));
+		rn->footer.next_blkaddr = cpu_to_le32(f2fs_next_free_blkaddr(super, type));
+		if(IS_INODE(np->page) && inode_has_chksum(super, &rn->i)) {
+			rn->i.i_inode_checksum = cpu_to_le32(inode_chksum(super, np->page));
+		}
+
+		ret = f2fs_submit_page(super, type, np->page, new_blkaddr);
+		if(ret < 0) {
+			return ret;
+		}
+
+		f2fs_invalidate_block(super, e->ni.blk_addr);
+		e->ni.blk_addr = new_blkaddr;
+		set_nat_dirty(nm, e);
+		np->dirty = 0;
+		nm->dirty_node_cnt--;
+	}
+	return f2fs_flush_write_buffers(super);
+}
+
+static int nat_entry_cmp(const void *a, const void *b)
+{
+	nid_t na = (*(struct nat_entry **)a)->ni.nid;
+	nid_t nb = (*(struct nat_entry **)b)->ni.nid;
+
+	return na < nb ? -1 : na > nb;
+}
+
+static void raw_nat_from_node_info(struct f2fs_nat_entry *raw_ne, struct node_info *ni)
+{
+	raw_ne->ino = cpu_to_le32(ni->ino);
+	raw_ne->block_addr = cpu_to_le32(ni->blk_addr);
+	raw_ne->version = ni->version;
+}
+
+/* keep nat_bits in step with a nat block about to be written */
+static void update_nat_bits(struct f2fs_super *super, unsigned int index,
+		struct f2fs_nat_block *nat_blk)
+{
+	unsigned int valid = 0, i = 0;
+
+	if(super->nat_bits == NULL) {
+		return;
+	}
+
+	/* nid 0 is reserved and counts as used */
+	if(index == 0) {
+		valid = 1;
+		i = 1;
+	}
+
+	for(; i<NAT_ENTRY_PER_BLOCK; i++) {
+		if(le32_to_cpu(nat_blk->entries[i].block_addr) != NULL_ADDR) {
+			valid++;
+		}
+	}
+
+	if(valid == 0) {
+		set_bit_le(index, super->empty_nat_bits);
+	} else {
+		clear_bit_le(index, super->empty_nat_bits);
+	}
+
+	if(valid == NAT_ENTRY_PER_BLOCK) {
+		set_bit_le(index, super->full_nat_bits);
+	} else {
+		clear_bit_le(index, super->full_nat_bits);
+	}
+}
+
+static int flush_nat_blocks(struct f2fs_super *super, struct nat_entry **set, int cnt)
+{
+	struct f2fs_nat_block *nat_blk = NULL;
+	struct page *page = NULL;
+	unsigned int index = 0;
+	block_t blkaddr = 0;
+	int ret = 0, i = 0;
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+	nat_blk = page_address(page);
+
+	while(i < cnt) {
+		index = set[i]->ni.nid / NAT_ENTRY_PER_BLOCK;
+		blkaddr = current_nat_addr(super, set[i]->ni.nid);
+		ret = read_page(page, super->fd, blkaddr);
+		if(ret < 0) {
+			perror("read page");
+			goto out;
+		}
+
+		for(; i<cnt && set[i]->ni.nid / NAT_ENTRY_PER_BLOCK == index; i++) {
+			raw_nat_from_node_info(&nat_blk->entries[set[i]->ni.nid % NAT_ENTRY_PER_BLOCK],
+				&set[i]->ni);
+		}
+		update_nat_bits(super, index, nat_blk);
+
+		/* the two copies of a nat block sit in adjacent segments */
+		if(f2fs_test_bit(index, super->nat_bitmap)) {
+			blkaddr -= blocks_per_seg(super);
+		} else {
+			blkaddr += blocks_per_seg(super);
+		}
+
+		ret = write_page(page, super->fd, blkaddr);
+		if(ret < 0) {
+			perror("write page");
+			goto out;
+		}
+		f2fs_change_bit(index, super->nat_bitmap);
+	}
+	ret = 0;
+
+out:
+	free_page(page);
+	return ret;
+}
+
+/*
+ * Like sit entries, dirty nat entries go to the hot data journal when they
+ * fit and to the shadow copies of their nat blocks otherwise.
+ */
+int f2fs_flush_nat_entries(struct f2fs_super *super)
+{
+	struct f2fs_nm_info *nm = NM_I(super);
+	struct f2fs_journal *journal = NAT_JOURNAL(super);
+	struct nat_entry **set = NULL, *e = NULL;
+	struct node_info ni;
+	int i = 0, cnt = 0, ret = 0;
+
+	for(i=0; i<nats_in_cursum(journal); i++) {
+		ni.nid = le32_to_cpu(journal->nat_j.entries[i].nid);
+		e = lookup_nat_cache(nm, ni.nid);
+		if(e == NULL) {
+			e = grab_nat_entry(nm, ni.nid);
+			if(e == NULL) {
+				perror("f2fs_malloc");
+				return -ENOMEM;
+			}
+			node_info_from_raw_nat(&e->ni, &journal->nat_j.entries[i].ne);
+		}
+		set_nat_dirty(nm, e);
+	}
+	journal->n_nats = cpu_to_le16(0);
+
+	if(nm->dirty_nat_cnt == 0) {
+		return 0;
+	}
+
+	set = f2fs_malloc(nm->dirty_nat_cnt * sizeof(struct nat_entry *));
+	if(set == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	for(i=0; i<NM_HASH_SIZE; i++) {
+		for(e=nm->nat_hash[i]; e!=NULL; e=e->next) {
+			if(e->dirty) {
+				set[cnt++] = e;
+			}
+		}
+	}
+
+	for(i=0; i<cnt; i++) {
+		if(set[i]->ni.blk_addr == NEW_ADDR) {
+			BUG("BUG: nid %u was never written\n", set[i]->ni.nid);
+		}
+	}
+	qsort(set, cnt, sizeof(struct nat_entry *), nat_entry_cmp);
+
+	/* nat_bits only describe nat blocks, so they need an empty journal */
+	if(cnt <= NAT_JOURNAL_ENTRIES && super->nat_bits == NULL) {
+		for(i=0; i<cnt; i++) {
+			journal->nat_j.entries[i].nid = cpu_to_le32(set[i]->ni.nid);
+			raw_nat_from_node_info(&journal->nat_j.entries[i].ne, &set[i]->ni);
+		}
+		journal->n_nats = cpu_to_le16(cnt);
+	} else {
+		ret = flush_nat_blocks(super, set, cnt);
+		if(ret < 0) {
+			goto out;
+		}
+	}
+
+	for(i=0; i<cnt; i++) {
+		set[i]->dirty = 0;
+	}
+	nm->dirty_nat_cnt = 0;
+
+out:
+	f2fs_free(set);
+	return ret;
+}
+
+/*
+ * nat_bits are only trusted when they were written with this checkpoint and
+ * no journaled entry shadows the block.
+ */
+int f2fs_nat_block_state(struct f2fs_super *super, unsigned int nat_index)
+{
+	struct f2fs_journal *journal = NULL;
+	nid_t start = nat_index * NAT_ENTRY_PER_BLOCK, nid = 0;
+	int i = 0;
+
+	if(f2fs_load(super, F2FS_LAZY_NAT) < 0 || super->nat_bits == NULL) {
+		return NAT_BLOCK_UNKNOWN;
+	}
+
+	if(super->sum_blk[CURSEG_HOT_DATA] != NULL) {
+		journal = NAT_JOURNAL(super);
+		for(i=0; i<nats_in_cursum(journal); i++) {
+			nid = le32_to_cpu(journal->nat_j.entries[i].nid);
+			if(nid >= start && nid < start + NAT_ENTRY_PER_BLOCK) {
+				return NAT_BLOCK_UNKNOWN;
+			}
+		}
+	}
+
+	if(test_bit_le(nat_index, super->empty_nat_bits)) {
+		return NAT_BLOCK_EMPTY;
+	}
+
+	if(test_bit_le(nat_index, super->full_nat_bits)) {
+		return NAT_BLOCK_FULL;
+	}
+	return NAT_BLOCK_UNKNOWN;
+}
+
+struct nat_scan_ctx {
+	nid_t start;
+	int flags;
+	nat_scan_fn fn;
+	void *arg;
+};
+
+static int scan_empty_nat_block(struct f2fs_super *super, unsigned int nat_index,
+		struct nat_scan_ctx *ctx)
+{
+	struct node_info ni;
+	nid_t nid = nat_index * NAT_ENTRY_PER_BLOCK;
+	int i = 0, ret = 0;
+
+	if(!(ctx->flags & NAT_SCAN_FREE)) {
+		return 0;
+	}
+
+	memset(&ni, 0, sizeof(struct node_info));
+	for(i=0; i<NAT_ENTRY_PER_BLOCK; i++, nid++) {
+		if(nid < F2FS_RESERVED_NODE_NUM || nid < ctx->start) {
+			continue;
+		}
+
+		ni.nid = nid;
+		ret = ctx->fn(super, &ni, ctx->arg);
+		if(ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int scan_nat_block(struct f2fs_super *super, unsigned int nat_index,
+		struct f2fs_nat_block *nat_blk, int state, struct nat_scan_ctx *ctx)
+{
+	struct f2fs_journal *journal = NULL;
+	struct f2fs_nat_entry *raw_ne = NULL;
+	struct node_info ni;
+	nid_t start = nat_index * NAT_ENTRY_PER_BLOCK, nid = 0;
+	int i = 0, ret = 0;
+
+	/* every entry is in use, hand them out as they are, nid 0 excepted */
+	if(state == NAT_BLOCK_FULL) {
+		for(i=(start == 0); i<NAT_ENTRY_PER_BLOCK; i++) {
+			if(start + i < ctx->start) {
+				continue;
+			}
+
+			ni.nid = start + i;
+			node_info_from_raw_nat(&ni, &nat_blk->entries[i]);
+			ret = ctx->fn(super, &ni, ctx->arg);
+			if(ret != 0) {
+				return ret;
+			}
+		}
+		return 0;
+	}
+
+	/* the journal is newer than the block */
+	if(super->sum_blk[CURSEG_HOT_DATA] != NULL) {
+		journal = NAT_JOURNAL(super);
+		for(i=0; i<nats_in_cursum(journal); i++) {
+			nid = le32_to_cpu(journal->nat_j.entries[i].nid);
+			if(nid >= start && nid < start + NAT_ENTRY_PER_BLOCK) {
+				nat_blk->entries[nid - start] = journal->nat_j.entries[i].ne;
+			}
+		}
+	}
+
+	for(i=0; i<NAT_ENTRY_PER_BLOCK; i++) {
+		nid = start + i;
+		raw_ne = &nat_blk->entries[i];
+		if(nid < ctx->start) {
+			continue;
+		}
+
+		if(nid < F2FS_RESERVED_NODE_NUM && raw_ne->block_addr == NULL_ADDR) {
+			continue;
+		}
+
+		if(raw_ne->block_addr == NULL_ADDR) {
+			if(!(ctx->flags & NAT_SCAN_FREE)) {
+				continue;
+			}
+		} else if(!(ctx->flags & NAT_SCAN_VALID)) {
+			continue;
+		}
+
+		ni.nid = nid;
+		node_info_from_raw_nat(&ni, raw_ne);
+		ret = ctx->fn(super, &ni, ctx->arg);
+		if(ret != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int need_read_nat_block(int state, int flags)
+{
+	if(state == NAT_BLOCK_EMPTY) {
+		return 0;
+	}
+
+	if(state == NAT_BLOCK_FULL && !(flags & NAT_SCAN_VALID)) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Walk the nat entries from start_nid on in nid order. Blocks nat_bits marks
+ * empty are never read, full ones are skipped by free scans and streamed by
+ * valid scans, and the rest are fetched in runs of physically consecutive
+ * blocks. A callback returning > 0 ends the scan early.
+ */
+int f2fs_scan_nat(struct f2fs_super *super, nid_t start_nid, int flags,
+		nat_scan_fn fn, void *arg, struct nat_scan_stat *stat)
+{
+	struct nat_scan_ctx ctx = {start_nid, flags, fn, arg};
+	struct nat_scan_stat tmp;
+	int states[NAT_SCAN_RA_BLOCKS];
+	unsigned int index = 0, nr = 0, i = 0;
+	block_t blkaddr = 0;
+	char *buf = NULL;
+	int ret = 0;
+
+	if(stat == NULL) {
+		stat = &tmp;
+	}
+	memset(stat, 0, sizeof(struct nat_scan_stat));
+
+	ret = f2fs_load(super, F2FS_LAZY_NAT);
+	if(ret < 0) {
+		return ret;
+	}
+
+	buf = f2fs_malloc(NAT_SCAN_RA_BLOCKS << F2FS_BLKSIZE_BITS);
+	if(buf == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	index = start_nid / NAT_ENTRY_PER_BLOCK;
+	while(index < super->nat_blocks) {
+		states[0] = f2fs_nat_block_state(super, index);
+		if(!need_read_nat_block(states[0], flags)) {
+			if(states[0] == NAT_BLOCK_EMPTY) {
+				stat->empty_blocks++;
+				ret = scan_empty_nat_block(super, index, &ctx);
+				if(ret != 0) {
+					goto out;
+				}
+			} else {
+				stat->full_blocks++;
+			}
+			index++;
+			continue;
+		}
+
+		blkaddr = current_nat_addr(super, index * NAT_ENTRY_PER_BLOCK);
+		for(nr=1; nr<NAT_SCAN_RA_BLOCKS && index + nr < super->nat_blocks; nr++) {
+			states[nr] = f2fs_nat_block_state(super, index + nr);
+			if(!need_read_nat_block(states[nr], flags)) {
+				break;
+			}
+
+			if(current_nat_addr(super, (index + nr) * NAT_ENTRY_PER_BLOCK) !=
+					blkaddr + nr) {
+				break;
+			}
+		}
+
+		ret = read_pages(buf, super->fd, blkaddr, nr);
+		if(ret < 0) {
+			perror("read pages");
+			goto out;
+		}
+		stat->reads++;
+		stat->read_blocks += nr;
+
+		for(i=0; i<nr; i++) {
+			if(states[i] == NAT_BLOCK_FULL) {
+				stat->full_blocks++;
+			}
+
+			ret = scan_nat_block(super, index + i,
+				(void *)(buf + (i << F2FS_BLKSIZE_BITS)), states[i], &ctx);
+			if(ret != 0) {
+				goto out;
+			}
+		}
+		index += nr;
+	}
+	ret = 0;
+
+out:
+	f2fs_free(buf);
+	return ret < 0 ? ret : 0;
+}
@@ -0,0 +1,253 @@
+#ifndef __NODE_H__
+#define __NODE_H__
+
+#include <pthread.h>
+#include "f2fs.h"
+
+struct node_info {
+	nid_t nid;
+	nid_t ino;
+	block_t blk_addr;
+	unsigned char version;
+};
+
+/* what nat_bits knows about a nat block without reading it */
+enum {
+	NAT_BLOCK_UNKNOWN = 0,
+	NAT_BLOCK_EMPTY,
+	NAT_BLOCK_FULL,
+};
+
+/* f2fs_scan_nat flags */
+#define NAT_SCAN_VALID		0x1	/* report nids that have a block */
+#define NAT_SCAN_FREE		0x2	/* report nids that are free */
+
+/* max nat blocks fetched by one read during a scan */
+#define NAT_SCAN_RA_BLOCKS	64
+
+struct nat_scan_stat {
+	unsigned int empty_blocks;	/* skipped, known empty */
+	unsigned int full_blocks;	/* streamed without entry checks */
+	unsigned int read_blocks;	/* read from the device */
+	unsigned int reads;		/* read syscalls */
+};
+
+#define NM_HASH_SIZE		4096
+#define FREE_NID_BATCH		4096
+
+struct nat_entry {
+	struct nat_entry *next;
+	struct node_info ni;
+	int dirty;
+};
+
+/* node blocks read or built by a modifying command */
+struct node_page {
+	struct node_page *next;		/* hash chain */
+	struct node_page *list;		/* every cached node page */
+	nid_t nid;
+	int dirty;
+	struct page *page;
+};
+
+struct free_nid {
+	nid_t nid;
+	unsigned char version;
+};
+
+struct f2fs_nm_info {
+	struct nat_entry *nat_hash[NM_HASH_SIZE];
+	struct node_page *node_hash[NM_HASH_SIZE];
+	struct node_page *node_list;
+	unsigned int nat_cnt, dirty_nat_cnt;
+	unsigned int node_cnt, dirty_node_cnt;
+
+	struct free_nid *free_nids;
+	unsigned int nr_free_nids, free_nid_pos;
+	nid_t next_scan_nid;
+
+	unsigned int valid_node_count;
+	unsigned int valid_inode_count;
+};
+
+#define NM_I(super)		((super)->nm_info)
+
+/*
+ * Read-only cache of nat entries and node blocks for library handles. Nids
+ * are spread over stripes with a lock each, so readers on different threads
+ * rarely wait on each other.
+ */
+#define NC_STRIPES		64
+#define NC_HASH_SIZE		256	/* buckets per stripe */
+#define NC_STRIPE_ENTRIES	256	/* entries kept per stripe */
+
+struct ncache_entry {
+	struct ncache_entry *next;	/* hash chain */
+	struct ncache_entry *prev_lru, *next_lru;
+	struct node_info ni;
+	struct page *page;		/* NULL until the block is read */
+};
+
+struct ncache_stripe {
+	pthread_mutex_t lock;
+	struct ncache_entry *hash[NC_HASH_SIZE];
+	struct ncache_entry lru;	/* most recently used first */
+	unsigned int nr_entries;
+};
+
+struct f2fs_node_cache {
+	struct ncache_stripe stripes[NC_STRIPES];
+};
+
+#define NC_I(super)		((super)->nc_info)
+
+typedef int (*nat_scan_fn)(struct f2fs_super *super, struct node_info *ni, void *arg);
+
+static inline nid_t max_nid(struct f2fs_super *super)
+{
+	return super->nat_blocks * NAT_ENTRY_PER_BLOCK;
+}
+
+static inline block_t current_nat_addr(struct f2fs_super *super, nid_t nid)
+{
+	unsigned int block_off = nid / NAT_ENTRY_PER_BLOCK;
+	unsigned int log_blocks = le32_to_cpu(super->raw_super->log_blocks_per_seg);
+	block_t blkaddr = 0;
+
+	blkaddr = le32_to_cpu(super->raw_super->nat_blkaddr) +
+		((block_t)(block_off >> log_blocks) << log_blocks << 1) +
+		(block_off & (blocks_per_seg(super) - 1));
+
+	if(f2fs_test_bit(block_off, super->nat_bitmap)) {
+		blkaddr += blocks_per_seg(super);
+	}
+	return blkaddr;
+}
+
+/* the version node footers carry, crc included when the cp asks for it */
+static inline unsigned long long cpver_of_node(struct f2fs_checkpoint *cp)
+{
+	unsigned long long cp_ver = cur_cp_version(cp);
+
+	if(is_set_ckpt_flags(cp, CP_CRC_RECOVERY_FLAG)) {
+		cp_ver |= (unsigned long long)cur_cp_crc(cp) << 32;
+	}
+	return cp_ver;
+}
+
+static inline void node_info_from_raw_nat(struct node_info *ni,
+		struct f2fs_nat_entry *raw_ne)
+{
+	ni->ino = le32_to_cpu(raw_ne->ino);
+	ni->blk_addr = le32_to_cpu(raw_ne->block_addr);
+	ni->version = raw_ne->version;
+}
+
+static inline struct f2fs_node *F2FS_NODE(struct page *page)
+{
+	return (struct f2fs_node *)page_address(page);
+}
+
+static inline nid_t nid_of_node(struct page *page)
+{
+	return le32_to_cpu(F2FS_NODE(page)->footer.nid);
+}
+
+static inline nid_t ino_of_node(struct page *page)
+{
+	return le32_to_cpu(F2FS_NODE(page)->footer.ino);
+}
+
+static inline unsigned int ofs_of_node(struct page *page)
+{
+	return le32_to_cpu(F2FS_NODE(page)->footer.flag) >> OFFSET_BIT_SHIFT;
+}
+
+static inline int IS_INODE(struct page *page)
+{
+	return ofs_of_node(page) == 0;
+}
+
+static inline int IS_DNODE(struct page *page)
+{
+	unsigned int ofs = ofs_of_node(page);
+
+	if(ofs == 3 || ofs == 4 + NIDS_PER_BLOCK || ofs == 5 + 2 * NIDS_PER_BLOCK) {
+		return 0;
+	}
+
+	if(ofs >= 6 + 2 * NIDS_PER_BLOCK) {
+		ofs -= 6 + 2 * NIDS_PER_BLOCK;
+		if(!(ofs % (NIDS_PER_BLOCK + 1))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static inline int is_node(struct page *page, int type)
+{
+	return (le32_to_cpu(F2FS_NODE(page)->footer.flag) >> type) & 1;
+}
+
+#define is_cold_node(page)	is_node(page, COLD_BIT_SHIFT)
+#define is_fsync_dnode(page)	is_node(page, FSYNC_BIT_SHIFT)
+#define is_dent_dnode(page)	is_node(page, DENT_BIT_SHIFT)
+
+static inline void fill_node_footer(struct page *page, nid_t nid, nid_t ino,
+		unsigned int ofs, int cold)
+{
+	struct f2fs_node *rn = F2FS_NODE(page);
+
+	rn->footer.nid = cpu_to_le32(nid);
+	rn->footer.ino = cpu_to_le32(ino);
+	rn->footer.flag = cpu_to_le32((ofs << OFFSET_BIT_SHIFT) |
+		(cold ? 1 << COLD_BIT_SHIFT : 0));
+}
+
+/* i == 1 means the parent is the inode itself */
+static inline nid_t get_nid(struct page *page, int off, int i)
+{
+	struct f2fs_node *rn = F2FS_NODE(page);
+
+	if(i == 1) {
+		return le32_to_cpu(rn->i.i_nid[off - NODE_DIR1_BLOCK]);
+	}
+	return le32_to_cpu(rn->in.nid[off]);
+}
+
+static inline void set_nid(struct page *page, int off, nid_t nid, int i)
+{
+	struct f2fs_node *rn = F2FS_NODE(page);
+
+	if(i == 1) {
+		rn->i.i_nid[off - NODE_DIR1_BLOCK] = cpu_to_le32(nid);
+	} else {
+		rn->in.nid[off] = cpu_to_le32(nid);
+	}
+}
+
+int f2fs_build_node_cache(struct f2fs_super *super);
+void f2fs_destroy_node_cache(struct f2fs_super *super);
+int f2fs_build_node_manager(struct f2fs_super *super);
+void f2fs_destroy_node_manager(struct f2fs_super *super);
+int f2fs_read_node_block(struct f2fs_super *super, nid_t nid, struct page *page);
+int f2fs_node_cached(struct f2fs_super *super, nid_t nid);
+struct page *f2fs_get_node_page(struct f2fs_super *super, nid_t nid);
+void f2fs_put_node_page(struct f2fs_super *super, struct page *page);
+struct page *f2fs_new_node_page(struct f2fs_super *super, nid_t nid, nid_t ino,
+		unsigned int ofs, int cold);
+void f2fs_mark_node_dirty(struct f2fs_super *super, struct page *page);
+int f2fs_alloc_nid(struct f2fs_super *super, nid_t *nid);
+nid_t f2fs_next_free_nid(struct f2fs_super *super);
+struct page *f2fs_recover_inode_page(struct f2fs_super *super, struct page *src);
+int f2fs_remove_node(struct f2fs_super *super, nid_t nid);
+int f2fs_flush_nodes(struct f2fs_super *super);
+int f2fs_flush_nat_entries(struct f2fs_super *super);
+int f2fs_get_node_info(struct f2fs_super *super, nid_t nid, struct node_info *ni);
+int f2fs_inode_chksum_verify(struct f2fs_super *super, struct page *page);
+int f2fs_nat_block_state(struct f2fs_super *super, unsigned int nat_index);
+int f2fs_scan_nat(struct f2fs_super *super, nid_t start_nid, int flags,
+		nat_scan_fn fn, void *arg, struct nat_scan_stat *stat);
+
+#endif /*__NODE_H__*/
@@ -4,7 +4,9 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include "f2fs_type.h"
+#include "stats.h"
 
 #define F2FS_PAGE_SIZE 4096
 
@@ -32,12 +34,58 @@ static inline void free_page(struct page *page)
 	f2fs_free(page_address(page));
 }
 
-static inline int read_page(struct page *page, int fd, int sector)
+static inline int read_page(struct page *page, int fd, block_t blkaddr)
 {
-	size_t len = 0;
-	lseek(fd, sector * F2FS_PAGE_SIZE, SEEK_SET);
-	len = read(fd, page_address(page), F2FS_PAGE_SIZE);
+	struct timespec start;
+	ssize_t len = 0;
+
+	f2fs_stat_read_start(&start);
+	len = pread(fd, page_address(page), F2FS_PAGE_SIZE,
+		(off_t)blkaddr * F2FS_PAGE_SIZE);
+	f2fs_stat_read_end(&start, len);
+	return len;
+}
+
+/* read nr consecutive blocks with one syscall, short reads are errors */
+static inline int read_pages(void *buf, int fd, block_t blkaddr, int nr)
+{
+	struct timespec start;
+	ssize_t len = 0;
+
+	f2fs_stat_read_start(&start);
+	len = pread(fd, buf, (size_t)nr * F2FS_PAGE_SIZE,
+		(off_t)blkaddr * F2FS_PAGE_SIZE);
+	f2fs_stat_read_end(&start, len);
+	if(len != (ssize_t)nr * F2FS_PAGE_SIZE) {
+		return -1;
+	}
+	return nr;
+}
+
+static inline int write_page(struct page *page, int fd, block_t blkaddr)
+{
+	ssize_t len = 0;
+
+	len = pwrite(fd, page_address(page), F2FS_PAGE_SIZE,
+		(off_t)blkaddr * F2FS_PAGE_SIZE);
+	f2fs_stat_write(len);
+	if(len != F2FS_PAGE_SIZE) {
+		return -1;
+	}
 	return len;
 }
 
+/* write a run of consecutive blocks gathered from nr pages */
+static inline int write_pagesv(struct iovec *iov, int nr, int fd, block_t blkaddr)
+{
+	ssize_t len = 0;
+
+	len = pwritev(fd, iov, nr, (off_t)blkaddr * F2FS_PAGE_SIZE);
+	f2fs_stat_write(len);
+	if(len != (ssize_t)nr * F2FS_PAGE_SIZE) {
+		return -1;
+	}
+	return nr;
+}
+
 #endif /*__PAGE_H__*/
@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "segment.h"
+#include "data.h"
+#include "dir.h"
+#include "namei.h"
+#include "recovery.h"
+#include "dev.h"
+
+/*
+ * Roll-forward recovery, after the kernel: fsync writes dnodes to the warm
+ * node log without a checkpoint, each one pointing at the next block of the
+ * log in its footer. The chain starts at the log head of the checkpoint and
+ * ends at the first block whose footer carries another checkpoint version.
+ */
+
+struct fsync_inode_entry {
+	struct fsync_inode_entry *next;
+	nid_t ino;
+	block_t blkaddr;		/* last fsync'd node block */
+	block_t last_dentry;		/* inode block to take the dentry from */
+	struct page *inode_page;
+};
+
+/* window of the warm node log read ahead of the footer checks */
+struct node_chain {
+	struct f2fs_super *super;
+	char *buf;
+	block_t start;
+	int nr;
+	unsigned int loop;
+	struct recovery_stat *stat;
+};
+
+static int init_node_chain(struct node_chain *chain, struct f2fs_super *super,
+		struct recovery_stat *stat)
+{
+	chain->buf = f2fs_malloc(RECOVERY_RA_BLOCKS * F2FS_PAGE_SIZE);
+	if(chain->buf == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	chain->super = super;
+	chain->start = NULL_ADDR;
+	chain->nr = 0;
+	chain->loop = 0;
+	chain->stat = stat;
+	return 0;
+}
+
+static void release_node_chain(struct node_chain *chain)
+{
+	f2fs_free(chain->buf);
+	chain->buf = NULL;
+}
+
+/*
+ * The log is written in order inside a segment, so the rest of the segment
+ * is read with one syscall and the window behind it is handed to the page
+ * cache while this one is checked.
+ */
+static struct page *chain_page(struct node_chain *chain, block_t blkaddr)
+{
+	struct f2fs_super *super = chain->super;
+	block_t seg_end = 0, next = 0, devblk = 0;
+	struct f2fs_dev *dev = NULL;
+	int nr = 0;
+
+	if(chain->nr > 0 && blkaddr >= chain->start &&
+			blkaddr < chain->start + chain->nr) {
+		return (struct page *)(chain->buf +
+			(size_t)(blkaddr - chain->start) * F2FS_PAGE_SIZE);
+	}
+
+	seg_end = START_BLOCK(super, GET_SEGNO(super, blkaddr) + 1);
+	nr = seg_end - blkaddr;
+	if(nr > RECOVERY_RA_BLOCKS) {
+		nr = RECOVERY_RA_BLOCKS;
+	}
+
+	if(f2fs_read_blocks(super, chain->buf, blkaddr, nr) < 0) {
+		perror("read pages");
+		chain->nr = 0;
+		return NULL;
+	}
+	chain->start = blkaddr;
+	chain->nr = nr;
+	chain->stat->reads++;
+
+	next = blkaddr + nr;
+	if(next < seg_end) {
+		nr = seg_end - next;
+		if(nr > RECOVERY_RA_BLOCKS) {
+			nr = RECOVERY_RA_BLOCKS;
+		}
+		dev = f2fs_dev_map(super, next, &devblk);
+		posix_fadvise(dev->fd, (off_t)devblk * F2FS_PAGE_SIZE,
+			(off_t)nr * F2FS_PAGE_SIZE, POSIX_FADV_WILLNEED);
+	}
+	return (struct page *)chain->buf;
+}
+
+static int is_recoverable_dnode(struct f2fs_super *super, struct page *page)
+{
+	struct f2fs_checkpoint *cp = super->raw_cp;
+	unsigned long long cp_ver = le64_to_cpu(F2FS_NODE(page)->footer.cp_ver);
+
+	/* fsck may have reset the crc part */
+	if(is_set_ckpt_flags(cp, CP_NOCRC_RECOVERY_FLAG)) {
+		return (unsigned int)cp_ver == (unsigned int)cur_cp_version(cp);
+	}
+	return cp_ver == cpver_of_node(cp);
+}
+
+/* next verified block of the chain, NULL once it ends */
+static struct page *next_chain_page(struct node_chain *chain, block_t *blkaddr)
+{
+	struct f2fs_super *super = chain->super;
+	struct page *page = NULL;
+
+	if(!is_main_blkaddr(super, *blkaddr)) {
+		return NULL;
+	}
+
+	/* a stale footer pointing backwards must not keep us busy forever */
+	if(chain->loop++ >= SM_I(super)->main_segments * blocks_per_seg(super)) {
+		printf("recovery: node chain loops at %llu\n", *blkaddr);
+		return NULL;
+	}
+
+	page = chain_page(chain, *blkaddr);
+	if(page == NULL || !is_recoverable_dnode(super, page)) {
+		return NULL;
+	}
+
+	if(nid_of_node(page) >= max_nid(super) || ino_of_node(page) >= max_nid(super)) {
+		return NULL;
+	}
+	return page;
+}
+
+static struct fsync_inode_entry *get_fsync_inode(struct fsync_inode_entry *head,
+		nid_t ino)
+{
+	while(head != NULL && head->ino != ino) {
+		head = head->next;
+	}
+	return head;
+}
+
+static struct fsync_inode_entry *add_fsync_inode(struct fsync_inode_entry **head,
+		nid_t ino)
+{
+	struct fsync_inode_entry *entry = NULL;
+
+	entry = f2fs_malloc(sizeof(struct fsync_inode_entry));
+	if(entry == NULL) {
+		perror("f2fs_malloc");
+		return NULL;
+	}
+	memset(entry, 0, sizeof(struct fsync_inode_entry));
+	entry->ino = ino;
+	entry->next = *head;
+	*head = entry;
+	return entry;
+}
+
+static void destroy_fsync_inodes(struct fsync_inode_entry **head)
+{
+	struct fsync_inode_entry *entry = NULL;
+
+	while(*head != NULL) {
+		entry = *head;
+		*head = entry->next;
+		f2fs_free(entry);
+	}
+}
+
+/*
+ * First walk: remember the last fsync'd block of every inode. Inodes
+ * created after the checkpoint are brought in as soon as their dentry
+ * carrying inode block shows up, so no nid handed out later collides.
+ */
+static int find_fsync_dnodes(struct f2fs_super *super, struct node_chain *chain,
+		struct fsync_inode_entry **head)
+{
+	struct fsync_inode_entry *entry = NULL, **pp = NULL;
+	block_t blkaddr = f2fs_next_free_blkaddr(super, CURSEG_WARM_NODE);
+	struct page *page = NULL;
+	struct node_info ni;
+	int ret = 0;
+
+	while((page = next_chain_page(chain, &blkaddr)) != NULL) {
+		chain->stat->chain_blocks++;
+		/* a crash before the next checkpoint replays the chain again */
+		f2fs_pin_segment(super, GET_SEGNO(super, blkaddr));
+		if(!is_fsync_dnode(page)) {
+			goto next;
+		}
+
+		entry = get_fsync_inode(*head, ino_of_node(page));
+		if(entry == NULL) {
+			entry = add_fsync_inode(head, ino_of_node(page));
+			if(entry == NULL) {
+				return -ENOMEM;
+			}
+		}
+
+		if(IS_INODE(page) && is_dent_dnode(page)) {
+			entry->inode_page = f2fs_recover_inode_page(super, page);
+			if(entry->inode_page == NULL) {
+				return -EIO;
+			}
+			entry->last_dentry = blkaddr;
+		}
+		entry->blkaddr = blkaddr;
+next:
+		blkaddr = le32_to_cpu(F2FS_NODE(page)->footer.next_blkaddr);
+	}
+
+	/* dnodes of an inode whose creation never made it are dropped */
+	pp = head;
+	while(*pp != NULL) {
+		entry = *pp;
+		if(entry->inode_page == NULL) {
+			ret = f2fs_get_node_info(super, entry->ino, &ni);
+			if(ret < 0) {
+				return ret;
+			}
+			if(ni.blk_addr == NULL_ADDR) {
+				*pp = entry->next;
+				f2fs_free(entry);
+				continue;
+			}
+		}
+		chain->stat->inodes++;
+		pp = &entry->next;
+	}
+	return 0;
+}
+
+/* link the inode under the name and parent its fsync'd inode block names */
+static int recover_dentry(struct f2fs_super *super, struct page *page,
+		struct recovery_stat *stat)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(page)->i, *pri = NULL;
+	nid_t ino = ino_of_node(page), pino = le32_to_cpu(ri->i_pino);
+	int len = le32_to_cpu(ri->i_namelen);
+	const char *name = (const char *)ri->i_name;
+	struct f2fs_dir_entry de;
+	struct page *dir_page = NULL;
+	int ret = 0;
+
+	if(len == 0 || len > F2FS_NAME_LEN || is_dot_dotdot(name, len)) {
+		return 0;
+	}
+
+	dir_page = f2fs_get_node_page(super, pino);
+	if(dir_page == NULL) {
+		printf("recovery: parent %u of inode %u is gone\n", pino, ino);
+		return -EIO;
+	}
+	pri = &F2FS_NODE(dir_page)->i;
+
+	ret = f2fs_find_entry(super, dir_page, name, len, &de);
+	if(ret == 0 && le32_to_cpu(de.ino) == ino) {
+		goto out;
+	}
+
+	/* the name was reused after the checkpoint, the old inode goes away */
+	if(ret == 0) {
+		ret = f2fs_unlink(super, pino, name, len);
+	}
+	if(ret < 0 && ret != -ENOENT) {
+		goto out;
+	}
+
+	ret = f2fs_add_link(super, dir_page, name, len, ino,
+		f2fs_file_type(le16_to_cpu(ri->i_mode)));
+	if(ret < 0) {
+		goto out;
+	}
+
+	if(S_ISDIR(le16_to_cpu(ri->i_mode))) {
+		pri->i_links = cpu_to_le32(le32_to_cpu(pri->i_links) + 1);
+		f2fs_mark_node_dirty(super, dir_page);
+	}
+	stat->dentries++;
+out:
+	f2fs_put_node_page(super, dir_page);
+	return ret;
+}
+
+/* second walk: replay every node of a found inode up to its last fsync */
+static int recover_data(struct f2fs_super *super, struct node_chain *chain,
+		struct fsync_inode_entry **head)
+{
+	struct fsync_inode_entry *entry = NULL, **pp = NULL;
+	block_t blkaddr = f2fs_next_free_blkaddr(super, CURSEG_WARM_NODE);
+	struct page *page = NULL;
+	int ret = 0;
+
+	chain->loop = 0;
+	while(*head != NULL && (page = next_chain_page(chain, &blkaddr)) != NULL) {
+		entry = get_fsync_inode(*head, ino_of_node(page));
+		if(entry == NULL) {
+			goto next;
+		}
+
+		if(IS_INODE(page)) {
+			entry->inode_page = f2fs_recover_inode_page(super, page);
+		} else if(entry->inode_page == NULL) {
+			entry->inode_page = f2fs_get_node_page(super, entry->ino);
+		}
+		if(entry->inode_page == NULL) {
+			return -EIO;
+		}
+
+		if(entry->last_dentry == blkaddr) {
+			ret = recover_dentry(super, page, chain->stat);
+			if(ret < 0) {
+				return ret;
+			}
+		}
+
+		if(IS_DNODE(page)) {
+			ret = f2fs_recover_data_blocks(super, entry->inode_page, page,
+				&chain->stat->data_blocks);
+			if(ret < 0) {
+				return ret;
+			}
+		}
+		chain->stat->nodes++;
+
+		if(entry->blkaddr == blkaddr) {
+			for(pp=head; *pp!=entry; pp=&(*pp)->next);
+			*pp = entry->next;
+			f2fs_free(entry);
+		}
+next:
+		blkaddr = le32_to_cpu(F2FS_NODE(page)->footer.next_blkaddr);
+	}
+	return 0;
+}
+
+/* whether the chain holds fsync'd dnodes, without touching the managers */
+int f2fs_has_fsync_data(struct f2fs_super *super)
+{
+	block_t blkaddr = f2fs_next_free_blkaddr(super, CURSEG_WARM_NODE);
+	struct recovery_stat stat;
+	struct node_chain chain;
+	struct page *page = NULL;
+	int ret = 0;
+
+	memset(&stat, 0, sizeof(struct recovery_stat));
+	ret = init_node_chain(&chain, super, &stat);
+	if(ret < 0) {
+		return ret;
+	}
+
+	while((page = next_chain_page(&chain, &blkaddr)) != NULL) {
+		if(is_fsync_dnode(page)) {
+			ret = 1;
+			break;
+		}
+		blkaddr = le32_to_cpu(F2FS_NODE(page)->footer.next_blkaddr);
+	}
+	release_node_chain(&chain);
+	return ret;
+}
+
+/*
+ * Replay the fsync'd state into the node, data and segment managers. The
+ * image itself is only changed by a checkpoint taken afterwards.
+ */
+int f2fs_recover_fsync_data(struct f2fs_super *super, struct recovery_stat *stat)
+{
+	struct fsync_inode_entry *head = NULL;
+	struct node_chain chain;
+	int ret = 0;
+
+	memset(stat, 0, sizeof(struct recovery_stat));
+	ret = init_node_chain(&chain, super, stat);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = find_fsync_dnodes(super, &chain, &head);
+	if(ret < 0 || head == NULL) {
+		goto out;
+	}
+
+	ret = recover_data(super, &chain, &head);
+	if(ret < 0) {
+		goto out;
+	}
+
+	/* the chain starts at the warm node head, what was replayed goes elsewhere */
+	ret = f2fs_new_cursegs(super);
+out:
+	destroy_fsync_inodes(&head);
+	release_node_chain(&chain);
+	return ret;
+}
@@ -0,0 +1,21 @@
+#ifndef __RECOVERY_H__
+#define __RECOVERY_H__
+
+#include "f2fs.h"
+
+/* warm node blocks fetched by one read while following the fsync chain */
+#define RECOVERY_RA_BLOCKS	64
+
+struct recovery_stat {
+	unsigned int chain_blocks;	/* node blocks past the checkpoint */
+	unsigned int reads;		/* read syscalls on the chain */
+	unsigned int inodes;		/* inodes with fsync'd nodes */
+	unsigned int nodes;		/* node blocks replayed */
+	unsigned int data_blocks;	/* block addresses replayed */
+	unsigned int dentries;		/* dentries brought back */
+};
+
+int f2fs_has_fsync_data(struct f2fs_super *super);
+int f2fs_recover_fsync_data(struct f2fs_super *super, struct recovery_stat *stat);
+
+#endif /*__RECOVERY_H__*/
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "f2fs_type.h"
+#include "roaring.h"
+
+void roaring_init(struct roaring *r)
+{
+	memset(r, 0, sizeof(struct roaring));
+}
+
+void roaring_free(struct roaring *r)
+{
+	unsigned int i = 0;
+
+	for(i=0; i<r->nr; i++) {
+		f2fs_free(r->groups[i].array);
+		f2fs_free(r->groups[i].bitmap);
+	}
+	f2fs_free(r->groups);
+	roaring_init(r);
+}
+
+/* the group of key, or where it goes */
+static unsigned int find_group(struct roaring *r, unsigned short key)
+{
+	unsigned int lo = 0, hi = r->nr, mid = 0;
+
+	/* appending */
+	if(r->nr > 0 && r->groups[r->nr - 1].key <= key) {
+		return r->groups[r->nr - 1].key == key ? r->nr - 1 : r->nr;
+	}
+
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(r->groups[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static struct roaring_group *insert_group(struct roaring *r, unsigned int pos,
+		unsigned short key)
+{
+	struct roaring_group *groups = NULL;
+	unsigned int max = 0;
+
+	if(r->nr == r->max) {
+		max = r->max ? r->max * 2 : 16;
+		groups = f2fs_malloc(max * sizeof(struct roaring_group));
+		if(groups == NULL) {
+			return NULL;
+		}
+		if(r->nr > 0) {
+			memcpy(groups, r->groups, r->nr * sizeof(struct roaring_group));
+		}
+		f2fs_free(r->groups);
+		r->groups = groups;
+		r->max = max;
+	}
+
+	memmove(&r->groups[pos + 1], &r->groups[pos],
+		(r->nr - pos) * sizeof(struct roaring_group));
+	memset(&r->groups[pos], 0, sizeof(struct roaring_group));
+	r->groups[pos].key = key;
+	r->nr++;
+	return &r->groups[pos];
+}
+
+/* where low is in the array of g, or where it goes */
+static unsigned int find_low(struct roaring_group *g, unsigned short low)
+{
+	unsigned int lo = 0, hi = g->card, mid = 0;
+
+	if(g->card > 0 && g->array[g->card - 1] < low) {
+		return g->card;
+	}
+
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(g->array[mid] < low) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* past ROARING_ARRAY_MAX values the bitmap is the smaller one */
+static int to_bitmap(struct roaring_group *g)
+{
+	unsigned int i = 0;
+
+	g->bitmap = f2fs_malloc(ROARING_BITMAP_WORDS * sizeof(unsigned long long));
+	if(g->bitmap == NULL) {
+		return -ENOMEM;
+	}
+	memset(g->bitmap, 0, ROARING_BITMAP_WORDS * sizeof(unsigned long long));
+	for(i=0; i<g->card; i++) {
+		g->bitmap[g->array[i] >> 6] |= 1ULL << (g->array[i] & 63);
+	}
+	f2fs_free(g->array);
+	g->array = NULL;
+	g->size = 0;
+	return 0;
+}
+
+static int grow_array(struct roaring_group *g)
+{
+	unsigned short *array = NULL;
+	unsigned int size = g->size ? g->size * 2 : 16;
+
+	if(size > ROARING_ARRAY_MAX) {
+		size = ROARING_ARRAY_MAX;
+	}
+	array = f2fs_malloc(size * sizeof(unsigned short));
+	if(array == NULL) {
+		return -ENOMEM;
+	}
+	if(g->card > 0) {
+		memcpy(array, g->array, g->card * sizeof(unsigned short));
+	}
+	f2fs_free(g->array);
+	g->array = array;
+	g->size = size;
+	return 0;
+}
+
+int roaring_add(struct roaring *r, unsigned int v)
+{
+	unsigned short key = v >> 16, low = v & 0xffff;
+	struct roaring_group *g = NULL;
+	unsigned int pos = find_group(r, key);
+	int ret = 0;
+
+	if(pos < r->nr && r->groups[pos].key == key) {
+		g = &r->groups[pos];
+	} else {
+		g = insert_group(r, pos, key);
+		if(g == NULL) {
+			return -ENOMEM;
+		}
+	}
+
+	if(g->bitmap != NULL) {
+		if(!(g->bitmap[low >> 6] & (1ULL << (low & 63)))) {
+			g->bitmap[low >> 6] |= 1ULL << (low & 63);
+			g->card++;
+		}
+		return 0;
+	}
+
+	pos = find_low(g, low);
+	if(pos < g->card && g->array[pos] == low) {
+		return 0;
+	}
+
+	if(g->card == ROARING_ARRAY_MAX) {
+		ret = to_bitmap(g);
+		if(ret < 0) {
+			return ret;
+		}
+		g->bitmap[low >> 6] |= 1ULL << (low & 63);
+		g->card++;
+		return 0;
+	}
+
+	if(g->card == g->size) {
+		ret = grow_array(g);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	memmove(&g->array[pos + 1], &g->array[pos], (g->card - pos) * sizeof(unsigned short));
+	g->array[pos] = low;
+	g->card++;
+	return 0;
+}
+
+int roaring_contains(struct roaring *r, unsigned int v)
+{
+	unsigned short key = v >> 16, low = v & 0xffff;
+	unsigned int pos = find_group(r, key);
+	struct roaring_group *g = NULL;
+
+	if(pos >= r->nr || r->groups[pos].key != key) {
+		return 0;
+	}
+
+	g = &r->groups[pos];
+	if(g->bitmap != NULL) {
+		return !!(g->bitmap[low >> 6] & (1ULL << (low & 63)));
+	}
+	pos = find_low(g, low);
+	return pos < g->card && g->array[pos] == low;
+}
+
+unsigned long long roaring_card(struct roaring *r)
+{
+	unsigned long long card = 0;
+	unsigned int i = 0;
+
+	for(i=0; i<r->nr; i++) {
+		card += r->groups[i].card;
+	}
+	return card;
+}
+
+size_t roaring_bytes(struct roaring *r)
+{
+	size_t bytes = r->max * sizeof(struct roaring_group);
+	unsigned int i = 0;
+
+	for(i=0; i<r->nr; i++) {
+		if(r->groups[i].bitmap != NULL) {
+			bytes += ROARING_BITMAP_WORDS * sizeof(unsigned long long);
+		} else {
+			bytes += r->groups[i].size * sizeof(unsigned short);
+		}
+	}
+	return bytes;
+}
+
+struct run_ctx {
+	unsigned int start, len;
+	roaring_run_fn fn;
+	void *arg;
+};
+
+/* extends the open run or hands it out and opens the next */
+static int add_to_run(struct run_ctx *ctx, unsigned int v, unsigned int n)
+{
+	int ret = 0;
+
+	if(ctx->len > 0 && ctx->start + ctx->len == v) {
+		ctx->len += n;
+		return 0;
+	}
+
+	if(ctx->len > 0) {
+		ret = ctx->fn(ctx->start, ctx->len, ctx->arg);
+	}
+	ctx->start = v;
+	ctx->len = n;
+	return ret;
+}
+
+/* full words of a bitmap are taken 64 values at a time */
+static int bitmap_runs(struct roaring_group *g, struct run_ctx *ctx)
+{
+	unsigned int base = (unsigned int)g->key << 16, i = 0;
+	unsigned long long word = 0;
+	int bit = 0, ret = 0;
+
+	for(i=0; i<ROARING_BITMAP_WORDS; i++) {
+		word = g->bitmap[i];
+		if(word == ~0ULL) {
+			ret = add_to_run(ctx, base + i * 64, 64);
+			if(ret != 0) {
+				return ret;
+			}
+			continue;
+		}
+
+		while(word != 0) {
+			bit = __builtin_ctzll(word);
+			word &= word - 1;
+			ret = add_to_run(ctx, base + i * 64 + bit, 1);
+			if(ret != 0) {
+				return ret;
+			}
+		}
+	}
+	return 0;
+}
+
+int roaring_runs(struct roaring *r, roaring_run_fn fn, void *arg)
+{
+	struct run_ctx ctx = {0, 0, fn, arg};
+	struct roaring_group *g = NULL;
+	unsigned int i = 0, j = 0;
+	int ret = 0;
+
+	for(i=0; i<r->nr; i++) {
+		g = &r->groups[i];
+		if(g->bitmap != NULL) {
+			ret = bitmap_runs(g, &ctx);
+		}
+		for(j=0; g->bitmap == NULL && j<g->card && ret == 0; j++) {
+			ret = add_to_run(&ctx, ((unsigned int)g->key << 16) | g->array[j], 1);
+		}
+		if(ret != 0) {
+			return ret < 0 ? ret : 0;
+		}
+	}
+
+	if(ctx.len > 0) {
+		ret = fn(ctx.start, ctx.len, arg);
+	}
+	return ret < 0 ? ret : 0;
+}
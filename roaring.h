@@ -0,0 +1,40 @@
+#ifndef __ROARING_H__
+#define __ROARING_H__
+
+#include <stddef.h>
+
+/*
+ * A compressed set of 32 bit values after roaring bitmaps: values are
+ * grouped by their upper 16 bits, a sparse group keeps its lower halves in
+ * a sorted array and a dense one in a bitmap of 8KB. Values added in
+ * ascending order, as the nat and sit walks produce them, are appended.
+ */
+#define ROARING_ARRAY_MAX	4096	/* values of a group kept as an array */
+#define ROARING_BITMAP_WORDS	1024
+
+struct roaring_group {
+	unsigned short key;		/* upper 16 bits */
+	unsigned int card;
+	unsigned int size;		/* slots of array, 0 with a bitmap */
+	unsigned short *array;
+	unsigned long long *bitmap;
+};
+
+struct roaring {
+	struct roaring_group *groups;
+	unsigned int nr, max;
+};
+
+typedef int (*roaring_run_fn)(unsigned int start, unsigned int len, void *arg);
+
+void roaring_init(struct roaring *r);
+void roaring_free(struct roaring *r);
+int roaring_add(struct roaring *r, unsigned int v);
+int roaring_contains(struct roaring *r, unsigned int v);
+unsigned long long roaring_card(struct roaring *r);
+/* memory held by the set */
+size_t roaring_bytes(struct roaring *r);
+/* fn for every run of consecutive values in ascending order, > 0 stops */
+int roaring_runs(struct roaring *r, roaring_run_fn fn, void *arg);
+
+#endif /*__ROARING_H__*/
@@ -0,0 +1,624 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "node.h"
+#include "segment.h"
+#include "scrub.h"
+#include "dev.h"
+
+/* a member of a multi device volume, one segment of it is read per round */
+struct scrub_lane {
+	unsigned int segno, end;	/* next segment, end of the member */
+	unsigned int first;		/* of the span being read */
+	int busy;
+	char *raw_buf;
+	char *buf;			/* a segment, page aligned */
+	struct f2fs_dev_io io;
+};
+
+struct scrub_ctx {
+	struct f2fs_super *super;
+	struct scrub_opts *opts;
+	struct scrub_stat *stat;
+	int fd;				/* opened with O_DIRECT when that works */
+	char *raw_buf;
+	char *buf;			/* SCRUB_IO_BLOCKS blocks, page aligned */
+	struct page *sum_page;
+	struct timespec begin, saved;
+	unsigned long long bytes, ios;	/* what the budget was charged */
+};
+
+static double seconds_since(struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static int stopped(struct scrub_ctx *ctx)
+{
+	return ctx->opts->stop != NULL && *ctx->opts->stop;
+}
+
+/* hold the next read back until the run is within both budgets */
+static void throttle(struct scrub_ctx *ctx, size_t len)
+{
+	struct scrub_opts *opts = ctx->opts;
+	struct timespec ts;
+	double due = 0, spent = 0;
+
+	ctx->bytes += len;
+	ctx->ios++;
+	if(opts->mbps > 0) {
+		due = ctx->bytes / (opts->mbps * 1048576.0);
+	}
+	if(opts->iops > 0 && (double)ctx->ios / opts->iops > due) {
+		due = (double)ctx->ios / opts->iops;
+	}
+
+	spent = seconds_since(&ctx->begin);
+	if(due > spent && !stopped(ctx)) {
+		ts.tv_sec = (time_t)(due - spent);
+		ts.tv_nsec = (long)((due - spent - ts.tv_sec) * 1e9);
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* nr blocks at blkaddr into ctx->buf, read errors are counted and skipped */
+static int scrub_read(struct scrub_ctx *ctx, block_t blkaddr, unsigned int nr)
+{
+	off_t off = (off_t)blkaddr * F2FS_BLKSIZE;
+	size_t len = (size_t)nr * F2FS_BLKSIZE;
+
+	throttle(ctx, len);
+	ctx->stat->reads++;
+	if(read_pages(ctx->buf, ctx->fd, blkaddr, nr) < 0) {
+		/* some files take O_DIRECT at open time and refuse it on read */
+		if(errno == EINVAL && ctx->stat->direct) {
+			close(ctx->fd);
+			ctx->fd = ctx->super->fd;
+			ctx->stat->direct = 0;
+			return scrub_read(ctx, blkaddr, nr);
+		}
+
+		printf("scrub blkaddr %llu: read of %u blocks failed: %s\n",
+			(unsigned long long)blkaddr, nr, strerror(errno));
+		ctx->stat->errors++;
+		return -EIO;
+	}
+
+	/* leave the page cache to the foreground */
+	if(!ctx->stat->direct) {
+		posix_fadvise(ctx->fd, off, len, POSIX_FADV_DONTNEED);
+	}
+	ctx->stat->blocks += nr;
+	return 0;
+}
+
+static void uuid_hex(struct f2fs_super *super, char *hex)
+{
+	int i = 0;
+
+	for(i=0; i<16; i++) {
+		sprintf(hex + 2 * i, "%02x", super->raw_super->uuid[i]);
+	}
+}
+
+/* the cursor only counts for the image it was written for */
+static int load_cursor(struct scrub_ctx *ctx, block_t *pos)
+{
+	char hex[33], uuid[33];
+	unsigned long long next = 0;
+	FILE *fp = NULL;
+	int n = 0;
+
+	*pos = 0;
+	if(ctx->opts->cursor == NULL) {
+		return 0;
+	}
+
+	fp = fopen(ctx->opts->cursor, "r");
+	if(fp == NULL) {
+		if(errno == ENOENT) {
+			return 0;
+		}
+		perror("fopen");
+		return -errno;
+	}
+
+	n = fscanf(fp, "%32s %llu", uuid, &next);
+	fclose(fp);
+
+	uuid_hex(ctx->super, hex);
+	if(n != 2 || strcmp(hex, uuid) ||
+			next > le64_to_cpu(ctx->super->raw_super->block_count)) {
+		printf("scrub cursor %s does not match the image, starting over\n",
+			ctx->opts->cursor);
+		return 0;
+	}
+	*pos = next;
+	return 0;
+}
+
+/* written aside and renamed over, so a crash leaves the old or the new one */
+static int save_cursor(struct scrub_ctx *ctx, block_t pos)
+{
+	char tmp[PATH_MAX], hex[33];
+	FILE *fp = NULL;
+	int ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ctx->saved);
+	if(ctx->opts->cursor == NULL) {
+		return 0;
+	}
+
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", ctx->opts->cursor) >= (int)sizeof(tmp)) {
+		return -ENAMETOOLONG;
+	}
+
+	fp = fopen(tmp, "w");
+	if(fp == NULL) {
+		perror("fopen");
+		return -errno;
+	}
+
+	uuid_hex(ctx->super, hex);
+	fprintf(fp, "%s %llu\n", hex, (unsigned long long)pos);
+	if(fflush(fp) != 0 || fsync(fileno(fp)) < 0) {
+		perror("fsync");
+		ret = -EIO;
+	}
+	fclose(fp);
+
+	if(ret == 0 && rename(tmp, ctx->opts->cursor) < 0) {
+		perror("rename");
+		ret = -errno;
+	}
+	return ret;
+}
+
+static int maybe_save_cursor(struct scrub_ctx *ctx, block_t pos)
+{
+	if(seconds_since(&ctx->saved) < SCRUB_SAVE_SECS) {
+		return 0;
+	}
+	return save_cursor(ctx, pos);
+}
+
+static void check_meta_block(struct scrub_ctx *ctx, block_t blkaddr, char *block)
+{
+	struct f2fs_super *super = ctx->super;
+	block_t cp_addr = le32_to_cpu(super->raw_super->cp_blkaddr);
+	unsigned long long version = 0;
+	int pack = 0;
+
+	if(blkaddr < 2) {
+		if(f2fs_check_super_block((void *)(block + F2FS_SUPER_OFFSET)) < 0) {
+			printf("scrub blkaddr %llu: super block %llu is bad\n",
+				(unsigned long long)blkaddr, (unsigned long long)blkaddr);
+			ctx->stat->errors++;
+		}
+		return;
+	}
+
+	if(blkaddr != cp_addr && blkaddr != cp_addr + blocks_per_seg(super)) {
+		return;
+	}
+
+	/* the pack not in use may be unwritten or torn, that is no error */
+	pack = blkaddr != cp_addr;
+	if(f2fs_check_checkpoint(super, blkaddr, &version) < 0) {
+		printf("scrub blkaddr %llu: checkpoint pack %d is not valid%s\n",
+			(unsigned long long)blkaddr, pack + 1,
+			pack == super->cp_ver ? "" : " (not in use)");
+		ctx->stat->errors += pack == super->cp_ver;
+	}
+}
+
+/* super blocks, checkpoint packs, sit, nat and ssa, in large reads */
+static int scrub_meta(struct scrub_ctx *ctx, block_t *pos)
+{
+	block_t end = SM_I(ctx->super)->main_blkaddr;
+	unsigned int nr = 0, i = 0;
+	int ret = 0;
+
+	while(*pos < end && !stopped(ctx)) {
+		nr = SCRUB_IO_BLOCKS - *pos % SCRUB_IO_BLOCKS;
+		if(nr > end - *pos) {
+			nr = end - *pos;
+		}
+
+		if(scrub_read(ctx, *pos, nr) == 0) {
+			for(i=0; i<nr; i++) {
+				check_meta_block(ctx, *pos + i, ctx->buf + (size_t)i * F2FS_BLKSIZE);
+			}
+		}
+
+		*pos += nr;
+		ret = maybe_save_cursor(ctx, *pos);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* the footer has to agree with the nat, the summary and, for inodes, the checksum */
+static void check_node(struct scrub_ctx *ctx, struct page *page, block_t blkaddr,
+		struct f2fs_summary *sum)
+{
+	struct f2fs_super *super = ctx->super;
+	nid_t nid = nid_of_node(page), ino = ino_of_node(page);
+	unsigned long long addr = blkaddr;
+	struct node_info ni;
+
+	ctx->stat->nodes++;
+	if(nid == 0 || nid >= max_nid(super)) {
+		printf("scrub blkaddr %llu: footer nid %u out of range\n", addr, nid);
+		ctx->stat->errors++;
+		return;
+	}
+
+	if(sum != NULL && le32_to_cpu(sum->nid) != nid) {
+		printf("scrub blkaddr %llu: footer nid %u, summary nid %u\n", addr, nid,
+			le32_to_cpu(sum->nid));
+		ctx->stat->errors++;
+	}
+
+	if(f2fs_get_node_info(super, nid, &ni) < 0) {
+		printf("scrub blkaddr %llu: no nat entry for nid %u\n", addr, nid);
+		ctx->stat->errors++;
+	} else if(ni.blk_addr != blkaddr) {
+		printf("scrub blkaddr %llu: nid %u is at %llu in the nat\n", addr, nid,
+			(unsigned long long)ni.blk_addr);
+		ctx->stat->errors++;
+	} else if(ni.ino != ino) {
+		printf("scrub blkaddr %llu: nid %u has ino %u in the nat, %u in the footer\n",
+			addr, nid, ni.ino, ino);
+		ctx->stat->errors++;
+	}
+
+	if(!IS_INODE(page)) {
+		if(nid == ino) {
+			printf("scrub blkaddr %llu: nid %u is its own ino but no inode\n",
+				addr, nid);
+			ctx->stat->errors++;
+		}
+		return;
+	}
+
+	ctx->stat->inodes++;
+	if(nid != ino) {
+		printf("scrub blkaddr %llu: inode %u has ino %u in the footer\n", addr, nid, ino);
+		ctx->stat->errors++;
+	} else if(!f2fs_inode_chksum_verify(super, page)) {
+		printf("scrub blkaddr %llu: inode %u checksum mismatch\n", addr, nid);
+		ctx->stat->errors++;
+	}
+}
+
+/* the summaries of an open log are the ones the checkpoint loaded */
+static struct f2fs_summary_block *read_summary(struct scrub_ctx *ctx,
+		unsigned int segno)
+{
+	struct f2fs_super *super = ctx->super;
+	int type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(curseg_segno(super, type) == segno) {
+			return super->sum_blk[type];
+		}
+	}
+
+	throttle(ctx, F2FS_BLKSIZE);
+	ctx->stat->reads++;
+	if(read_page(ctx->sum_page, super->fd,
+			le32_to_cpu(super->raw_super->ssa_blkaddr) + segno) < 0) {
+		printf("scrub segment %u: summary block unreadable\n", segno);
+		ctx->stat->errors++;
+		return NULL;
+	}
+	return page_address(ctx->sum_page);
+}
+
+/*
+ * The valid span of a node segment, or of a data segment when asked for.
+ * Returns 0 when there is nothing to read.
+ */
+static int segment_span(struct scrub_ctx *ctx, unsigned int segno,
+		unsigned int *first, unsigned int *last)
+{
+	struct f2fs_super *super = ctx->super;
+	struct seg_entry *se = get_seg_entry(super, segno);
+	char *map = (char *)se->cur_valid_map;
+	unsigned int off = 0;
+
+	if(se->valid_blocks == 0 || (se->type < CURSEG_HOT_NODE && !ctx->opts->data)) {
+		return 0;
+	}
+
+	*first = blocks_per_seg(super);
+	*last = 0;
+	for(off=0; off<blocks_per_seg(super); off++) {
+		if(f2fs_test_bit(off, map)) {
+			*first = off < *first ? off : *first;
+			*last = off;
+		}
+	}
+	return 1;
+}
+
+/* nr blocks of segno from off are in buf */
+static void check_blocks(struct scrub_ctx *ctx, unsigned int segno,
+		struct f2fs_summary_block *sum_blk, char *buf, unsigned int off,
+		unsigned int nr)
+{
+	struct seg_entry *se = get_seg_entry(ctx->super, segno);
+	char *map = (char *)se->cur_valid_map;
+	block_t base = START_BLOCK(ctx->super, segno);
+	unsigned int i = 0;
+
+	if(se->type < CURSEG_HOT_NODE) {
+		return;
+	}
+
+	for(i=0; i<nr; i++) {
+		if(f2fs_test_bit(off + i, map)) {
+			check_node(ctx, address_to_page(buf + (size_t)i * F2FS_BLKSIZE),
+				base + off + i, sum_blk ? &sum_blk->entries[off + i] : NULL);
+		}
+	}
+}
+
+static void scrub_segment(struct scrub_ctx *ctx, unsigned int segno)
+{
+	struct f2fs_super *super = ctx->super;
+	struct f2fs_summary_block *sum_blk = NULL;
+	unsigned int first = 0, last = 0, off = 0, nr = 0;
+	block_t base = START_BLOCK(super, segno);
+
+	if(!segment_span(ctx, segno, &first, &last)) {
+		return;
+	}
+
+	if(get_seg_entry(super, segno)->type >= CURSEG_HOT_NODE) {
+		sum_blk = read_summary(ctx, segno);
+	}
+
+	for(off=first; off<=last; off+=nr) {
+		nr = last - off + 1 < SCRUB_IO_BLOCKS ? last - off + 1 : SCRUB_IO_BLOCKS;
+		if(scrub_read(ctx, base + off, nr) == 0) {
+			check_blocks(ctx, segno, sum_blk, ctx->buf, off, nr);
+		}
+	}
+}
+
+/* the first segment with something to read from lane->segno on */
+static int submit_lane(struct scrub_ctx *ctx, struct scrub_lane *lane)
+{
+	struct f2fs_super *super = ctx->super;
+	unsigned int first = 0, last = 0;
+
+	for(; lane->segno < lane->end && !stopped(ctx); lane->segno++) {
+		if(segment_span(ctx, lane->segno, &first, &last)) {
+			break;
+		}
+	}
+	if(lane->segno >= lane->end || stopped(ctx)) {
+		return 0;
+	}
+
+	lane->first = first;
+	lane->io.blkaddr = START_BLOCK(super, lane->segno) + first;
+	lane->io.nr = last - first + 1;
+	lane->io.buf = lane->buf;
+	throttle(ctx, (size_t)lane->io.nr * F2FS_BLKSIZE);
+	ctx->stat->reads++;
+	f2fs_dev_submit(super, &lane->io);
+	return 1;
+}
+
+static void complete_lane(struct scrub_ctx *ctx, struct scrub_lane *lane)
+{
+	struct f2fs_super *super = ctx->super;
+	struct f2fs_summary_block *sum_blk = NULL;
+	unsigned int segno = lane->segno++;
+	block_t devblk = 0;
+	struct f2fs_dev *dev = f2fs_dev_map(super, lane->io.blkaddr, &devblk);
+	int ret = f2fs_dev_wait(&lane->io);
+
+	if(ret < 0) {
+		printf("scrub blkaddr %llu: read of %u blocks failed: %s\n",
+			(unsigned long long)lane->io.blkaddr, lane->io.nr, strerror(-ret));
+		ctx->stat->errors++;
+		return;
+	}
+	posix_fadvise(dev->fd, (off_t)devblk * F2FS_BLKSIZE,
+		(off_t)lane->io.nr * F2FS_BLKSIZE, POSIX_FADV_DONTNEED);
+	ctx->stat->blocks += lane->io.nr;
+
+	if(get_seg_entry(super, segno)->type >= CURSEG_HOT_NODE) {
+		sum_blk = read_summary(ctx, segno);
+	}
+	check_blocks(ctx, segno, sum_blk, lane->buf, lane->first, lane->io.nr);
+}
+
+/*
+ * Each member of a multi device volume has a queue of its own, every round
+ * reads the next segment of all members at once. A cursor saved on the way
+ * is where the member furthest behind is, resuming may read some segments
+ * of the others again.
+ */
+static int scrub_members(struct scrub_ctx *ctx, block_t *pos)
+{
+	struct f2fs_super *super = ctx->super;
+	struct scrub_lane *lanes = NULL, *lane = NULL;
+	unsigned int start = GET_SEGNO(super, *pos), next = 0;
+	size_t size = (size_t)(blocks_per_seg(super) + 1) * F2FS_BLKSIZE;
+	int i = 0, busy = 0, ret = 0;
+
+	lanes = f2fs_malloc(super->ndevs * sizeof(struct scrub_lane));
+	if(lanes == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memset(lanes, 0, super->ndevs * sizeof(struct scrub_lane));
+
+	for(i=0; i<super->ndevs; i++) {
+		lane = &lanes[i];
+		f2fs_dev_segments(super, i, &lane->segno, &lane->end);
+		if(lane->segno < start) {
+			lane->segno = start;
+		}
+
+		lane->raw_buf = f2fs_malloc(size);
+		if(lane->raw_buf == NULL) {
+			perror("f2fs_malloc");
+			ret = -ENOMEM;
+			goto out;
+		}
+		lane->buf = (char *)(((unsigned long)lane->raw_buf + F2FS_BLKSIZE - 1) &
+			~(unsigned long)(F2FS_BLKSIZE - 1));
+	}
+
+	ret = f2fs_dev_start(super);
+	if(ret < 0) {
+		goto out;
+	}
+
+	do {
+		for(i=0, busy=0; i<super->ndevs; i++) {
+			lanes[i].busy = submit_lane(ctx, &lanes[i]);
+			busy += lanes[i].busy;
+		}
+
+		next = SM_I(super)->main_segments;
+		for(i=0; i<super->ndevs; i++) {
+			lane = &lanes[i];
+			if(lane->busy) {
+				complete_lane(ctx, lane);
+			}
+			if(lane->segno < lane->end && lane->segno < next) {
+				next = lane->segno;
+			}
+		}
+
+		*pos = START_BLOCK(super, next);
+		ret = maybe_save_cursor(ctx, *pos);
+	} while(busy > 0 && ret == 0);
+	f2fs_dev_stop(super);
+
+out:
+	for(i=0; i<super->ndevs; i++) {
+		if(lanes[i].raw_buf != NULL) {
+			f2fs_free(lanes[i].raw_buf);
+		}
+	}
+	f2fs_free(lanes);
+	return ret;
+}
+
+static int scrub_main(struct scrub_ctx *ctx, block_t *pos)
+{
+	struct f2fs_sm_info *sm = SM_I(ctx->super);
+	unsigned int segno = 0;
+	int ret = 0;
+
+	if(ctx->super->ndevs > 1) {
+		return scrub_members(ctx, pos);
+	}
+
+	for(segno=GET_SEGNO(ctx->super, *pos); segno<sm->main_segments &&
+			!stopped(ctx); segno++) {
+		scrub_segment(ctx, segno);
+		*pos = START_BLOCK(ctx->super, segno + 1);
+
+		ret = maybe_save_cursor(ctx, *pos);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int f2fs_scrub(struct f2fs_super *super, struct scrub_opts *opts,
+		struct scrub_stat *stat)
+{
+	struct scrub_ctx ctx;
+	block_t pos = 0, end = START_BLOCK(super, SM_I(super)->main_segments);
+	int ret = 0;
+
+	memset(stat, 0, sizeof(struct scrub_stat));
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.super = super;
+	ctx.opts = opts;
+	ctx.stat = stat;
+	clock_gettime(CLOCK_MONOTONIC, &ctx.begin);
+	ctx.saved = ctx.begin;
+
+	ret = load_cursor(&ctx, &pos);
+	if(ret < 0) {
+		return ret;
+	}
+	stat->start = pos;
+
+	ctx.raw_buf = f2fs_malloc((SCRUB_IO_BLOCKS + 1) * F2FS_BLKSIZE);
+	ctx.sum_page = alloc_page();
+	if(ctx.raw_buf == NULL || ctx.sum_page == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+	ctx.buf = (char *)(((unsigned long)ctx.raw_buf + F2FS_BLKSIZE - 1) &
+		~(unsigned long)(F2FS_BLKSIZE - 1));
+
+	/* the members of a volume are read through their queues */
+	ctx.fd = -1;
+	if(super->ndevs == 1) {
+		ctx.fd = open(super->devs[0].path, O_RDONLY | O_DIRECT);
+	}
+	stat->direct = ctx.fd >= 0;
+	if(ctx.fd < 0) {
+		ctx.fd = super->fd;
+	}
+
+	if(pos < SM_I(super)->main_blkaddr) {
+		ret = scrub_meta(&ctx, &pos);
+	}
+	if(ret == 0) {
+		ret = scrub_main(&ctx, &pos);
+	}
+
+	stat->next = pos;
+	stat->done = pos >= end;
+	if(ret == 0 && stat->done && opts->cursor != NULL) {
+		if(unlink(opts->cursor) < 0 && errno != ENOENT) {
+			perror("unlink");
+		}
+	} else if(ret == 0) {
+		ret = save_cursor(&ctx, pos);
+	}
+
+	if(ctx.fd != super->fd) {
+		close(ctx.fd);
+	}
+out:
+	stat->secs = seconds_since(&ctx.begin);
+	if(ctx.raw_buf != NULL) {
+		f2fs_free(ctx.raw_buf);
+	}
+	if(ctx.sum_page != NULL) {
+		free_page(ctx.sum_page);
+	}
+	return ret;
+}
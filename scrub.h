@@ -0,0 +1,42 @@
+#ifndef __SCRUB_H__
+#define __SCRUB_H__
+
+#include <signal.h>
+#include "f2fs.h"
+
+/* blocks per read, the buffer is aligned for O_DIRECT */
+#define SCRUB_IO_BLOCKS		256
+/* the progress cursor is written at least this often */
+#define SCRUB_SAVE_SECS		5
+
+struct scrub_opts {
+	int data;			/* read the valid data blocks too */
+	unsigned int mbps;		/* 0 for no limit */
+	unsigned int iops;		/* 0 for no limit */
+	const char *cursor;		/* progress file to resume from, or NULL */
+	volatile sig_atomic_t *stop;	/* set to stop and save the cursor */
+};
+
+struct scrub_stat {
+	block_t start;			/* where this run began */
+	block_t next;			/* where the next run begins */
+	int done;			/* the whole image was covered */
+	int direct;			/* reads bypassed the page cache */
+	unsigned long long blocks;
+	unsigned long long reads;
+	unsigned int nodes;
+	unsigned int inodes;
+	unsigned int errors;
+	double secs;
+};
+
+/*
+ * Read the image front to back: both super blocks and checkpoint packs, the
+ * sit, nat and ssa areas, every valid node block and with opts->data every
+ * valid data block. Problems are printed and counted, the run only fails
+ * when it can not go on.
+ */
+int f2fs_scrub(struct f2fs_super *super, struct scrub_opts *opts,
+		struct scrub_stat *stat);
+
+#endif /*__SCRUB_H__*/
@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "segment.h"
+#include "trace.h"
+#include "dev.h"
+
+/* max sit blocks fetched by one read of a sit walk */
+#define SIT_RA_BLOCKS		64
+
+static char *sit_bitmap_ptr(struct f2fs_super *super)
+{
+	struct f2fs_checkpoint *raw_cp = super->raw_cp;
+
+	if(is_set_ckpt_flags(raw_cp, CP_LARGE_NAT_BITMAP_FLAG)) {
+		return (char *)raw_cp->sit_nat_version_bitmap +
+			le32_to_cpu(raw_cp->nat_ver_bitmap_bytesize) + sizeof(__le32);
+	}
+
+	if(super->raw_super->cp_payload) {
+		return (char *)raw_cp + F2FS_BLKSIZE;
+	}
+	return (char *)raw_cp->sit_nat_version_bitmap;
+}
+
+/* sit block of segno in the checkpoint, readers need no segment manager */
+block_t f2fs_current_sit_addr(struct f2fs_super *super, unsigned int segno)
+{
+	unsigned int offset = segno / SIT_ENTRY_PER_BLOCK;
+	block_t blkaddr = le32_to_cpu(super->raw_super->sit_blkaddr) + offset;
+
+	if(f2fs_test_bit(offset, sit_bitmap_ptr(super))) {
+		blkaddr += sit_blocks(super);
+	}
+	return blkaddr;
+}
+
+static block_t next_sit_addr(struct f2fs_super *super, block_t blkaddr)
+{
+	block_t sit_blkaddr = le32_to_cpu(super->raw_super->sit_blkaddr);
+
+	blkaddr -= sit_blkaddr;
+	if(blkaddr >= SM_I(super)->sit_blocks) {
+		blkaddr -= SM_I(super)->sit_blocks;
+	} else {
+		blkaddr += SM_I(super)->sit_blocks;
+	}
+	return blkaddr + sit_blkaddr;
+}
+
+static void seg_info_from_raw_sit(struct seg_entry *se,
+		struct f2fs_sit_entry *raw_sit)
+{
+	se->valid_blocks = GET_SIT_VBLOCKS(raw_sit);
+	se->ckpt_valid_blocks = se->valid_blocks;
+	se->type = GET_SIT_TYPE(raw_sit);
+	memcpy(se->cur_valid_map, raw_sit->valid_map, SIT_VBLOCK_MAP_SIZE);
+	se->mtime = le64_to_cpu(raw_sit->mtime);
+}
+
+/*
+ * Walk the sit entries of the checkpoint in segno order, fetched in runs of
+ * physically consecutive blocks, with the journal entries in place of the
+ * ones they replace. A callback returning > 0 ends the walk early.
+ */
+int f2fs_scan_sit(struct f2fs_super *super, sit_scan_fn fn, void *arg)
+{
+	unsigned int main_segments = le32_to_cpu(super->raw_super->segment_count_main);
+	struct f2fs_journal *journal = NULL;
+	struct f2fs_sit_block *sit_blk = NULL;
+	unsigned int sit_blks = 0, index = 0, nr = 0, i = 0, j = 0, segno = 0;
+	block_t blkaddr = 0;
+	char *buf = NULL;
+	int ret = 0;
+
+	ret = f2fs_load(super, F2FS_LAZY_SUM(CURSEG_COLD_DATA));
+	if(ret < 0) {
+		return ret;
+	}
+
+	journal = SIT_JOURNAL(super);
+	for(i=0; i<sits_in_cursum(journal); i++) {
+		segno = le32_to_cpu(journal->sit_j.entries[i].segno);
+		if(segno >= main_segments) {
+			printf("BAD sit journal segno %u\n", segno);
+			return -EINVAL;
+		}
+	}
+
+	buf = f2fs_malloc(SIT_RA_BLOCKS << F2FS_BLKSIZE_BITS);
+	if(buf == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	sit_blks = (main_segments + SIT_ENTRY_PER_BLOCK - 1) / SIT_ENTRY_PER_BLOCK;
+	for(index=0; index<sit_blks; index+=nr) {
+		blkaddr = f2fs_current_sit_addr(super, index * SIT_ENTRY_PER_BLOCK);
+		for(nr=1; nr<SIT_RA_BLOCKS && index + nr < sit_blks; nr++) {
+			if(f2fs_current_sit_addr(super, (index + nr) * SIT_ENTRY_PER_BLOCK) !=
+					blkaddr + nr) {
+				break;
+			}
+		}
+
+		ret = read_pages(buf, super->fd, blkaddr, nr);
+		if(ret < 0) {
+			perror("read pages");
+			goto out;
+		}
+
+		for(i=0; i<nr; i++) {
+			sit_blk = (void *)(buf + (i << F2FS_BLKSIZE_BITS));
+
+			/* the journal is newer than the sit blocks */
+			for(j=0; j<sits_in_cursum(journal); j++) {
+				segno = le32_to_cpu(journal->sit_j.entries[j].segno);
+				if(segno / SIT_ENTRY_PER_BLOCK == index + i) {
+					sit_blk->entries[segno % SIT_ENTRY_PER_BLOCK] =
+						journal->sit_j.entries[j].se;
+				}
+			}
+
+			for(j=0; j<SIT_ENTRY_PER_BLOCK; j++) {
+				segno = (index + i) * SIT_ENTRY_PER_BLOCK + j;
+				if(segno >= main_segments) {
+					break;
+				}
+
+				ret = fn(super, segno, &sit_blk->entries[j], arg);
+				if(ret != 0) {
+					goto out;
+				}
+			}
+		}
+	}
+	ret = 0;
+
+out:
+	f2fs_free(buf);
+	return ret < 0 ? ret : 0;
+}
+
+static int build_sit_entry(struct f2fs_super *super, unsigned int segno,
+		struct f2fs_sit_entry *raw_sit, void *arg)
+{
+	seg_info_from_raw_sit(get_seg_entry(super, segno), raw_sit);
+	return 0;
+}
+
+int f2fs_build_segment_manager(struct f2fs_super *super)
+{
+	F2FS_TRACE_SCOPE("sit", NULL, 0);
+	struct f2fs_super_block *raw_super = super->raw_super;
+	struct f2fs_sm_info *sm = NULL;
+	struct curseg_info *curseg = NULL;
+	int ret = 0, type = 0;
+
+	/* the sit journal and the summaries the current segments go on with */
+	ret = f2fs_load(super, F2FS_LAZY_SUMS);
+	if(ret < 0) {
+		return ret;
+	}
+
+	sm = f2fs_malloc(sizeof(struct f2fs_sm_info));
+	if(sm == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memset(sm, 0, sizeof(struct f2fs_sm_info));
+
+	sm->main_blkaddr = le32_to_cpu(raw_super->main_blkaddr);
+	sm->main_segments = le32_to_cpu(raw_super->segment_count_main);
+	sm->segs_per_sec = le32_to_cpu(raw_super->segs_per_sec);
+	sm->sit_blocks = sit_blocks(super);
+	sm->sit_bitmap = sit_bitmap_ptr(super);
+
+	sm->sentries = f2fs_malloc(sm->main_segments * sizeof(struct seg_entry));
+	if(sm->sentries == NULL) {
+		perror("f2fs_malloc");
+		f2fs_free(sm);
+		return -ENOMEM;
+	}
+	memset(sm->sentries, 0, sm->main_segments * sizeof(struct seg_entry));
+	super->sm_info = sm;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		sm->wb[type].iov = f2fs_malloc(blocks_per_seg(super) * sizeof(struct iovec));
+		if(sm->wb[type].iov == NULL) {
+			perror("f2fs_malloc");
+			f2fs_destroy_segment_manager(super);
+			return -ENOMEM;
+		}
+	}
+
+	ret = f2fs_scan_sit(super, build_sit_entry, NULL);
+	if(ret < 0) {
+		f2fs_destroy_segment_manager(super);
+		return ret;
+	}
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		curseg = &sm->curseg[type];
+		curseg->segno = curseg_segno(super, type);
+		curseg->next_blkoff = curseg_blkoff(super, type);
+		curseg->alloc_type = super->raw_cp->alloc_type[type];
+		curseg->sum_blk = super->sum_blk[type];
+		curseg->sum_blk->footer.entry_type = type < CURSEG_HOT_NODE ?
+			SUM_TYPE_DATA : SUM_TYPE_NODE;
+	}
+	return 0;
+}
+
+void f2fs_destroy_segment_manager(struct f2fs_super *super)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct ssa_page *ssa = NULL;
+	int type = 0;
+
+	if(sm == NULL) {
+		return;
+	}
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		f2fs_free(sm->wb[type].iov);
+	}
+
+	while(sm->ssa_list) {
+		ssa = sm->ssa_list;
+		sm->ssa_list = ssa->next;
+		free_page(ssa->page);
+		f2fs_free(ssa);
+	}
+
+	f2fs_free(sm->sentries);
+	f2fs_free(sm);
+	super->sm_info = NULL;
+}
+
+static int is_curseg(struct f2fs_sm_info *sm, unsigned int segno)
+{
+	int type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(sm->curseg[type].segno == segno) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Blocks the last checkpoint still points at must survive until the next one
+ * is on disk, so a segment is only reusable once it was free at checkpoint.
+ * The same goes for the segments of a node chain being replayed.
+ */
+static int segment_is_free(struct f2fs_super *super, unsigned int segno)
+{
+	struct seg_entry *se = get_seg_entry(super, segno);
+
+	return se->valid_blocks == 0 && se->ckpt_valid_blocks == 0 &&
+		!se->pinned && !is_curseg(SM_I(super), segno);
+}
+
+static unsigned int get_free_segment(struct f2fs_super *super, unsigned int segno)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	unsigned int nsecs = sm->main_segments / sm->segs_per_sec;
+	unsigned int secno = 0, i = 0, j = 0;
+
+	/* keep filling the open section */
+	if((segno + 1) % sm->segs_per_sec != 0 && segno + 1 < sm->main_segments &&
+			segment_is_free(super, segno + 1)) {
+		return segno + 1;
+	}
+
+	for(i=1; i<=nsecs; i++) {
+		secno = (segno / sm->segs_per_sec + i) % nsecs;
+		for(j=0; j<sm->segs_per_sec; j++) {
+			if(!segment_is_free(super, secno * sm->segs_per_sec + j)) {
+				break;
+			}
+		}
+
+		if(j == sm->segs_per_sec) {
+			return secno * sm->segs_per_sec;
+		}
+	}
+	return NULL_SEGNO;
+}
+
+static int queue_ssa_page(struct f2fs_super *super, struct curseg_info *curseg)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct f2fs_summary_block *sum_blk = NULL;
+	struct ssa_page *ssa = NULL;
+
+	if(curseg->segno >= sm->main_segments) {
+		return 0;
+	}
+
+	ssa = f2fs_malloc(sizeof(struct ssa_page));
+	if(ssa == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	ssa->page = alloc_page();
+	if(ssa->page == NULL) {
+		perror("alloc page");
+		f2fs_free(ssa);
+		return -ENOMEM;
+	}
+
+	/* journals are only meaningful in the cp, not in the ssa */
+	sum_blk = page_address(ssa->page);
+	memset(sum_blk, 0, F2FS_PAGE_SIZE);
+	memcpy(sum_blk->entries, curseg->sum_blk->entries, sizeof(sum_blk->entries));
+	sum_blk->footer.entry_type = curseg->sum_blk->footer.entry_type;
+
+	ssa->segno = curseg->segno;
+	ssa->next = sm->ssa_list;
+	sm->ssa_list = ssa;
+	return 0;
+}
+
+static int new_curseg(struct f2fs_super *super, int type)
+{
+	struct curseg_info *curseg = &SM_I(super)->curseg[type];
+	unsigned int segno = 0;
+	int ret = 0;
+
+	segno = get_free_segment(super, curseg->segno);
+	if(segno == NULL_SEGNO) {
+		printf("No free segment for log %d\n", type);
+		return -ENOSPC;
+	}
+
+	ret = queue_ssa_page(super, curseg);
+	if(ret < 0) {
+		return ret;
+	}
+
+	curseg->segno = segno;
+	curseg->next_blkoff = 0;
+	curseg->alloc_type = LFS;
+	memset(curseg->sum_blk->entries, 0, sizeof(curseg->sum_blk->entries));
+	get_seg_entry(super, segno)->type = type;
+	return 0;
+}
+
+static void update_sit_entry(struct f2fs_super *super, block_t blkaddr, int del)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct seg_entry *se = get_seg_entry(super, GET_SEGNO(super, blkaddr));
+	unsigned int offset = GET_BLKOFF(super, blkaddr);
+
+	if(del > 0) {
+		if(f2fs_test_bit(offset, (char *)se->cur_valid_map)) {
+			BUG("BUG: block %llu allocated twice\n", blkaddr);
+		}
+		f2fs_set_bit(offset, (char *)se->cur_valid_map);
+		se->valid_blocks++;
+	} else {
+		if(!f2fs_test_bit(offset, (char *)se->cur_valid_map)) {
+			return;
+		}
+		f2fs_clear_bit(offset, (char *)se->cur_valid_map);
+		se->valid_blocks--;
+	}
+
+	se->mtime = f2fs_get_mtime(super);
+	if(!se->dirty) {
+		se->dirty = 1;
+		sm->dirty_sentries++;
+	}
+}
+
+/* move the head of the log to the block it hands out next */
+static int settle_curseg(struct f2fs_super *super, int type)
+{
+	struct curseg_info *curseg = &SM_I(super)->curseg[type];
+	int ret = 0;
+
+	while(1) {
+		if(curseg->alloc_type == SSR || curseg->next_blkoff >= blocks_per_seg(super)) {
+			ret = new_curseg(super, type);
+			if(ret < 0) {
+				return ret;
+			}
+		}
+
+		/* blocks behind the log head may be taken by roll-forward recovery */
+		if(!f2fs_test_bit(curseg->next_blkoff,
+				(char *)get_seg_entry(super, curseg->segno)->cur_valid_map)) {
+			return 0;
+		}
+		curseg->next_blkoff++;
+	}
+}
+
+/*
+ * Append one block to the log of the given type. The head is settled again
+ * right after, like the kernel changes segments as soon as one is full, so
+ * f2fs_next_free_blkaddr() is the block node footers chain to.
+ */
+int f2fs_allocate_block(struct f2fs_super *super, int type,
+		struct f2fs_summary *sum, block_t *new_blkaddr)
+{
+	struct curseg_info *curseg = &SM_I(super)->curseg[type];
+	int ret = 0;
+
+	ret = settle_curseg(super, type);
+	if(ret < 0) {
+		return ret;
+	}
+
+	*new_blkaddr = START_BLOCK(super, curseg->segno) + curseg->next_blkoff;
+	curseg->sum_blk->entries[curseg->next_blkoff] = *sum;
+	get_seg_entry(super, curseg->segno)->type = type;
+	update_sit_entry(super, *new_blkaddr, 1);
+	curseg->next_blkoff++;
+	return settle_curseg(super, type);
+}
+
+static struct f2fs_summary_block *get_ssa_block(struct f2fs_super *super,
+		unsigned int segno)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct ssa_page *ssa = NULL;
+
+	for(ssa=sm->ssa_list; ssa!=NULL; ssa=ssa->next) {
+		if(ssa->segno == segno) {
+			return page_address(ssa->page);
+		}
+	}
+
+	ssa = f2fs_malloc(sizeof(struct ssa_page));
+	if(ssa == NULL) {
+		perror("f2fs_malloc");
+		return NULL;
+	}
+
+	ssa->page = alloc_page();
+	if(ssa->page == NULL) {
+		perror("alloc page");
+		f2fs_free(ssa);
+		return NULL;
+	}
+
+	if(read_page(ssa->page, super->fd,
+			le32_to_cpu(super->raw_super->ssa_blkaddr) + segno) < 0) {
+		perror("read page");
+		free_page(ssa->page);
+		f2fs_free(ssa);
+		return NULL;
+	}
+
+	ssa->segno = segno;
+	ssa->next = sm->ssa_list;
+	sm->ssa_list = ssa;
+	return page_address(ssa->page);
+}
+
+/* the summary of segno as this command sees it, copied to page */
+int f2fs_get_summary(struct f2fs_super *super, unsigned int segno, struct page *page)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct ssa_page *ssa = NULL;
+	int type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(sm->curseg[type].segno == segno) {
+			memcpy(page_address(page), sm->curseg[type].sum_blk,
+				sizeof(struct f2fs_summary_block));
+			return 0;
+		}
+	}
+
+	for(ssa=sm->ssa_list; ssa!=NULL; ssa=ssa->next) {
+		if(ssa->segno == segno) {
+			memcpy(page_address(page), page_address(ssa->page), F2FS_PAGE_SIZE);
+			return 0;
+		}
+	}
+
+	if(read_page(page, super->fd,
+			le32_to_cpu(super->raw_super->ssa_blkaddr) + segno) < 0) {
+		perror("read page");
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Account a block that was written after the checkpoint and is now found
+ * to be live, together with its summary.
+ */
+int f2fs_validate_block(struct f2fs_super *super, block_t blkaddr,
+		struct f2fs_summary *sum)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct f2fs_summary_block *sum_blk = NULL;
+	unsigned int segno = 0, offset = 0;
+	struct seg_entry *se = NULL;
+	int type = 0;
+
+	if(!is_main_blkaddr(super, blkaddr)) {
+		return 0;
+	}
+
+	segno = GET_SEGNO(super, blkaddr);
+	offset = GET_BLKOFF(super, blkaddr);
+	se = get_seg_entry(super, segno);
+	if(!f2fs_test_bit(offset, (char *)se->cur_valid_map)) {
+		update_sit_entry(super, blkaddr, 1);
+	}
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		if(sm->curseg[type].segno == segno) {
+			sm->curseg[type].sum_blk->entries[offset] = *sum;
+			return 0;
+		}
+	}
+
+	sum_blk = get_ssa_block(super, segno);
+	if(sum_blk == NULL) {
+		return -ENOMEM;
+	}
+	sum_blk->entries[offset] = *sum;
+	return 0;
+}
+
+void f2fs_invalidate_block(struct f2fs_super *super, block_t blkaddr)
+{
+	if(!is_main_blkaddr(super, blkaddr)) {
+		return;
+	}
+	update_sit_entry(super, blkaddr, -1);
+}
+
+block_t f2fs_next_free_blkaddr(struct f2fs_super *super, int type)
+{
+	struct curseg_info *curseg = &SM_I(super)->curseg[type];
+
+	return START_BLOCK(super, curseg->segno) + curseg->next_blkoff;
+}
+
+void f2fs_pin_segment(struct f2fs_super *super, unsigned int segno)
+{
+	struct seg_entry *se = get_seg_entry(super, segno);
+
+	if(!se->pinned) {
+		se->pinned = 1;
+		SM_I(super)->pinned_segments++;
+	}
+}
+
+/* once a checkpoint is on disk nothing before it is needed again */
+void f2fs_unpin_segments(struct f2fs_super *super)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	unsigned int segno = 0;
+
+	for(segno=0; sm->pinned_segments>0 && segno<sm->main_segments; segno++) {
+		if(sm->sentries[segno].pinned) {
+			sm->sentries[segno].pinned = 0;
+			sm->pinned_segments--;
+		}
+	}
+}
+
+/*
+ * Every log goes on in a free segment of its own, like the kernel does
+ * before writing what it recovered, so nothing is written over the blocks
+ * behind the old heads.
+ */
+int f2fs_new_cursegs(struct f2fs_super *super)
+{
+	int type = 0, ret = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		ret = new_curseg(super, type);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+unsigned int f2fs_free_segments(struct f2fs_super *super)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	unsigned int segno = 0, free = 0;
+
+	for(segno=0; segno<sm->main_segments; segno++) {
+		if(sm->sentries[segno].valid_blocks == 0 && !is_curseg(sm, segno)) {
+			free++;
+		}
+	}
+	return free;
+}
+
+block_t f2fs_valid_user_blocks(struct f2fs_super *super)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	unsigned int segno = 0;
+	block_t valid = 0;
+
+	for(segno=0; segno<sm->main_segments; segno++) {
+		valid += sm->sentries[segno].valid_blocks;
+	}
+	return valid;
+}
+
+static int flush_wb_log(struct f2fs_super *super, struct wb_log *wb)
+{
+	unsigned int done = 0, nr = 0;
+	int ret = 0;
+
+	for(done=0; done<wb->nr; done+=nr) {
+		nr = wb->nr - done;
+		if(nr > WB_IOV_MAX) {
+			nr = WB_IOV_MAX;
+		}
+
+		ret = f2fs_write_blocksv(super, wb->iov + done, nr, wb->start + done);
+		if(ret < 0) {
+			perror("write pages");
+			return ret;
+		}
+	}
+	wb->nr = 0;
+	return 0;
+}
+
+/*
+ * Queue a block just allocated from a log. The page has to stay alive and
+ * unchanged until the buffer of that log is flushed.
+ */
+int f2fs_submit_page(struct f2fs_super *super, int type, struct page *page,
+		block_t blkaddr)
+{
+	struct wb_log *wb = &SM_I(super)->wb[type];
+	int ret = 0;
+
+	if(wb->nr > 0 && blkaddr != wb->start + wb->nr) {
+		ret = flush_wb_log(super, wb);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+
+	if(wb->nr == 0) {
+		wb->start = blkaddr;
+	}
+	wb->iov[wb->nr].iov_base = page_address(page);
+	wb->iov[wb->nr].iov_len = F2FS_PAGE_SIZE;
+	wb->nr++;
+
+	/* the segment is complete */
+	if(GET_BLKOFF(super, blkaddr) == blocks_per_seg(super) - 1) {
+		return flush_wb_log(super, wb);
+	}
+	return 0;
+}
+
+int f2fs_flush_write_buffers(struct f2fs_super *super)
+{
+	int ret = 0, type = 0;
+
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		ret = flush_wb_log(super, &SM_I(super)->wb[type]);
+		if(ret < 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int flush_sit_blocks(struct f2fs_super *super)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct f2fs_sit_block *sit_blk = NULL;
+	struct seg_entry *se = NULL;
+	struct page *page = NULL;
+	unsigned int start = 0, segno = 0, end = 0;
+	block_t blkaddr = 0;
+	int ret = 0, dirty = 0;
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+	sit_blk = page_address(page);
+
+	for(start=0; start<sm->main_segments; start+=SIT_ENTRY_PER_BLOCK) {
+		end = start + SIT_ENTRY_PER_BLOCK;
+		if(end > sm->main_segments) {
+			end = sm->main_segments;
+		}
+
+		dirty = 0;
+		for(segno=start; segno<end; segno++) {
+			if(sm->sentries[segno].dirty) {
+				dirty = 1;
+				break;
+			}
+		}
+
+		if(!dirty) {
+			continue;
+		}
+
+		/* the other copy becomes current, the checkpoint flips the bit */
+		blkaddr = f2fs_current_sit_addr(super, start);
+		ret = read_page(page, super->fd, blkaddr);
+		if(ret < 0) {
+			perror("read page");
+			goto out;
+		}
+
+		for(segno=start; segno<end; segno++) {
+			se = &sm->sentries[segno];
+			if(se->dirty) {
+				seg_info_to_raw_sit(se, &sit_blk->entries[segno - start]);
+				se->dirty = 0;
+			}
+		}
+
+		ret = write_page(page, super->fd, next_sit_addr(super, blkaddr));
+		if(ret < 0) {
+			perror("write page");
+			goto out;
+		}
+		f2fs_change_bit(start / SIT_ENTRY_PER_BLOCK, sm->sit_bitmap);
+	}
+	ret = 0;
+
+out:
+	free_page(page);
+	return ret;
+}
+
+/*
+ * Dirty sit entries stay in the journal of the cold data summary when they
+ * fit, otherwise the journal is emptied and every touched sit block is
+ * rewritten to its shadow copy.
+ */
+int f2fs_flush_sit_entries(struct f2fs_super *super)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct f2fs_journal *journal = SIT_JOURNAL(super);
+	struct seg_entry *se = NULL;
+	unsigned int segno = 0;
+	int i = 0, ret = 0;
+
+	for(i=0; i<sits_in_cursum(journal); i++) {
+		se = get_seg_entry(super, le32_to_cpu(journal->sit_j.entries[i].segno));
+		if(!se->dirty) {
+			se->dirty = 1;
+			sm->dirty_sentries++;
+		}
+	}
+	journal->n_sits = cpu_to_le16(0);
+
+	if(sm->dirty_sentries > SIT_JOURNAL_ENTRIES) {
+		ret = flush_sit_blocks(super);
+		if(ret < 0) {
+			return ret;
+		}
+	} else {
+		i = 0;
+		for(segno=0; segno<sm->main_segments; segno++) {
+			se = &sm->sentries[segno];
+			if(!se->dirty) {
+				continue;
+			}
+
+			journal->sit_j.entries[i].segno = cpu_to_le32(segno);
+			seg_info_to_raw_sit(se, &journal->sit_j.entries[i].se);
+			se->dirty = 0;
+			i++;
+		}
+		journal->n_sits = cpu_to_le16(i);
+	}
+	sm->dirty_sentries = 0;
+
+	for(segno=0; segno<sm->main_segments; segno++) {
+		se = &sm->sentries[segno];
+		se->ckpt_valid_blocks = se->valid_blocks;
+	}
+	return 0;
+}
+
+int f2fs_write_ssa_pages(struct f2fs_super *super)
+{
+	struct f2fs_sm_info *sm = SM_I(super);
+	struct ssa_page *ssa = NULL;
+	block_t ssa_blkaddr = le32_to_cpu(super->raw_super->ssa_blkaddr);
+	int ret = 0;
+
+	while(sm->ssa_list) {
+		ssa = sm->ssa_list;
+		ret = write_page(ssa->page, super->fd, ssa_blkaddr + ssa->segno);
+		if(ret < 0) {
+			perror("write page");
+			return ret;
+		}
+
+		sm->ssa_list = ssa->next;
+		free_page(ssa->page);
+		f2fs_free(ssa);
+	}
+	return 0;
+}
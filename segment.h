@@ -0,0 +1,140 @@
+#ifndef __SEGMENT_H__
+#define __SEGMENT_H__
+
+#include <string.h>
+#include "f2fs.h"
+
+#define NULL_SEGNO		((unsigned int)~0)
+
+struct seg_entry {
+	unsigned short valid_blocks;
+	unsigned short ckpt_valid_blocks;	/* as of the last checkpoint */
+	unsigned char type;
+	unsigned char dirty;
+	unsigned char pinned;			/* kept free until the next checkpoint */
+	unsigned char cur_valid_map[SIT_VBLOCK_MAP_SIZE];
+	unsigned long long mtime;
+};
+
+struct curseg_info {
+	unsigned int segno;
+	unsigned short next_blkoff;
+	unsigned char alloc_type;
+	struct f2fs_summary_block *sum_blk;
+};
+
+/* summary block of a segment that was filled up, written at checkpoint */
+struct ssa_page {
+	struct ssa_page *next;
+	unsigned int segno;
+	struct page *page;
+};
+
+/*
+ * Blocks appended to one log are held back and written as a single
+ * sequential run, at the latest when the segment is full.
+ */
+struct wb_log {
+	block_t start;
+	unsigned int nr;
+	struct iovec *iov;
+};
+
+/* pwritev takes at most this many pages at once */
+#define WB_IOV_MAX		1024
+
+struct f2fs_sm_info {
+	block_t main_blkaddr;
+	unsigned int main_segments;
+	unsigned int segs_per_sec;
+	block_t sit_blocks;		/* blocks of one sit copy */
+	char *sit_bitmap;
+	struct seg_entry *sentries;
+	unsigned int dirty_sentries;
+	unsigned int pinned_segments;
+	struct curseg_info curseg[NR_CURSEG_TYPE];
+	struct ssa_page *ssa_list;
+	struct wb_log wb[NR_CURSEG_TYPE];
+};
+
+#define SM_I(super)		((super)->sm_info)
+
+static inline unsigned int GET_SEGNO(struct f2fs_super *super, block_t blkaddr)
+{
+	return (blkaddr - SM_I(super)->main_blkaddr) >>
+		le32_to_cpu(super->raw_super->log_blocks_per_seg);
+}
+
+static inline unsigned int GET_BLKOFF(struct f2fs_super *super, block_t blkaddr)
+{
+	return (blkaddr - SM_I(super)->main_blkaddr) & (blocks_per_seg(super) - 1);
+}
+
+static inline block_t START_BLOCK(struct f2fs_super *super, unsigned int segno)
+{
+	return SM_I(super)->main_blkaddr +
+		((block_t)segno << le32_to_cpu(super->raw_super->log_blocks_per_seg));
+}
+
+static inline int is_main_blkaddr(struct f2fs_super *super, block_t blkaddr)
+{
+	return blkaddr >= SM_I(super)->main_blkaddr &&
+		blkaddr < START_BLOCK(super, SM_I(super)->main_segments);
+}
+
+/* blocks of one of the two sit copies */
+static inline block_t sit_blocks(struct f2fs_super *super)
+{
+	return (block_t)(le32_to_cpu(super->raw_super->segment_count_sit) >> 1) <<
+		le32_to_cpu(super->raw_super->log_blocks_per_seg);
+}
+
+static inline struct seg_entry *get_seg_entry(struct f2fs_super *super,
+		unsigned int segno)
+{
+	return &SM_I(super)->sentries[segno];
+}
+
+static inline void set_summary(struct f2fs_summary *sum, nid_t nid,
+		unsigned short ofs_in_node, unsigned char version)
+{
+	sum->nid = cpu_to_le32(nid);
+	sum->ofs_in_node = cpu_to_le16(ofs_in_node);
+	sum->version = version;
+}
+
+static inline void seg_info_to_raw_sit(struct seg_entry *se,
+		struct f2fs_sit_entry *raw_sit)
+{
+	raw_sit->vblocks = cpu_to_le16(((unsigned short)se->type << SIT_VBLOCKS_SHIFT) |
+		se->valid_blocks);
+	memcpy(raw_sit->valid_map, se->cur_valid_map, SIT_VBLOCK_MAP_SIZE);
+	raw_sit->mtime = cpu_to_le64(se->mtime);
+}
+
+typedef int (*sit_scan_fn)(struct f2fs_super *super, unsigned int segno,
+		struct f2fs_sit_entry *raw_sit, void *arg);
+
+block_t f2fs_current_sit_addr(struct f2fs_super *super, unsigned int segno);
+int f2fs_scan_sit(struct f2fs_super *super, sit_scan_fn fn, void *arg);
+int f2fs_build_segment_manager(struct f2fs_super *super);
+void f2fs_destroy_segment_manager(struct f2fs_super *super);
+int f2fs_allocate_block(struct f2fs_super *super, int type,
+		struct f2fs_summary *sum, block_t *new_blkaddr);
+int f2fs_get_summary(struct f2fs_super *super, unsigned int segno, struct page *page);
+int f2fs_validate_block(struct f2fs_super *super, block_t blkaddr,
+		struct f2fs_summary *sum);
+void f2fs_invalidate_block(struct f2fs_super *super, block_t blkaddr);
+block_t f2fs_next_free_blkaddr(struct f2fs_super *super, int type);
+void f2fs_pin_segment(struct f2fs_super *super, unsigned int segno);
+void f2fs_unpin_segments(struct f2fs_super *super);
+int f2fs_new_cursegs(struct f2fs_super *super);
+unsigned int f2fs_free_segments(struct f2fs_super *super);
+block_t f2fs_valid_user_blocks(struct f2fs_super *super);
+int f2fs_submit_page(struct f2fs_super *super, int type, struct page *page,
+		block_t blkaddr);
+int f2fs_flush_write_buffers(struct f2fs_super *super);
+int f2fs_flush_sit_entries(struct f2fs_super *super);
+int f2fs_write_ssa_pages(struct f2fs_super *super);
+
+#endif /*__SEGMENT_H__*/
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "node.h"
+#include "super.h"
+#include "segwalk.h"
+#include "dev.h"
+
+void f2fs_seg_walk_init(struct seg_walk *walk, struct f2fs_super *super,
+		int (*match)(struct f2fs_super *, unsigned int),
+		int (*scan)(struct seg_walker *, unsigned int))
+{
+	memset(walk, 0, sizeof(struct seg_walk));
+	walk->super = super;
+	walk->serialize = NM_I(super) != NULL;
+	walk->match = match;
+	walk->scan = scan;
+	pthread_mutex_init(&walk->core_lock, NULL);
+}
+
+void f2fs_seg_walk_exit(struct seg_walk *walk)
+{
+	pthread_mutex_destroy(&walk->core_lock);
+}
+
+void f2fs_seg_walker_init(struct seg_walk *walk, struct seg_walker *w)
+{
+	w->walk = walk;
+	w->last_nid = (nid_t)-1;
+	w->last_ino = 0;
+	w->ret = 0;
+}
+
+nid_t f2fs_seg_walk_owner(struct seg_walker *w, nid_t nid)
+{
+	struct seg_walk *walk = w->walk;
+	struct node_info ni;
+	int ret = 0;
+
+	if(nid == w->last_nid) {
+		return w->last_ino;
+	}
+
+	if(walk->serialize) {
+		pthread_mutex_lock(&walk->core_lock);
+	}
+	ret = f2fs_get_node_info(walk->super, nid, &ni);
+	if(walk->serialize) {
+		pthread_mutex_unlock(&walk->core_lock);
+	}
+
+	/* an orphan's blocks are freed by the next modifying command */
+	w->last_nid = nid;
+	w->last_ino = ret < 0 || f2fs_is_orphan(walk->super, ni.ino) ? 0 : ni.ino;
+	return w->last_ino;
+}
+
+static void *walker_main(void *arg)
+{
+	struct seg_walker *w = arg;
+	struct seg_walk *walk = w->walk;
+	unsigned int segno = 0;
+	int dev = w->dev, left = walk->super->ndevs;
+
+	while(w->ret == 0 && left > 0) {
+		segno = __sync_fetch_and_add(&walk->next_segno[dev], 1);
+		if(segno >= walk->end_segno[dev]) {
+			/* done with this member, help on the next one */
+			dev = (dev + 1) % walk->super->ndevs;
+			left--;
+			continue;
+		}
+		if(walk->match(walk->super, segno)) {
+			w->ret = walk->scan(w, segno);
+		}
+	}
+	return NULL;
+}
+
+static inline struct seg_walker *walker_at(void *workers, size_t size, int i)
+{
+	return (struct seg_walker *)((char *)workers + (size_t)i * size);
+}
+
+int f2fs_seg_walk_run(struct seg_walk *walk, void *workers, size_t size,
+		int threads)
+{
+	struct seg_walker *w = NULL;
+	int i = 0, started = 0, ret = 0;
+
+	for(i=0; i<walk->super->ndevs; i++) {
+		f2fs_dev_segments(walk->super, i, &walk->next_segno[i],
+			&walk->end_segno[i]);
+	}
+
+	for(started=0; started<threads; started++) {
+		w = walker_at(workers, size, started);
+		w->dev = started % walk->super->ndevs;
+		w->ret = 0;
+		ret = pthread_create(&w->thread, NULL, walker_main, w);
+		if(ret != 0) {
+			ret = -ret;
+			break;
+		}
+	}
+
+	if(started > 0) {
+		ret = 0;
+	}
+	for(i=0; i<started; i++) {
+		w = walker_at(workers, size, i);
+		pthread_join(w->thread, NULL);
+		if(w->ret < 0) {
+			ret = w->ret;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,53 @@
+#ifndef __SEGWALK_H__
+#define __SEGWALK_H__
+
+#include <pthread.h>
+#include "f2fs.h"
+
+/*
+ * Threads scanning the main area a segment at a time. Every member of the
+ * volume is walked from a cursor of its own and the walkers start spread
+ * over the members so that all of them are read at once, a walker done
+ * with its member helps on the next one.
+ *
+ * The workers of a walk are an array of structs that each begin with a
+ * struct seg_walker, scan() gets the walker and casts it to its worker.
+ */
+struct seg_walker;
+
+struct seg_walk {
+	struct f2fs_super *super;
+	int serialize;			/* the node manager is not thread safe */
+	pthread_mutex_t core_lock;
+	unsigned int next_segno[MAX_DEVICES], end_segno[MAX_DEVICES];
+	/* nonzero for the segments scan() is called on */
+	int (*match)(struct f2fs_super *super, unsigned int segno);
+	int (*scan)(struct seg_walker *w, unsigned int segno);
+};
+
+struct seg_walker {
+	struct seg_walk *walk;
+	pthread_t thread;
+	int dev;			/* the member it starts on */
+	nid_t last_nid, last_ino;	/* of the last owner lookup */
+	int ret;
+};
+
+void f2fs_seg_walk_init(struct seg_walk *walk, struct f2fs_super *super,
+		int (*match)(struct f2fs_super *, unsigned int),
+		int (*scan)(struct seg_walker *, unsigned int));
+void f2fs_seg_walk_exit(struct seg_walk *walk);
+void f2fs_seg_walker_init(struct seg_walk *walk, struct seg_walker *w);
+
+/* the inode owning node nid, 0 for orphans and nids that do not resolve */
+nid_t f2fs_seg_walk_owner(struct seg_walker *w, nid_t nid);
+
+/*
+ * Scan the matching segments with threads workers of size bytes each,
+ * the first error of a worker is returned. With fewer threads than asked
+ * for the ones running take all segments.
+ */
+int f2fs_seg_walk_run(struct seg_walk *walk, void *workers, size_t size,
+		int threads);
+
+#endif /*__SEGWALK_H__*/
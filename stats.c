@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "stats.h"
+
+int f2fs_stats_enabled = 0;
+__thread int f2fs_stat_op = F2FS_OP_OTHER;
+__thread struct f2fs_thread_stats f2fs_thread_stats;
+
+/* the threads counting now, and the sum of those that are gone */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct f2fs_thread_stats stats_threads = {
+	.prev = &stats_threads,
+	.next = &stats_threads,
+};
+static struct f2fs_stats stats_exited;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+
+static const char *op_names[F2FS_NR_OPS] = {
+	"other", "mount", "lookup", "readdir", "stat", "read", "checkpoint",
+};
+static const char *cache_names[F2FS_NR_CACHES] = {
+	"nat", "node", "dentry", "path",
+};
+static const char *pool_names[F2FS_NR_POOLS] = {
+	"small", "page", "large",
+};
+
+static void add_stats(struct f2fs_stats *dst, struct f2fs_stats *src)
+{
+	unsigned long long *d = (unsigned long long *)dst;
+	unsigned long long *s = (unsigned long long *)src;
+	size_t i = 0;
+
+	for(i=0; i<sizeof(struct f2fs_stats) / sizeof(*d); i++) {
+		d[i] += s[i];
+	}
+}
+
+/* at thread exit the counters move to stats_exited */
+static void stats_thread_exit(void *arg)
+{
+	struct f2fs_thread_stats *ts = arg;
+
+	pthread_mutex_lock(&stats_lock);
+	add_stats(&stats_exited, &ts->stats);
+	ts->prev->next = ts->next;
+	ts->next->prev = ts->prev;
+	ts->linked = 0;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+static void stats_init()
+{
+	pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+void f2fs_stats_enable(int on)
+{
+	f2fs_stats_enabled = on;
+}
+
+void f2fs_stats_register()
+{
+	struct f2fs_thread_stats *ts = &f2fs_thread_stats;
+
+	pthread_once(&stats_once, stats_init);
+	pthread_mutex_lock(&stats_lock);
+	ts->next = &stats_threads;
+	ts->prev = stats_threads.prev;
+	stats_threads.prev->next = ts;
+	stats_threads.prev = ts;
+	ts->linked = 1;
+	pthread_mutex_unlock(&stats_lock);
+	pthread_setspecific(stats_key, ts);
+}
+
+/* counters of running threads may be a few increments behind */
+void f2fs_stats_read(struct f2fs_stats *stats)
+{
+	struct f2fs_thread_stats *ts = NULL;
+
+	pthread_mutex_lock(&stats_lock);
+	memcpy(stats, &stats_exited, sizeof(struct f2fs_stats));
+	for(ts=stats_threads.next; ts != &stats_threads; ts=ts->next) {
+		add_stats(stats, &ts->stats);
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+void f2fs_stats_reset()
+{
+	struct f2fs_thread_stats *ts = NULL;
+
+	pthread_mutex_lock(&stats_lock);
+	memset(&stats_exited, 0, sizeof(struct f2fs_stats));
+	for(ts=stats_threads.next; ts != &stats_threads; ts=ts->next) {
+		memset(&ts->stats, 0, sizeof(struct f2fs_stats));
+	}
+	pthread_mutex_unlock(&stats_lock);
+}
+
+const char *f2fs_stat_op_name(int op)
+{
+	if(op < 0 || op >= F2FS_NR_OPS) {
+		return NULL;
+	}
+	return op_names[op];
+}
+
+static void print_ns(unsigned long long ns)
+{
+	if(ns < 1000) {
+		fprintf(stderr, "%lluns", ns);
+	} else if(ns < 1000000) {
+		fprintf(stderr, "%lluus", ns / 1000);
+	} else {
+		fprintf(stderr, "%llums", ns / 1000000);
+	}
+}
+
+/* to stderr, stdout may carry the output of the command */
+void f2fs_stats_print(struct f2fs_stats *stats)
+{
+	struct f2fs_op_stats *st = NULL;
+	unsigned long long allocs = 0;
+	int op = 0, i = 0;
+
+	for(op=0; op<F2FS_NR_OPS; op++) {
+		st = &stats->op[op];
+		for(i=0, allocs=0; i<F2FS_NR_POOLS; i++) {
+			allocs += st->allocs[i];
+		}
+		if(st->ops == 0 && st->reads == 0 && st->writes == 0 && allocs == 0) {
+			continue;
+		}
+
+		fprintf(stderr, "%s: %llu ops, %llu reads, %llu blocks, %llu bytes, ",
+			op_names[op], st->ops, st->reads, st->read_blocks, st->read_bytes);
+		print_ns(st->read_ns);
+		fprintf(stderr, " reading, %llu writes, %llu blocks written\n",
+			st->writes, st->write_blocks);
+
+		fprintf(stderr, "  cache hits/misses:");
+		for(i=0; i<F2FS_NR_CACHES; i++) {
+			fprintf(stderr, " %s %llu/%llu", cache_names[i], st->hits[i],
+				st->misses[i]);
+		}
+
+		fprintf(stderr, "\n  allocs:");
+		for(i=0; i<F2FS_NR_POOLS; i++) {
+			fprintf(stderr, " %s %llu (%llu bytes)", pool_names[i],
+				st->allocs[i], st->alloc_bytes[i]);
+		}
+		fprintf(stderr, "\n");
+
+		if(st->reads == 0) {
+			continue;
+		}
+
+		/* each bucket by its lower bound */
+		fprintf(stderr, "  read latency:");
+		for(i=0; i<F2FS_LAT_BUCKETS; i++) {
+			if(st->read_lat[i] != 0) {
+				fprintf(stderr, " ");
+				print_ns(1ULL << i);
+				fprintf(stderr, ":%llu", st->read_lat[i]);
+			}
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+void f2fs_stat_alloc(size_t size)
+{
+	struct f2fs_op_stats *st = f2fs_op_stats();
+	int pool = F2FS_POOL_SMALL;
+
+	if(st != NULL) {
+		if(size == 4096) {
+			pool = F2FS_POOL_PAGE;
+		} else if(size > 4096) {
+			pool = F2FS_POOL_LARGE;
+		}
+		st->allocs[pool]++;
+		st->alloc_bytes[pool] += size;
+	}
+}
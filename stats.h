@@ -0,0 +1,179 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <time.h>
+
+/*
+ * I/O, cache and allocation counters. Every thread counts into its own
+ * block without locks, f2fs_stats_read() sums the blocks of all threads
+ * and of the threads that are gone. Counting is off until
+ * f2fs_stats_enable(), then each hook costs a few increments and a
+ * block read two clock reads.
+ *
+ * Counts go to the operation the thread is in. Only the outermost one
+ * counts, a lookup that reads inodes is all lookup.
+ */
+enum {
+	F2FS_OP_OTHER = 0,
+	F2FS_OP_MOUNT,
+	F2FS_OP_LOOKUP,
+	F2FS_OP_READDIR,
+	F2FS_OP_STAT,
+	F2FS_OP_READ,
+	F2FS_OP_CHECKPOINT,
+	F2FS_NR_OPS,
+};
+
+enum {
+	F2FS_CACHE_NAT = 0,		/* nat entries */
+	F2FS_CACHE_NODE,		/* node blocks */
+	F2FS_CACHE_DENTRY,		/* name lookups */
+	F2FS_CACHE_PATH,		/* whole paths */
+	F2FS_NR_CACHES,
+};
+
+/* allocations by size */
+enum {
+	F2FS_POOL_SMALL = 0,		/* less than a page */
+	F2FS_POOL_PAGE,			/* one page */
+	F2FS_POOL_LARGE,		/* more than a page */
+	F2FS_NR_POOLS,
+};
+
+/* read latency buckets, bucket i holds [2^i, 2^(i+1)) ns */
+#define F2FS_LAT_BUCKETS	32
+
+struct f2fs_op_stats {
+	unsigned long long ops;
+	unsigned long long reads;	/* syscalls */
+	unsigned long long read_blocks;
+	unsigned long long read_bytes;
+	unsigned long long read_ns;
+	unsigned long long writes;	/* syscalls */
+	unsigned long long write_blocks;
+	unsigned long long hits[F2FS_NR_CACHES];
+	unsigned long long misses[F2FS_NR_CACHES];
+	unsigned long long allocs[F2FS_NR_POOLS];
+	unsigned long long alloc_bytes[F2FS_NR_POOLS];
+	unsigned long long read_lat[F2FS_LAT_BUCKETS];
+};
+
+struct f2fs_stats {
+	struct f2fs_op_stats op[F2FS_NR_OPS];
+};
+
+struct f2fs_thread_stats {
+	struct f2fs_stats stats;
+	struct f2fs_thread_stats *prev, *next;
+	int linked;
+};
+
+extern int f2fs_stats_enabled;
+extern __thread int f2fs_stat_op;
+extern __thread struct f2fs_thread_stats f2fs_thread_stats;
+
+void f2fs_stats_enable(int on);
+void f2fs_stats_register();
+void f2fs_stats_read(struct f2fs_stats *stats);
+void f2fs_stats_reset();
+const char *f2fs_stat_op_name(int op);
+void f2fs_stats_print(struct f2fs_stats *stats);
+
+/* the counters of the current op, NULL while counting is off */
+static inline struct f2fs_op_stats *f2fs_op_stats()
+{
+	if(!f2fs_stats_enabled) {
+		return NULL;
+	}
+
+	if(!f2fs_thread_stats.linked) {
+		f2fs_stats_register();
+	}
+	return &f2fs_thread_stats.stats.op[f2fs_stat_op];
+}
+
+/* returns what f2fs_stat_leave() restores */
+static inline int f2fs_stat_enter(int op)
+{
+	struct f2fs_op_stats *st = NULL;
+	int prev = f2fs_stat_op;
+
+	if(prev == F2FS_OP_OTHER) {
+		f2fs_stat_op = op;
+		st = f2fs_op_stats();
+		if(st != NULL) {
+			st->ops++;
+		}
+	}
+	return prev;
+}
+
+static inline void f2fs_stat_leave(int prev)
+{
+	f2fs_stat_op = prev;
+}
+
+static inline void f2fs_stat_cache(int cache, int hit)
+{
+	struct f2fs_op_stats *st = f2fs_op_stats();
+
+	if(st != NULL) {
+		if(hit) {
+			st->hits[cache]++;
+		} else {
+			st->misses[cache]++;
+		}
+	}
+}
+
+void f2fs_stat_alloc(size_t size);
+
+static inline void f2fs_stat_read_start(struct timespec *start)
+{
+	start->tv_sec = 0;
+	start->tv_nsec = 0;
+	if(f2fs_stats_enabled) {
+		clock_gettime(CLOCK_MONOTONIC, start);
+	}
+}
+
+/* ret is what the read syscall returned */
+static inline void f2fs_stat_read_end(struct timespec *start, long ret)
+{
+	struct f2fs_op_stats *st = f2fs_op_stats();
+	struct timespec end;
+	unsigned long long ns = 0;
+	int bucket = 0;
+
+	/* off, or turned on while the read ran */
+	if(st == NULL || (start->tv_sec == 0 && start->tv_nsec == 0)) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start->tv_sec) * 1000000000ULL + end.tv_nsec -
+		start->tv_nsec;
+	for(bucket=0; bucket<F2FS_LAT_BUCKETS-1 && (ns >> (bucket + 1)); bucket++);
+
+	st->reads++;
+	st->read_ns += ns;
+	st->read_lat[bucket]++;
+	if(ret > 0) {
+		st->read_bytes += ret;
+		st->read_blocks += (ret + 4095) / 4096;
+	}
+}
+
+static inline void f2fs_stat_write(long ret)
+{
+	struct f2fs_op_stats *st = f2fs_op_stats();
+
+	if(st != NULL) {
+		st->writes++;
+		if(ret > 0) {
+			st->write_blocks += (ret + 4095) / 4096;
+		}
+	}
+}
+
+#endif /*__STATS_H__*/
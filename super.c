@@ -4,26 +4,65 @@
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include "page.h"
 #include "f2fs_type.h"
 #include "f2fs.h"
 #include "crc32.h"
 #include "super.h"
+#include "node.h"
+#include "data.h"
+#include "dir.h"
+#include "dcache.h"
 #include "utils.h"
+#include "trace.h"
+#include "dev.h"
 
-int f2fs_fill_super(struct f2fs_super *super, char *devpath)
+/* magic and, with the feature on, the crc of one super block copy */
+int f2fs_check_super_block(struct f2fs_super_block *raw_super)
 {
+	unsigned int crc = 0;
+	size_t crc_offset = 0;
+
+	if(le32_to_cpu(raw_super->magic) != F2FS_SUPER_MAGIC) {
+		printf("BAD Magic %X\n", le32_to_cpu(raw_super->magic));
+		return -EINVAL;
+	}
+
+	if(!F2FS_HAS_FEATURE(raw_super, F2FS_FEATURE_SB_CHKSUM)) {
+//		printf("skip crc.\n");
+		return 0;
+	}
+
+	crc_offset = le32_to_cpu(raw_super->checksum_offset);
+	if(crc_offset != offsetof(struct f2fs_super_block, crc)) {
+		printf("BAD CRC offset %lu\n", crc_offset);
+		return -EINVAL;
+	}
+
+	crc = crc32_classic((void *)raw_super, crc_offset);
+	crc = crc32_finalize(crc);
+
+	if(crc != le32_to_cpu(raw_super->crc)) {
+		printf("BAD CRC:%X(%X)\n", le32_to_cpu(raw_super->crc), crc);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int f2fs_fill_super(struct f2fs_super *super, const char *devpath, int flags)
+{
+	F2FS_TRACE_SCOPE("superblock", NULL, 0);
 	struct f2fs_super_block *raw_super = NULL;
 	struct page *sp1;
 	int ret = 0, super_ver = 0;
-	unsigned int crc = 0;
-	size_t crc_offset = 0;
 
 	memset(super, 0, sizeof(struct f2fs_super));
-	super->fd = open(devpath, O_RDWR);
-	if(super->fd < 0) {
-		perror("open");
-		return super->fd;
+	pthread_mutex_init(&super->lazy_lock, NULL);
+	super->devpath = devpath;
+	ret = f2fs_open_device(super, flags);
+	if(ret < 0) {
+		return ret;
 	}
 
 	sp1 = alloc_page();
@@ -47,195 +86,363 @@ retry:
 	super_ver++;
 
 	raw_super = (void *)((char *)page_address(sp1) + F2FS_SUPER_OFFSET);
-	if(le32_to_cpu(raw_super->magic) != F2FS_SUPER_MAGIC) {
-		printf("BAD Magic %X\n", le32_to_cpu(raw_super->magic));
+	if(f2fs_check_super_block(raw_super) < 0) {
 		goto retry;
 	}
 
-	if(!F2FS_HAS_FEATURE(raw_super, F2FS_FEATURE_SB_CHKSUM)) {
-//		printf("skip crc.\n");
-		goto out;
+	super->raw_super = raw_super;
+	return f2fs_open_devices(super, flags);
+}
+
+int f2fs_umount(struct f2fs_super *super)
+{
+	struct page *page = NULL;
+	int i = 0;
+
+	if(super->root) {
+		f2fs_put_inode(super->root);
+		super->root = NULL;
 	}
+	f2fs_destroy_dentry_cache(super);
 
-	crc_offset = le32_to_cpu(raw_super->checksum_offset);
-	if(crc_offset != offsetof(struct f2fs_super_block, crc)) {
-		printf("BAD CRC offset %lu\n", crc_offset);
-		goto retry;
+	if(super->raw_cp) {
+		f2fs_free(super->raw_cp);
 	}
 
-	crc = crc32_classic((void *)raw_super, crc_offset);
-	crc = crc32_finalize(crc);
+	if(super->nat_bits) {
+		f2fs_free(super->nat_bits);
+	}
 
-	if(crc != le32_to_cpu(raw_super->crc)) {
-		printf("BAD CRC:%X(%X)\n", le32_to_cpu(raw_super->crc), crc);
-		goto retry;
+	if(super->orphans) {
+		f2fs_free(super->orphans);
 	}
 
-out:
-	super->raw_super = raw_super;
+	for(i=0; i<NR_CURSEG_TYPE; i++) {
+		if(super->sum_blk[i]) {
+			free_page(address_to_page(super->sum_blk[i]));
+		}
+	}
+
+	if(super->raw_super) {
+		page = address_to_page((char *)super->raw_super - F2FS_SUPER_OFFSET);
+		free_page(page);
+		super->raw_super = NULL;
+	}
+
+	f2fs_close_devices(super);
+	if(super->fd >= 0) {
+		close(super->fd);
+		super->fd = -1;
+	}
 	return 0;
 }
 
-int f2fs_umount(struct f2fs_super *super)
+/* room for the summaries of the current segments, read by f2fs_load() */
+static int alloc_summaries(struct f2fs_super *super)
 {
 	struct page *page = NULL;
+	int type = 0;
 
-	if(super->raw_cp) {
-		f2fs_free(super->raw_cp);
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		page = alloc_page();
+		if(page == NULL) {
+			perror("alloc page");
+			return -ENOMEM;
+		}
+		memset(page_address(page), 0, F2FS_PAGE_SIZE);
+		super->sum_blk[type] = page_address(page);
 	}
+	return 0;
+}
 
-	if(super->nat_bits) {
-		f2fs_free(super->nat_bits);
+/*
+ * Everything a reader needs: super block, checkpoint, nat bitmaps,
+ * summaries, orphans, the dentry cache and the root inode. A lazy mount
+ * stops at the checkpoint and leaves the rest to f2fs_load(), which is
+ * what a single lookup wants. f2fs_umount undoes any part.
+ */
+static int __f2fs_mount(struct f2fs_super *super, const char *devpath, int flags,
+		int older, int lazy)
+{
+	F2FS_TRACE_SCOPE("mount", NULL, 0);
+	int op = f2fs_stat_enter(F2FS_OP_MOUNT);
+	int ret = 0;
+
+	ret = f2fs_fill_super(super, devpath, flags);
+	if(ret < 0) {
+		goto umount;
 	}
 
-	page = address_to_page((char *)super->raw_super - F2FS_SUPER_OFFSET);
-	free_page(page);
-	super->raw_super = NULL;
+	ret = f2fs_get_valid_checkpoint(super, older);
+	if(ret < 0) {
+		goto umount;
+	}
+
+	ret = f2fs_build_nat_bitmap(super);
+	if(ret < 0) {
+		goto umount;
+	}
+
+	ret = alloc_summaries(super);
+	if(ret < 0) {
+		goto umount;
+	}
+
+	super->lazy = F2FS_LAZY_ALL;
+	if(!lazy) {
+		ret = f2fs_load(super, F2FS_LAZY_ALL);
+		if(ret < 0) {
+			goto umount;
+		}
+	}
+
+	ret = f2fs_build_dentry_cache(super);
+	if(ret < 0) {
+		goto umount;
+	}
+
+	super->root = (void *)f2fs_malloc(sizeof(struct f2fs_inode));
+	if(super->root == NULL) {
+		ret = -ENOMEM;
+		goto umount;
+	}
+
+	ret = f2fs_read_inode(super, super->root, le32_to_cpu(super->raw_super->root_ino));
+	if(ret < 0) {
+		f2fs_free(super->root);
+		super->root = NULL;
+		goto umount;
+	}
+
+	if(!S_ISDIR(le16_to_cpu(super->root->raw_inode->i_mode))) {
+		printf("Error: the root was not a dir.\n");
+		ret = -EINVAL;
+		goto umount;
+	}
+	f2fs_stat_leave(op);
 	return 0;
+
+umount:
+	f2fs_umount(super);
+	f2fs_stat_leave(op);
+	return ret;
 }
 
-int f2fs_get_valid_checkpoint(struct f2fs_super *super)
+int f2fs_mount(struct f2fs_super *super, const char *devpath, int flags)
 {
-	unsigned long cpblk = le32_to_cpu(super->raw_super->cp_blkaddr);
-	struct page *cp1_page = NULL, *cp2_page = NULL;
-	struct page *cp1_bak_page = NULL, *cp2_bak_page = NULL;
-	struct f2fs_checkpoint *cptmp1 = NULL, *cptmp2 = NULL;
-	struct f2fs_checkpoint *cp = NULL;
-	int ret = 0, cp_blocks = 0, blocksize = 0, i = 0;
+	return __f2fs_mount(super, devpath, flags, 0, 0);
+}
 
-	blocksize = le32_to_cpu(super->raw_super->log_blocksize);
-	cp_blocks = le32_to_cpu(super->raw_super->cp_payload) + 1;
-	cp = f2fs_malloc(cp_blocks * blocksize);
-	if(cp == NULL) {
-		perror("f2fs_malloc");
-		return -ENOMEM;
-	}
+int f2fs_mount_lazy(struct f2fs_super *super, const char *devpath, int flags)
+{
+	return __f2fs_mount(super, devpath, flags, 0, 1);
+}
+
+/* the image as of the checkpoint before the current one, read-only */
+int f2fs_mount_older(struct f2fs_super *super, const char *devpath)
+{
+	return __f2fs_mount(super, devpath, O_RDONLY, 1, 0);
+}
+
+/*
+ * A pack only counts when the cp blocks at its head and its tail carry the
+ * same version and both checksums hold, which is what the writer commits
+ * last. Returns the head block.
+ */
+static struct page *validate_checkpoint(struct f2fs_super *super, block_t cp_addr,
+		unsigned long long *version)
+{
+	struct page *head = NULL, *tail = NULL;
+	struct f2fs_checkpoint *cp = NULL;
+	unsigned int total = 0;
+	int ret = 0;
 
-	cp1_page = alloc_page();
-	if(cp1_page == NULL) {
+	head = alloc_page();
+	if(head == NULL) {
 		perror("alloc page");
-		return -ENOMEM;
+		return NULL;
 	}
 
-	ret = read_page(cp1_page, super->fd, cpblk);
+	ret = read_page(head, super->fd, cp_addr);
 	if(ret < 0) {
-		f2fs_free(cp);
-		free_page(cp1_page);
 		perror("read page");
-		return ret;
+		goto free_head;
 	}
 
-	cptmp1 = page_address(cp1_page);
+	cp = page_address(head);
+	if(!cp_crc_valid(cp)) {
+		goto free_head;
+	}
+
+	total = le32_to_cpu(cp->cp_pack_total_block_count);
+	if(total < 2 || total > blocks_per_seg(super)) {
+		goto free_head;
+	}
 
-	cp2_page = alloc_page();
-	if(cp2_page == NULL) {
-		f2fs_free(cp);
-		free_page(cp1_page);
+	tail = alloc_page();
+	if(tail == NULL) {
 		perror("alloc page");
-		return -ENOMEM;
+		goto free_head;
 	}
 
-	cpblk += 1 << le32_to_cpu(super->raw_super->log_blocks_per_seg);
-	ret = read_page(cp2_page, super->fd, cpblk);
+	ret = read_page(tail, super->fd, cp_addr + total - 1);
 	if(ret < 0) {
-		f2fs_free(cp);
-		free_page(cp1_page);
-		free_page(cp2_page);
 		perror("read page");
-		return ret;
+		goto free_tail;
 	}
 
-	cptmp2 = page_address(cp2_page);
+	cp = page_address(tail);
+	if(!cp_crc_valid(cp) || cur_cp_version(cp) !=
+			cur_cp_version((struct f2fs_checkpoint *)page_address(head))) {
+		goto free_tail;
+	}
+
+	*version = cur_cp_version(cp);
+	free_page(tail);
+	return head;
+
+free_tail:
+	free_page(tail);
+free_head:
+	free_page(head);
+	return NULL;
+}
+
+/* 0 when the pack at cp_addr is complete, with its version */
+int f2fs_check_checkpoint(struct f2fs_super *super, block_t cp_addr,
+		unsigned long long *version)
+{
+	struct page *head = NULL;
+
+	head = validate_checkpoint(super, cp_addr, version);
+	if(head == NULL) {
+		return -EINVAL;
+	}
+	free_page(head);
+	return 0;
+}
+
+static unsigned long long monotonic_secs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+/* secs the fs has been mounted over its life, as the kernel's get_mtime */
+unsigned long long f2fs_get_mtime(struct f2fs_super *super)
+{
+	return super->elapsed_time + monotonic_secs() - super->mounted_time;
+}
 
-	if(le32_to_cpu(cptmp1->checkpoint_ver) >= le32_to_cpu(cptmp2->checkpoint_ver)) {
-//		printf("use checkpoint1\n");
-		memcpy(cp, cptmp1, blocksize);
+/* the newer of the two valid packs, or with older the other one */
+int f2fs_get_valid_checkpoint(struct f2fs_super *super, int older)
+{
+	F2FS_TRACE_SCOPE("checkpoint", NULL, 0);
+	block_t cp_addr = le32_to_cpu(super->raw_super->cp_blkaddr);
+	struct page *cp1 = NULL, *cp2 = NULL, *cur = NULL;
+	unsigned long long ver1 = 0, ver2 = 0;
+	struct f2fs_checkpoint *cp = NULL;
+	int ret = 0, cp_blocks = 0, i = 0;
+
+	cp1 = validate_checkpoint(super, cp_addr, &ver1);
+	cp2 = validate_checkpoint(super, cp_addr + blocks_per_seg(super), &ver2);
+
+	if(older) {
+		if(cp1 == NULL || cp2 == NULL || ver1 == ver2) {
+			printf("No older checkpoint\n");
+			ret = -ENOENT;
+			goto out;
+		}
+		super->cp_ver = ver1 < ver2 ? 0 : 1;
+		cur = ver1 < ver2 ? cp1 : cp2;
+	} else if(cp1 != NULL && (cp2 == NULL || ver1 >= ver2)) {
+		cur = cp1;
 		super->cp_ver = 0;
-		cpblk = le32_to_cpu(super->raw_super->cp_blkaddr);
-	} else {
-//		printf("use checkpoint2\n");
-		memcpy(cp, cptmp2, blocksize);
+	} else if(cp2 != NULL) {
+		cur = cp2;
 		super->cp_ver = 1;
-		cpblk = cpblk;
+	} else {
+		printf("No valid checkpoint\n");
+		ret = -EINVAL;
+		goto out;
 	}
 
+	cp_blocks = le32_to_cpu(super->raw_super->cp_payload) + 1;
+	cp = f2fs_malloc(cp_blocks * F2FS_BLKSIZE);
+	if(cp == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+	memcpy(cp, page_address(cur), F2FS_BLKSIZE);
+
 	for(i=1; i<cp_blocks; i++) {
-		ret = read_page(cp1_page, super->fd, cpblk + 1);
+		ret = read_page(address_to_page((char *)cp + F2FS_BLKSIZE * i),
+			super->fd, __start_cp_addr(super) + i);
 		if(ret < 0) {
 			perror("read page");
 			f2fs_free(cp);
-			free_page(cp1_page);
-			free_page(cp2_page);
-			return -1;
+			goto out;
 		}
-
-		memcpy(cp + blocksize * i, page_address(cp1_page), blocksize);
 	}
 	super->raw_cp = cp;
-	free_page(cp1_page);
-	free_page(cp2_page);
-	return 0;
-}
-
-int f2fs_read_inode(struct f2fs_super *super, struct f2fs_inode *inode, inode_t ino)
-{
-	struct page *nat_page = NULL, *inode_page = NULL;
-	struct f2fs_nat_block *nat = NULL;
-	struct f2fs_raw_inode *raw_inode;
-	int ret = 0, byteoff = 0, bitoff = 0;
-	unsigned long blkaddr = 0, tmpaddr, blocks_per_seg = 0;
+	super->elapsed_time = le64_to_cpu(cp->elapsed_time);
+	super->mounted_time = monotonic_secs();
+	ret = 0;
 
-	memset(inode, 0, sizeof(struct f2fs_inode *));
-	nat_page = alloc_page();
-	if(nat_page == NULL) {
-		perror("alloc page");
-		return -ENOMEM;
+out:
+	if(cp1 != NULL) {
+		free_page(cp1);
 	}
-
-	tmpaddr = ((unsigned long)ino / NAT_ENTRY_PER_BLOCK);
-	blocks_per_seg = 1 << le32_to_cpu(super->raw_super->log_blocks_per_seg);
-	blkaddr = le32_to_cpu(super->raw_super->nat_blkaddr) + (tmpaddr / blocks_per_seg) *
-			blocks_per_seg * 2 + tmpaddr % blocks_per_seg;
-
-	byteoff = ino / 8;
-	bitoff = ino % 8;
-	if(!(super->nat_bitmap[byteoff] & (1 << bitoff))) {
-		blkaddr += blocks_per_seg;
+	if(cp2 != NULL) {
+		free_page(cp2);
 	}
+	return ret;
+}
 
-	ret = read_page(nat_page, super->fd, blkaddr);
-	if(ret < 0) {
-		free_page(nat_page);
-		perror("read page");
-		return -1;
-	}
+static int __f2fs_read_inode(struct f2fs_super *super, struct f2fs_inode *inode,
+		inode_t ino)
+{
+	struct page *inode_page = NULL;
+	int ret = 0;
 
-	nat = (void *)page_address(nat_page);
+	memset(inode, 0, sizeof(struct f2fs_inode));
 	inode_page = alloc_page();
 	if(inode_page == NULL) {
-		free_page(nat_page);
 		perror("alloc page");
 		return -ENOMEM;
 	}
 
-	blkaddr = le32_to_cpu(nat->entries[ino % NAT_ENTRY_PER_BLOCK].block_addr);
-	ret = read_page(inode_page, super->fd, blkaddr);
-	if(ret < 0) {
+	/* orphans are gone for every reader, only the write path frees them */
+	if(f2fs_is_orphan(super, ino)) {
 		free_page(inode_page);
-		free_page(nat_page);
-		perror("read page");
-		return -1;
+		return -ENOENT;
 	}
 
-	raw_inode = (void *)page_address(inode_page);
+	ret = f2fs_read_node_block(super, ino, inode_page);
+	if(ret < 0) {
+		free_page(inode_page);
+		return ret;
+	}
 
-	inode->raw_inode = raw_inode;
-	inode->nat_block = nat;
+	inode->raw_inode = (void *)page_address(inode_page);
 	inode->ino = ino;
 	inode->count = 1;
 	return 0;
 }
 
+int f2fs_read_inode(struct f2fs_super *super, struct f2fs_inode *inode, inode_t ino)
+{
+	F2FS_TRACE_SCOPE("read_inode", "ino", ino);
+	int op = f2fs_stat_enter(F2FS_OP_STAT);
+	int ret = __f2fs_read_inode(super, inode, ino);
+
+	f2fs_stat_leave(op);
+	return ret;
+}
+
 void f2fs_free_inode(struct f2fs_inode *inode)
 {
 	struct page *page = NULL;
@@ -244,10 +451,6 @@ void f2fs_free_inode(struct f2fs_inode *inode)
 		page = address_to_page(inode->raw_inode);
 		free_page(page);
 	}
-	if(inode->nat_block != NULL) {
-		page = address_to_page(inode->nat_block);
-		free_page(page);
-	}
 }
 
 int f2fs_get_inode(struct f2fs_inode *inode)
@@ -273,15 +476,11 @@ int f2fs_put_inode(struct f2fs_inode *inode)
 
 struct dir_iter *dir_iter_start(struct f2fs_super *super, struct f2fs_inode *inode)
 {
+	struct f2fs_raw_inode *ri = inode->raw_inode;
 	struct dir_iter *iter = NULL;
-	struct f2fs_dentry_block *dentry_block = NULL;
 	struct page *page = NULL;
-	int ret = 0;
-	struct f2fs_node *node = NULL;
-	void *inline_data = NULL;
-	int reserved_size = 0, bitmap_size = 0;
 
-	if(!S_ISDIR(le32_to_cpu(inode->raw_inode->i_mode))) {
+	if(!S_ISDIR(le16_to_cpu(ri->i_mode))) {
 		return NULL;
 	}
 
@@ -291,78 +490,120 @@ struct dir_iter *dir_iter_start(struct f2fs_super *super, struct f2fs_inode *ino
 	}
 
 	memset((void *)iter, 0, sizeof(struct dir_iter));
-	if(le32_to_cpu(inode->raw_inode->i_inline) && F2FS_INLINE_DENTRY) {
-		node = (struct f2fs_node *)inode->raw_inode;
-		inline_data = inline_data_addr(inode->raw_inode);
-		reserved_size = INLINE_RESERVED_SIZE(inode->raw_inode);
-		bitmap_size = INLINE_DENTRY_BITMAP_SIZE(inode->raw_inode);
-
-		iter->dentry_bitmap = inline_data;
+	if(f2fs_has_inline_dentry(ri)) {
 		iter->dentry_inline = 1;
-		iter->dentry = inline_data + bitmap_size + reserved_size;
-		iter->entry_cnt = NR_INLINE_DENTRY(inode->raw_inode);
-
+		make_dentry_ptr_inline(super->raw_super, &iter->d, ri);
 	} else {
 		page = alloc_page();
-		ret = read_page(page, super->fd, le32_to_cpu(inode->raw_inode->i_addr[0]));
-		dentry_block = page_address(page);
-		iter->dentry_bitmap = dentry_block->dentry_bitmap;
-		iter->dentry_inline = 0;
-		iter->dentry = dentry_block->dentry;
-		iter->entry_cnt = SIZE_OF_DENTRY_BITMAP;
+		if(page == NULL) {
+			f2fs_free(iter);
+			return NULL;
+		}
+		iter->dentry_block = page_address(page);
+		iter->nr_blocks = (le64_to_cpu(ri->i_size) + F2FS_BLKSIZE - 1) /
+			F2FS_BLKSIZE;
+		/* nothing loaded yet, the first next() reads block 0 */
+		iter->bidx = (unsigned long)-1;
+		iter->d.max = 0;
 	}
 
 	iter->inode = inode;
-	iter->off = 2;
-	iter->dentry_block = dentry_block;
+	iter->off = 0;
 	iter->super = super;
 	iter->pos = NULL;
 	return iter;
 }
 
-struct f2fs_inode *dir_iter_next(struct dir_iter *iter)
+static int dir_iter_next_block(struct dir_iter *iter)
 {
-	struct f2fs_inode *inode = NULL;
-	struct f2fs_dentry_block *dentry = NULL;
-	int i = 0, byteoff = 0, bitoff = 0, ret = 0;
-	inode_t ino = 0;
+	struct page *page = address_to_page(iter->dentry_block);
+	int ret = 0;
+
+	while(++iter->bidx < iter->nr_blocks) {
+		ret = f2fs_read_data_block(iter->super,
+			address_to_page(iter->inode->raw_inode), iter->bidx, page);
+		if(ret == -ENOENT) {
+			continue;
+		}
+		if(ret < 0) {
+			return ret;
+		}
+
+		make_dentry_ptr_block(&iter->d, iter->dentry_block);
+		iter->off = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static struct f2fs_inode *__dir_iter_next(struct dir_iter *iter)
+{
+	struct f2fs_dir_entry *de = NULL;
 	struct f2fs_inode *tmp = NULL;
+	int i = 0, ret = 0, len = 0;
+	inode_t ino = 0;
 
 	if(iter == NULL) {
 		return NULL;
 	}
 
-	/*TODO*/
-
-	inode = iter->inode;
-	for(i=iter->off; i< iter->entry_cnt; i++) {
-		byteoff = i / BITS_PER_BYTE;
-		bitoff = i % BITS_PER_BYTE;
-		if(!(iter->dentry_bitmap[byteoff] & (1 << bitoff))) {
-			continue;
-		}
-
-		if(iter->pos != NULL) {
-			f2fs_put_inode(iter->pos);
-			iter->pos = NULL;
+	while(1) {
+		for(i=iter->off; i<iter->d.max; i++) {
+			if(!test_bit_le(i, iter->d.bitmap)) {
+				continue;
+			}
+
+			de = &iter->d.dentry[i];
+			len = le16_to_cpu(de->name_len);
+			if(len == 0) {
+				continue;
+			}
+
+			/* long names span several slots */
+			iter->off = i + GET_DENTRY_SLOTS(len);
+			if(is_dot_dotdot((char *)iter->d.filename[i], len)) {
+				i = iter->off - 1;
+				continue;
+			}
+
+			ino = le32_to_cpu(de->ino);
+			if(f2fs_is_orphan(iter->super, ino)) {
+				i = iter->off - 1;
+				continue;
+			}
+
+			if(iter->pos != NULL) {
+				f2fs_put_inode(iter->pos);
+				iter->pos = NULL;
+			}
+
+			tmp = (void *)f2fs_malloc(sizeof(struct f2fs_inode));
+			if(tmp == NULL) {
+				return NULL;
+			}
+
+			ret = f2fs_read_inode(iter->super, tmp, ino);
+			if(ret < 0) {
+				f2fs_free(tmp);
+				return NULL;
+			}
+			iter->pos = tmp;
+			return tmp;
 		}
 
-		tmp = (void *)f2fs_malloc(sizeof(struct f2fs_inode));
-		if(tmp == NULL) {
+		if(iter->dentry_inline || dir_iter_next_block(iter) <= 0) {
 			return NULL;
 		}
-
-		ino = le32_to_cpu(iter->dentry[i].ino);
-		ret = f2fs_read_inode(iter->super, tmp, ino);
-		if(ret < 0) {
-			f2fs_free(tmp);
-			return NULL;
-		}
-		iter->off = i + 1;
-		iter->pos = tmp;
-		return tmp;
 	}
-	return NULL;
+}
+
+struct f2fs_inode *dir_iter_next(struct dir_iter *iter)
+{
+	int op = f2fs_stat_enter(F2FS_OP_READDIR);
+	struct f2fs_inode *ret = __dir_iter_next(iter);
+
+	f2fs_stat_leave(op);
+	return ret;
 }
 
 void dir_iter_end(struct dir_iter *iter)
@@ -384,146 +625,175 @@ void dir_iter_end(struct dir_iter *iter)
 	f2fs_free(iter);
 }
 
-int f2fs_read_ssa(struct f2fs_super *super)
+static int read_compacted_summaries(struct f2fs_super *super)
 {
-#if 0
-	struct f2fs_super_block *raw_super = super->raw_super;
 	struct f2fs_checkpoint *raw_cp = super->raw_cp;
-	struct page *ssa_page = NULL;
-	struct f2fs_summary *summary = NULL;
-	struct f2fs_journal *journal = NULL;
-	struct f2fs_summary_block *summary_block = NULL;
+	struct f2fs_summary_block *sum_blk = NULL;
+	struct page *page = NULL;
 	block_t blkaddr = 0;
-	int ret  = 0, i = 0, j = 0;
+	char *kaddr = NULL;
+	int ret = 0, type = 0, i = 0, offset = 0, blk_off = 0;
 
-	if(!is_set_ckpt_flags(raw_cp, CP_COMPACT_SUM_FLAG)) {
-		printf("TODO:");
-		return -1;
-	}
-
-	ssa_page = alloc_page();
-	if(ssa_page == NULL) {
+	page = alloc_page();
+	if(page == NULL) {
 		perror("alloc page");
 		return -ENOMEM;
 	}
 
 	blkaddr = start_sum_block(super);
-	ret = read_page(ssa_page, super->fd, blkaddr);
+	ret = read_page(page, super->fd, blkaddr++);
 	if(ret < 0) {
-		free_page(ssa_page);
 		perror("read page");
-		return -1;
+		goto out;
 	}
+	kaddr = page_address(page);
+
+	/* nat journal, then sit journal, then the data summary entries */
+	memcpy(&super->sum_blk[CURSEG_HOT_DATA]->journal, kaddr, SUM_JOURNAL_SIZE);
+	memcpy(&super->sum_blk[CURSEG_COLD_DATA]->journal, kaddr + SUM_JOURNAL_SIZE,
+		SUM_JOURNAL_SIZE);
+	offset = 2 * SUM_JOURNAL_SIZE;
+
+	for(type=CURSEG_HOT_DATA; type<=CURSEG_COLD_DATA; type++) {
+		sum_blk = super->sum_blk[type];
+		sum_blk->footer.entry_type = SUM_TYPE_DATA;
+
+		blk_off = curseg_blkoff(super, type);
+		if(raw_cp->alloc_type[type] == SSR) {
+			blk_off = blocks_per_seg(super);
+		}
+
+		for(i=0; i<blk_off && i<ENTRIES_IN_SUM; i++) {
+			memcpy(&sum_blk->entries[i], kaddr + offset, SUMMARY_SIZE);
+			offset += SUMMARY_SIZE;
+			if(offset + SUMMARY_SIZE <= F2FS_PAGE_SIZE - SUM_FOOTER_SIZE) {
+				continue;
+			}
+
+			ret = read_page(page, super->fd, blkaddr++);
+			if(ret < 0) {
+				perror("read page");
+				goto out;
+			}
+			offset = 0;
+		}
+	}
+	ret = 0;
+
+out:
+	free_page(page);
+	return ret;
+}
+
+static int read_normal_summaries(struct f2fs_super *super, int type)
+{
+	struct f2fs_checkpoint *raw_cp = super->raw_cp;
+	struct page *page = NULL;
+	block_t blkaddr = 0;
+	int ret = 0, base = 0;
 
-	summary = page_address(ssa_page) + SUM_JOURNAL_SIZE * 2;
-
-	for(i=0; i<le32_to_cpu(raw_cp->cur_data_blkoff[0]); i++) {
-		printf("%d %d %d\n", summary[i].nid, summary[i].version, summary[i].ofs_in_node);
-	}
-
-	journal = page_address(ssa_page);
-	printf("sum: %d\n", journal->n_nats);
-	for(i=0; i<NAT_JOURNAL_ENTRIES; i++) {
-		printf("nat %d %d %d %d\n",
-			journal->nat_j.entries[i].nid,
-			journal->nat_j.entries[i].ne.version,
-			journal->nat_j.entries[i].ne.ino,
-			journal->nat_j.entries[i].ne.block_addr);
-	}
-
-	journal = page_address(ssa_page) + SUM_JOURNAL_SIZE;
-	printf("sum: %d\n", journal->n_sits);
-	for(i=0; i<SIT_JOURNAL_ENTRIES; i++) {
-		printf("sit %d %d %d\n",
-			journal->sit_j.entries[i].segno,
-			journal->sit_j.entries[i].se.vblocks,
-			journal->sit_j.entries[i].se.mtime);
-	}
-
-	for(j=0; j<3; j++) {
-		blkaddr = (raw_super->ssa_blkaddr + raw_cp->cur_node_segno[j]);
-		ret = read_page(ssa_page, super->fd, blkaddr);
-		summary_block = page_address(ssa_page);
-		printf("segno:%d addr:%lu node%d sum: %d\n", raw_cp->cur_node_segno[j],
-			blkaddr, j, summary_block->journal.n_nats);
-		for(i=0; i<summary_block->journal.n_nats; i++) {
-			journal = &summary_block->journal;
-			printf("node nat %d %d %d %d\n",
-				journal->nat_j.entries[i].nid,
-				journal->nat_j.entries[i].ne.version,
-				journal->nat_j.entries[i].ne.ino,
-				journal->nat_j.entries[i].ne.block_addr);
+	if(is_set_ckpt_flags(raw_cp, CP_UMOUNT_FLAG | CP_FASTBOOT_FLAG)) {
+		if(type < CURSEG_HOT_NODE) {
+			base = NR_CURSEG_TYPE;
+		} else {
+			base = NR_CURSEG_NODE_TYPE;
 		}
+		blkaddr = sum_blk_addr(super, base, type < CURSEG_HOT_NODE ?
+			type : type - CURSEG_HOT_NODE);
+	} else if(type < CURSEG_HOT_NODE) {
+		blkaddr = sum_blk_addr(super, NR_CURSEG_DATA_TYPE, type);
+	} else {
+		/* node summaries of a live log are only kept in the ssa */
+		blkaddr = le32_to_cpu(super->raw_super->ssa_blkaddr) +
+			curseg_segno(super, type);
 	}
-#endif
 
+	page = address_to_page(super->sum_blk[type]);
+	ret = read_page(page, super->fd, blkaddr);
+	if(ret < 0) {
+		perror("read page");
+		return ret;
+	}
 	return 0;
 }
 
-static int __get_free_nat_bitmaps(struct f2fs_super *super)
+/*
+ * The summary of a current segment with its journal. Compacted data
+ * summaries share their blocks, so any data type reads all three; the
+ * loaded types are returned.
+ */
+static int read_summaries(struct f2fs_super *super, int type)
 {
-	unsigned long nat_bits_blocks = 0;
+	F2FS_TRACE_SCOPE("summaries", "type", type);
+	int ret = 0;
+
+	if(type < CURSEG_HOT_NODE &&
+			is_set_ckpt_flags(super->raw_cp, CP_COMPACT_SUM_FLAG)) {
+		ret = read_compacted_summaries(super);
+		return ret < 0 ? ret : (int)F2FS_LAZY_DATA_SUMS;
+	}
+
+	ret = read_normal_summaries(super, type);
+	return ret < 0 ? ret : (int)F2FS_LAZY_SUM(type);
+}
+
+static int read_nat_bits(struct f2fs_super *super)
+{
+	F2FS_TRACE_SCOPE("nat_bits", NULL, 0);
+	unsigned int nr_blocks = 0;
 	struct f2fs_nat_bitmap *nat_bits = NULL;
 	unsigned int nat_bits_bytes = 0;
-	unsigned int nat_segs = 0;
 	block_t nat_bits_addr = 0;
-	struct page *page = NULL;
-	int ret = 0, i = 0;
+	int ret = 0;
+
+	if(!is_set_ckpt_flags(super->raw_cp, CP_NAT_BITS_FLAG)) {
+		return 0;
+	}
 
-	nat_segs = le32_to_cpu(super->raw_super->segment_count_nat) >> 1;
-	super->nat_blocks = nat_segs << le32_to_cpu(super->raw_super->log_blocks_per_seg);
 	nat_bits_bytes = super->nat_blocks / BITS_PER_BYTE;
-	nat_bits_blocks = F2FS_BLK_ALIGN((nat_bits_bytes >> 1) + 8);
-	nat_bits_addr = __start_cp_addr(super) +
-		(1 << le32_to_cpu(super->raw_super->log_blocks_per_seg)) -
-		nat_bits_blocks;
+	nr_blocks = nat_bits_blocks(super);
+	nat_bits_addr = __start_cp_addr(super) + blocks_per_seg(super) -
+		nr_blocks;
 
-	nat_bits = (void *)f2fs_malloc(nat_bits_blocks << F2FS_BLKSIZE_BITS);
+	nat_bits = (void *)f2fs_malloc(nr_blocks << F2FS_BLKSIZE_BITS);
 	if(nat_bits == NULL) {
 		perror("f2fs_malloc");
 		return -ENOMEM;
 	}
 
-	page = alloc_page();
-	if(page == NULL) {
-		perror("alloc_page");
+	ret = read_pages(nat_bits, super->fd, nat_bits_addr, nr_blocks);
+	if(ret < 0) {
+		perror("read pages");
 		f2fs_free(nat_bits);
-		return -ENOMEM;
+		return ret;
 	}
 
-	for(i=0; i<nat_bits_blocks; i++) {
-		ret = read_page(page, super->fd, nat_bits_addr++);
-		if(ret < 0) {
-			f2fs_free(nat_bits);
-			goto out;
-		}
-
-		memcpy(nat_bits + (i << F2FS_BLKSIZE_BITS),
-			page_address(page), F2FS_BLKSIZE);
+	/* left over from an older checkpoint, the nat blocks are the truth */
+	if(le64_to_cpu(nat_bits->cp_checksum) != cur_cp_checksum(super->raw_cp)) {
+		f2fs_free(nat_bits);
+		return 0;
 	}
-	super->nat_bits = nat_bits;
 
-out:
-	free_page(page);
-	return ret;
+	super->nat_bits = nat_bits;
+	super->full_nat_bits = nat_bits->bitmap;
+	super->empty_nat_bits = nat_bits->bitmap + nat_bits_bytes;
+	return 0;
 }
 
+/* which nat copies are current, nat_bits itself is read by f2fs_load() */
 int f2fs_build_nat_bitmap(struct f2fs_super *super)
 {
 	struct f2fs_checkpoint *raw_cp = super->raw_cp;
-	int ret = 0, offset = 0;
+	unsigned int nat_segs = 0;
+	int offset = 0;
 	char *bitmap = NULL;
 
-	ret = __get_free_nat_bitmaps(super);
-	if(ret < 0) {
-		return ret;
-	}
+	nat_segs = le32_to_cpu(super->raw_super->segment_count_nat) >> 1;
+	super->nat_blocks = nat_segs << le32_to_cpu(super->raw_super->log_blocks_per_seg);
 
 	if(is_set_ckpt_flags(raw_cp, CP_LARGE_NAT_BITMAP_FLAG)) {
 		bitmap = raw_cp->sit_nat_version_bitmap + sizeof(__le32);
-	}
-
-	if(super->raw_super->cp_payload) {
+	} else if(super->raw_super->cp_payload) {
 		bitmap = raw_cp->sit_nat_version_bitmap;
 	} else {
 		offset = le32_to_cpu(raw_cp->sit_ver_bitmap_bytesize);
@@ -534,3 +804,148 @@ int f2fs_build_nat_bitmap(struct f2fs_super *super)
 	return 0;
 }
 
+
+static int nid_cmp(const void *a, const void *b)
+{
+	nid_t x = *(const nid_t *)a, y = *(const nid_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Orphan blocks sit between the cp payload and the summaries. A block with
+ * a bad checksum is left out, its inodes then simply stay visible.
+ */
+static int read_orphans(struct f2fs_super *super)
+{
+	F2FS_TRACE_SCOPE("orphans", NULL, 0);
+	struct f2fs_checkpoint *raw_cp = super->raw_cp;
+	unsigned int payload = le32_to_cpu(super->raw_super->cp_payload);
+	unsigned int nr_blocks = 0, i = 0, j = 0, cnt = 0, n = 0;
+	size_t crc_offset = offsetof(struct f2fs_orphan_block, check_sum);
+	struct f2fs_orphan_block *blk = NULL;
+	char *buf = NULL;
+	unsigned int crc = 0;
+	int ret = 0;
+
+	if(!is_set_ckpt_flags(raw_cp, CP_ORPHAN_PRESENT_FLAG)) {
+		return 0;
+	}
+
+	nr_blocks = le32_to_cpu(raw_cp->cp_pack_start_sum) - 1 - payload;
+	if(nr_blocks == 0) {
+		return 0;
+	}
+
+	if(nr_blocks > blocks_per_seg(super)) {
+		printf("BAD orphan block count:%u\n", nr_blocks);
+		return -EINVAL;
+	}
+
+	buf = f2fs_malloc(nr_blocks * F2FS_BLKSIZE);
+	if(buf == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	super->orphans = f2fs_malloc(nr_blocks * F2FS_ORPHANS_PER_BLOCK * sizeof(nid_t));
+	if(super->orphans == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if(read_pages(buf, super->fd, __start_cp_addr(super) + 1 + payload,
+			nr_blocks) < 0) {
+		perror("read pages");
+		ret = -EIO;
+		goto out;
+	}
+
+	for(i=0; i<nr_blocks; i++) {
+		blk = (struct f2fs_orphan_block *)(buf + i * F2FS_BLKSIZE);
+		crc = f2fs_cal_crc32(F2FS_SUPER_MAGIC, blk, crc_offset);
+		if(blk->check_sum != 0 && le32_to_cpu(blk->check_sum) != crc) {
+			printf("BAD orphan block %u CRC:%X(%X)\n", i,
+				le32_to_cpu(blk->check_sum), crc);
+			continue;
+		}
+
+		cnt = le32_to_cpu(blk->entry_count);
+		if(cnt > F2FS_ORPHANS_PER_BLOCK) {
+			cnt = F2FS_ORPHANS_PER_BLOCK;
+		}
+
+		for(j=0; j<cnt; j++) {
+			super->orphans[n++] = le32_to_cpu(blk->ino[j]);
+		}
+	}
+
+	qsort(super->orphans, n, sizeof(nid_t), nid_cmp);
+	for(i=0, j=0; i<n; i++) {
+		if(j == 0 || super->orphans[j - 1] != super->orphans[i]) {
+			super->orphans[j++] = super->orphans[i];
+		}
+	}
+	super->nr_orphans = j;
+
+out:
+	if(ret < 0) {
+		f2fs_free(super->orphans);
+		super->orphans = NULL;
+	}
+	f2fs_free(buf);
+	return ret;
+}
+
+/* a part that fails to load is tried again on the next call */
+int __f2fs_load(struct f2fs_super *super, unsigned int parts)
+{
+	unsigned int todo = 0;
+	int ret = 0, type = 0;
+
+	pthread_mutex_lock(&super->lazy_lock);
+	for(type=0; type<NR_CURSEG_TYPE; type++) {
+		todo = super->lazy & parts;
+		if(!(todo & F2FS_LAZY_SUM(type))) {
+			continue;
+		}
+
+		ret = read_summaries(super, type);
+		if(ret < 0) {
+			goto out;
+		}
+		__atomic_and_fetch(&super->lazy, ~(unsigned int)ret, __ATOMIC_RELEASE);
+	}
+
+	todo = super->lazy & parts;
+	if(todo & F2FS_LAZY_NAT_BITS) {
+		ret = read_nat_bits(super);
+		if(ret < 0) {
+			goto out;
+		}
+		__atomic_and_fetch(&super->lazy, ~F2FS_LAZY_NAT_BITS, __ATOMIC_RELEASE);
+	}
+
+	if(todo & F2FS_LAZY_ORPHANS) {
+		ret = read_orphans(super);
+		if(ret < 0) {
+			goto out;
+		}
+		__atomic_and_fetch(&super->lazy, ~F2FS_LAZY_ORPHANS, __ATOMIC_RELEASE);
+	}
+	ret = 0;
+out:
+	pthread_mutex_unlock(&super->lazy_lock);
+	return ret;
+}
+
+/* an orphan list that can not be read hides nothing */
+int f2fs_is_orphan(struct f2fs_super *super, nid_t ino)
+{
+	if(f2fs_load(super, F2FS_LAZY_ORPHANS) < 0 || super->nr_orphans == 0) {
+		return 0;
+	}
+	return bsearch(&ino, super->orphans, super->nr_orphans, sizeof(nid_t),
+		nid_cmp) != NULL;
+}
@@ -2,22 +2,18 @@
 #define __SUPER_H__
 
 #include "f2fs.h"
+#include "dir.h"
 
 struct dir_iter {
-	int off, entry_cnt;
+	int off;
 	struct f2fs_super *super;
 	struct f2fs_inode *inode, *pos;
 	struct f2fs_dentry_block *dentry_block;
 
-	/* inline */
+	/* block dentries are walked one block after the other */
 	int dentry_inline;
-	char *dentry_bitmap;
-	struct f2fs_dir_entry *dentry;
-};
-
-struct path {
-	struct path *next, *prev;
-	struct f2fs_inode *inode;
+	unsigned long bidx, nr_blocks;
+	struct f2fs_dentry_ptr d;
 };
 
 static inline int f2fs_is_vaild_inode(struct f2fs_inode *inode)
@@ -32,15 +28,22 @@ static inline int f2fs_is_vaild_inode(struct f2fs_inode *inode)
 	return 1;
 }
 
-int f2fs_fill_super(struct f2fs_super *super, char *devpath);
+int f2fs_check_super_block(struct f2fs_super_block *raw_super);
+int f2fs_fill_super(struct f2fs_super *super, const char *devpath, int flags);
+int f2fs_mount(struct f2fs_super *super, const char *devpath, int flags);
+int f2fs_mount_lazy(struct f2fs_super *super, const char *devpath, int flags);
+int f2fs_mount_older(struct f2fs_super *super, const char *devpath);
 int f2fs_umount(struct f2fs_super *super);
-int f2fs_get_valid_checkpoint(struct f2fs_super *super);
-int f2fs_read_ssa(struct f2fs_super *super);
+int f2fs_get_valid_checkpoint(struct f2fs_super *super, int older);
+unsigned long long f2fs_get_mtime(struct f2fs_super *super);
+int f2fs_check_checkpoint(struct f2fs_super *super, block_t cp_addr,
+		unsigned long long *version);
 int f2fs_read_inode(struct f2fs_super *super, struct f2fs_inode *inode, inode_t ino);
 void f2fs_free_inode(struct f2fs_inode *inode);
 int f2fs_get_inode(struct f2fs_inode *inode);
 int f2fs_put_inode(struct f2fs_inode *inode);
 int f2fs_build_nat_bitmap(struct f2fs_super *super);
+int f2fs_is_orphan(struct f2fs_super *super, nid_t ino);
 
 struct dir_iter *dir_iter_start(struct f2fs_super *super, struct f2fs_inode *inode);
 struct f2fs_inode *dir_iter_next(struct dir_iter *iter);
@@ -0,0 +1,1190 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "node.h"
+#include "data.h"
+#include "dir.h"
+#include "namei.h"
+#include "tar.h"
+#include "dev.h"
+
+#define TAR_LINK_HASH		1024
+#define TAR_CHUNK_QUEUE		4096
+/* largest value an octal ustar field of size bytes holds */
+#define TAR_OCTAL_MAX(size)	((1ULL << (3 * ((size) - 1))) - 1)
+
+struct ustar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+/* the archive is a sequence of chunks: bytes, a run of image blocks or zeros */
+enum {
+	TAR_CHUNK_BYTES,
+	TAR_CHUNK_IMAGE,
+	TAR_CHUNK_ZERO,
+};
+
+struct tar_chunk {
+	int type;
+	size_t len;
+	off_t off;			/* image offset of TAR_CHUNK_IMAGE */
+	char buf[];			/* data of TAR_CHUNK_BYTES */
+};
+
+struct tar_entry {
+	char *path;			/* archive name, dirs end in '/' */
+	char *link;			/* archive name of an earlier hard link */
+	struct page *page;		/* inode block */
+};
+
+struct tar_slot {
+	void *item;
+	size_t size;
+};
+
+/* a bounded fifo between two stages, closed by either side */
+struct tar_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct tar_slot *slots;
+	unsigned int head, nr, max;
+	size_t size, max_size;
+	int closed;
+};
+
+struct tar_link {
+	struct tar_link *next;
+	nid_t ino;
+	char path[];
+};
+
+struct tar_dirent {
+	nid_t ino;
+	int len;
+	char name[];
+};
+
+struct tar_dir {
+	struct f2fs_super *super;
+	char *buf;
+	size_t len, max;
+};
+
+struct tar_run {
+	int type;
+	block_t start;
+	unsigned long nr;
+};
+
+struct tar_ctx {
+	struct f2fs_super *super;
+	struct tar_stat *stat;
+	int out;
+	int splice_out;			/* out is a pipe */
+	int serialize;			/* the node manager is not thread safe */
+	pthread_mutex_t core_lock;
+	struct tar_queue entries, chunks;
+	struct tar_link *links[TAR_LINK_HASH];
+	int err;
+};
+
+static const char tar_zeros[16 * F2FS_BLKSIZE];
+
+static int queue_init(struct tar_queue *q, unsigned int max, size_t max_size)
+{
+	memset(q, 0, sizeof(struct tar_queue));
+	q->slots = f2fs_malloc(max * sizeof(struct tar_slot));
+	if(q->slots == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+
+	q->max = max;
+	q->max_size = max_size;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	return 0;
+}
+
+static void queue_destroy(struct tar_queue *q)
+{
+	if(q->slots == NULL) {
+		return;
+	}
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+	f2fs_free(q->slots);
+	q->slots = NULL;
+}
+
+/* wait for room, an item larger than max_size still goes in alone */
+static int queue_put(struct tar_queue *q, void *item, size_t size)
+{
+	struct tar_slot *slot = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&q->lock);
+	while(!q->closed && (q->nr == q->max ||
+			(q->nr > 0 && q->size + size > q->max_size))) {
+		pthread_cond_wait(&q->cond, &q->lock);
+	}
+
+	if(q->closed) {
+		ret = -EPIPE;
+	} else {
+		slot = &q->slots[(q->head + q->nr) % q->max];
+		slot->item = item;
+		slot->size = size;
+		q->nr++;
+		q->size += size;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return ret;
+}
+
+/* the next item, NULL once the queue is closed and drained */
+static void *queue_get(struct tar_queue *q)
+{
+	struct tar_slot *slot = NULL;
+	void *item = NULL;
+
+	pthread_mutex_lock(&q->lock);
+	while(q->nr == 0 && !q->closed) {
+		pthread_cond_wait(&q->cond, &q->lock);
+	}
+
+	if(q->nr > 0) {
+		slot = &q->slots[q->head];
+		item = slot->item;
+		q->size -= slot->size;
+		q->head = (q->head + 1) % q->max;
+		q->nr--;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return item;
+}
+
+static void queue_close(struct tar_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* the first error wins, every stage stops on it */
+static void tar_error(struct tar_ctx *ctx, int err)
+{
+	__sync_bool_compare_and_swap(&ctx->err, 0, err);
+}
+
+static void lock_core(struct tar_ctx *ctx)
+{
+	if(ctx->serialize) {
+		pthread_mutex_lock(&ctx->core_lock);
+	}
+}
+
+static void unlock_core(struct tar_ctx *ctx)
+{
+	if(ctx->serialize) {
+		pthread_mutex_unlock(&ctx->core_lock);
+	}
+}
+
+static char *tar_strdup(const char *s)
+{
+	int len = strlen(s);
+	char *dup = NULL;
+
+	dup = f2fs_malloc(len + 1);
+	if(dup == NULL) {
+		perror("f2fs_malloc");
+		return NULL;
+	}
+	memcpy(dup, s, len + 1);
+	return dup;
+}
+
+static struct tar_entry *new_entry(const char *path, int len)
+{
+	struct tar_entry *entry = NULL;
+
+	entry = f2fs_malloc(sizeof(struct tar_entry) + len + 1);
+	if(entry == NULL) {
+		perror("f2fs_malloc");
+		return NULL;
+	}
+
+	entry->path = (char *)(entry + 1);
+	memcpy(entry->path, path, len);
+	entry->path[len] = '\0';
+	entry->link = NULL;
+	entry->page = NULL;
+	return entry;
+}
+
+static void free_entry(struct tar_entry *entry)
+{
+	if(entry->page != NULL) {
+		free_page(entry->page);
+	}
+	if(entry->link != NULL) {
+		f2fs_free(entry->link);
+	}
+	f2fs_free(entry);
+}
+
+static int read_inode_page(struct tar_ctx *ctx, nid_t ino, struct page **page)
+{
+	int ret = 0;
+
+	*page = alloc_page();
+	if(*page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	lock_core(ctx);
+	ret = f2fs_read_node_block(ctx->super, ino, *page);
+	unlock_core(ctx);
+	if(ret == 0 && (!IS_INODE(*page) || ino_of_node(*page) != ino)) {
+		ret = -EIO;
+	}
+
+	if(ret < 0) {
+		free_page(*page);
+		*page = NULL;
+	}
+	return ret;
+}
+
+/* hand out the name ino was archived under first, or remember path for it */
+static int find_link(struct tar_ctx *ctx, nid_t ino, const char *path, char **link)
+{
+	struct tar_link **head = &ctx->links[ino % TAR_LINK_HASH];
+	struct tar_link *l = NULL;
+	int len = strlen(path);
+
+	*link = NULL;
+	for(l=*head; l!=NULL; l=l->next) {
+		if(l->ino == ino) {
+			*link = tar_strdup(l->path);
+			return *link == NULL ? -ENOMEM : 0;
+		}
+	}
+
+	l = f2fs_malloc(sizeof(struct tar_link) + len + 1);
+	if(l == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	l->ino = ino;
+	memcpy(l->path, path, len + 1);
+	l->next = *head;
+	*head = l;
+	return 0;
+}
+
+static void free_links(struct tar_ctx *ctx)
+{
+	struct tar_link *l = NULL, *next = NULL;
+	int i = 0;
+
+	for(i=0; i<TAR_LINK_HASH; i++) {
+		for(l=ctx->links[i]; l!=NULL; l=next) {
+			next = l->next;
+			f2fs_free(l);
+		}
+	}
+}
+
+static int collect_dirent(void *arg, const char *name, int len, nid_t ino,
+		unsigned char file_type)
+{
+	struct tar_dir *dir = arg;
+	struct tar_dirent *d = NULL;
+	size_t size = (sizeof(struct tar_dirent) + len + 1 + 7) & ~7UL;
+	size_t max = 0;
+	char *buf = NULL;
+
+	if(f2fs_is_orphan(dir->super, ino)) {
+		return 0;
+	}
+
+	if(dir->len + size > dir->max) {
+		max = dir->max ? dir->max * 2 : F2FS_BLKSIZE;
+		while(dir->len + size > max) {
+			max *= 2;
+		}
+
+		buf = f2fs_malloc(max);
+		if(buf == NULL) {
+			perror("f2fs_malloc");
+			return -ENOMEM;
+		}
+		if(dir->buf != NULL) {
+			memcpy(buf, dir->buf, dir->len);
+			f2fs_free(dir->buf);
+		}
+		dir->buf = buf;
+		dir->max = max;
+	}
+
+	d = (struct tar_dirent *)(dir->buf + dir->len);
+	d->ino = ino;
+	d->len = len;
+	memcpy(d->name, name, len);
+	d->name[len] = '\0';
+	dir->len += size;
+	return 0;
+}
+
+/*
+ * The walker stage: queue ino under path, then everything below it. The
+ * entries of a dir are collected before the dir is queued, the reader
+ * frees its inode block. Unreadable inodes are reported and skipped.
+ */
+static int walk_inode(struct tar_ctx *ctx, nid_t ino, char *path, int len)
+{
+	struct tar_stat *stat = ctx->stat;
+	struct tar_entry *entry = NULL;
+	struct tar_dirent *d = NULL;
+	struct page *page = NULL;
+	struct tar_dir dir;
+	unsigned int mode = 0;
+	size_t pos = 0;
+	int ret = 0;
+
+	memset(&dir, 0, sizeof(dir));
+	dir.super = ctx->super;
+
+	ret = read_inode_page(ctx, ino, &page);
+	if(ret < 0) {
+		goto skip;
+	}
+
+	mode = le16_to_cpu(F2FS_NODE(page)->i.i_mode);
+	if(S_ISSOCK(mode)) {
+		fprintf(stderr, "tar %s: socket ignored\n", path);
+		stat->skipped++;
+		goto out;
+	}
+
+	if(S_ISDIR(mode)) {
+		if(len + 1 >= PATH_MAX) {
+			ret = -ENAMETOOLONG;
+			goto skip;
+		}
+		path[len++] = '/';
+		path[len] = '\0';
+
+		lock_core(ctx);
+		ret = f2fs_readdir(ctx->super, page, collect_dirent, &dir);
+		unlock_core(ctx);
+		if(ret < 0) {
+			goto skip;
+		}
+	}
+
+	entry = new_entry(path, len);
+	if(entry == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	entry->page = page;
+	page = NULL;
+
+	if(!S_ISDIR(mode) && le32_to_cpu(F2FS_NODE(entry->page)->i.i_links) > 1) {
+		ret = find_link(ctx, ino, path, &entry->link);
+		if(ret < 0) {
+			free_entry(entry);
+			goto out;
+		}
+	}
+
+	if(S_ISDIR(mode)) {
+		stat->dirs++;
+	} else if(entry->link != NULL) {
+		stat->links++;
+	} else if(S_ISREG(mode)) {
+		stat->files++;
+	} else {
+		stat->others++;
+	}
+
+	ret = queue_put(&ctx->entries, entry, 0);
+	if(ret < 0) {
+		free_entry(entry);
+		goto out;
+	}
+
+	for(pos=0; pos<dir.len; pos+=(sizeof(struct tar_dirent) + d->len + 1 + 7) & ~7UL) {
+		d = (struct tar_dirent *)(dir.buf + pos);
+		if(len + d->len >= PATH_MAX) {
+			fprintf(stderr, "tar %s%s: %s\n", path, d->name, strerror(ENAMETOOLONG));
+			stat->skipped++;
+			continue;
+		}
+
+		memcpy(path + len, d->name, d->len + 1);
+		ret = walk_inode(ctx, d->ino, path, len + d->len);
+		if(ret < 0) {
+			break;
+		}
+	}
+	goto out;
+
+skip:
+	if(ret != -ENOMEM) {
+		fprintf(stderr, "tar %s: %s\n", path, strerror(-ret));
+		stat->skipped++;
+		ret = 0;
+	}
+out:
+	if(page != NULL) {
+		free_page(page);
+	}
+	if(dir.buf != NULL) {
+		f2fs_free(dir.buf);
+	}
+	return ret;
+}
+
+static struct tar_chunk *new_chunk(int type, size_t len, size_t buf_len)
+{
+	struct tar_chunk *chunk = NULL;
+
+	chunk = f2fs_malloc(sizeof(struct tar_chunk) + buf_len);
+	if(chunk == NULL) {
+		perror("f2fs_malloc");
+		return NULL;
+	}
+	chunk->type = type;
+	chunk->len = len;
+	chunk->off = 0;
+	return chunk;
+}
+
+/* image runs are read ahead as soon as they are queued */
+static int put_chunk(struct tar_ctx *ctx, struct tar_chunk *chunk)
+{
+	size_t size = chunk->type == TAR_CHUNK_ZERO ? 0 : chunk->len;
+	struct f2fs_dev *dev = NULL;
+	block_t devblk = 0;
+	int ret = 0;
+
+	if(chunk->type == TAR_CHUNK_IMAGE) {
+		dev = f2fs_dev_map(ctx->super, chunk->off / F2FS_BLKSIZE, &devblk);
+		posix_fadvise(dev->fd, (off_t)devblk * F2FS_BLKSIZE, chunk->len,
+			POSIX_FADV_WILLNEED);
+	}
+
+	ret = queue_put(&ctx->chunks, chunk, size);
+	if(ret < 0) {
+		f2fs_free(chunk);
+	}
+	return ret;
+}
+
+static int put_zeros(struct tar_ctx *ctx, size_t len)
+{
+	struct tar_chunk *chunk = NULL;
+
+	if(len == 0) {
+		return 0;
+	}
+
+	chunk = new_chunk(TAR_CHUNK_ZERO, len, 0);
+	if(chunk == NULL) {
+		return -ENOMEM;
+	}
+	return put_chunk(ctx, chunk);
+}
+
+static void tar_octal(char *field, int size, unsigned long long value)
+{
+	if(value > TAR_OCTAL_MAX(size)) {
+		value = 0;
+	}
+	snprintf(field, size, "%0*llo", size - 1, value);
+}
+
+/* append "len key=value\n" to a pax header, len counts the whole record */
+static int pax_record(char *buf, int off, int max, const char *key, const char *value)
+{
+	int body = strlen(key) + strlen(value) + 3;
+	int len = body, n = 0;
+
+	if(off < 0) {
+		return off;
+	}
+
+	do {
+		n = len;
+		len = body + snprintf(NULL, 0, "%d", n);
+	} while(len != n);
+
+	if(off + len >= max) {
+		return -ENAMETOOLONG;
+	}
+	snprintf(buf + off, len + 1, "%d %s=%s\n", len, key, value);
+	return off + len;
+}
+
+/* where path splits into ustar prefix and name, 0 if name holds it all */
+static int split_name(const char *path)
+{
+	int len = strlen(path), i = 0;
+
+	if(len <= (int)sizeof(((struct ustar_header *)0)->name)) {
+		return 0;
+	}
+
+	for(i=len-101; i<len-1 && i<=155; i++) {
+		if(i > 0 && path[i] == '/') {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void fill_header(struct ustar_header *h, struct f2fs_raw_inode *ri,
+		char typeflag, unsigned long long size)
+{
+	memset(h, 0, sizeof(struct ustar_header));
+	tar_octal(h->mode, sizeof(h->mode), le16_to_cpu(ri->i_mode) & 07777);
+	tar_octal(h->uid, sizeof(h->uid), le32_to_cpu(ri->i_uid));
+	tar_octal(h->gid, sizeof(h->gid), le32_to_cpu(ri->i_gid));
+	tar_octal(h->size, sizeof(h->size), size);
+	tar_octal(h->mtime, sizeof(h->mtime), le64_to_cpu(ri->i_mtime));
+	h->typeflag = typeflag;
+	memcpy(h->magic, "ustar", 6);
+	memcpy(h->version, "00", 2);
+}
+
+static void header_checksum(struct ustar_header *h)
+{
+	unsigned char *p = (unsigned char *)h;
+	unsigned int sum = 0, i = 0;
+
+	memset(h->chksum, ' ', sizeof(h->chksum));
+	for(i=0; i<sizeof(struct ustar_header); i++) {
+		sum += p[i];
+	}
+	snprintf(h->chksum, 7, "%06o", sum);
+}
+
+/* a ustar header, behind a pax header for whatever ustar can not hold */
+static int tar_header(struct tar_entry *entry, char typeflag,
+		unsigned long long size, const char *linkname, unsigned int major,
+		unsigned int minor, struct tar_chunk **chunk)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(entry->page)->i;
+	char pax[2 * PATH_MAX + 128], num[24];
+	struct ustar_header *h = NULL;
+	int split = split_name(entry->path), pax_len = 0;
+	size_t len = TAR_BLOCK_SIZE, pax_blocks = 0;
+
+	if(split < 0) {
+		pax_len = pax_record(pax, pax_len, sizeof(pax), "path", entry->path);
+	}
+	if(linkname != NULL && strlen(linkname) > sizeof(h->linkname)) {
+		pax_len = pax_record(pax, pax_len, sizeof(pax), "linkpath", linkname);
+	}
+	if(size > TAR_OCTAL_MAX(sizeof(h->size))) {
+		snprintf(num, sizeof(num), "%llu", size);
+		pax_len = pax_record(pax, pax_len, sizeof(pax), "size", num);
+	}
+	if(le32_to_cpu(ri->i_uid) > TAR_OCTAL_MAX(sizeof(h->uid))) {
+		snprintf(num, sizeof(num), "%u", le32_to_cpu(ri->i_uid));
+		pax_len = pax_record(pax, pax_len, sizeof(pax), "uid", num);
+	}
+	if(le32_to_cpu(ri->i_gid) > TAR_OCTAL_MAX(sizeof(h->gid))) {
+		snprintf(num, sizeof(num), "%u", le32_to_cpu(ri->i_gid));
+		pax_len = pax_record(pax, pax_len, sizeof(pax), "gid", num);
+	}
+	if(pax_len < 0) {
+		return pax_len;
+	}
+
+	if(pax_len > 0) {
+		pax_blocks = (pax_len + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE;
+		len += (1 + pax_blocks) * TAR_BLOCK_SIZE;
+	}
+
+	*chunk = new_chunk(TAR_CHUNK_BYTES, len, len);
+	if(*chunk == NULL) {
+		return -ENOMEM;
+	}
+	memset((*chunk)->buf, 0, len);
+	h = (struct ustar_header *)(*chunk)->buf;
+
+	if(pax_len > 0) {
+		fill_header(h, ri, 'x', pax_len);
+		strcpy(h->name, "././@PaxHeader");
+		header_checksum(h);
+		memcpy(h + 1, pax, pax_len);
+		h = (struct ustar_header *)((*chunk)->buf + (1 + pax_blocks) * TAR_BLOCK_SIZE);
+	}
+
+	fill_header(h, ri, typeflag, size);
+	if(split > 0) {
+		memcpy(h->prefix, entry->path, split);
+		strncpy(h->name, entry->path + split + 1, sizeof(h->name));
+	} else {
+		strncpy(h->name, entry->path, sizeof(h->name));
+	}
+	if(linkname != NULL) {
+		strncpy(h->linkname, linkname, sizeof(h->linkname));
+	}
+	if(typeflag == '3' || typeflag == '4') {
+		tar_octal(h->devmajor, sizeof(h->devmajor), major);
+		tar_octal(h->devminor, sizeof(h->devminor), minor);
+	}
+	header_checksum(h);
+	return 0;
+}
+
+/* special inodes keep the old device encoding in the first address, or the new one in the second */
+static void decode_dev(struct page *page, unsigned int *major, unsigned int *minor)
+{
+	__le32 *addr = blkaddr_in_node(page);
+	unsigned int dev = le32_to_cpu(addr[0]);
+
+	if(dev != 0) {
+		*major = (dev >> 8) & 0xff;
+		*minor = dev & 0xff;
+		return;
+	}
+
+	dev = le32_to_cpu(addr[1]);
+	*major = (dev & 0xfff00) >> 8;
+	*minor = (dev & 0xff) | ((dev >> 12) & 0xfff00);
+}
+
+static int read_symlink(struct tar_ctx *ctx, struct page *inode_page, char *target)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(inode_page)->i;
+	unsigned long long size = le64_to_cpu(ri->i_size);
+	struct page *page = NULL;
+	int ret = 0;
+
+	if(size >= F2FS_BLKSIZE) {
+		return -ENAMETOOLONG;
+	}
+
+	if(ri->i_inline & F2FS_INLINE_DATA) {
+		if(size > MAX_INLINE_DATA(ctx->super->raw_super, ri)) {
+			return -EIO;
+		}
+		memcpy(target, inline_data_addr(ri), size);
+		target[size] = '\0';
+		return 0;
+	}
+
+	page = alloc_page();
+	if(page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	lock_core(ctx);
+	ret = f2fs_read_data_block(ctx->super, inode_page, 0, page);
+	unlock_core(ctx);
+	if(ret == 0) {
+		memcpy(target, page_address(page), size);
+		target[size] = '\0';
+	}
+	free_page(page);
+	return ret;
+}
+
+static int put_inline(struct tar_ctx *ctx, struct f2fs_raw_inode *ri,
+		unsigned long long size)
+{
+	struct tar_chunk *chunk = NULL;
+
+	if(size > MAX_INLINE_DATA(ctx->super->raw_super, ri)) {
+		return -EIO;
+	}
+
+	chunk = new_chunk(TAR_CHUNK_BYTES, size, size);
+	if(chunk == NULL) {
+		return -ENOMEM;
+	}
+	memcpy(chunk->buf, inline_data_addr(ri), size);
+	return put_chunk(ctx, chunk);
+}
+
+static int flush_run(struct tar_ctx *ctx, struct tar_run *run,
+		unsigned long long *left)
+{
+	struct tar_chunk *chunk = NULL;
+	unsigned long long len = (unsigned long long)run->nr * F2FS_BLKSIZE;
+
+	if(run->nr == 0) {
+		return 0;
+	}
+	if(len > *left) {
+		len = *left;
+	}
+
+	chunk = new_chunk(run->type, len, 0);
+	if(chunk == NULL) {
+		return -ENOMEM;
+	}
+	chunk->off = (off_t)run->start * F2FS_BLKSIZE;
+	*left -= len;
+	run->nr = 0;
+	return put_chunk(ctx, chunk);
+}
+
+/* nr blocks at blkaddr, holes join any hole before them */
+static int add_run(struct tar_ctx *ctx, struct tar_run *run, block_t blkaddr,
+		unsigned long nr, unsigned long long *left)
+{
+	int type = TAR_CHUNK_IMAGE, ret = 0;
+	block_t devblk = 0;
+
+	if(blkaddr == NULL_ADDR || blkaddr == NEW_ADDR) {
+		type = TAR_CHUNK_ZERO;
+	}
+
+	/* a run of image blocks stays on one member of the volume */
+	if(run->nr > 0 && run->type == type && (type == TAR_CHUNK_ZERO ||
+			(run->nr < TAR_RUN_BLOCKS && run->start + run->nr == blkaddr &&
+			f2fs_dev_map(ctx->super, run->start, &devblk) ==
+			f2fs_dev_map(ctx->super, blkaddr, &devblk)))) {
+		run->nr += nr;
+		return 0;
+	}
+
+	ret = flush_run(ctx, run, left);
+	if(ret < 0) {
+		return ret;
+	}
+	run->type = type;
+	run->start = blkaddr;
+	run->nr = nr;
+	return 0;
+}
+
+/* blocks left in the dnode that holds index */
+static unsigned long dnode_blocks_left(struct f2fs_super *super,
+		struct f2fs_raw_inode *ri, unsigned long index)
+{
+	unsigned long direct = ADDRS_PER_INODE(super->raw_super, ri);
+	unsigned long per_block = ADDRS_PER_BLOCK(ri);
+
+	if(index < direct) {
+		return direct - index;
+	}
+	return per_block - (index - direct) % per_block;
+}
+
+/*
+ * Map the file one dnode at a time and queue runs of contiguous blocks.
+ * A dnode that can not be read is reported and archived as zeros, the
+ * header already promised its size.
+ */
+static int put_file_blocks(struct tar_ctx *ctx, struct tar_entry *entry,
+		unsigned long long size)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(entry->page)->i;
+	unsigned long nblocks = (size + F2FS_BLKSIZE - 1) / F2FS_BLKSIZE;
+	unsigned long index = 0, count = 0, i = 0;
+	unsigned long long left = size;
+	block_t addrs[DEF_ADDRS_PER_BLOCK];
+	struct dnode_of_data dn;
+	struct tar_run run;
+	int ret = 0;
+
+	memset(&run, 0, sizeof(run));
+	while(index < nblocks) {
+		count = dnode_blocks_left(ctx->super, ri, index);
+		if(count > nblocks - index) {
+			count = nblocks - index;
+		}
+
+		set_new_dnode(&dn, ino_of_node(entry->page), entry->page);
+		lock_core(ctx);
+		ret = f2fs_get_dnode_of_data(ctx->super, &dn, index, LOOKUP_NODE);
+		if(ret == 0) {
+			for(i=0; i<count; i++) {
+				addrs[i] = datablock_addr(dn.node_page, dn.ofs_in_node + i);
+			}
+			f2fs_put_dnode(ctx->super, &dn);
+		}
+		unlock_core(ctx);
+
+		if(ret == -ENOMEM) {
+			return ret;
+		}
+
+		if(ret < 0) {
+			if(ret != -ENOENT) {
+				fprintf(stderr, "tar %s: block %lu: %s\n", entry->path,
+					index, strerror(-ret));
+			}
+			ret = add_run(ctx, &run, NULL_ADDR, count, &left);
+		} else {
+			for(i=0; i<count && ret==0; i++) {
+				ret = add_run(ctx, &run, addrs[i], 1, &left);
+			}
+		}
+		if(ret < 0) {
+			return ret;
+		}
+		index += count;
+	}
+	return flush_run(ctx, &run, &left);
+}
+
+static int read_entry(struct tar_ctx *ctx, struct tar_entry *entry)
+{
+	struct f2fs_raw_inode *ri = &F2FS_NODE(entry->page)->i;
+	unsigned int mode = le16_to_cpu(ri->i_mode), major = 0, minor = 0;
+	unsigned long long size = 0;
+	struct tar_chunk *chunk = NULL;
+	char *linkname = entry->link;
+	char target[F2FS_BLKSIZE];
+	char typeflag = '0';
+	int ret = 0;
+
+	if(entry->link != NULL) {
+		typeflag = '1';
+	} else if(S_ISDIR(mode)) {
+		typeflag = '5';
+	} else if(S_ISLNK(mode)) {
+		ret = read_symlink(ctx, entry->page, target);
+		if(ret < 0) {
+			fprintf(stderr, "tar %s: %s\n", entry->path, strerror(-ret));
+			return ret == -ENOMEM ? ret : 0;
+		}
+		linkname = target;
+		typeflag = '2';
+	} else if(S_ISCHR(mode) || S_ISBLK(mode)) {
+		decode_dev(entry->page, &major, &minor);
+		typeflag = S_ISCHR(mode) ? '3' : '4';
+	} else if(S_ISFIFO(mode)) {
+		typeflag = '6';
+	} else {
+		size = le64_to_cpu(ri->i_size);
+	}
+
+	ret = tar_header(entry, typeflag, size, linkname, major, minor, &chunk);
+	if(ret == -ENAMETOOLONG) {
+		fprintf(stderr, "tar %s: %s\n", entry->path, strerror(-ret));
+		return 0;
+	}
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = put_chunk(ctx, chunk);
+	if(ret < 0 || typeflag != '0') {
+		return ret;
+	}
+
+	if(ri->i_inline & F2FS_INLINE_DATA) {
+		ret = put_inline(ctx, ri, size);
+	} else {
+		ret = put_file_blocks(ctx, entry, size);
+	}
+	if(ret < 0) {
+		return ret;
+	}
+	return put_zeros(ctx, (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+}
+
+/* the reader stage: headers and block runs for every entry, then the trailer */
+static void *reader_main(void *arg)
+{
+	struct tar_ctx *ctx = arg;
+	struct tar_entry *entry = NULL;
+	int ret = 0;
+
+	while((entry = queue_get(&ctx->entries)) != NULL) {
+		if(ret == 0) {
+			ret = read_entry(ctx, entry);
+			if(ret < 0) {
+				tar_error(ctx, ret);
+				queue_close(&ctx->entries);
+			}
+		}
+		free_entry(entry);
+	}
+
+	/* two zero blocks end the archive */
+	if(ret == 0 && ctx->err == 0) {
+		ret = put_zeros(ctx, 2 * TAR_BLOCK_SIZE);
+		if(ret < 0) {
+			tar_error(ctx, ret);
+		}
+	}
+	queue_close(&ctx->chunks);
+	return NULL;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n = 0;
+	int ret = 0;
+
+	while(len > 0) {
+		n = write(fd, buf, len);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			ret = n < 0 ? -errno : -EIO;
+			perror("write");
+			return ret;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* splice moves image pages into the pipe without copying them */
+static int write_image(struct tar_ctx *ctx, off_t off, size_t len, char *buf)
+{
+	struct timespec start;
+	block_t devblk = 0;
+	struct f2fs_dev *dev = f2fs_dev_map(ctx->super, off / F2FS_BLKSIZE, &devblk);
+	loff_t pos = (off_t)devblk * F2FS_BLKSIZE;
+	size_t chunk = 0;
+	ssize_t n = 0;
+	int ret = 0;
+
+	while(len > 0) {
+		if(ctx->splice_out) {
+			n = splice(dev->fd, &pos, ctx->out, NULL, len, SPLICE_F_MORE);
+			if(n > 0) {
+				ctx->stat->spliced += n;
+				len -= n;
+				continue;
+			}
+			if(n == 0) {
+				return -EIO;
+			}
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno != EINVAL && errno != ENOSYS) {
+				ret = -errno;
+				perror("splice");
+				return ret;
+			}
+			ctx->splice_out = 0;
+		}
+
+		chunk = len < TAR_RUN_BLOCKS * F2FS_BLKSIZE ? len : TAR_RUN_BLOCKS * F2FS_BLKSIZE;
+		f2fs_stat_read_start(&start);
+		n = pread(dev->fd, buf, chunk, pos);
+		f2fs_stat_read_end(&start, n);
+		if(n <= 0) {
+			perror("pread");
+			return -EIO;
+		}
+
+		ret = write_all(ctx->out, buf, n);
+		if(ret < 0) {
+			return ret;
+		}
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_chunk(struct tar_ctx *ctx, struct tar_chunk *chunk, char *buf)
+{
+	size_t left = chunk->len, n = 0;
+	int ret = 0;
+
+	switch(chunk->type) {
+	case TAR_CHUNK_BYTES:
+		return write_all(ctx->out, chunk->buf, chunk->len);
+	case TAR_CHUNK_IMAGE:
+		return write_image(ctx, chunk->off, chunk->len, buf);
+	}
+
+	while(left > 0 && ret == 0) {
+		n = left < sizeof(tar_zeros) ? left : sizeof(tar_zeros);
+		ret = write_all(ctx->out, tar_zeros, n);
+		left -= n;
+	}
+	return ret;
+}
+
+/* the writer stage: emit chunks in order until the reader closes the queue */
+static void *writer_main(void *arg)
+{
+	struct tar_ctx *ctx = arg;
+	struct tar_chunk *chunk = NULL;
+	char *buf = NULL;
+	int ret = 0;
+
+	buf = f2fs_malloc(TAR_RUN_BLOCKS * F2FS_BLKSIZE);
+	if(buf == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		tar_error(ctx, ret);
+		queue_close(&ctx->chunks);
+	}
+
+	while((chunk = queue_get(&ctx->chunks)) != NULL) {
+		if(ret == 0) {
+			ret = write_chunk(ctx, chunk, buf);
+			if(ret < 0) {
+				tar_error(ctx, ret);
+				queue_close(&ctx->chunks);
+			}
+			ctx->stat->bytes += chunk->len;
+		}
+		f2fs_free(chunk);
+	}
+
+	if(buf != NULL) {
+		f2fs_free(buf);
+	}
+	return NULL;
+}
+
+/* archive names start at the last component of path, or "." for the root */
+static int top_name(const char *path, char *name)
+{
+	int len = strlen(path), start = 0;
+
+	while(len > 0 && path[len - 1] == '/') {
+		len--;
+	}
+	for(start=len; start>0 && path[start - 1]!='/'; start--);
+
+	if(len == start) {
+		strcpy(name, ".");
+		return 1;
+	}
+	if(len - start >= PATH_MAX) {
+		return -ENAMETOOLONG;
+	}
+	memcpy(name, path + start, len - start);
+	name[len - start] = '\0';
+	return len - start;
+}
+
+int f2fs_tar(struct f2fs_super *super, const char *path, int out,
+		struct tar_stat *stat)
+{
+	struct tar_ctx *ctx = NULL;
+	pthread_t reader, writer;
+	struct stat st;
+	char *name = NULL;
+	nid_t ino = 0;
+	int len = 0, ret = 0;
+
+	memset(stat, 0, sizeof(struct tar_stat));
+	ret = f2fs_lookup_path(super, path, &ino);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ctx = f2fs_malloc(sizeof(struct tar_ctx));
+	name = f2fs_malloc(PATH_MAX);
+	if(ctx == NULL || name == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	len = top_name(path, name);
+	if(len < 0) {
+		ret = len;
+		goto free;
+	}
+
+	memset(ctx, 0, sizeof(struct tar_ctx));
+	ctx->super = super;
+	ctx->stat = stat;
+	ctx->out = out;
+	ctx->splice_out = fstat(out, &st) == 0 && S_ISFIFO(st.st_mode);
+	ctx->serialize = NM_I(super) != NULL;
+	pthread_mutex_init(&ctx->core_lock, NULL);
+
+	ret = queue_init(&ctx->entries, TAR_ENTRY_QUEUE, (size_t)-1);
+	if(ret == 0) {
+		ret = queue_init(&ctx->chunks, TAR_CHUNK_QUEUE, TAR_READAHEAD_BYTES);
+	}
+	if(ret < 0) {
+		goto destroy;
+	}
+
+	ret = pthread_create(&writer, NULL, writer_main, ctx);
+	if(ret != 0) {
+		ret = -ret;
+		goto destroy;
+	}
+
+	ret = pthread_create(&reader, NULL, reader_main, ctx);
+	if(ret != 0) {
+		tar_error(ctx, -ret);
+		queue_close(&ctx->chunks);
+		pthread_join(writer, NULL);
+		goto destroy;
+	}
+
+	ret = walk_inode(ctx, ino, name, len);
+	if(ret < 0) {
+		tar_error(ctx, ret);
+	}
+	queue_close(&ctx->entries);
+
+	pthread_join(reader, NULL);
+	pthread_join(writer, NULL);
+	ret = ctx->err;
+
+destroy:
+	queue_destroy(&ctx->chunks);
+	queue_destroy(&ctx->entries);
+	pthread_mutex_destroy(&ctx->core_lock);
+	free_links(ctx);
+free:
+	if(name != NULL) {
+		f2fs_free(name);
+	}
+	if(ctx != NULL) {
+		f2fs_free(ctx);
+	}
+	return ret;
+}
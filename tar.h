@@ -0,0 +1,32 @@
+#ifndef __TAR_H__
+#define __TAR_H__
+
+#include "f2fs.h"
+
+#define TAR_BLOCK_SIZE		512
+/* inodes the walker may run ahead of the reader */
+#define TAR_ENTRY_QUEUE		256
+/* header and file bytes the reader may run ahead of the writer */
+#define TAR_READAHEAD_BYTES	(8 << 20)
+/* the longest run of image blocks one chunk covers */
+#define TAR_RUN_BLOCKS		256
+
+struct tar_stat {
+	unsigned int files;
+	unsigned int dirs;
+	unsigned int links;		/* hard links to a file archived before */
+	unsigned int others;		/* symlinks, devices and fifos */
+	unsigned int skipped;		/* sockets and inodes that could not be read */
+	unsigned long long bytes;	/* size of the archive */
+	unsigned long long spliced;	/* file bytes moved by splice */
+};
+
+/*
+ * Write the subtree at path to out as a POSIX tar. The walker runs in the
+ * caller, a reader thread maps file blocks and starts readahead on them and
+ * a writer thread emits the archive, splicing file data when out is a pipe.
+ */
+int f2fs_tar(struct f2fs_super *super, const char *path, int out,
+		struct tar_stat *stat);
+
+#endif /*__TAR_H__*/
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+int f2fs_trace_enabled = 0;
+
+/*
+ * A thread pushes its ring once, without a lock. Rings live until
+ * f2fs_trace_stop(), which bumps the generation so that threads still
+ * holding a freed ring take a new one next time.
+ */
+static struct trace_ring *trace_rings;
+static unsigned int trace_gen;
+static unsigned long long trace_base;
+static char trace_path[4096];
+
+static __thread struct trace_ring *thread_ring;
+static __thread unsigned int thread_gen;
+
+unsigned long long f2fs_trace_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct trace_ring *get_ring()
+{
+	struct trace_ring *ring = thread_ring;
+
+	if(ring != NULL && thread_gen == trace_gen) {
+		return ring;
+	}
+
+	ring = malloc(sizeof(struct trace_ring));
+	if(ring == NULL) {
+		return NULL;
+	}
+	ring->head = 0;
+	ring->tid = syscall(SYS_gettid);
+
+	do {
+		ring->next = trace_rings;
+	} while(!__sync_bool_compare_and_swap(&trace_rings, ring->next, ring));
+
+	thread_ring = ring;
+	thread_gen = trace_gen;
+	return ring;
+}
+
+void f2fs_trace_event(struct trace_scope *ts)
+{
+	struct trace_ring *ring = NULL;
+	struct trace_event *e = NULL;
+
+	if(!f2fs_trace_enabled) {
+		return;
+	}
+
+	ring = get_ring();
+	if(ring == NULL) {
+		return;
+	}
+
+	e = &ring->events[ring->head % F2FS_TRACE_EVENTS];
+	e->name = ts->name;
+	e->key = ts->key;
+	e->start = ts->start;
+	e->dur = f2fs_trace_now() - ts->start;
+	e->arg = ts->arg;
+	ring->head++;
+}
+
+int f2fs_trace_start(const char *path)
+{
+	if(strlen(path) >= sizeof(trace_path)) {
+		return -ENAMETOOLONG;
+	}
+
+	strcpy(trace_path, path);
+	trace_base = f2fs_trace_now();
+	__sync_synchronize();
+	f2fs_trace_enabled = 1;
+	return 0;
+}
+
+static void write_event(FILE *fp, int tid, struct trace_event *e, int first)
+{
+	/* a scope opened before a restart begins at 0 */
+	unsigned long long start = e->start > trace_base ? e->start - trace_base : 0;
+
+	fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"f2fs\",\"ph\":\"X\","
+		"\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%d",
+		first ? "" : ",", e->name, start / 1000, start % 1000,
+		e->dur / 1000, e->dur % 1000, getpid(), tid);
+	if(e->key != NULL) {
+		fprintf(fp, ",\"args\":{\"%s\":%llu}", e->key, e->arg);
+	}
+	fprintf(fp, "}");
+}
+
+int f2fs_trace_stop()
+{
+	struct trace_ring *ring = NULL, *next = NULL;
+	unsigned long long i = 0, first = 0, lost = 0, nr = 0;
+	FILE *fp = NULL;
+	int ret = 0;
+
+	if(!f2fs_trace_enabled) {
+		return 0;
+	}
+	f2fs_trace_enabled = 0;
+	__sync_synchronize();
+
+	fp = fopen(trace_path, "w");
+	if(fp == NULL) {
+		ret = -errno;
+		perror("fopen");
+	} else {
+		fprintf(fp, "{\"traceEvents\":[");
+	}
+
+	ring = __sync_lock_test_and_set(&trace_rings, NULL);
+	for(; ring != NULL; ring = next) {
+		next = ring->next;
+		first = 0;
+		if(ring->head > F2FS_TRACE_EVENTS) {
+			first = ring->head - F2FS_TRACE_EVENTS;
+			lost += first;
+		}
+
+		for(i=first; fp != NULL && i<ring->head; i++) {
+			write_event(fp, ring->tid, &ring->events[i % F2FS_TRACE_EVENTS],
+				nr++ == 0);
+		}
+		free(ring);
+	}
+	trace_gen++;
+
+	if(fp != NULL) {
+		fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+		if(fclose(fp) != 0) {
+			ret = -errno;
+			perror("fclose");
+		}
+	}
+
+	if(lost > 0) {
+		fprintf(stderr, "trace: the rings were full, %llu events lost\n", lost);
+	}
+	return ret;
+}
@@ -0,0 +1,74 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/*
+ * Scoped trace events written as Chrome trace JSON (chrome://tracing,
+ * ui.perfetto.dev). Every thread records into its own ring, the oldest
+ * events are overwritten when it is full. While tracing is off a scope
+ * costs one test of f2fs_trace_enabled.
+ *
+ *	F2FS_TRACE_SCOPE("readdir", "ino", ino);
+ *
+ * records from there to the end of the enclosing block. Names and keys must
+ * be string literals, the rings only keep the pointers.
+ */
+#define F2FS_TRACE_EVENTS	32768	/* per thread */
+
+struct trace_event {
+	const char *name;
+	const char *key;		/* of arg, NULL for none */
+	unsigned long long start;	/* ns */
+	unsigned long long dur;
+	unsigned long long arg;
+};
+
+struct trace_ring {
+	struct trace_ring *next;
+	unsigned long long head;	/* events recorded, head % size is next */
+	int tid;
+	struct trace_event events[F2FS_TRACE_EVENTS];
+};
+
+struct trace_scope {
+	const char *name;		/* NULL while tracing is off */
+	const char *key;
+	unsigned long long start;
+	unsigned long long arg;
+};
+
+extern int f2fs_trace_enabled;
+
+unsigned long long f2fs_trace_now();
+void f2fs_trace_event(struct trace_scope *ts);
+
+/* start recording, f2fs_trace_stop() writes the events to path */
+int f2fs_trace_start(const char *path);
+/* call once the traced threads are done */
+int f2fs_trace_stop();
+
+static inline struct trace_scope f2fs_trace_begin(const char *name,
+		const char *key, unsigned long long arg)
+{
+	struct trace_scope ts = {NULL, NULL, 0, 0};
+
+	if(__builtin_expect(f2fs_trace_enabled, 0)) {
+		ts.name = name;
+		ts.key = key;
+		ts.arg = arg;
+		ts.start = f2fs_trace_now();
+	}
+	return ts;
+}
+
+static inline void f2fs_trace_end(struct trace_scope *ts)
+{
+	if(__builtin_expect(ts->name != NULL, 0)) {
+		f2fs_trace_event(ts);
+	}
+}
+
+#define F2FS_TRACE_SCOPE(name, key, arg) \
+	struct trace_scope __trace_scope __attribute__((cleanup(f2fs_trace_end))) = \
+		f2fs_trace_begin(name, key, arg)
+
+#endif /*__TRACE_H__*/
@@ -0,0 +1,548 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "page.h"
+#include "f2fs_type.h"
+#include "f2fs.h"
+#include "super.h"
+#include "node.h"
+#include "dir.h"
+#include "namei.h"
+#include "dev.h"
+#include "trace.h"
+#include "xattr.h"
+
+#define IS_XATTR_LAST_ENTRY(entry)	(*(__le32 *)(entry) == 0)
+
+struct xattr_item {
+	char *path;
+	struct page *page;		/* inode block */
+	nid_t xnid;
+	block_t blkaddr;		/* of the xattr node */
+	struct page *xnode;
+	int err;
+};
+
+struct xattr_dirent {
+	nid_t ino;
+	int len;
+	char name[];
+};
+
+struct xattr_dir {
+	struct f2fs_super *super;
+	char *buf;
+	size_t len, max;
+};
+
+struct xattr_ctx {
+	struct f2fs_super *super;
+	struct xattr_stat *stat;
+	xattr_fn fn;
+	void *arg;
+	struct xattr_item items[XATTR_BATCH];
+	struct xattr_item *order[XATTR_BATCH];
+	int nr;
+	char *run;			/* XATTR_RUN_BLOCKS blocks */
+};
+
+const char *f2fs_xattr_prefix(int index)
+{
+	switch(index) {
+	case F2FS_XATTR_INDEX_USER:
+		return "user.";
+	case F2FS_XATTR_INDEX_POSIX_ACL_ACCESS:
+		return "system.posix_acl_access";
+	case F2FS_XATTR_INDEX_POSIX_ACL_DEFAULT:
+		return "system.posix_acl_default";
+	case F2FS_XATTR_INDEX_TRUSTED:
+		return "trusted.";
+	case F2FS_XATTR_INDEX_LUSTRE:
+		return "lustre.";
+	case F2FS_XATTR_INDEX_SECURITY:
+		return "security.";
+	case F2FS_XATTR_INDEX_ADVISE:
+		return "system.advise";
+	case F2FS_XATTR_INDEX_ENCRYPTION:
+		return "encryption.";
+	case F2FS_XATTR_INDEX_VERITY:
+		return "verity.";
+	}
+	return NULL;
+}
+
+int f2fs_walk_xattrs(struct f2fs_super *super, struct f2fs_raw_inode *ri,
+		struct page *xnode, const char *path, xattr_fn fn, void *arg)
+{
+	int inline_addrs = get_inline_xattr_addrs(super->raw_super, ri);
+	size_t inline_size = inline_addrs * sizeof(__le32);
+	size_t size = inline_size + (xnode != NULL ? VALID_XATTR_BLOCK_SIZE : 0);
+	struct f2fs_xattr_header *header = NULL;
+	struct f2fs_xattr_entry *entry = NULL;
+	size_t pos = 0;
+	char *buf = NULL;
+	int ret = 0;
+
+	if(size < sizeof(struct f2fs_xattr_header)) {
+		return 0;
+	}
+
+	/* the list runs on from the inode into the node block */
+	buf = f2fs_malloc(size);
+	if(buf == NULL) {
+		perror("f2fs_malloc");
+		return -ENOMEM;
+	}
+	memcpy(buf, &ri->i_addr[DEF_ADDRS_PER_INODE - inline_addrs], inline_size);
+	if(xnode != NULL) {
+		memcpy(buf + inline_size, page_address(xnode), VALID_XATTR_BLOCK_SIZE);
+	}
+
+	header = (struct f2fs_xattr_header *)buf;
+	if(le32_to_cpu(header->h_magic) != F2FS_XATTR_MAGIC) {
+		goto out;
+	}
+
+	for(pos=sizeof(struct f2fs_xattr_header); pos+sizeof(__le32)<=size;
+			pos+=XATTR_ENTRY_SIZE(entry)) {
+		entry = (struct f2fs_xattr_entry *)(buf + pos);
+		if(IS_XATTR_LAST_ENTRY(entry)) {
+			break;
+		}
+		if(pos + XATTR_ENTRY_SIZE(entry) > size) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = fn(arg, path, entry);
+		if(ret != 0) {
+			break;
+		}
+	}
+
+out:
+	f2fs_free(buf);
+	return ret;
+}
+
+static int read_inode(struct f2fs_super *super, nid_t ino, struct page **page)
+{
+	int ret = 0;
+
+	*page = alloc_page();
+	if(*page == NULL) {
+		perror("alloc page");
+		return -ENOMEM;
+	}
+
+	ret = f2fs_read_node_block(super, ino, *page);
+	if(ret == 0 && (!IS_INODE(*page) || ino_of_node(*page) != ino)) {
+		ret = -EIO;
+	}
+
+	if(ret < 0) {
+		free_page(*page);
+		*page = NULL;
+	}
+	return ret;
+}
+
+/* the xattr node carries the footer of its inode's node */
+static int check_xnode(struct page *xnode, nid_t xnid, nid_t ino)
+{
+	if(nid_of_node(xnode) != xnid || ino_of_node(xnode) != ino) {
+		return -EIO;
+	}
+	return 0;
+}
+
+int f2fs_get_xattrs(struct f2fs_super *super, const char *path, xattr_fn fn,
+		void *arg)
+{
+	struct page *page = NULL, *xnode = NULL;
+	nid_t ino = 0, xnid = 0;
+	int ret = 0;
+
+	ret = f2fs_lookup_path(super, path, &ino);
+	if(ret < 0) {
+		return ret;
+	}
+
+	ret = read_inode(super, ino, &page);
+	if(ret < 0) {
+		return ret;
+	}
+
+	xnid = le32_to_cpu(F2FS_NODE(page)->i.i_xattr_nid);
+	if(xnid != 0) {
+		xnode = alloc_page();
+		if(xnode == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		ret = f2fs_read_node_block(super, xnid, xnode);
+		if(ret == 0) {
+			ret = check_xnode(xnode, xnid, ino);
+		}
+		if(ret < 0) {
+			goto out;
+		}
+	}
+
+	ret = f2fs_walk_xattrs(super, &F2FS_NODE(page)->i, xnode, path, fn, arg);
+out:
+	if(xnode != NULL) {
+		free_page(xnode);
+	}
+	free_page(page);
+	return ret;
+}
+
+static int collect_dirent(void *arg, const char *name, int len, nid_t ino,
+		unsigned char file_type)
+{
+	struct xattr_dir *dir = arg;
+	struct xattr_dirent *d = NULL;
+	size_t size = (sizeof(struct xattr_dirent) + len + 1 + 7) & ~7UL;
+	size_t max = 0;
+	char *buf = NULL;
+
+	if(f2fs_is_orphan(dir->super, ino)) {
+		return 0;
+	}
+
+	if(dir->len + size > dir->max) {
+		max = dir->max ? dir->max * 2 : F2FS_BLKSIZE;
+		while(dir->len + size > max) {
+			max *= 2;
+		}
+
+		buf = f2fs_malloc(max);
+		if(buf == NULL) {
+			perror("f2fs_malloc");
+			return -ENOMEM;
+		}
+		if(dir->buf != NULL) {
+			memcpy(buf, dir->buf, dir->len);
+			f2fs_free(dir->buf);
+		}
+		dir->buf = buf;
+		dir->max = max;
+	}
+
+	d = (struct xattr_dirent *)(dir->buf + dir->len);
+	d->ino = ino;
+	d->len = len;
+	memcpy(d->name, name, len);
+	d->name[len] = '\0';
+	dir->len += size;
+	return 0;
+}
+
+static int item_blkaddr_cmp(const void *a, const void *b)
+{
+	const struct xattr_item *x = *(struct xattr_item **)a;
+	const struct xattr_item *y = *(struct xattr_item **)b;
+
+	if(x->blkaddr != y->blkaddr) {
+		return x->blkaddr < y->blkaddr ? -1 : 1;
+	}
+	return 0;
+}
+
+/* the blocks of order[0..nr-1] lie within XATTR_RUN_BLOCKS of the first */
+static void read_xnode_run(struct xattr_ctx *ctx, struct xattr_item **order, int nr)
+{
+	block_t start = order[0]->blkaddr;
+	int blocks = order[nr - 1]->blkaddr - start + 1;
+	int i = 0, ret = 0;
+
+	ret = f2fs_read_blocks(ctx->super, ctx->run, start, blocks);
+	ctx->stat->reads++;
+	ctx->stat->xattr_nodes += nr;
+	ctx->stat->read_blocks += blocks;
+
+	for(i=0; i<nr; i++) {
+		order[i]->err = ret < 0 ? -EIO : 0;
+		if(ret < 0) {
+			continue;
+		}
+
+		order[i]->xnode = alloc_page();
+		if(order[i]->xnode == NULL) {
+			order[i]->err = -ENOMEM;
+			continue;
+		}
+		memcpy(page_address(order[i]->xnode),
+			ctx->run + ((order[i]->blkaddr - start) << F2FS_BLKSIZE_BITS),
+			F2FS_BLKSIZE);
+	}
+}
+
+/* xattr node blocks of the batch in address order, near ones in one read */
+static void read_xnodes(struct xattr_ctx *ctx)
+{
+	struct xattr_item *item = NULL;
+	struct node_info ni;
+	int i = 0, j = 0, nr = 0;
+
+	for(i=0; i<ctx->nr; i++) {
+		item = &ctx->items[i];
+		if(item->xnid == 0) {
+			continue;
+		}
+
+		/* what the node manager holds may be newer than the disk */
+		if(f2fs_node_cached(ctx->super, item->xnid)) {
+			item->xnode = alloc_page();
+			if(item->xnode == NULL) {
+				item->err = -ENOMEM;
+				continue;
+			}
+			item->err = f2fs_read_node_block(ctx->super, item->xnid, item->xnode);
+			continue;
+		}
+
+		item->err = f2fs_get_node_info(ctx->super, item->xnid, &ni);
+		if(item->err == 0 && (ni.blk_addr == NULL_ADDR || ni.blk_addr == NEW_ADDR)) {
+			item->err = -ENOENT;
+		}
+		if(item->err < 0) {
+			continue;
+		}
+		item->blkaddr = ni.blk_addr;
+		ctx->order[nr++] = item;
+	}
+	qsort(ctx->order, nr, sizeof(struct xattr_item *), item_blkaddr_cmp);
+
+	for(i=0; i<nr; i=j) {
+		for(j=i+1; j<nr && ctx->order[j]->blkaddr - ctx->order[j - 1]->blkaddr <=
+				XATTR_RUN_GAP &&
+				ctx->order[j]->blkaddr - ctx->order[i]->blkaddr < XATTR_RUN_BLOCKS; j++);
+		read_xnode_run(ctx, &ctx->order[i], j - i);
+	}
+}
+
+static int count_xattr(void *arg, const char *path, struct f2fs_xattr_entry *entry)
+{
+	struct xattr_ctx *ctx = arg;
+	int ret = ctx->fn(ctx->arg, path, entry);
+
+	ctx->stat->xattrs++;
+	return ret;
+}
+
+/* hand out the xattrs of the batch in walk order, fn's > 0 stops */
+static int flush_items(struct xattr_ctx *ctx)
+{
+	F2FS_TRACE_SCOPE("xattr_batch", "inodes", ctx->nr);
+	struct xattr_stat *stat = ctx->stat;
+	struct xattr_item *item = NULL;
+	unsigned long long xattrs = 0;
+	int i = 0, ret = 0;
+
+	read_xnodes(ctx);
+
+	for(i=0; i<ctx->nr; i++) {
+		item = &ctx->items[i];
+		if(item->err == 0 && item->xnode != NULL) {
+			item->err = check_xnode(item->xnode, item->xnid,
+				ino_of_node(item->page));
+		}
+		if(item->err == -ENOMEM) {
+			ret = ret != 0 ? ret : -ENOMEM;
+		} else if(item->err < 0) {
+			fprintf(stderr, "xattr %s: %s\n", item->path, strerror(-item->err));
+			stat->skipped++;
+		} else if(ret == 0) {
+			xattrs = stat->xattrs;
+			ret = f2fs_walk_xattrs(ctx->super, &F2FS_NODE(item->page)->i,
+				item->xnode, item->path, count_xattr, ctx);
+			if(ret == -EINVAL) {
+				fprintf(stderr, "xattr %s: corrupt xattr list\n", item->path);
+				stat->skipped++;
+				ret = 0;
+			}
+			if(stat->xattrs > xattrs) {
+				stat->xattr_files++;
+				stat->inline_only += item->xnid == 0;
+			}
+		}
+
+		f2fs_free(item->path);
+		free_page(item->page);
+		if(item->xnode != NULL) {
+			free_page(item->xnode);
+		}
+	}
+	ctx->nr = 0;
+	return ret;
+}
+
+/* queue the inode for its xattrs, page becomes the batch's */
+static int add_item(struct xattr_ctx *ctx, const char *path, int len,
+		struct page *page)
+{
+	struct xattr_item *item = &ctx->items[ctx->nr];
+
+	item->path = f2fs_malloc(len + 1);
+	if(item->path == NULL) {
+		perror("f2fs_malloc");
+		free_page(page);
+		return -ENOMEM;
+	}
+	memcpy(item->path, path, len + 1);
+	item->page = page;
+	item->xnid = le32_to_cpu(F2FS_NODE(page)->i.i_xattr_nid);
+	item->blkaddr = NULL_ADDR;
+	item->xnode = NULL;
+	item->err = 0;
+
+	if(++ctx->nr == XATTR_BATCH) {
+		return flush_items(ctx);
+	}
+	return 0;
+}
+
+/*
+ * Queue ino under path, then everything below it. Inodes without inline
+ * xattr room or an xattr node have nothing to hand out and are not queued.
+ * Unreadable inodes are reported and skipped.
+ */
+static int walk_inode(struct xattr_ctx *ctx, nid_t ino, char *path, int len)
+{
+	struct xattr_stat *stat = ctx->stat;
+	struct xattr_dirent *d = NULL;
+	struct page *page = NULL;
+	struct f2fs_raw_inode *ri = NULL;
+	struct xattr_dir dir;
+	size_t pos = 0;
+	int sep = 0, ret = 0;
+
+	memset(&dir, 0, sizeof(dir));
+	dir.super = ctx->super;
+
+	ret = read_inode(ctx->super, ino, &page);
+	if(ret < 0) {
+		goto skip;
+	}
+	ri = &F2FS_NODE(page)->i;
+	stat->files++;
+
+	if(S_ISDIR(le16_to_cpu(ri->i_mode))) {
+		ret = f2fs_readdir(ctx->super, page, collect_dirent, &dir);
+		if(ret < 0) {
+			goto skip;
+		}
+	}
+
+	if(get_inline_xattr_addrs(ctx->super->raw_super, ri) != 0 || ri->i_xattr_nid != 0) {
+		ret = add_item(ctx, path, len, page);
+		page = NULL;
+		if(ret != 0) {
+			goto out;
+		}
+	}
+
+	sep = len > 0 && path[len - 1] != '/';
+	for(pos=0; pos<dir.len; pos+=(sizeof(struct xattr_dirent) + d->len + 1 + 7) & ~7UL) {
+		d = (struct xattr_dirent *)(dir.buf + pos);
+		if(len + sep + d->len >= PATH_MAX) {
+			fprintf(stderr, "xattr %s/%s: %s\n", path, d->name, strerror(ENAMETOOLONG));
+			stat->skipped++;
+			continue;
+		}
+
+		path[len] = '/';
+		memcpy(path + len + sep, d->name, d->len + 1);
+		ret = walk_inode(ctx, d->ino, path, len + sep + d->len);
+		path[len] = '\0';
+		if(ret != 0) {
+			break;
+		}
+	}
+	goto out;
+
+skip:
+	if(ret != -ENOMEM) {
+		fprintf(stderr, "xattr %s: %s\n", path, strerror(-ret));
+		stat->skipped++;
+		ret = 0;
+	}
+out:
+	if(page != NULL) {
+		free_page(page);
+	}
+	if(dir.buf != NULL) {
+		f2fs_free(dir.buf);
+	}
+	return ret;
+}
+
+int f2fs_dump_xattrs(struct f2fs_super *super, const char *path, xattr_fn fn,
+		void *arg, struct xattr_stat *stat)
+{
+	F2FS_TRACE_SCOPE("dump_xattrs", NULL, 0);
+	struct xattr_ctx *ctx = NULL;
+	char *name = NULL;
+	nid_t ino = 0;
+	int len = strlen(path), ret = 0, i = 0;
+
+	memset(stat, 0, sizeof(struct xattr_stat));
+	ret = f2fs_lookup_path(super, path, &ino);
+	if(ret < 0) {
+		return ret;
+	}
+
+	while(len > 1 && path[len - 1] == '/') {
+		len--;
+	}
+	if(len >= PATH_MAX) {
+		return -ENAMETOOLONG;
+	}
+
+	ctx = f2fs_malloc(sizeof(struct xattr_ctx));
+	name = f2fs_malloc(PATH_MAX);
+	if(ctx == NULL || name == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+	memset(ctx, 0, sizeof(struct xattr_ctx));
+	ctx->super = super;
+	ctx->stat = stat;
+	ctx->fn = fn;
+	ctx->arg = arg;
+	ctx->run = f2fs_malloc(XATTR_RUN_BLOCKS * F2FS_BLKSIZE);
+	if(ctx->run == NULL) {
+		perror("f2fs_malloc");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(name, path, len);
+	name[len] = '\0';
+	ret = walk_inode(ctx, ino, name, len);
+	if(ret == 0) {
+		ret = flush_items(ctx);
+	}
+
+	/* a failed walk leaves a batch behind */
+	for(i=0; i<ctx->nr; i++) {
+		f2fs_free(ctx->items[i].path);
+		free_page(ctx->items[i].page);
+	}
+out:
+	if(ctx != NULL && ctx->run != NULL) {
+		f2fs_free(ctx->run);
+	}
+	if(ctx != NULL) {
+		f2fs_free(ctx);
+	}
+	if(name != NULL) {
+		f2fs_free(name);
+	}
+	return ret < 0 ? ret : 0;
+}
@@ -0,0 +1,59 @@
+#ifndef __XATTR_H__
+#define __XATTR_H__
+
+#include "f2fs.h"
+
+/* files whose xattr node blocks are read together, sorted by address */
+#define XATTR_BATCH		256
+/* the longest run of xattr node blocks one read covers */
+#define XATTR_RUN_BLOCKS	64
+/* blocks between two xattr nodes that are read over rather than split at */
+#define XATTR_RUN_GAP		8
+
+#define XATTR_ALIGN(size)	(((size) + 3) & ~3)
+#define XATTR_ENTRY_SIZE(e)	XATTR_ALIGN(sizeof(struct f2fs_xattr_entry) + \
+				(e)->e_name_len + le16_to_cpu((e)->e_value_size))
+
+struct xattr_stat {
+	unsigned int files;		/* inodes walked */
+	unsigned int xattr_files;	/* inodes with at least one xattr */
+	unsigned long long xattrs;
+	unsigned int inline_only;	/* inodes whose xattrs all fit the inode */
+	unsigned int xattr_nodes;	/* xattr node blocks needed */
+	unsigned int reads;		/* the reads they took */
+	unsigned long long read_blocks;	/* with the blocks read over */
+	unsigned int skipped;		/* inodes or xattr nodes that could not be read */
+};
+
+/* path is the name the inode was reached by, > 0 stops the walk */
+typedef int (*xattr_fn)(void *arg, const char *path, struct f2fs_xattr_entry *entry);
+
+static inline char *xattr_value(struct f2fs_xattr_entry *entry)
+{
+	return entry->e_name + entry->e_name_len;
+}
+
+/* "user." and the like, the names of acls are their prefix alone */
+const char *f2fs_xattr_prefix(int index);
+
+/*
+ * fn for each xattr of the inode ri, the inline ones and those in xnode,
+ * the block of i_xattr_nid or NULL. A list without the magic is empty, a
+ * corrupt one -EINVAL after the entries before the damage.
+ */
+int f2fs_walk_xattrs(struct f2fs_super *super, struct f2fs_raw_inode *ri,
+		struct page *xnode, const char *path, xattr_fn fn, void *arg);
+
+/* the xattrs of the inode at path */
+int f2fs_get_xattrs(struct f2fs_super *super, const char *path, xattr_fn fn,
+		void *arg);
+
+/*
+ * The xattrs of every inode of the subtree at path, in walk order. The
+ * inline ones come from the inode blocks the walk reads anyway, the xattr
+ * node blocks of XATTR_BATCH inodes are read in address order.
+ */
+int f2fs_dump_xattrs(struct f2fs_super *super, const char *path, xattr_fn fn,
+		void *arg, struct xattr_stat *stat);
+
+#endif /*__XATTR_H__*/